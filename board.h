@@ -0,0 +1,63 @@
+#ifndef BOARD_H
+#define BOARD_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct Line
+{
+    int x1, y1, x2, y2;
+    float color[3];
+    int size;
+    bool isEraser;
+};
+
+struct Stroke
+{
+    std::vector<Line> lines;
+    float color[3];
+    int size;
+    bool isEraser;
+    uint32_t author; // Peer that drew the stroke, 0 if unknown
+    uint32_t seq;    // Per-author sequence number; (author, seq) is the stroke id
+    uint64_t stamp;  // Clock it was drawn at; orders the stack, see stackPosition
+    bool removed;    // Undone; kept so a redo or a late remote op can find it
+};
+
+// Position in a board's strokes of each stroke id; see strokeKey
+typedef std::unordered_map<uint64_t, size_t> StrokeIndex;
+
+// Part of a board's oldest content, flattened to pixels once the board
+// outgrew its stroke budget; see board_tiles.h
+struct RasterTile
+{
+    int x, y;                     // Board position of the top-left pixel
+    std::vector<uint8_t> encoded; // Run-length encoded pixels
+    unsigned int texture;         // GL texture while the board is shown, else 0
+};
+
+struct Board
+{
+    std::string name;
+    std::vector<RasterTile> tiles; // Drawn under strokes
+    std::vector<Stroke> strokes;
+    std::vector<uint8_t> packed;   // Strokes of an evicted board; see packStrokes
+    // Strokes of a board that is not shown, held instead of strokes while a
+    // checkpoint may still be writing them; copied out before they change
+    std::shared_ptr<std::vector<Stroke>> shared;
+    StrokeIndex index;             // Of strokes or shared, built when first shown; kept until packed
+    uint64_t lastUsed;             // Board switch count when it was last shown
+    float currentColor[3];
+    int pointSize;
+    int tool;
+    int pagedIndex; // Board in the open session file whose strokes are not loaded yet, or -1
+    // Newest clear applied while shown, by (stamp, author); strokes stacked
+    // below it that arrive later are dropped. Not saved.
+    uint64_t clearStamp;
+    uint32_t clearAuthor;
+};
+
+#endif
@@ -0,0 +1,126 @@
+#include "board_store.h"
+#include "board_tiles.h"
+#include <algorithm>
+
+size_t strokesBytes(const std::vector<Stroke> &list)
+{
+    size_t bytes = list.capacity() * sizeof(Stroke);
+    for (size_t s = 0; s < list.size(); s++)
+    {
+        bytes += list[s].lines.capacity() * sizeof(Line);
+    }
+    return bytes;
+}
+
+const std::vector<Stroke> &boardStrokes(const Board &board)
+{
+    return board.shared ? *board.shared : board.strokes;
+}
+
+void ensureBoardResident(Board &board, SessionFile &session)
+{
+    if (board.shared)
+    {
+        // Only copied if the checkpoint is still writing them
+        if (board.shared.use_count() == 1)
+        {
+            board.strokes.swap(*board.shared);
+        }
+        else
+        {
+            board.strokes = *board.shared;
+        }
+        board.shared.reset();
+    }
+    if (board.pagedIndex >= 0)
+    {
+        loadBoardStrokes(session, board.pagedIndex, board.strokes);
+        loadBoardTiles(session, board.pagedIndex, board.tiles);
+        board.pagedIndex = -1;
+    }
+    if (!board.packed.empty())
+    {
+        unpackStrokes(board.packed, board.strokes);
+        std::vector<uint8_t>().swap(board.packed);
+    }
+}
+
+void unmapBoard(Board &board, bool current, SessionFile &session)
+{
+    if (board.pagedIndex >= 0)
+    {
+        ensureBoardResident(board, session);
+        if (!current && !board.strokes.empty())
+        {
+            packStrokes(board.strokes, board.packed);
+            std::vector<Stroke>().swap(board.strokes);
+        }
+    }
+}
+
+size_t residentBoardBytes(const std::vector<Board> &boards, const std::vector<Stroke> &strokes)
+{
+    size_t bytes = strokesBytes(strokes);
+    for (size_t i = 0; i < boards.size(); i++)
+    {
+        bytes += strokesBytes(boardStrokes(boards[i])) + boards[i].packed.capacity() + tilesBytes(boards[i].tiles);
+    }
+    return bytes;
+}
+
+void evictBoards(std::vector<Board> &boards, int current, const std::vector<Stroke> &strokes, size_t budget)
+{
+    std::vector<int> order;
+    for (size_t i = 0; i < boards.size(); i++)
+    {
+        if (static_cast<int>(i) != current && !boardStrokes(boards[i]).empty())
+        {
+            order.push_back(i);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b)
+              { return boards[a].lastUsed < boards[b].lastUsed; });
+
+    size_t resident = residentBoardBytes(boards, strokes);
+    for (size_t i = 0; i < order.size() && resident > budget; i++)
+    {
+        Board &board = boards[order[i]];
+        size_t before = strokesBytes(boardStrokes(board));
+        packStrokes(boardStrokes(board), board.packed);
+        std::vector<Stroke>().swap(board.strokes);
+        board.shared.reset();
+        StrokeIndex().swap(board.index);
+        resident -= before - board.packed.capacity();
+    }
+}
+
+void storeBoard(Board &board, std::vector<Stroke> &strokes, StrokeIndex &index, uint64_t lastUsed)
+{
+    board.strokes.swap(strokes);
+    board.index.swap(index);
+    strokes.clear();
+    index.clear();
+    board.lastUsed = lastUsed;
+}
+
+void showBoard(std::vector<Board> &boards, int board, std::vector<Stroke> &strokes, StrokeIndex &index,
+               SessionFile &session)
+{
+    ensureBoardResident(boards[board], session);
+    strokes.clear();
+    strokes.swap(boards[board].strokes);
+    index.clear();
+    index.swap(boards[board].index);
+    if (index.empty())
+    {
+        indexStrokes(index, strokes);
+    }
+}
+
+void deleteBoard(std::vector<Board> &boards, int &current, std::vector<Stroke> &strokes, StrokeIndex &index,
+                 SessionFile &session)
+{
+    boards.erase(boards.begin() + current);
+    current = std::max(0, current - 1);
+    showBoard(boards, current, strokes, index, session);
+}
@@ -0,0 +1,56 @@
+#ifndef BOARD_STORE_H
+#define BOARD_STORE_H
+
+#include "board.h"
+#include "history.h"
+#include "session_file.h"
+#include <cstdint>
+#include <vector>
+
+// Where the strokes of each board live, and moving them when the board
+// that is shown changes.
+//
+// The strokes of the current board are kept in a vector of the caller's,
+// strokes below, so the network thread can add to them, and so is their
+// StrokeIndex. Every other board keeps its own: still in the mapped
+// session file until first shown, packed once the least recently shown
+// boards no longer fit the memory budget, or shared with a checkpoint that
+// is writing them. A board's index is built the first time it is shown
+// and goes with it between switches, and is dropped when it is packed.
+
+const size_t BOARD_MEMORY_BUDGET = 64 * 1024 * 1024;
+
+size_t strokesBytes(const std::vector<Stroke> &list);
+
+// The strokes a board shares with a checkpoint, or its own
+const std::vector<Stroke> &boardStrokes(const Board &board);
+
+// Brings a board's strokes into board.strokes, from wherever they are
+void ensureBoardResident(Board &board, SessionFile &session);
+
+// Reads a board out of the mapped session file before it is closed,
+// straight into packed form unless it is the current board
+void unmapBoard(Board &board, bool current, SessionFile &session);
+
+// Boards still in the mapped session file count as nothing
+size_t residentBoardBytes(const std::vector<Board> &boards, const std::vector<Stroke> &strokes);
+
+// Packs the least recently shown boards until the rest fit the budget,
+// dropping their indexes
+void evictBoards(std::vector<Board> &boards, int current, const std::vector<Stroke> &strokes, size_t budget);
+
+// Hands the strokes and index of the board that was shown back to it;
+// lastUsed orders eviction
+void storeBoard(Board &board, std::vector<Stroke> &strokes, StrokeIndex &index, uint64_t lastUsed);
+
+// Moves the strokes and index of boards[board] into strokes and index,
+// which must be stored; the index is only built if the board has none
+void showBoard(std::vector<Board> &boards, int board, std::vector<Stroke> &strokes, StrokeIndex &index,
+               SessionFile &session);
+
+// Drops the current board, whose strokes are in strokes, and shows the
+// one before it
+void deleteBoard(std::vector<Board> &boards, int &current, std::vector<Stroke> &strokes, StrokeIndex &index,
+                 SessionFile &session);
+
+#endif
@@ -0,0 +1,239 @@
+#include "board_tiles.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+const int TILE_PIXELS = BASE_TILE_SIZE * BASE_TILE_SIZE;
+
+// Untouched pixels are transparent so the board background shows through
+const uint32_t EMPTY_PIXEL = BACKGROUND_COLOR & 0x00ffffffu;
+
+static uint64_t tileKey(int x, int y)
+{
+    return (static_cast<uint64_t>(static_cast<uint32_t>(y)) << 32) | static_cast<uint32_t>(x);
+}
+
+static int tileOrigin(int coordinate)
+{
+    return static_cast<int>(std::floor(float(coordinate) / BASE_TILE_SIZE)) * BASE_TILE_SIZE;
+}
+
+void binStrokes(const std::vector<Stroke> &strokes, size_t count, const std::vector<char> *select,
+                std::vector<TileBin> &bins)
+{
+    std::unordered_map<uint64_t, size_t> binIndex;
+    bins.clear();
+    for (size_t s = 0; s < count; s++)
+    {
+        if (select && !(*select)[s])
+        {
+            continue;
+        }
+        for (size_t i = 0; i < strokes[s].lines.size(); i++)
+        {
+            // Anti-aliasing reaches half a pixel past the line's radius
+            const Line &line = strokes[s].lines[i];
+            int reach = std::max(line.size, 1) / 2 + 2;
+            for (int y = tileOrigin(std::min(line.y1, line.y2) - reach); y <= std::max(line.y1, line.y2) + reach; y += BASE_TILE_SIZE)
+            {
+                for (int x = tileOrigin(std::min(line.x1, line.x2) - reach); x <= std::max(line.x1, line.x2) + reach; x += BASE_TILE_SIZE)
+                {
+                    std::unordered_map<uint64_t, size_t>::iterator it = binIndex.find(tileKey(x, y));
+                    if (it == binIndex.end())
+                    {
+                        it = binIndex.insert(std::make_pair(tileKey(x, y), bins.size())).first;
+                        TileBin bin;
+                        bin.x = x;
+                        bin.y = y;
+                        bins.push_back(bin);
+                    }
+                    std::vector<size_t> &list = bins[it->second].strokes;
+                    if (list.empty() || list.back() != s)
+                    {
+                        list.push_back(s);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Packets start with a uint16 n: with the top bit set the next pixel
+// repeats (n & 0x7fff) + 1 times, otherwise n + 1 literal pixels follow
+void encodeTile(const uint32_t *pixels, std::vector<uint8_t> &encoded)
+{
+    encoded.clear();
+    int i = 0;
+    while (i < TILE_PIXELS)
+    {
+        int run = 1;
+        while (i + run < TILE_PIXELS && run < 0x8000 && pixels[i + run] == pixels[i])
+        {
+            run++;
+        }
+        uint16_t header;
+        int count;
+        if (run >= 2)
+        {
+            header = 0x8000 | (run - 1);
+            count = 1;
+        }
+        else
+        {
+            // Literals last until the next pair of equal pixels
+            count = 1;
+            while (i + count < TILE_PIXELS && count < 0x8000 &&
+                   !(i + count + 1 < TILE_PIXELS && pixels[i + count] == pixels[i + count + 1]))
+            {
+                count++;
+            }
+            header = count - 1;
+            run = count;
+        }
+        size_t at = encoded.size();
+        encoded.resize(at + sizeof(header) + count * sizeof(uint32_t));
+        memcpy(&encoded[at], &header, sizeof(header));
+        memcpy(&encoded[at + sizeof(header)], pixels + i, count * sizeof(uint32_t));
+        i += run;
+    }
+}
+
+bool decodeTile(const std::vector<uint8_t> &encoded, uint32_t *pixels)
+{
+    size_t at = 0;
+    int i = 0;
+    while (i < TILE_PIXELS)
+    {
+        uint16_t header;
+        if (at + sizeof(header) > encoded.size())
+        {
+            return false;
+        }
+        memcpy(&header, &encoded[at], sizeof(header));
+        at += sizeof(header);
+
+        int count = (header & 0x7fff) + 1;
+        int literals = (header & 0x8000) ? 1 : count;
+        if (i + count > TILE_PIXELS || at + literals * sizeof(uint32_t) > encoded.size())
+        {
+            return false;
+        }
+        if (header & 0x8000)
+        {
+            uint32_t pixel;
+            memcpy(&pixel, &encoded[at], sizeof(pixel));
+            std::fill(pixels + i, pixels + i + count, pixel);
+        }
+        else
+        {
+            memcpy(pixels + i, &encoded[at], count * sizeof(uint32_t));
+        }
+        at += literals * sizeof(uint32_t);
+        i += count;
+    }
+    return true;
+}
+
+size_t strokesOverBudget(const std::vector<Stroke> &strokes, size_t budget)
+{
+    size_t total = 0;
+    for (size_t s = 0; s < strokes.size(); s++)
+    {
+        total += strokes[s].lines.size();
+    }
+    if (total <= budget)
+    {
+        return 0;
+    }
+
+    size_t count = 0;
+    while (count < strokes.size() && total > budget / 4 * 3)
+    {
+        total -= strokes[count++].lines.size();
+    }
+    return count;
+}
+
+void flattenStrokes(std::vector<RasterTile> &tiles, const std::vector<Stroke> &strokes, size_t count)
+{
+    std::vector<char> live(count);
+    for (size_t s = 0; s < count; s++)
+    {
+        live[s] = !strokes[s].removed;
+    }
+    std::vector<TileBin> bins;
+    binStrokes(strokes, count, &live, bins);
+
+    std::unordered_map<uint64_t, size_t> tileIndex;
+    for (size_t t = 0; t < tiles.size(); t++)
+    {
+        tileIndex[tileKey(tiles[t].x, tiles[t].y)] = t;
+    }
+
+    Image image;
+    for (size_t b = 0; b < bins.size(); b++)
+    {
+        const TileBin &bin = bins[b];
+        std::unordered_map<uint64_t, size_t>::iterator it = tileIndex.find(tileKey(bin.x, bin.y));
+        imageInit(image, BASE_TILE_SIZE, BASE_TILE_SIZE, EMPTY_PIXEL);
+        image.originX = bin.x;
+        image.originY = bin.y;
+        if (it == tileIndex.end())
+        {
+            RasterTile tile;
+            tile.x = bin.x;
+            tile.y = bin.y;
+            tile.texture = 0;
+            it = tileIndex.insert(std::make_pair(tileKey(bin.x, bin.y), tiles.size())).first;
+            tiles.push_back(tile);
+        }
+        else if (!decodeTile(tiles[it->second].encoded, &image.pixels[0]))
+        {
+            imageInit(image, BASE_TILE_SIZE, BASE_TILE_SIZE, EMPTY_PIXEL);
+        }
+
+        for (size_t i = 0; i < bin.strokes.size(); i++)
+        {
+            rasterizeStroke(image, strokes[bin.strokes[i]]);
+        }
+        encodeTile(&image.pixels[0], tiles[it->second].encoded);
+    }
+}
+
+void compositeTiles(Image &image, const std::vector<RasterTile> &tiles)
+{
+    std::vector<uint32_t> pixels(TILE_PIXELS);
+    for (size_t t = 0; t < tiles.size(); t++)
+    {
+        const RasterTile &tile = tiles[t];
+        int left = std::max(tile.x, image.originX), right = std::min(tile.x + BASE_TILE_SIZE, image.originX + image.width);
+        int top = std::max(tile.y, image.originY), bottom = std::min(tile.y + BASE_TILE_SIZE, image.originY + image.height);
+        if (left >= right || top >= bottom || !decodeTile(tile.encoded, &pixels[0]))
+        {
+            continue;
+        }
+        for (int y = top; y < bottom; y++)
+        {
+            const uint32_t *src = &pixels[(y - tile.y) * BASE_TILE_SIZE];
+            uint32_t *dst = &image.pixels[static_cast<size_t>(y - image.originY) * image.width];
+            for (int x = left; x < right; x++)
+            {
+                if (src[x - tile.x] >> 24)
+                {
+                    dst[x - image.originX] = src[x - tile.x];
+                }
+            }
+        }
+    }
+}
+
+size_t tilesBytes(const std::vector<RasterTile> &tiles)
+{
+    size_t bytes = 0;
+    for (size_t t = 0; t < tiles.size(); t++)
+    {
+        bytes += sizeof(RasterTile) + tiles[t].encoded.size();
+    }
+    return bytes;
+}
@@ -0,0 +1,46 @@
+#ifndef BOARD_TILES_H
+#define BOARD_TILES_H
+
+#include "board.h"
+#include "raster.h"
+#include <cstdint>
+#include <vector>
+
+// Fixed-size raster tiles for strokes that no longer exist as vectors.
+//
+// Once the strokes of a board add up to more than the segment budget, the
+// oldest are drawn into BASE_TILE_SIZE tiles and dropped, until the rest
+// fit in three quarters of it. Tiles are kept run-length encoded, since
+// whiteboard pixels come in long runs, and are drawn under all strokes. A
+// flattened stroke can no longer be undone or redone.
+
+const int BASE_TILE_SIZE = 256;
+const size_t SEGMENT_BUDGET = 200000;
+
+// Tile-aligned area and the strokes, in order, that can touch it
+struct TileBin
+{
+    int x, y;
+    std::vector<size_t> strokes;
+};
+
+// Bins strokes[0, count), skipping those whose select entry is zero
+void binStrokes(const std::vector<Stroke> &strokes, size_t count, const std::vector<char> *select,
+                std::vector<TileBin> &bins);
+
+void encodeTile(const uint32_t *pixels, std::vector<uint8_t> &encoded);
+bool decodeTile(const std::vector<uint8_t> &encoded, uint32_t *pixels);
+
+// Number of leading strokes to flatten to get back under budget, or 0
+size_t strokesOverBudget(const std::vector<Stroke> &strokes, size_t budget);
+
+// Draws strokes[0, count) into the tiles, adding tiles where needed.
+// Undone strokes are skipped; they are about to be dropped.
+void flattenStrokes(std::vector<RasterTile> &tiles, const std::vector<Stroke> &strokes, size_t count);
+
+// Copies the pixels the tiles have set into the image
+void compositeTiles(Image &image, const std::vector<RasterTile> &tiles);
+
+size_t tilesBytes(const std::vector<RasterTile> &tiles);
+
+#endif
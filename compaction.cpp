@@ -0,0 +1,240 @@
+#include "compaction.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+const uint8_t COVERED = 1; // Painted for certain by a later live stroke
+const uint8_t BLOCKED = 2; // Touched by an earlier stroke that stays a vector
+
+struct CoverageGrid
+{
+    int left, top, width, height;
+    std::vector<uint8_t> flags;
+};
+
+static float lineRadius(const Line &line)
+{
+    return std::max(line.size, 1) * 0.5f;
+}
+
+// Everything a line can touch, drawn by GL or by the rasterizer, with a
+// pixel of margin
+static float footprintRadius(const Line &line)
+{
+    return lineRadius(line) + 1.0f;
+}
+
+// Calls visit(flags, count) for each row span of the line's footprint
+// that lies inside the grid
+template <typename Visit>
+static bool visitFootprint(CoverageGrid &grid, const Line &line, Visit visit)
+{
+    float radius = footprintRadius(line);
+    int rowStart, rowEnd;
+    lineRowRange(line, radius, rowStart, rowEnd);
+    for (int py = std::max(rowStart, grid.top); py <= std::min(rowEnd, grid.top + grid.height - 1); py++)
+    {
+        int x0, x1;
+        if (!lineRowSpan(line, radius, py, x0, x1))
+        {
+            continue;
+        }
+        x0 = std::max(x0, grid.left);
+        x1 = std::min(x1, grid.left + grid.width - 1);
+        if (x0 <= x1 && !visit(&grid.flags[static_cast<size_t>(py - grid.top) * grid.width + (x0 - grid.left)], x1 - x0 + 1))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// True if every pixel the stroke touches has flag set, or with set false,
+// has it clear
+static bool footprintUniform(CoverageGrid &grid, const Stroke &stroke, uint8_t flag, bool set)
+{
+    uint8_t want = set ? flag : 0;
+    for (size_t i = 0; i < stroke.lines.size(); i++)
+    {
+        bool uniform = visitFootprint(grid, stroke.lines[i], [flag, want](uint8_t *flags, int count)
+        {
+            for (int x = 0; x < count; x++)
+            {
+                if ((flags[x] & flag) != want)
+                {
+                    return false;
+                }
+            }
+            return true;
+        });
+        if (!uniform)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void markFootprint(CoverageGrid &grid, const Stroke &stroke, uint8_t flag)
+{
+    for (size_t i = 0; i < stroke.lines.size(); i++)
+    {
+        visitFootprint(grid, stroke.lines[i], [flag](uint8_t *flags, int count)
+        {
+            for (int x = 0; x < count; x++)
+            {
+                flags[x] |= flag;
+            }
+            return true;
+        });
+    }
+}
+
+// Pixels the GL path paints for certain. Wide GL_LINES have no caps and
+// span `size` pixels along the minor axis; a pixel is shaved off every side
+// to stay clear of rasterization rules, and a little more across so the
+// rasterizer, which centers lines half a pixel over, fully covers it too.
+static void markCovered(CoverageGrid &grid, const Line &line)
+{
+    bool xMajor = std::abs(line.x2 - line.x1) >= std::abs(line.y2 - line.y1);
+    int a1 = xMajor ? line.x1 : line.y1, a2 = xMajor ? line.x2 : line.y2;
+    int b1 = xMajor ? line.y1 : line.x1, b2 = xMajor ? line.y2 : line.x2;
+    if (a1 == a2)
+    {
+        return;
+    }
+    float slope = float(b2 - b1) / float(a2 - a1);
+    float half = lineRadius(line) - 1.25f;
+    if (half < 0.5f)
+    {
+        return;
+    }
+
+    for (int a = std::min(a1, a2) + 1; a <= std::max(a1, a2) - 1; a++)
+    {
+        float center = b1 + (a + 0.5f - a1) * slope;
+        int bStart = static_cast<int>(std::ceil(center - half - 0.5f));
+        int bEnd = static_cast<int>(std::floor(center + half - 0.5f));
+        for (int b = bStart; b <= bEnd; b++)
+        {
+            int px = xMajor ? a : b, py = xMajor ? b : a;
+            if (px >= grid.left && px < grid.left + grid.width && py >= grid.top && py < grid.top + grid.height)
+            {
+                grid.flags[static_cast<size_t>(py - grid.top) * grid.width + (px - grid.left)] |= COVERED;
+            }
+        }
+    }
+}
+
+static void renderTiles(const std::vector<Stroke> &strokes, Compaction &compaction)
+{
+    std::vector<TileBin> bins;
+    binStrokes(strokes, strokes.size(), &compaction.flattened, bins);
+
+    // Untouched pixels stay transparent so the board shows through
+    compaction.tiles.resize(bins.size());
+    for (size_t t = 0; t < bins.size(); t++)
+    {
+        Image image;
+        imageInit(image, BASE_TILE_SIZE, BASE_TILE_SIZE, BACKGROUND_COLOR & 0x00ffffffu);
+        image.originX = bins[t].x;
+        image.originY = bins[t].y;
+        for (size_t i = 0; i < bins[t].strokes.size(); i++)
+        {
+            rasterizeStroke(image, strokes[bins[t].strokes[i]]);
+        }
+        compaction.tiles[t].x = bins[t].x;
+        compaction.tiles[t].y = bins[t].y;
+        compaction.tiles[t].texture = 0;
+        compaction.tiles[t].pixels.swap(image.pixels);
+    }
+}
+
+bool compactStrokes(const std::vector<Stroke> &strokes, Compaction &compaction)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    compaction.strokeCount = strokes.size();
+    compaction.flattened.assign(strokes.size(), 0);
+    compaction.tiles.clear();
+    memset(&compaction.stats, 0, sizeof(compaction.stats));
+    compaction.stats.strokes = strokes.size();
+
+    int minX = 0, minY = 0, maxX = -1, maxY = -1;
+    for (size_t s = 0; s < strokes.size(); s++)
+    {
+        compaction.stats.segments += strokes[s].lines.size();
+        for (size_t i = 0; i < strokes[s].lines.size(); i++)
+        {
+            const Line &line = strokes[s].lines[i];
+            int reach = static_cast<int>(std::ceil(footprintRadius(line))) + 1;
+            if (maxX < minX)
+            {
+                minX = maxX = line.x1;
+                minY = maxY = line.y1;
+            }
+            minX = std::min(minX, std::min(line.x1, line.x2) - reach);
+            maxX = std::max(maxX, std::max(line.x1, line.x2) + reach);
+            minY = std::min(minY, std::min(line.y1, line.y2) - reach);
+            maxY = std::max(maxY, std::max(line.y1, line.y2) + reach);
+        }
+    }
+    if (maxX < minX)
+    {
+        return true;
+    }
+
+    CoverageGrid grid;
+    grid.left = minX;
+    grid.top = minY;
+    grid.width = maxX - minX + 1;
+    grid.height = maxY - minY + 1;
+    if (static_cast<size_t>(grid.width) * grid.height > COMPACTION_MAX_PIXELS)
+    {
+        return false;
+    }
+    grid.flags.assign(static_cast<size_t>(grid.width) * grid.height, 0);
+
+    // Back to front: a stroke is hidden if everything it touches is
+    // painted over by strokes that come after it
+    std::vector<char> hidden(strokes.size(), 0);
+    for (size_t s = strokes.size(); s-- > 0;)
+    {
+        const Stroke &stroke = strokes[s];
+        if (stroke.removed || stroke.lines.empty())
+        {
+            continue;
+        }
+        hidden[s] = footprintUniform(grid, stroke, COVERED, true);
+        for (size_t i = 0; i < stroke.lines.size(); i++)
+        {
+            markCovered(grid, stroke.lines[i]);
+        }
+    }
+
+    // Front to back: tiles sit under every vector stroke, so a stroke is
+    // only flattened if nothing that stays a vector lies beneath it. Eraser
+    // strokes over flattened strokes go too, or they would block the next
+    // layer drawn on the same spot. Undone strokes stay vectors since a
+    // redo brings them back.
+    for (size_t s = 0; s < strokes.size(); s++)
+    {
+        const Stroke &stroke = strokes[s];
+        bool eraser = stroke.isEraser && !stroke.removed && !stroke.lines.empty();
+        if ((hidden[s] || eraser) && footprintUniform(grid, stroke, BLOCKED, false))
+        {
+            compaction.flattened[s] = 1;
+            compaction.stats.flattenedStrokes++;
+            compaction.stats.flattenedSegments += stroke.lines.size();
+        }
+        else
+        {
+            markFootprint(grid, stroke, BLOCKED);
+        }
+    }
+
+    renderTiles(strokes, compaction);
+    compaction.stats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return true;
+}
@@ -0,0 +1,46 @@
+#ifndef COMPACTION_H
+#define COMPACTION_H
+
+#include "board_tiles.h"
+#include <cstdint>
+#include <vector>
+
+// Finds strokes whose every pixel ends up under later eraser or opaque
+// strokes and moves them, and eraser strokes drawn over them, out of the
+// vector draw path into raster tiles.
+//
+// The tiles are composited under all remaining strokes, so a flattened
+// stroke may only have flattened strokes beneath it; then undoing the
+// strokes that hid it still shows it exactly where it was. Strokes are
+// never removed from the board, so saving, export and undo still see them.
+
+const size_t COMPACTION_MAX_PIXELS = 64 * 1024 * 1024; // Coverage grid limit
+
+struct BaseTile
+{
+    int x, y;                     // Board position of the top-left pixel
+    std::vector<uint32_t> pixels; // Packed like Image; alpha 0 where untouched
+    unsigned int texture;         // GL texture once uploaded, else 0
+};
+
+struct CompactionStats
+{
+    size_t strokes;
+    size_t segments;
+    size_t flattenedStrokes;
+    size_t flattenedSegments;
+    double ms;
+};
+
+struct Compaction
+{
+    size_t strokeCount;          // Leading strokes of the board that were examined
+    std::vector<char> flattened; // Per examined stroke: drawn from the tiles
+    std::vector<BaseTile> tiles;
+    CompactionStats stats;
+};
+
+// Returns false if the strokes span more than COMPACTION_MAX_PIXELS
+bool compactStrokes(const std::vector<Stroke> &strokes, Compaction &compaction);
+
+#endif
@@ -0,0 +1,163 @@
+#include "history.h"
+#include <algorithm>
+
+void historyInit(History &history, size_t limitBytes)
+{
+    history.undo.clear();
+    history.redo.clear();
+    history.spill = NULL;
+    history.spilled = 0;
+    history.limitBytes = std::max(limitBytes, 4 * sizeof(uint32_t));
+}
+
+void historyClear(History &history)
+{
+    if (history.spill)
+    {
+        fclose(history.spill);
+    }
+    historyInit(history, history.limitBytes);
+}
+
+static void spillOldest(History &history)
+{
+    if ((history.undo.size() + history.redo.size()) * sizeof(uint32_t) <= history.limitBytes || history.undo.size() < 2)
+    {
+        return;
+    }
+
+    size_t count = history.undo.size() / 2;
+    if (!history.spill)
+    {
+        history.spill = tmpfile();
+    }
+    // Without a spill file the oldest entries are simply forgotten
+    if (history.spill && fseek(history.spill, history.spilled * sizeof(uint32_t), SEEK_SET) == 0 &&
+        fwrite(&history.undo[0], sizeof(uint32_t), count, history.spill) == count)
+    {
+        history.spilled += count;
+    }
+    history.undo.erase(history.undo.begin(), history.undo.begin() + count);
+}
+
+static void unspill(History &history)
+{
+    size_t count = std::min<uint64_t>(history.spilled, history.limitBytes / sizeof(uint32_t) / 2);
+    history.undo.resize(count);
+    if (fseek(history.spill, (history.spilled - count) * sizeof(uint32_t), SEEK_SET) != 0 ||
+        fread(&history.undo[0], sizeof(uint32_t), count, history.spill) != count)
+    {
+        history.undo.clear();
+        count = history.spilled;
+    }
+    history.spilled -= count;
+}
+
+void historyRecord(History &history, uint32_t seq)
+{
+    history.redo.clear();
+    history.undo.push_back(seq);
+    spillOldest(history);
+}
+
+bool historyUndo(History &history, uint32_t &seq)
+{
+    if (history.undo.empty() && history.spilled > 0)
+    {
+        unspill(history);
+    }
+    if (history.undo.empty())
+    {
+        return false;
+    }
+    seq = history.undo.back();
+    history.undo.pop_back();
+    history.redo.push_back(seq);
+    return true;
+}
+
+bool historyRedo(History &history, uint32_t &seq)
+{
+    if (history.redo.empty())
+    {
+        return false;
+    }
+    seq = history.redo.back();
+    history.redo.pop_back();
+    history.undo.push_back(seq);
+    spillOldest(history);
+    return true;
+}
+
+uint64_t strokeKey(uint32_t author, uint32_t seq)
+{
+    return (static_cast<uint64_t>(author) << 32) | seq;
+}
+
+void indexStrokes(StrokeIndex &index, const std::vector<Stroke> &strokes)
+{
+    index.clear();
+    for (size_t i = 0; i < strokes.size(); i++)
+    {
+        if (strokes[i].author != 0)
+        {
+            index[strokeKey(strokes[i].author, strokes[i].seq)] = i;
+        }
+    }
+}
+
+void indexLastStroke(StrokeIndex &index, const std::vector<Stroke> &strokes)
+{
+    const Stroke &stroke = strokes.back();
+    if (stroke.author != 0)
+    {
+        index[strokeKey(stroke.author, stroke.seq)] = strokes.size() - 1;
+    }
+}
+
+Stroke *findStroke(std::vector<Stroke> &strokes, const StrokeIndex &index, uint32_t author, uint32_t seq)
+{
+    StrokeIndex::const_iterator it = index.find(strokeKey(author, seq));
+    if (it == index.end() || it->second >= strokes.size())
+    {
+        return NULL;
+    }
+    return &strokes[it->second];
+}
+
+bool stackedBelow(const Stroke &a, const Stroke &b)
+{
+    return a.stamp != b.stamp ? a.stamp < b.stamp : a.author < b.author;
+}
+
+size_t stackPosition(const std::vector<Stroke> &strokes, const Stroke &stroke)
+{
+    size_t position = strokes.size();
+    while (position > 0 && stackedBelow(stroke, strokes[position - 1]))
+    {
+        position--;
+    }
+    return position;
+}
+
+size_t insertStroke(std::vector<Stroke> &strokes, StrokeIndex &index, const Stroke &stroke)
+{
+    size_t position = stackPosition(strokes, stroke);
+    strokes.insert(strokes.begin() + position, stroke);
+    for (size_t i = position; i < strokes.size(); i++)
+    {
+        if (strokes[i].author != 0)
+        {
+            index[strokeKey(strokes[i].author, strokes[i].seq)] = i;
+        }
+    }
+    return position;
+}
+
+size_t clearBelow(std::vector<Stroke> &strokes, StrokeIndex &index, const Stroke &clear)
+{
+    size_t count = stackPosition(strokes, clear);
+    strokes.erase(strokes.begin(), strokes.begin() + count);
+    indexStrokes(index, strokes);
+    return count;
+}
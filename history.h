@@ -0,0 +1,61 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "board.h"
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// Undo/redo of this peer's own strokes on one board.
+//
+// Entries are just the sequence numbers of the strokes: undo tombstones a
+// stroke (Stroke::removed) and redo revives it, so neither copies board
+// state and both replicate to peers as a single stroke id. Once the two
+// stacks take more than limitBytes, the oldest half of the undo stack is
+// spilled to a temporary file and read back when undo gets that far.
+
+const size_t HISTORY_LIMIT_BYTES = 256 * 1024;
+
+struct History
+{
+    std::vector<uint32_t> undo;
+    std::vector<uint32_t> redo;
+    FILE *spill;
+    uint64_t spilled; // Entries in the spill file, oldest first
+    size_t limitBytes;
+};
+
+void historyInit(History &history, size_t limitBytes);
+void historyClear(History &history); // Also closes the spill file
+
+// A new stroke by this peer; forgets everything that could be redone
+void historyRecord(History &history, uint32_t seq);
+
+// Moves the newest entry to the other stack; false when there is none
+bool historyUndo(History &history, uint32_t &seq);
+bool historyRedo(History &history, uint32_t &seq);
+
+// Stroke ids are (author, seq); author 0 marks strokes saved without one
+uint64_t strokeKey(uint32_t author, uint32_t seq);
+void indexStrokes(StrokeIndex &index, const std::vector<Stroke> &strokes);
+void indexLastStroke(StrokeIndex &index, const std::vector<Stroke> &strokes);
+Stroke *findStroke(std::vector<Stroke> &strokes, const StrokeIndex &index, uint32_t author, uint32_t seq);
+
+// Strokes are stacked by (stamp, author). A peer stamps a stroke with its
+// wall clock in milliseconds, or one past the newest stamp it has drawn or
+// received if that is later, so a stroke lands above everything its author
+// could see, a peer that just joined draws above what came before, and
+// strokes drawn concurrently stack the same way on every peer whatever
+// order they arrive in.
+bool stackedBelow(const Stroke &a, const Stroke &b);
+// Where stroke belongs in strokes; searched from the top, where new
+// strokes almost always go
+size_t stackPosition(const std::vector<Stroke> &strokes, const Stroke &stroke);
+// Inserts at stackPosition and reindexes the strokes it moved up;
+// returns the position
+size_t insertStroke(std::vector<Stroke> &strokes, StrokeIndex &index, const Stroke &stroke);
+// A clear is stamped like a stroke and takes away the strokes stacked
+// below it, which are the first ones; returns how many went
+size_t clearBelow(std::vector<Stroke> &strokes, StrokeIndex &index, const Stroke &clear);
+
+#endif
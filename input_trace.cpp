@@ -0,0 +1,234 @@
+#include "input_trace.h"
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+const size_t TRACE_FLUSH_BYTES = 64 * 1024;
+
+std::atomic<uint64_t> allocationCount(0);
+
+void *operator new(size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    void *memory = malloc(size ? size : 1);
+    if (!memory)
+    {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void *memory) noexcept
+{
+    free(memory);
+}
+
+static int traceArgCount(uint8_t type)
+{
+    switch (type)
+    {
+    case TRACE_MOUSE_BUTTON:
+    case TRACE_MOUSE_WHEEL:
+        return 4;
+    case TRACE_KEYBOARD:
+        return 3;
+    case TRACE_MOUSE_MOTION:
+    case TRACE_RESHAPE:
+        return 2;
+    case TRACE_FRAME:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static void putVarint(std::vector<uint8_t> &out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+static bool getVarint(const uint8_t *&cursor, const uint8_t *end, uint64_t &value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64 && cursor < end; shift += 7)
+    {
+        uint8_t byte = *cursor++;
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void flush(TraceWriter &writer)
+{
+    if (!writer.buffer.empty() && fwrite(&writer.buffer[0], 1, writer.buffer.size(), writer.file) != writer.buffer.size())
+    {
+        fprintf(stderr, "Writing the input trace failed\n");
+    }
+    writer.buffer.clear();
+}
+
+bool traceOpen(TraceWriter &writer, const char *path, const TraceHeader &header)
+{
+    writer.file = fopen(path, "wb");
+    writer.buffer.clear();
+    writer.lastMs = 0;
+    return writer.file && fwrite(&header, sizeof(header), 1, writer.file) == 1;
+}
+
+void traceAppend(TraceWriter &writer, const TraceEvent &event)
+{
+    std::lock_guard<std::mutex> lock(writer.mutex);
+    if (!writer.file)
+    {
+        return;
+    }
+    double delta = event.timeMs > writer.lastMs ? event.timeMs - writer.lastMs : 0;
+    uint64_t deltaUs = static_cast<uint64_t>(delta * 1000.0);
+    writer.lastMs += deltaUs / 1000.0;
+
+    writer.buffer.push_back(event.type);
+    putVarint(writer.buffer, deltaUs);
+    for (int i = 0; i < traceArgCount(event.type); i++)
+    {
+        // Zigzag, so small negative coordinates stay short
+        putVarint(writer.buffer, (static_cast<uint32_t>(event.args[i]) << 1) ^ static_cast<uint32_t>(event.args[i] >> 31));
+    }
+    if (event.type == TRACE_NETWORK)
+    {
+        putVarint(writer.buffer, event.text.size());
+        writer.buffer.insert(writer.buffer.end(), event.text.begin(), event.text.end());
+    }
+    if (writer.buffer.size() >= TRACE_FLUSH_BYTES)
+    {
+        flush(writer);
+    }
+}
+
+void traceClose(TraceWriter &writer)
+{
+    std::lock_guard<std::mutex> lock(writer.mutex);
+    if (writer.file)
+    {
+        flush(writer);
+        fclose(writer.file);
+        writer.file = NULL;
+    }
+}
+
+bool traceLoad(const char *path, TraceHeader &header, std::vector<TraceEvent> &events)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        return false;
+    }
+    std::vector<uint8_t> data;
+    uint8_t chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    {
+        data.insert(data.end(), chunk, chunk + n);
+    }
+    fclose(file);
+
+    if (data.size() < sizeof(header))
+    {
+        return false;
+    }
+    memcpy(&header, &data[0], sizeof(header));
+    if (header.magic != TRACE_MAGIC || header.version != TRACE_VERSION)
+    {
+        return false;
+    }
+
+    events.clear();
+    const uint8_t *cursor = &data[0] + sizeof(header);
+    const uint8_t *end = &data[0] + data.size();
+    double timeMs = 0;
+    while (cursor < end)
+    {
+        TraceEvent event;
+        uint64_t value;
+        memset(event.args, 0, sizeof(event.args));
+        event.type = *cursor++;
+        bool ok = getVarint(cursor, end, value);
+        timeMs += value / 1000.0;
+        event.timeMs = timeMs;
+        for (int i = 0; i < traceArgCount(event.type) && ok; i++)
+        {
+            ok = getVarint(cursor, end, value);
+            uint32_t zigzag = static_cast<uint32_t>(value);
+            event.args[i] = static_cast<int32_t>((zigzag >> 1) ^ (0u - (zigzag & 1)));
+        }
+        if (ok && event.type == TRACE_NETWORK)
+        {
+            ok = getVarint(cursor, end, value) && value <= static_cast<uint64_t>(end - cursor);
+            if (ok)
+            {
+                event.text.assign(reinterpret_cast<const char *>(cursor), value);
+                cursor += value;
+            }
+        }
+        if (!ok || event.type < TRACE_MOUSE_BUTTON || event.type > TRACE_FRAME)
+        {
+            break;
+        }
+        events.push_back(event);
+    }
+    return true;
+}
+
+static void hashBytes(uint64_t &hash, const void *data, size_t length)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+}
+
+template <typename T>
+static void hashValue(uint64_t &hash, T value)
+{
+    hashBytes(hash, &value, sizeof(value));
+}
+
+uint64_t boardChecksum(const std::vector<Stroke> &strokes, const std::vector<RasterTile> &tiles)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t s = 0; s < strokes.size(); s++)
+    {
+        const Stroke &stroke = strokes[s];
+        hashValue(hash, stroke.author);
+        hashValue(hash, stroke.seq);
+        hashValue<int32_t>(hash, stroke.size);
+        hashValue<uint8_t>(hash, (stroke.isEraser ? 1 : 0) | (stroke.removed ? 2 : 0));
+        hashBytes(hash, stroke.color, sizeof(stroke.color));
+        hashValue<uint32_t>(hash, stroke.lines.size());
+        for (size_t i = 0; i < stroke.lines.size(); i++)
+        {
+            const Line &line = stroke.lines[i];
+            int32_t points[4] = {line.x1, line.y1, line.x2, line.y2};
+            hashBytes(hash, points, sizeof(points));
+        }
+    }
+    for (size_t t = 0; t < tiles.size(); t++)
+    {
+        hashValue<int32_t>(hash, tiles[t].x);
+        hashValue<int32_t>(hash, tiles[t].y);
+        if (!tiles[t].encoded.empty())
+        {
+            hashBytes(hash, &tiles[t].encoded[0], tiles[t].encoded.size());
+        }
+    }
+    return hash;
+}
@@ -0,0 +1,75 @@
+#ifndef INPUT_TRACE_H
+#define INPUT_TRACE_H
+
+#include "board.h"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Recording of everything that drives a session, for replaying it later
+// as a repeatable end-to-end benchmark.
+//
+// A trace holds the GLUT input events, every message that arrived from
+// the network and every frame tick, in the order they were handled. The
+// boards as they were when recording started are saved next to it as
+// <trace>.ibd. Events are a type byte, the time since the previous event
+// in microseconds and their arguments, all as varints.
+
+const uint32_t TRACE_MAGIC = 0x52544249; // "IBTR"
+const uint32_t TRACE_VERSION = 1;
+
+enum TraceEventType
+{
+    TRACE_MOUSE_BUTTON = 1, // button, state, x, y
+    TRACE_MOUSE_MOTION = 2, // x, y
+    TRACE_KEYBOARD = 3,     // key, x, y
+    TRACE_MOUSE_WHEEL = 4,  // wheel, direction, x, y
+    TRACE_RESHAPE = 5,      // width, height
+    TRACE_NETWORK = 6,      // text holds the message
+    TRACE_FRAME = 7         // sidebar animation step in microseconds
+};
+
+struct TraceHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t localAuthor;
+    int32_t windowWidth;
+    int32_t windowHeight;
+};
+
+struct TraceEvent
+{
+    uint8_t type;
+    double timeMs; // Since recording started
+    int32_t args[4];
+    std::string text;
+};
+
+struct TraceWriter
+{
+    FILE *file;
+    std::vector<uint8_t> buffer;
+    double lastMs;
+    std::mutex mutex; // Network messages are recorded from their own thread
+};
+
+bool traceOpen(TraceWriter &writer, const char *path, const TraceHeader &header);
+void traceAppend(TraceWriter &writer, const TraceEvent &event);
+void traceClose(TraceWriter &writer);
+
+// Stops at the first truncated event, so a trace cut short by a crash
+// still replays up to that point
+bool traceLoad(const char *path, TraceHeader &header, std::vector<TraceEvent> &events);
+
+// Heap allocations made by the whole process; operator new is replaced in
+// input_trace.cpp to count them
+extern std::atomic<uint64_t> allocationCount;
+
+// FNV-1a over stroke ids, flags, settings and lines, then the tiles
+uint64_t boardChecksum(const std::vector<Stroke> &strokes, const std::vector<RasterTile> &tiles);
+
+#endif
@@ -0,0 +1,630 @@
+#include "journal.h"
+#include "board_tiles.h"
+#include "history.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+const uint32_t JOURNAL_MAGIC = 0x4c4a4249; // "IBJL"
+const uint32_t JOURNAL_VERSION = 3;
+const char *JOURNAL_STATE_PATH = "journal.state";
+
+static std::string segmentPath(uint32_t generation)
+{
+    return "journal-" + std::to_string(generation) + ".log";
+}
+
+static std::string checkpointPath(uint32_t generation)
+{
+    return "checkpoint-" + std::to_string(generation) + ".ibd";
+}
+
+static uint32_t checksum(const unsigned char *data, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void putBytes(std::vector<unsigned char> &out, const void *data, size_t length)
+{
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    out.insert(out.end(), bytes, bytes + length);
+}
+
+template <typename T>
+static void putValue(std::vector<unsigned char> &out, T value)
+{
+    putBytes(out, &value, sizeof(value));
+}
+
+template <typename T>
+static bool getValue(const unsigned char *&cursor, const unsigned char *end, T &value)
+{
+    if (static_cast<size_t>(end - cursor) < sizeof(value))
+    {
+        return false;
+    }
+    memcpy(&value, cursor, sizeof(value));
+    cursor += sizeof(value);
+    return true;
+}
+
+static FILE *openSegment(uint32_t generation)
+{
+    FILE *file = fopen(segmentPath(generation).c_str(), "wb");
+    if (file)
+    {
+        uint32_t header[3] = {JOURNAL_MAGIC, JOURNAL_VERSION, generation};
+        fwrite(header, sizeof(header), 1, file);
+        syncFile(file);
+    }
+    return file;
+}
+
+static bool fileExists(const std::string &path)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file)
+    {
+        fclose(file);
+        return true;
+    }
+    return false;
+}
+
+// Frames one record: payload length, checksum, payload
+static void appendRecord(Journal &journal, const std::vector<unsigned char> &payload)
+{
+    // Without an open journal the board still works, it just is not durable
+    if (!journal.writer.joinable())
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(journal.mutex);
+    bool wasEmpty = journal.pending.empty();
+    putValue<uint32_t>(journal.pending, payload.size());
+    putValue<uint32_t>(journal.pending, checksum(&payload[0], payload.size()));
+    putBytes(journal.pending, &payload[0], payload.size());
+    journal.stats.records++;
+    journal.stats.bytes += payload.size() + 8;
+    journal.stats.bytesSinceCheckpoint += payload.size() + 8;
+    if (wasEmpty)
+    {
+        journal.wake.notify_one();
+    }
+}
+
+void journalAddStroke(Journal &journal, int board, const Stroke &stroke)
+{
+    std::vector<unsigned char> payload;
+    payload.reserve(32 + stroke.lines.size() * 16);
+    putValue<uint8_t>(payload, JOURNAL_ADD_STROKE);
+    putValue<int32_t>(payload, board);
+    putValue<uint32_t>(payload, stroke.author);
+    putValue<uint32_t>(payload, stroke.seq);
+    putValue<uint64_t>(payload, stroke.stamp);
+    putValue<int32_t>(payload, stroke.size);
+    putValue<uint32_t>(payload, stroke.isEraser ? 1 : 0);
+    putBytes(payload, stroke.color, sizeof(float) * 3);
+    putValue<uint32_t>(payload, stroke.lines.size());
+    for (size_t i = 0; i < stroke.lines.size(); i++)
+    {
+        const Line &line = stroke.lines[i];
+        int32_t coords[4] = {line.x1, line.y1, line.x2, line.y2};
+        putBytes(payload, coords, sizeof(coords));
+    }
+    std::vector<StyleRun> runs;
+    strokeStyleRuns(stroke, runs);
+    putValue<uint32_t>(payload, runs.size());
+    putBytes(payload, runs.empty() ? NULL : &runs[0], runs.size() * sizeof(StyleRun));
+    appendRecord(journal, payload);
+}
+
+void journalBoardOp(Journal &journal, JournalOp op, int board)
+{
+    std::vector<unsigned char> payload;
+    putValue<uint8_t>(payload, op);
+    putValue<int32_t>(payload, board);
+    appendRecord(journal, payload);
+}
+
+void journalStrokeOp(Journal &journal, JournalOp op, int board, uint32_t author, uint32_t seq)
+{
+    std::vector<unsigned char> payload;
+    putValue<uint8_t>(payload, op);
+    putValue<int32_t>(payload, board);
+    putValue<uint32_t>(payload, author);
+    putValue<uint32_t>(payload, seq);
+    appendRecord(journal, payload);
+}
+
+void journalCreateBoard(Journal &journal, const std::string &name)
+{
+    std::vector<unsigned char> payload;
+    putValue<uint8_t>(payload, JOURNAL_CREATE_BOARD);
+    putValue<int32_t>(payload, -1);
+    putValue<uint32_t>(payload, name.size());
+    putBytes(payload, name.data(), name.size());
+    appendRecord(journal, payload);
+}
+
+void journalFlatten(Journal &journal, int board, uint32_t strokeCount)
+{
+    std::vector<unsigned char> payload;
+    putValue<uint8_t>(payload, JOURNAL_FLATTEN);
+    putValue<int32_t>(payload, board);
+    putValue(payload, strokeCount);
+    appendRecord(journal, payload);
+}
+
+void journalClear(Journal &journal, int board, uint32_t strokeCount)
+{
+    std::vector<unsigned char> payload;
+    putValue<uint8_t>(payload, JOURNAL_CLEAR);
+    putValue<int32_t>(payload, board);
+    putValue(payload, strokeCount);
+    appendRecord(journal, payload);
+}
+
+static double msSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void writerLoop(Journal &journal)
+{
+    std::vector<unsigned char> batch, tail;
+    std::unique_lock<std::mutex> lock(journal.mutex);
+    while (true)
+    {
+        journal.wake.wait(lock, [&journal]()
+                          { return journal.stopping || journal.rotatePending || !journal.pending.empty(); });
+
+        // Let appends arriving within the commit window share one fsync
+        journal.wake.wait_for(lock, std::chrono::milliseconds(JOURNAL_GROUP_COMMIT_MS), [&journal]()
+                              { return journal.stopping || journal.rotatePending; });
+
+        bool rotate = journal.rotatePending;
+        uint32_t generation = journal.generation;
+        journal.rotatePending = false;
+        batch.swap(journal.pending);
+        tail.swap(journal.rotateTail);
+        bool stopping = journal.stopping;
+        lock.unlock();
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if (rotate && journal.file)
+        {
+            if (!tail.empty())
+            {
+                fwrite(&tail[0], 1, tail.size(), journal.file);
+            }
+            syncFile(journal.file);
+            fclose(journal.file);
+            journal.file = openSegment(generation);
+        }
+        if (!batch.empty() && journal.file)
+        {
+            fwrite(&batch[0], 1, batch.size(), journal.file);
+            syncFile(journal.file);
+        }
+        double commitMs = msSince(start);
+        batch.clear();
+        tail.clear();
+
+        lock.lock();
+        journal.stats.commits++;
+        journal.stats.maxCommitMs = std::max(journal.stats.maxCommitMs, commitMs);
+        if (rotate)
+        {
+            journal.fileGeneration = generation;
+            journal.rotated.notify_all();
+        }
+        if (stopping && journal.pending.empty() && !journal.rotatePending)
+        {
+            return;
+        }
+    }
+}
+
+bool journalOpen(Journal &journal, uint32_t generation, uint32_t checkpointGeneration)
+{
+    journal.file = openSegment(generation);
+    if (!journal.file)
+    {
+        return false;
+    }
+    journal.fileGeneration = generation;
+    journal.generation = generation;
+    journal.checkpointGeneration = checkpointGeneration;
+    journal.rotatePending = false;
+    journal.stopping = false;
+    journal.checkpointRunning = false;
+    memset(&journal.stats, 0, sizeof(journal.stats));
+    journal.writer = std::thread(writerLoop, std::ref(journal));
+    return true;
+}
+
+void journalClose(Journal &journal)
+{
+    if (journal.checkpointer.joinable())
+    {
+        journal.checkpointer.join();
+    }
+    if (journal.writer.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(journal.mutex);
+            journal.stopping = true;
+        }
+        journal.wake.notify_all();
+        journal.writer.join();
+    }
+    if (journal.file)
+    {
+        fclose(journal.file);
+        journal.file = NULL;
+    }
+}
+
+bool journalCheckpointDue(Journal &journal)
+{
+    std::lock_guard<std::mutex> lock(journal.mutex);
+    return !journal.checkpointRunning && journal.stats.bytesSinceCheckpoint >= JOURNAL_CHECKPOINT_BYTES;
+}
+
+size_t journalPendingBytes(Journal &journal)
+{
+    std::lock_guard<std::mutex> lock(journal.mutex);
+    return journal.pending.size();
+}
+
+// Replaces the state file in one rename, so there is always one to read
+static bool writeState(uint32_t generation)
+{
+    std::string tempPath = std::string(JOURNAL_STATE_PATH) + ".tmp";
+    FILE *file = fopen(tempPath.c_str(), "wb");
+    if (!file)
+    {
+        return false;
+    }
+    bool ok = fwrite(&generation, sizeof(generation), 1, file) == 1 && syncFile(file);
+    ok = (fclose(file) == 0) && ok;
+    return ok && replaceFile(tempPath.c_str(), JOURNAL_STATE_PATH);
+}
+
+static uint32_t readState()
+{
+    uint32_t generation = 0;
+    FILE *file = fopen(JOURNAL_STATE_PATH, "rb");
+    if (file)
+    {
+        if (fread(&generation, sizeof(generation), 1, file) != 1)
+        {
+            generation = 0;
+        }
+        fclose(file);
+    }
+    return generation;
+}
+
+static void runCheckpoint(Journal &journal, std::vector<Board> snapshot, int currentBoard, uint32_t generation)
+{
+    // saveSession fsyncs the checkpoint and its directory entry before it
+    // returns, and writeState does the same for the state, so the segments
+    // below are only deleted once what replaces them is on disk
+    bool saved = saveSession(checkpointPath(generation).c_str(), snapshot, currentBoard);
+
+    // The segment the checkpoint replaces must be closed before it is deleted
+    std::unique_lock<std::mutex> lock(journal.mutex);
+    journal.rotated.wait(lock, [&]()
+                         { return journal.fileGeneration >= generation || journal.stopping; });
+    uint32_t previous = journal.checkpointGeneration;
+    lock.unlock();
+
+    if (saved && writeState(generation))
+    {
+        if (previous > 0)
+        {
+            remove(checkpointPath(previous).c_str());
+        }
+        for (uint32_t g = std::max(previous, 1u); g < generation; g++)
+        {
+            remove(segmentPath(g).c_str());
+        }
+        lock.lock();
+        journal.checkpointGeneration = generation;
+        journal.stats.checkpoints++;
+    }
+    else
+    {
+        lock.lock();
+    }
+    journal.checkpointRunning = false;
+}
+
+bool journalStartCheckpoint(Journal &journal, std::vector<Board> snapshot, int currentBoard)
+{
+    uint32_t generation;
+    {
+        std::lock_guard<std::mutex> lock(journal.mutex);
+        if (!journal.writer.joinable() || journal.checkpointRunning || journal.rotatePending)
+        {
+            return false;
+        }
+        journal.checkpointRunning = true;
+        journal.rotateTail.swap(journal.pending);
+        journal.rotatePending = true;
+        journal.generation++;
+        generation = journal.generation;
+        journal.stats.bytesSinceCheckpoint = 0;
+    }
+    journal.wake.notify_all();
+
+    if (journal.checkpointer.joinable())
+    {
+        journal.checkpointer.join();
+    }
+    journal.checkpointer = std::thread(runCheckpoint, std::ref(journal), std::move(snapshot), currentBoard, generation);
+    return true;
+}
+
+static void makeResident(SessionFile &checkpoint, Board &board)
+{
+    if (board.pagedIndex >= 0)
+    {
+        loadBoardStrokes(checkpoint, board.pagedIndex, board.strokes);
+        loadBoardTiles(checkpoint, board.pagedIndex, board.tiles);
+        board.pagedIndex = -1;
+    }
+}
+
+// Applies one record with the same semantics as the UI action that wrote it
+static bool applyRecord(const unsigned char *cursor, const unsigned char *end,
+                        SessionFile &checkpoint, std::vector<Board> &boards, int &currentBoard)
+{
+    uint8_t op;
+    int32_t board;
+    if (!getValue(cursor, end, op) || !getValue(cursor, end, board))
+    {
+        return false;
+    }
+    bool validBoard = board >= 0 && board < static_cast<int>(boards.size());
+
+    switch (op)
+    {
+    case JOURNAL_ADD_STROKE:
+    {
+        Stroke stroke;
+        uint32_t flags, lineCount, runCount;
+        stroke.removed = false;
+        if (!getValue(cursor, end, stroke.author) || !getValue(cursor, end, stroke.seq) ||
+            !getValue(cursor, end, stroke.stamp) || !getValue(cursor, end, stroke.size) || !getValue(cursor, end, flags) ||
+            !getValue(cursor, end, stroke.color) || !getValue(cursor, end, lineCount) ||
+            static_cast<size_t>(end - cursor) < lineCount * sizeof(int32_t) * 4)
+        {
+            return false;
+        }
+        stroke.isEraser = flags != 0;
+        stroke.lines.resize(lineCount);
+        for (uint32_t i = 0; i < lineCount; i++)
+        {
+            Line &line = stroke.lines[i];
+            getValue(cursor, end, line.x1);
+            getValue(cursor, end, line.y1);
+            getValue(cursor, end, line.x2);
+            getValue(cursor, end, line.y2);
+            line.size = stroke.size;
+            line.isEraser = stroke.isEraser;
+            memcpy(line.color, stroke.color, sizeof(float) * 3);
+        }
+        if (!getValue(cursor, end, runCount) || static_cast<size_t>(end - cursor) < runCount * sizeof(StyleRun))
+        {
+            return false;
+        }
+        for (uint32_t r = 0; r < runCount; r++)
+        {
+            StyleRun run;
+            getValue(cursor, end, run);
+            applyStyleRun(stroke, run);
+        }
+        if (validBoard)
+        {
+            makeResident(checkpoint, boards[board]);
+            std::vector<Stroke> &strokes = boards[board].strokes;
+            strokes.insert(strokes.begin() + stackPosition(strokes, stroke), stroke);
+        }
+        break;
+    }
+    case JOURNAL_UNDO:
+    case JOURNAL_REDO:
+    {
+        uint32_t author, seq;
+        if (!getValue(cursor, end, author) || !getValue(cursor, end, seq))
+        {
+            return false;
+        }
+        if (validBoard)
+        {
+            makeResident(checkpoint, boards[board]);
+            // Undo mostly targets recent strokes, so search from the end
+            std::vector<Stroke> &strokes = boards[board].strokes;
+            for (size_t i = strokes.size(); i-- > 0;)
+            {
+                if (strokes[i].author == author && strokes[i].seq == seq)
+                {
+                    strokes[i].removed = op == JOURNAL_UNDO;
+                    break;
+                }
+            }
+        }
+        break;
+    }
+    case JOURNAL_CLEAR:
+    {
+        // A clear from another peer leaves the strokes stamped above it
+        uint32_t strokeCount;
+        if (!getValue(cursor, end, strokeCount))
+        {
+            return false;
+        }
+        if (validBoard)
+        {
+            makeResident(checkpoint, boards[board]);
+            std::vector<Stroke> &strokes = boards[board].strokes;
+            strokes.erase(strokes.begin(), strokes.begin() + std::min<size_t>(strokeCount, strokes.size()));
+            boards[board].tiles.clear();
+        }
+        break;
+    }
+    case JOURNAL_FLATTEN:
+    {
+        uint32_t strokeCount;
+        if (!getValue(cursor, end, strokeCount))
+        {
+            return false;
+        }
+        if (validBoard)
+        {
+            makeResident(checkpoint, boards[board]);
+            std::vector<Stroke> &strokes = boards[board].strokes;
+            strokeCount = std::min<size_t>(strokeCount, strokes.size());
+            flattenStrokes(boards[board].tiles, strokes, strokeCount);
+            strokes.erase(strokes.begin(), strokes.begin() + strokeCount);
+        }
+        break;
+    }
+    case JOURNAL_CREATE_BOARD:
+    {
+        uint32_t nameLength;
+        if (!getValue(cursor, end, nameLength) || static_cast<size_t>(end - cursor) < nameLength)
+        {
+            return false;
+        }
+        Board created;
+        created.name.assign(reinterpret_cast<const char *>(cursor), nameLength);
+        created.pointSize = 2;
+        created.tool = 1;
+        created.pagedIndex = -1;
+        created.lastUsed = 0;
+        created.clearStamp = 0;
+        created.clearAuthor = 0;
+        created.currentColor[0] = created.currentColor[1] = created.currentColor[2] = 0.0f;
+        boards.push_back(created);
+        currentBoard = boards.size() - 1;
+        break;
+    }
+    case JOURNAL_DELETE_BOARD:
+        if (validBoard && boards.size() > 1)
+        {
+            boards.erase(boards.begin() + board);
+            currentBoard = std::max(0, board - 1);
+        }
+        break;
+    case JOURNAL_SELECT_BOARD:
+        if (validBoard)
+        {
+            currentBoard = board;
+        }
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+// Replays one segment; returns false if it ends in a torn or corrupt record
+static bool replaySegment(uint32_t generation, SessionFile &checkpoint, std::vector<Board> &boards,
+                          int &currentBoard, RecoveryStats &stats)
+{
+    FILE *file = fopen(segmentPath(generation).c_str(), "rb");
+    if (!file)
+    {
+        return false;
+    }
+    std::vector<unsigned char> data;
+    unsigned char buffer[65536];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        data.insert(data.end(), buffer, buffer + n);
+    }
+    fclose(file);
+
+    const unsigned char *cursor = data.empty() ? NULL : &data[0];
+    const unsigned char *end = cursor + data.size();
+    uint32_t magic, version, segmentGeneration;
+    if (!getValue(cursor, end, magic) || !getValue(cursor, end, version) || !getValue(cursor, end, segmentGeneration) ||
+        magic != JOURNAL_MAGIC || version != JOURNAL_VERSION || segmentGeneration != generation)
+    {
+        return false;
+    }
+
+    while (cursor < end)
+    {
+        uint32_t length, sum;
+        if (!getValue(cursor, end, length) || !getValue(cursor, end, sum) ||
+            static_cast<size_t>(end - cursor) < length || checksum(cursor, length) != sum ||
+            !applyRecord(cursor, cursor + length, checkpoint, boards, currentBoard))
+        {
+            return false;
+        }
+        cursor += length;
+        stats.records++;
+    }
+    return true;
+}
+
+bool recoverBoards(SessionFile &checkpoint, std::vector<Board> &boards, int &currentBoard,
+                   uint32_t &checkpointGeneration, uint32_t &nextGeneration, RecoveryStats &stats)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    stats.ms = 0;
+    stats.segments = 0;
+    stats.records = 0;
+    stats.tornTail = false;
+
+    checkpointGeneration = readState();
+    uint32_t generation = std::max(checkpointGeneration, 1u);
+    if (checkpointGeneration == 0 && !fileExists(segmentPath(generation)))
+    {
+        return false;
+    }
+
+    boards.clear();
+    currentBoard = 0;
+    if (checkpointGeneration > 0)
+    {
+        if (!openSession(checkpointPath(checkpointGeneration).c_str(), checkpoint))
+        {
+            return false;
+        }
+        for (uint32_t i = 0; i < checkpoint.boardCount; i++)
+        {
+            Board board;
+            readBoardInfo(checkpoint, i, board);
+            board.pagedIndex = i;
+            boards.push_back(board);
+        }
+        currentBoard = checkpoint.currentBoard;
+    }
+
+    // The rest of a segment after a torn record was never durable; the
+    // session that followed the crash carried on in the next segment.
+    for (; fileExists(segmentPath(generation)); generation++)
+    {
+        stats.segments++;
+        if (!replaySegment(generation, checkpoint, boards, currentBoard, stats))
+        {
+            stats.tornTail = true;
+        }
+    }
+
+    nextGeneration = generation;
+    stats.ms = msSince(start);
+    return !boards.empty();
+}
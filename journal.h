@@ -0,0 +1,103 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "board.h"
+#include "session_file.h"
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Append-only journal of board mutations with periodic checkpoints.
+//
+// Appending only encodes the record into memory; a writer thread writes
+// everything that arrived in the last JOURNAL_GROUP_COMMIT_MS and fsyncs
+// once per group, so drawing never waits on the disk. Files live in the
+// working directory:
+//
+//   journal-<g>.log      records since checkpoint g (segment g, g+1, ...)
+//   checkpoint-<g>.ibd   session-format snapshot of every board
+//   journal.state        the generation of the newest complete checkpoint
+//
+// A checkpoint rotates to a new segment, writes the snapshot in the
+// background, then points journal.state at it and deletes what it covers.
+
+enum JournalOp
+{
+    JOURNAL_ADD_STROKE = 1,
+    JOURNAL_UNDO = 2,
+    JOURNAL_CLEAR = 3,
+    JOURNAL_CREATE_BOARD = 4,
+    JOURNAL_DELETE_BOARD = 5,
+    JOURNAL_SELECT_BOARD = 6,
+    JOURNAL_REDO = 7,
+    JOURNAL_FLATTEN = 8
+};
+
+const int JOURNAL_GROUP_COMMIT_MS = 5;
+const uint64_t JOURNAL_CHECKPOINT_BYTES = 4 * 1024 * 1024;
+
+struct JournalStats
+{
+    uint64_t records;
+    uint64_t bytes;
+    uint64_t commits;
+    double maxCommitMs;
+    uint64_t bytesSinceCheckpoint;
+    int checkpoints;
+};
+
+struct Journal
+{
+    FILE *file;
+    uint32_t fileGeneration;       // Segment the writer has open
+    uint32_t generation;           // Segment new records belong to
+    uint32_t checkpointGeneration; // Generation named by journal.state
+    std::vector<unsigned char> pending;
+    std::vector<unsigned char> rotateTail; // Last records of the segment being closed
+    bool rotatePending;
+    bool stopping;
+    bool checkpointRunning;
+    JournalStats stats;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable rotated;
+    std::thread writer;
+    std::thread checkpointer;
+};
+
+struct RecoveryStats
+{
+    double ms;
+    int segments;
+    uint64_t records;
+    bool tornTail;
+};
+
+// Rebuilds boards from the newest checkpoint (left mapped in checkpoint,
+// with boards paged) plus every journal segment after it. Returns false
+// when there is no journal to recover from.
+bool recoverBoards(SessionFile &checkpoint, std::vector<Board> &boards, int &currentBoard,
+                   uint32_t &checkpointGeneration, uint32_t &nextGeneration, RecoveryStats &stats);
+
+bool journalOpen(Journal &journal, uint32_t generation, uint32_t checkpointGeneration);
+void journalClose(Journal &journal);
+
+void journalAddStroke(Journal &journal, int board, const Stroke &stroke);
+void journalBoardOp(Journal &journal, JournalOp op, int board);
+void journalStrokeOp(Journal &journal, JournalOp op, int board, uint32_t author, uint32_t seq); // Undo or redo
+void journalCreateBoard(Journal &journal, const std::string &name);
+void journalFlatten(Journal &journal, int board, uint32_t strokeCount); // Leading strokes moved into tiles
+void journalClear(Journal &journal, int board, uint32_t strokeCount);   // Leading strokes and all tiles dropped
+
+bool journalCheckpointDue(Journal &journal);
+size_t journalPendingBytes(Journal &journal); // Appended but not yet written
+
+// Starts a new segment and writes the snapshot in the background. The
+// snapshot must be exactly the state after the last appended record.
+bool journalStartCheckpoint(Journal &journal, std::vector<Board> snapshot, int currentBoard);
+
+#endif
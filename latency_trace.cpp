@@ -0,0 +1,131 @@
+#include "latency_trace.h"
+#include <cstdio>
+
+static const char *const SPAN_NAMES[SPAN_STAGES] = {
+    "capture", "commit", "serialize", "send", "network",
+    "poll wait", "parse", "apply", "redraw wait", "draw"};
+
+void spanRingInit(SpanRing &ring, size_t capacity)
+{
+    std::lock_guard<std::mutex> lock(ring.mutex);
+    ring.spans.assign(capacity, StrokeSpan());
+    ring.next = 0;
+    ring.total = 0;
+}
+
+void spanRecord(SpanRing &ring, uint32_t peer, uint32_t author, uint32_t seq, SpanStage stage, double startMs, double endMs)
+{
+    std::lock_guard<std::mutex> lock(ring.mutex);
+    if (ring.spans.empty())
+    {
+        return;
+    }
+    StrokeSpan &span = ring.spans[ring.next];
+    span.peer = peer;
+    span.author = author;
+    span.seq = seq;
+    span.stage = stage;
+    span.startMs = startMs;
+    span.endMs = endMs < startMs ? startMs : endMs;
+    ring.next = (ring.next + 1) % ring.spans.size();
+    ring.total++;
+}
+
+int writeChromeTrace(const char *path, SpanRing &ring, uint32_t localAuthor)
+{
+    std::vector<StrokeSpan> spans;
+    {
+        std::lock_guard<std::mutex> lock(ring.mutex);
+        size_t count = ring.total < ring.spans.size() ? static_cast<size_t>(ring.total) : ring.spans.size();
+        size_t first = (ring.next + ring.spans.size() - count) % (ring.spans.empty() ? 1 : ring.spans.size());
+        for (size_t i = 0; i < count; i++)
+        {
+            spans.push_back(ring.spans[(first + i) % ring.spans.size()]);
+        }
+    }
+
+    FILE *file = fopen(path, "w");
+    if (!file)
+    {
+        return -1;
+    }
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    // A process per peer and a thread per stage, so every stage gets its
+    // own row in the viewer
+    std::vector<uint32_t> peers;
+    for (size_t i = 0; i < spans.size(); i++)
+    {
+        bool known = false;
+        for (size_t p = 0; p < peers.size() && !known; p++)
+        {
+            known = peers[p] == spans[i].peer;
+        }
+        if (!known)
+        {
+            peers.push_back(spans[i].peer);
+        }
+    }
+    for (size_t p = 0; p < peers.size(); p++)
+    {
+        fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":\"peer %08x%s\"}},\n",
+                peers[p], peers[p], peers[p] == localAuthor ? " (this peer)" : "");
+        for (int stage = 0; stage < SPAN_STAGES; stage++)
+        {
+            fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+                    peers[p], stage, SPAN_NAMES[stage]);
+            fprintf(file, "{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":%u,\"tid\":%d,\"args\":{\"sort_index\":%d}},\n",
+                    peers[p], stage, stage);
+        }
+    }
+
+    for (size_t i = 0; i < spans.size(); i++)
+    {
+        const StrokeSpan &span = spans[i];
+        fprintf(file, "{\"name\":\"%s\",\"cat\":\"stroke\",\"ph\":\"X\",\"pid\":%u,\"tid\":%d,\"ts\":%.1f,\"dur\":%.1f,"
+                      "\"args\":{\"stroke\":\"%08x:%u\"}}%s\n",
+                SPAN_NAMES[span.stage], span.peer, span.stage, span.startMs * 1000.0, (span.endMs - span.startMs) * 1000.0,
+                span.author, span.seq, i + 1 < spans.size() ? "," : "");
+    }
+    fprintf(file, "]}\n");
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok ? static_cast<int>(spans.size()) : -1;
+}
+
+void clockSyncReset(ClockSync &sync)
+{
+    sync.count = 0;
+    sync.next = 0;
+}
+
+void clockSyncSample(ClockSync &sync, double probeMs, double remoteMs, double replyMs)
+{
+    // The peer is assumed to answer halfway through the round trip
+    sync.offsetMs[sync.next] = remoteMs - (probeMs + replyMs) * 0.5;
+    sync.rttMs[sync.next] = replyMs - probeMs;
+    sync.next = (sync.next + 1) % CLOCK_SAMPLES;
+    if (sync.count < CLOCK_SAMPLES)
+    {
+        sync.count++;
+    }
+}
+
+bool clockSyncEstimate(const ClockSync &sync, double &offsetMs, double &rttMs)
+{
+    if (sync.count == 0)
+    {
+        return false;
+    }
+    int best = 0;
+    for (int i = 1; i < sync.count; i++)
+    {
+        if (sync.rttMs[i] < sync.rttMs[best])
+        {
+            best = i;
+        }
+    }
+    offsetMs = sync.offsetMs[best];
+    rttMs = sync.rttMs[best];
+    return true;
+}
@@ -0,0 +1,76 @@
+#ifndef LATENCY_TRACE_H
+#define LATENCY_TRACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Per-stroke timing of the path from one peer's mouse-up to another
+// peer's screen.
+//
+// Each stage a stroke goes through is a span tagged with the stroke id.
+// The sender's stages travel with the stroke (a T message, see
+// stroke_wire.h) and are moved onto the local clock with the offset from
+// clock probes, so the receiving peer holds the whole pipeline. Spans go
+// into a fixed ring and are only written out, as Chrome trace event JSON
+// for chrome://tracing or Perfetto, when asked for.
+
+const size_t SPAN_RING_SIZE = 65536;
+
+enum SpanStage
+{
+    SPAN_CAPTURE,     // Mouse-down to mouse-up
+    SPAN_COMMIT,      // Adding it to the board, journal and history
+    SPAN_SERIALIZE,   // Encoding the message
+    SPAN_SEND,        // The send call
+    SPAN_NETWORK,     // Half the probe round trip
+    SPAN_POLL_WAIT,   // The rest until recv returned it
+    SPAN_PARSE,       // Decoding the message
+    SPAN_APPLY,       // Adding it to the board and journal
+    SPAN_REDRAW_WAIT, // Until a frame started drawing it
+    SPAN_DRAW,        // That frame, up to the buffer swap
+    SPAN_STAGES
+};
+
+struct StrokeSpan
+{
+    uint32_t peer; // Whose process ran the stage
+    uint32_t author, seq;
+    uint8_t stage;
+    double startMs, endMs; // Local clock
+};
+
+struct SpanRing
+{
+    std::vector<StrokeSpan> spans;
+    size_t next;
+    uint64_t total;
+    std::mutex mutex; // Spans come from the UI and network threads
+};
+
+const int CLOCK_SAMPLES = 8;
+
+// Offset of a peer's clock from ours, from the probe with the shortest
+// round trip among the last CLOCK_SAMPLES
+struct ClockSync
+{
+    double offsetMs[CLOCK_SAMPLES]; // Remote minus local
+    double rttMs[CLOCK_SAMPLES];
+    int count;
+    int next;
+};
+
+void spanRingInit(SpanRing &ring, size_t capacity);
+void spanRecord(SpanRing &ring, uint32_t peer, uint32_t author, uint32_t seq, SpanStage stage, double startMs, double endMs);
+
+// Returns the number of spans written, or -1 on failure
+int writeChromeTrace(const char *path, SpanRing &ring, uint32_t localAuthor);
+
+void clockSyncReset(ClockSync &sync);
+// probeMs and replyMs are local, remoteMs is when the peer answered
+void clockSyncSample(ClockSync &sync, double probeMs, double remoteMs, double replyMs);
+// False until a probe has come back
+bool clockSyncEstimate(const ClockSync &sync, double &offsetMs, double &rttMs);
+
+#endif
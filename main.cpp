@@ -3,6 +3,7 @@
 #include <GL/glut.h>
 #include <sstream>
 #include <vector>
+#include <deque>
 #include <cstring>
 #include <cmath>
 #include <math.h>
@@ -11,18 +12,39 @@
 #include <chrono>
 #include <mutex>
 #include <functional>
-#define _WIN32_WINNT 0x0601 // Windows 7 or later
-#include <winsock2.h>
-#include <ws2tcpip.h>
-#pragma comment(lib, "ws2_32.lib")
+#include <atomic>
+#include <random>
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include "board.h"
+#include "board_store.h"
+#include "session_file.h"
+#include "journal.h"
+#include "history.h"
+#include "compaction.h"
+#include "tiled_export.h"
+#include "stroke_predictor.h"
+#include "input_trace.h"
+#include "stroke_wire.h"
+#include "stroke_draw.h"
+#include "shapes.h"
+#include "perf_stats.h"
+#include "latency_trace.h"
+#include "metrics.h"
+#include "net_socket.h"
+#include "shm_transport.h"
+#include "send_lanes.h"
+#include "presence.h"
+#include "stroke_seen.h"
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
 #endif
 
 void toggleSidebar();
-void animateSidebar();
-void animateRightSidebar();
 void toggleRightSidebar();
+bool animateSidebars(float elapsedMs);
+void requestRedraw();
 void drawStrokes();
 void drawColorPicker();
 void display();
@@ -64,6 +86,7 @@ int tool = 1;
 float currentColor[3] = {0.0, 0.0, 0.0};
 int pointSize = 2;
 int squareStartX = -1, squareStartY = -1;
+int previewX = -1, previewY = -1;
 
 bool isSidebarVisible = true;
 float sidebarPosition = 0.0f;
@@ -71,42 +94,253 @@ float sidebarPosition = 0.0f;
 bool isRightSidebarVisible = false;
 float rightSidebarPosition = RIGHT_SIDEBAR_WIDTH;
 
-SOCKET hostSocket = INVALID_SOCKET;
-SOCKET clientSocket = INVALID_SOCKET;
+// A connection to another board: the host has one per client and relays
+// what each one sends to the others, a client has one to the host.
+// Guarded by peersMutex.
+struct Peer
+{
+    Transport transport;
+    bool connected;
+    uint32_t id;               // Connection number, for metrics
+    std::string receiveBuffer; // Start of a message still arriving
+    ChunkJoiner chunks;        // Long messages arriving in pieces
+    SendLanes lanes;           // Messages the transport has not taken yet
+    size_t queuedBytes;        // Over all lanes
+    int64_t sendCredit;        // What a client may still send the host
+    bool creditFromHost;       // The host gives credit, so a client waits for it
+    // Bytes of this peer's messages the host has finished with and owes
+    // back as credit
+    std::shared_ptr<std::atomic<int64_t>> creditReturned;
+    uint64_t messagesIn, messagesOut, bytesIn, bytesOut;
+    uint64_t drops;              // Messages not queued because the queue was full
+    ByteBudget presenceBudget;   // For cursor updates to this peer
+    ByteBudget presenceInBudget; // For its own, relayed to the others
+    uint64_t presenceBytesIn, presenceBytesOut;
+    uint64_t presenceDrops;      // Cursor updates replaced or over budget
+    ClockSync clock;
+
+    // Newest stroke from this peer and when it arrived; its T message
+    // follows right behind it
+    uint64_t lastStrokeKey;
+    double lastStrokeReceiveMs;
+};
+
+const size_t PEER_QUEUE_LIMIT = 8 * 1024 * 1024;
+
+NetSocket hostSocket = NET_INVALID;
+NetSocket metricsSocket = NET_INVALID;
+NetSocket localSocket = NET_INVALID; // Clients on this machine, with -shm
+bool sharedMemory = false;
+std::vector<Peer> peers;
+std::mutex peersMutex;
+uint32_t nextPeerId = 1;
 bool isHost = false;
 bool isClient = false;
+std::atomic<uint64_t> parseErrors(0);
+std::atomic<uint64_t> duplicateStrokes(0); // Arrived again and were dropped
+
+// Per-board figures for the metrics endpoint, rebuilt by the UI thread
+// once a second while hosting
+const int BOARD_METRICS_INTERVAL_MS = 1000;
+
+std::string boardMetricsText;
+std::mutex metricsMutex;
+double boardMetricsMs = -BOARD_METRICS_INTERVAL_MS;
 
 std::mutex strokesMutex; // Mutex for synchronizing access to strokes
 
-struct Line
+// Cursor presence, see presence.h. The UI writes localCursor and the
+// network thread remoteCursors, both under presenceMutex.
+std::mutex presenceMutex;
+CursorState localCursor = {};
+std::map<uint32_t, RemoteCursor> remoteCursors; // By author
+PresenceSender presenceSender = {};             // Network thread only
+
+void sendStroke(const Stroke &stroke, double commitMs);
+void startMetrics();
+void addPeer(const Transport &transport);
+void closePeer(Peer &peer);
+void queueForPeer(Peer &peer, const SharedBytes &message, const std::vector<SharedBytes> &pieces, Lane lane,
+                  const SharedCredit &credit, double queuedMs);
+void flushSends();
+void sendStrokeOp(char op, uint32_t author, uint32_t seq);
+void sendClear(uint32_t author, uint32_t seq, uint64_t stamp);
+
+std::vector<Board> boards;
+int currentBoardIndex = 0;
+std::vector<Stroke> strokes;
+Stroke currentStroke;
+
+// Strokes drawn here are (localAuthor, seq); a new author is picked on
+// every start. Undo and redo only ever touch this peer's own strokes.
+uint32_t localAuthor = 0;
+uint32_t nextStrokeSeq = 1;
+size_t historyLimitBytes = HISTORY_LIMIT_BYTES;
+std::vector<History> histories; // One per board
+StrokeIndex strokeIndex;        // Position in strokes of each stroke id
+// Every stroke and clear id drawn here or received, on any board, since ids
+// are unique across them and a remote stroke lands on whichever board is
+// open. Guarded by strokesMutex.
+StrokeSeen strokesSeen;
+// Newest stamp drawn or received, on any board; see stackPosition. Guarded
+// by strokesMutex.
+uint64_t strokeClock = 0;
+// Tiles a clear took off the current board, whose textures only the main
+// thread can delete. Guarded by strokesMutex.
+std::vector<RasterTile> clearedTiles;
+
+// Strokes of the current board that compaction moved into raster tiles. A
+// pass over a copy of the board runs in the background whenever another
+// COMPACTION_INTERVAL_STROKES strokes have been added.
+const size_t COMPACTION_INTERVAL_STROKES = 2000;
+Compaction compaction = {};         // Covers the first compaction.strokeCount strokes
+Compaction finishedCompaction = {}; // Handed over by the background pass
+bool compactionFinished = false;    // Guarded by compactionMutex
+bool compactionRunning = false;
+std::atomic<bool> compactionStale(false); // A flattened stroke was undone, redone or cleared
+uint64_t boardEpoch = 0;                  // Changes whenever strokes is replaced or cleared
+uint64_t compactionEpoch = 0;             // boardEpoch the running pass started at
+std::mutex compactionMutex;
+std::thread compactionThread;
+
+// Once the current board holds more than segmentBudget segments, its
+// oldest strokes are drawn into boards[currentBoardIndex].tiles in the
+// background and dropped, so the vector path stays bounded.
+size_t segmentBudget = SEGMENT_BUDGET;
+std::vector<RasterTile> flattenedTiles;    // Handed over by the background pass
+size_t flattenCount = 0;                   // Leading strokes the running pass covers
+bool flattenFinished = false;              // Guarded by compactionMutex
+bool flattenRunning = false;
+size_t flattenCheckedSize = 0;             // strokes.size() when the budget was last checked
+uint64_t strokeOpCount = 0;                // Undo, redo and strokes stacked under others on the current board
+uint64_t flattenEpoch = 0, flattenOps = 0; // boardEpoch and strokeOpCount the pass started at
+std::thread flattenThread;
+
+// Boards restored from the session file keep their strokes in the mapped
+// file until they are first selected.
+const char *SESSION_PATH = "session.ibd";
+SessionFile sessionFile = {};
+
+// The strokes of the current board live in strokes; every other board
+// keeps its own, packed once the least recently shown boards no longer
+// fit in boardMemoryBudget. See board_store.h.
+size_t boardMemoryBudget = BOARD_MEMORY_BUDGET;
+uint64_t boardSwitches = 0;
+
+// Every change to a board is appended here; a checkpoint snapshot is
+// written in the background once enough has accumulated.
+Journal journal;
+
+void startCheckpoint()
+{
+    // Held until the checkpoint starts so the network thread cannot append
+    // a stroke that is neither in the snapshot nor in the new segment.
+    std::lock_guard<std::mutex> lock(strokesMutex);
+    boards[currentBoardIndex].pointSize = pointSize;
+    memcpy(boards[currentBoardIndex].currentColor, currentColor, sizeof(float) * 3);
+    boards[currentBoardIndex].tool = tool;
+
+    // The checkpoint that is mapped now is deleted once the new one is done.
+    // Every other board hands its strokes to the snapshot instead of having
+    // them copied here; they are only copied if the board is shown again
+    // before the checkpoint thread has written them. Packed boards and
+    // tiles are copied as they are, already encoded.
+    for (size_t i = 0; i < boards.size(); i++)
+    {
+        Board &board = boards[i];
+        unmapBoard(board, static_cast<int>(i) == currentBoardIndex, sessionFile);
+        if (static_cast<int>(i) != currentBoardIndex && !board.strokes.empty())
+        {
+            board.shared = std::make_shared<std::vector<Stroke>>();
+            board.shared->swap(board.strokes);
+        }
+    }
+    closeSession(sessionFile);
+    // Without the boards' stroke indexes, which the checkpoint has no use for
+    std::vector<Board> snapshot;
+    snapshot.reserve(boards.size());
+    for (size_t i = 0; i < boards.size(); i++)
+    {
+        StrokeIndex index;
+        index.swap(boards[i].index);
+        snapshot.push_back(boards[i]);
+        index.swap(boards[i].index);
+    }
+    snapshot[currentBoardIndex].strokes = strokes;
+    journalStartCheckpoint(journal, std::move(snapshot), currentBoardIndex);
+}
+
+// Freehand motion events are only recorded here; the frame that follows
+// moves them into currentStroke and draws them in one batch.
+struct MotionSample
 {
-    int x1, y1, x2, y2;
-    float color[3];
-    int size;
-    bool isEraser;
+    Line line;
+    double timeMs;
 };
 
-struct Stroke
+std::vector<MotionSample> pendingSamples;
+
+// Extrapolates the pointer past the newest sample; the predicted tail is
+// drawn provisionally each frame and never becomes part of the stroke.
+StrokePredictor strokePredictor;
+
+// Per-frame counters for checking how well input and draws are batched
+struct FrameStats
 {
-    std::vector<Line> lines;
-    float color[3];
-    int size;
-    bool isEraser;
+    int motionSamples;
+    int segmentsDrawn;
+    int drawBatches;
+    float strokesMs; // Board, tiles and the stroke being drawn
+    float chromeMs;  // Sidebars, thumbnails and toolbar
+    float flushMs;   // Buffer swap
 };
-void sendStroke(const Stroke &stroke);
-struct Board
-{
-    std::string name;
-    std::vector<Stroke> strokes;
-    float currentColor[3];
-    int pointSize;
-    int tool;
+
+FrameStats frameStats = {0, 0, 0, 0, 0, 0};
+FrameStats lastFrameStats = {0, 0, 0, 0, 0, 0};
+bool logFrameStats = false;
+
+// Performance overlay, toggled with 'h'; see perf_stats.h. Input latency
+// runs from a motion sample to the swap of the frame that draws it, remote
+// latency from a message's arrival to that swap, as peer clocks are not
+// synchronized.
+const size_t MAX_PENDING_ARRIVALS = 4096;
+
+bool showPerfHud = false;
+RollingHistogram frameTimes;
+RollingHistogram inputLatency;
+RollingHistogram remoteLatency;
+// Time from queueing to the socket taking the last byte, per lane over
+// every peer; guarded by peersMutex
+RollingHistogram laneWait[LANE_COUNT];
+TrafficCounters traffic;
+TrafficRates trafficPerSecond = {0, 0, 0, 0};
+uint64_t trafficAtWindow[4] = {0, 0, 0, 0};
+double perfWindowStartMs = 0;
+std::vector<double> flushedSampleTimes; // Motion samples in this frame
+std::atomic<size_t> receiveQueueBytes(0);
+std::atomic<size_t> sendQueueBytes(0);
+
+struct RemoteArrival
+{
+    double timeMs; // Applied to the board
+    uint32_t author, seq;
 };
 
-std::vector<Board> boards;
-int currentBoardIndex = 0;
-std::vector<Stroke> strokes;
-Stroke currentStroke;
+std::vector<RemoteArrival> remoteArrivals; // Not drawn yet; guarded by strokesMutex
+std::vector<RemoteArrival> drawnArrivals;  // Drawn in this frame
+
+// Stroke latency tracing, written out with 't'; see latency_trace.h
+const char *STROKE_TRACE_PATH = "stroke_trace.json";
+const int CLOCK_PROBE_INTERVAL_MS = 1000;
+
+SpanRing strokeSpans;
+double strokeStartMs = 0; // Mouse-down of the stroke being drawn
+double lastReceiveMs = 0; // When recv returned the bytes being parsed
+
+int64_t msToUs(double ms)
+{
+    return static_cast<int64_t>(ms * 1000.0);
+}
 
 typedef struct
 {
@@ -115,213 +349,786 @@ typedef struct
     std::function<void()> callbackFunction;
 } Button;
 
-void setPencilTool()
+// Frame scheduler: redraw requests from anywhere (including the network
+// thread) only set a flag; a GLUT timer turns them into at most one
+// display() per frame interval, and keeps ticking only while something
+// is animating or in the background, or remote changes keep coming. An
+// open session with nothing changed for IDLE_AFTER_MS is polled every
+// IDLE_POLL_MS.
+const int FRAME_INTERVAL_MS = 16;
+const int IDLE_POLL_MS = 100;
+const int IDLE_AFTER_MS = 500;
+
+std::atomic<bool> redrawRequested(false);
+bool frameTimerArmed = false;
+int frameTimerId = 0; // Of the newest timer; an idle poll a frame replaced is ignored
+bool sidebarsAnimating = false;
+std::thread::id mainThreadId;
+std::chrono::steady_clock::time_point lastFrameTime;
+std::chrono::steady_clock::time_point lastTickTime;
+std::chrono::steady_clock::time_point lastChangeTime;
+std::chrono::steady_clock::time_point lastAnimationTime;
+
+float elapsedMsSince(std::chrono::steady_clock::time_point start)
 {
-    tool = 1;
-    selectedBottomTool = 0;
-    glutPostRedisplay();
+    return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
 }
 
-void setEraserTool()
+const std::chrono::steady_clock::time_point appStartTime = std::chrono::steady_clock::now();
+
+double nowMs()
 {
-    tool = 2;
-    selectedBottomTool = 1;
-    glutPostRedisplay();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - appStartTime).count();
 }
 
-void setCircleTool()
+// Input recording (-record <trace>) and replay (-replay <trace>, or
+// -replay-realtime <trace> to keep the recorded pace); see input_trace.h
+TraceWriter traceWriter;
+bool recordingTrace = false;
+double traceStartMs = 0;
+const char *recordPath = NULL;
+const char *replayPath = NULL;
+bool replayRealtime = false;
+std::vector<TraceEvent> replayEvents;
+
+void recordEvent(TraceEventType type, int a0, int a1 = 0, int a2 = 0, int a3 = 0)
 {
-    tool = 3;
+    if (recordingTrace)
+    {
+        TraceEvent event;
+        event.type = type;
+        event.timeMs = nowMs() - traceStartMs;
+        event.args[0] = a0;
+        event.args[1] = a1;
+        event.args[2] = a2;
+        event.args[3] = a3;
+        traceAppend(traceWriter, event);
+    }
 }
 
-void setSquareTool()
+void recordMessage(const std::string &message)
 {
-    tool = 4;
+    if (recordingTrace)
+    {
+        TraceEvent event;
+        event.type = TRACE_NETWORK;
+        event.timeMs = nowMs() - traceStartMs;
+        event.text.assign(message, 0, message.find('\n'));
+        traceAppend(traceWriter, event);
+    }
 }
 
-void clearScreen()
+void releaseCompactionTiles()
 {
-    strokes.clear();
-    glutPostRedisplay();
+    for (size_t t = 0; t < compaction.tiles.size(); t++)
+    {
+        if (compaction.tiles[t].texture)
+        {
+            glDeleteTextures(1, &compaction.tiles[t].texture);
+        }
+    }
 }
 
-static bool canAdjustSize = true;
-const int COOLDOWN_MS = 200;
+// Every stroke goes back to being drawn as a vector
+// The caller holds strokesMutex
+void resetCompaction()
+{
+    releaseCompactionTiles();
+    compaction = Compaction();
+    boardEpoch++;
+    flattenCheckedSize = 0;
+}
 
-void resetSizeAdjustFlag(int value)
+void discardCompaction()
 {
-    canAdjustSize = true;
+    std::lock_guard<std::mutex> lock(strokesMutex);
+    resetCompaction();
 }
 
-void increasePointSize()
+void runCompaction(std::vector<Stroke> snapshot)
 {
-    if (canAdjustSize && pointSize < 50)
+    Compaction result;
+    if (!compactStrokes(snapshot, result))
     {
-        pointSize++;
-        canAdjustSize = false;
-        glutTimerFunc(COOLDOWN_MS, resetSizeAdjustFlag, 0);
-        glutPostRedisplay();
+        result = Compaction();
     }
+    std::lock_guard<std::mutex> lock(compactionMutex);
+    finishedCompaction = std::move(result);
+    compactionFinished = true;
 }
 
-void decreasePointSize()
+// Installs a finished pass, or starts one once enough strokes were added
+void updateCompaction(bool force)
 {
-    if (canAdjustSize && pointSize > 1)
+    if (compactionRunning)
     {
-        pointSize--;
-        canAdjustSize = false;
-        glutTimerFunc(COOLDOWN_MS, resetSizeAdjustFlag, 0);
-        glutPostRedisplay();
+        std::lock_guard<std::mutex> lock(compactionMutex);
+        if (!compactionFinished)
+        {
+            return;
+        }
+        compactionFinished = false;
+        compactionRunning = false;
+        if (compactionEpoch == boardEpoch && finishedCompaction.strokeCount > 0)
+        {
+            std::lock_guard<std::mutex> strokesLock(strokesMutex);
+            releaseCompactionTiles();
+            compaction = std::move(finishedCompaction);
+            const CompactionStats &stats = compaction.stats;
+            std::cout << "Compaction: " << stats.segments << " -> " << stats.segments - stats.flattenedSegments
+                      << " segments drawn, " << stats.flattenedStrokes << " strokes in "
+                      << compaction.tiles.size() << " tiles, " << stats.ms << " ms\n";
+            redrawRequested = true;
+        }
+        return;
     }
+
+    std::vector<Stroke> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(strokesMutex);
+        if (strokes.size() < compaction.strokeCount + (force ? 1 : COMPACTION_INTERVAL_STROKES))
+        {
+            return;
+        }
+        snapshot = strokes;
+    }
+    if (compactionThread.joinable())
+    {
+        compactionThread.join();
+    }
+    compactionRunning = true;
+    compactionEpoch = boardEpoch;
+    compactionThread = std::thread(runCompaction, std::move(snapshot));
 }
 
-void undoLastStroke()
+// Textures are made again on the next draw
+void releaseBoardTiles(Board &board)
 {
-    if (!strokes.empty())
+    for (size_t t = 0; t < board.tiles.size(); t++)
     {
-        strokes.pop_back();
-        glutPostRedisplay();
+        if (board.tiles[t].texture)
+        {
+            glDeleteTextures(1, &board.tiles[t].texture);
+            board.tiles[t].texture = 0;
+        }
     }
 }
 
-void deleteCurrentBoard()
+void releaseClearedTiles()
 {
-    if (boards.size() == 1)
+    std::lock_guard<std::mutex> lock(strokesMutex);
+    for (size_t t = 0; t < clearedTiles.size(); t++)
     {
-        clearScreen();
-        return;
+        if (clearedTiles[t].texture)
+        {
+            glDeleteTextures(1, &clearedTiles[t].texture);
+        }
     }
+    clearedTiles.clear();
+}
+
+void runFlatten(std::vector<RasterTile> tiles, std::vector<Stroke> prefix)
+{
+    flattenStrokes(tiles, prefix, prefix.size());
+    std::lock_guard<std::mutex> lock(compactionMutex);
+    flattenedTiles.swap(tiles);
+    flattenFinished = true;
+}
 
-    std::vector<Board> tempBoards;
-    for (int i = 0; i < static_cast<int>(boards.size()); i++) // Cast to int
+// Installs finished tiles, or starts a pass once the board is over budget.
+// Tiles are only installed if no stroke they cover changed meanwhile.
+void updateFlattening()
+{
+    if (flattenRunning)
     {
-        if (i != currentBoardIndex)
+        std::vector<RasterTile> tiles;
+        {
+            std::lock_guard<std::mutex> lock(compactionMutex);
+            if (!flattenFinished)
+            {
+                return;
+            }
+            flattenFinished = false;
+            flattenRunning = false;
+            tiles.swap(flattenedTiles);
+        }
         {
-            tempBoards.push_back(boards[i]);
+            std::lock_guard<std::mutex> lock(strokesMutex);
+            if (flattenEpoch != boardEpoch || flattenOps != strokeOpCount)
+            {
+                return;
+            }
+            Board &board = boards[currentBoardIndex];
+            releaseBoardTiles(board);
+            for (size_t t = 0; t < tiles.size(); t++)
+            {
+                tiles[t].texture = 0;
+            }
+            board.tiles.swap(tiles);
+            strokes.erase(strokes.begin(), strokes.begin() + flattenCount);
+            indexStrokes(strokeIndex, strokes);
+            journalFlatten(journal, currentBoardIndex, flattenCount);
         }
+        discardCompaction();
+        std::cout << "Flattened " << flattenCount << " strokes into " << boards[currentBoardIndex].tiles.size()
+                  << " tiles (" << tilesBytes(boards[currentBoardIndex].tiles) / 1024 << " KB)\n";
+        redrawRequested = true;
+        return;
     }
 
-    boards = tempBoards;
-    currentBoardIndex = std::max(0, currentBoardIndex - 1);
-    strokes = boards[currentBoardIndex].strokes;
-    pointSize = boards[currentBoardIndex].pointSize;
-    memcpy(currentColor, boards[currentBoardIndex].currentColor, sizeof(float) * 3);
-    tool = boards[currentBoardIndex].tool;
-    totalContentHeight = (boards.size() * (THUMBNAIL_HEIGHT + 30)) + 35;
-    glutPostRedisplay();
+    std::vector<Stroke> prefix;
+    {
+        std::lock_guard<std::mutex> lock(strokesMutex);
+        if (strokes.size() == flattenCheckedSize)
+        {
+            return;
+        }
+        flattenCheckedSize = strokes.size();
+        flattenCount = strokesOverBudget(strokes, segmentBudget);
+        if (flattenCount == 0)
+        {
+            return;
+        }
+        prefix.assign(strokes.begin(), strokes.begin() + flattenCount);
+    }
+    if (flattenThread.joinable())
+    {
+        flattenThread.join();
+    }
+    flattenRunning = true;
+    flattenEpoch = boardEpoch;
+    flattenOps = strokeOpCount;
+    flattenThread = std::thread(runFlatten, boards[currentBoardIndex].tiles, std::move(prefix));
 }
 
-void drawText(int x, int y, const char *text)
+// Waits for compaction and flattening and installs what they produced
+void finishBackgroundPasses()
 {
-    glRasterPos2i(x, y);
-    while (*text)
+    while (compactionRunning || flattenRunning)
     {
-        glutBitmapCharacter(GLUT_BITMAP_HELVETICA_12, *text++);
+        if (compactionThread.joinable())
+        {
+            compactionThread.join();
+        }
+        if (flattenThread.joinable())
+        {
+            flattenThread.join();
+        }
+        updateCompaction(false);
+        updateFlattening();
     }
 }
 
-// Define predefined colors
-const float predefinedColors[][3] = {
-    {1.0f, 0.0f, 0.0f}, // Red
-    {0.0f, 1.0f, 0.0f}, // Green
-    {0.0f, 0.0f, 1.0f}, // Blue
-    {1.0f, 1.0f, 0.0f}, // Yellow
-    {1.0f, 0.0f, 1.0f}, // Magenta
-    {0.0f, 1.0f, 1.0f}  // Cyan
-};
-
-const int NUM_PREDEFINED_COLORS = sizeof(predefinedColors) / sizeof(predefinedColors[0]);
+void frameTick(int);
 
-// Function to handle color button clicks
-void setColorFromPalette(int index)
+void scheduleFrame()
 {
-    if (index >= 0 && index < NUM_PREDEFINED_COLORS)
+    if (frameTimerArmed)
     {
-        memcpy(currentColor, predefinedColors[index], sizeof(float) * 3);
-        glutPostRedisplay();
+        return;
     }
+
+    // From the last tick too, or ticks with nothing to draw would not wait
+    int delay = FRAME_INTERVAL_MS - static_cast<int>(elapsedMsSince(std::max(lastFrameTime, lastTickTime)));
+    frameTimerArmed = true;
+    glutTimerFunc(std::max(0, delay), frameTick, ++frameTimerId);
 }
 
-// Add color buttons to the buttons array
-Button colorButtons[NUM_PREDEFINED_COLORS];
+// GLUT timers cannot be cancelled, so a frame scheduled meanwhile makes
+// this one stale instead
+void scheduleIdlePoll()
+{
+    glutTimerFunc(IDLE_POLL_MS, frameTick, ++frameTimerId);
+}
 
-void initColorButtons()
+// Background work and animation for one frame; true if it needs drawing
+bool advanceFrame(float animationMs)
 {
-    for (int i = 0; i < NUM_PREDEFINED_COLORS; i++)
+    if (journalCheckpointDue(journal))
     {
-        colorButtons[i] = {10, 320 + i * 30, 100, 25, "", []() {}};
-        colorButtons[i].callbackFunction = [i]()
-        { setColorFromPalette(i); };
+        startCheckpoint();
     }
-}
-
-Button buttons[] =
+    if (compactionStale.exchange(false))
     {
-        {10, 10, 100, 25, "<<", toggleSidebar},
-        {10, 40, 100, 25, "PENCIL (P)", setPencilTool},
-        {10, 80, 100, 25, "ERASER (E)", setEraserTool},
-        {10, 120, 100, 25, "CIRCLE (C)", setCircleTool},
-        {10, 160, 100, 25, "SQUARE (S)", setSquareTool},
-        {10, 200, 100, 25, "UNDO (U)", undoLastStroke},
-        {10, 240, 100, 25, "CLEAR", clearScreen},
-        {30, 280, 30, 25, "+", increasePointSize},
-        {70, 280, 30, 25, "-", decreasePointSize},
-        {windowWidth - RIGHT_SIDEBAR_WIDTH + 10, 10, 100, 25, "<", toggleRightSidebar}};
-int numButtons = 10;
+        discardCompaction();
+        releaseClearedTiles();
+    }
+    updateCompaction(false);
+    updateFlattening();
 
-Button bottomButtons[] =
+    if (sidebarsAnimating)
     {
-        {0, 0, BOTTOM_BUTTON_SIZE, BOTTOM_BUTTON_SIZE, "", setPencilTool},
-        {0, 0, BOTTOM_BUTTON_SIZE, BOTTOM_BUTTON_SIZE, "", setEraserTool},
-        {0, 0, BOTTOM_BUTTON_SIZE, BOTTOM_BUTTON_SIZE, "", clearScreen},
-        {0, 0, BOTTOM_BUTTON_SIZE, BOTTOM_BUTTON_SIZE, "", deleteCurrentBoard}};
-const int NUM_BOTTOM_BUTTONS = 4;
+        sidebarsAnimating = animateSidebars(animationMs);
+        redrawRequested = true;
+    }
+    return redrawRequested.exchange(false);
+}
 
-void drawRotatedClearButtonIcon(Button *b)
+// Segment counts and memory of every board for the metrics endpoint. Only
+// the current board changes, so the others are cheap to count: packed
+// boards keep their count and paged ones have it in the session index.
+void updateBoardMetrics()
 {
-    glPushMatrix();
-    glTranslatef(b->x + 20, b->y + 20, 0);
-    glRotatef(45.0f, 0, 0, 1);
-    glTranslatef(-(b->x + 20), -(b->y + 20), 0);
+    std::stringstream segments, bytes;
+    for (size_t i = 0; i < boards.size(); i++)
+    {
+        const Board &board = boards[i];
+        std::string labels = metricLabel("board", toString(i + 1)) + "," + metricLabel("name", board.name);
+        uint64_t lineCount = 0;
+        size_t residentBytes = tilesBytes(board.tiles) + board.packed.capacity();
+        if (static_cast<int>(i) == currentBoardIndex)
+        {
+            std::lock_guard<std::mutex> lock(strokesMutex);
+            for (size_t s = 0; s < strokes.size(); s++)
+            {
+                lineCount += strokes[s].lines.size();
+            }
+            residentBytes += strokesBytes(strokes);
+        }
+        else if (board.pagedIndex >= 0)
+        {
+            lineCount = boardLineCount(sessionFile, board.pagedIndex);
+        }
+        else if (!board.packed.empty())
+        {
+            lineCount = packedSegmentCount(board.packed);
+        }
+        else
+        {
+            const std::vector<Stroke> &list = boardStrokes(board);
+            for (size_t s = 0; s < list.size(); s++)
+            {
+                lineCount += list[s].lines.size();
+            }
+            residentBytes += strokesBytes(list);
+        }
+        metricSample(segments, "instantboard_board_segments", labels, lineCount);
+        metricSample(bytes, "instantboard_board_resident_bytes", labels, residentBytes);
+    }
 
-    glBegin(GL_TRIANGLES);
-    glVertex2i(b->x + 10, b->y + 30);
-    glVertex2i(b->x + 30, b->y + 30);
-    glVertex2i(b->x + 20, b->y + 10);
-    glEnd();
+    std::stringstream out;
+    metricFamily(out, "instantboard_boards", "gauge", "Boards in the session");
+    metricSample(out, "instantboard_boards", "", boards.size());
+    metricFamily(out, "instantboard_board_segments", "gauge", "Line segments per board, not counting flattened strokes");
+    out << segments.str();
+    metricFamily(out, "instantboard_board_resident_bytes", "gauge", "Memory held by a board's strokes and tiles");
+    out << bytes.str();
 
-    glBegin(GL_LINES);
-    glVertex2i(b->x + 16, b->y + 10);
-    glVertex2i(b->x + 24, b->y + 10);
-    glEnd();
+    std::lock_guard<std::mutex> lock(metricsMutex);
+    boardMetricsText = out.str();
+    boardMetricsMs = nowMs();
+}
 
-    glColor3f(1.0, 1.0, 1.0);
-    glBegin(GL_LINES);
-    glVertex2i(b->x + 14, b->y + 20);
-    glVertex2i(b->x + 18, b->y + 20);
-    glVertex2i(b->x + 22, b->y + 20);
-    glVertex2i(b->x + 26, b->y + 20);
-    glEnd();
+void frameTick(int timerId)
+{
+    if (timerId != frameTimerId)
+    {
+        return;
+    }
+    frameTimerArmed = false;
+    lastTickTime = std::chrono::steady_clock::now();
+    float animationMs = 0;
+    if (sidebarsAnimating)
+    {
+        animationMs = std::min(elapsedMsSince(lastAnimationTime), 100.0f);
+        lastAnimationTime = std::chrono::steady_clock::now();
+    }
+    recordEvent(TRACE_FRAME, static_cast<int>(animationMs * 1000.0f));
+    if (isHost && nowMs() - boardMetricsMs >= BOARD_METRICS_INTERVAL_MS)
+    {
+        updateBoardMetrics();
+    }
 
-    glPopMatrix();
+    if (advanceFrame(animationMs))
+    {
+        glutPostRedisplay();
+        lastChangeTime = std::chrono::steady_clock::now();
+    }
+
+    // Remote strokes and compaction can only raise the flag, so keep
+    // polling: every frame while there is work or changes are coming in,
+    // else slowly while a session is open
+    bool active = elapsedMsSince(lastChangeTime) < IDLE_AFTER_MS;
+    if (sidebarsAnimating || compactionRunning || flattenRunning || ((isHost || isClient) && active))
+    {
+        scheduleFrame();
+    }
+    else if (isHost || isClient)
+    {
+        scheduleIdlePoll();
+    }
 }
 
-void drawIcon(Button *b, int iconType)
+void requestRedraw()
 {
-    glColor3f(0.0, 0.0, 0.0);
-    glLineWidth(2.0);
-
-    switch (iconType)
+    redrawRequested = true;
+    if (std::this_thread::get_id() == mainThreadId)
     {
-    case 0:
-        glBegin(GL_QUADS);
-        glVertex2i(b->x + 16, b->y + 12);
-        glVertex2i(b->x + 24, b->y + 12);
-        glVertex2i(b->x + 24, b->y + 28);
-        glVertex2i(b->x + 16, b->y + 28);
-        glEnd();
+        scheduleFrame();
+    }
+}
 
-        glBegin(GL_TRIANGLES);
+void startSidebarAnimation()
+{
+    if (!sidebarsAnimating)
+    {
+        sidebarsAnimating = true;
+        lastAnimationTime = std::chrono::steady_clock::now();
+    }
+    requestRedraw();
+}
+
+void setPencilTool()
+{
+    tool = 1;
+    selectedBottomTool = 0;
+    requestRedraw();
+}
+
+void setEraserTool()
+{
+    tool = 2;
+    selectedBottomTool = 1;
+    requestRedraw();
+}
+
+void setCircleTool()
+{
+    tool = 3;
+    requestRedraw();
+}
+
+void setSquareTool()
+{
+    tool = 4;
+    requestRedraw();
+}
+
+static bool canAdjustSize = true;
+const int COOLDOWN_MS = 200;
+
+void resetSizeAdjustFlag(int value)
+{
+    canAdjustSize = true;
+}
+
+void increasePointSize()
+{
+    if (canAdjustSize && pointSize < 50)
+    {
+        pointSize++;
+        canAdjustSize = false;
+        glutTimerFunc(COOLDOWN_MS, resetSizeAdjustFlag, 0);
+        requestRedraw();
+    }
+}
+
+void decreasePointSize()
+{
+    if (canAdjustSize && pointSize > 1)
+    {
+        pointSize--;
+        canAdjustSize = false;
+        glutTimerFunc(COOLDOWN_MS, resetSizeAdjustFlag, 0);
+        requestRedraw();
+    }
+}
+
+// Stamp for a stroke or clear made here; the caller holds strokesMutex
+uint64_t nextStrokeStamp()
+{
+    uint64_t wallMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          std::chrono::system_clock::now().time_since_epoch()).count();
+    strokeClock = std::max(strokeClock + 1, wallMs);
+    return strokeClock;
+}
+
+// Adds a stroke drawn here to the current board and replicates it
+void commitLocalStroke(Stroke &stroke)
+{
+    double commitMs = nowMs();
+    stroke.author = localAuthor;
+    stroke.seq = nextStrokeSeq++;
+    stroke.removed = false;
+    {
+        std::lock_guard<std::mutex> lock(strokesMutex);
+        stroke.stamp = nextStrokeStamp();
+        markStrokeSeen(strokesSeen, stroke.author, stroke.seq);
+        strokes.push_back(stroke);
+        indexLastStroke(strokeIndex, strokes);
+        journalAddStroke(journal, currentBoardIndex, stroke);
+    }
+    historyRecord(histories[currentBoardIndex], stroke.seq);
+    sendStroke(stroke, commitMs);
+}
+
+// Tombstones or revives a stroke of the current board; the caller holds
+// strokesMutex. Returns false if the stroke is not there.
+bool setStrokeRemoved(uint32_t author, uint32_t seq, bool removed)
+{
+    Stroke *stroke = findStroke(strokes, strokeIndex, author, seq);
+    if (!stroke || stroke->removed == removed)
+    {
+        return false;
+    }
+    stroke->removed = removed;
+    strokeOpCount++;
+    size_t index = stroke - &strokes[0];
+    if (index < compaction.strokeCount && compaction.flattened[index])
+    {
+        compactionStale = true;
+    }
+    journalStrokeOp(journal, removed ? JOURNAL_UNDO : JOURNAL_REDO, currentBoardIndex, author, seq);
+    return true;
+}
+
+// Puts a remote stroke where it stacks on the current board; the caller
+// holds strokesMutex. One drawn concurrently with strokes here goes under
+// some of them, which moves them up a place: the compaction is kept lined
+// up with them until it is redone, and a flattening pass that counted
+// them is dropped.
+void stackRemoteStroke(const Stroke &stroke)
+{
+    strokeClock = std::max(strokeClock, stroke.stamp);
+    size_t index = insertStroke(strokes, strokeIndex, stroke);
+    if (index + 1 == strokes.size())
+    {
+        return;
+    }
+    if (index < compaction.strokeCount)
+    {
+        compaction.flattened.insert(compaction.flattened.begin() + index, 0);
+        compaction.strokeCount++;
+    }
+    compactionStale = true;
+    strokeOpCount++;
+}
+
+// Whether a stroke stacks below the newest clear applied to the current
+// board, so arrived too late to show; the caller holds strokesMutex
+bool clearedAway(const Stroke &stroke)
+{
+    const Board &board = boards[currentBoardIndex];
+    Stroke clear = Stroke();
+    clear.author = board.clearAuthor;
+    clear.stamp = board.clearStamp;
+    return stackedBelow(stroke, clear);
+}
+
+// Drops the strokes of the current board stacked below a clear, and its
+// tiles, which hold the oldest strokes; the caller holds strokesMutex.
+// Strokes drawn concurrently elsewhere and stamped above the clear stay.
+// The compaction is kept lined up with the strokes until it is redone.
+void applyClear(uint32_t author, uint64_t stamp)
+{
+    Stroke clear = Stroke();
+    clear.author = author;
+    clear.stamp = stamp;
+    size_t count = clearBelow(strokes, strokeIndex, clear);
+
+    Board &board = boards[currentBoardIndex];
+    if (!clearedAway(clear))
+    {
+        board.clearStamp = stamp;
+        board.clearAuthor = author;
+    }
+    clearedTiles.insert(clearedTiles.end(), board.tiles.begin(), board.tiles.end());
+    board.tiles.clear();
+
+    size_t flattened = std::min(count, compaction.strokeCount);
+    compaction.flattened.erase(compaction.flattened.begin(), compaction.flattened.begin() + flattened);
+    compaction.strokeCount -= flattened;
+    compactionStale = true;
+    strokeOpCount++;
+    journalClear(journal, currentBoardIndex, count);
+}
+
+// Clears the current board and sends the clear, which takes the id and
+// stamp of a stroke so peers stack it and drop repeats the same way
+void clearScreen()
+{
+    uint32_t seq = nextStrokeSeq++;
+    uint64_t stamp;
+    {
+        std::lock_guard<std::mutex> lock(strokesMutex);
+        stamp = nextStrokeStamp();
+        markStrokeSeen(strokesSeen, localAuthor, seq);
+        applyClear(localAuthor, stamp);
+    }
+    discardCompaction();
+    releaseClearedTiles();
+    historyClear(histories[currentBoardIndex]);
+    sendClear(localAuthor, seq, stamp);
+    requestRedraw();
+}
+
+// History entries whose stroke was cleared away are skipped
+void undoLastStroke()
+{
+    uint32_t seq;
+    while (historyUndo(histories[currentBoardIndex], seq))
+    {
+        std::lock_guard<std::mutex> lock(strokesMutex);
+        if (setStrokeRemoved(localAuthor, seq, true))
+        {
+            sendStrokeOp('U', localAuthor, seq);
+            requestRedraw();
+            return;
+        }
+    }
+}
+
+void redoLastStroke()
+{
+    uint32_t seq;
+    while (historyRedo(histories[currentBoardIndex], seq))
+    {
+        std::lock_guard<std::mutex> lock(strokesMutex);
+        if (setStrokeRemoved(localAuthor, seq, false))
+        {
+            sendStrokeOp('R', localAuthor, seq);
+            requestRedraw();
+            return;
+        }
+    }
+}
+
+void deleteCurrentBoard()
+{
+    if (boards.size() == 1)
+    {
+        clearScreen();
+        return;
+    }
+
+    historyClear(histories[currentBoardIndex]);
+    histories.erase(histories.begin() + currentBoardIndex);
+    {
+        // Held until the next board is in strokes; see storeCurrentBoard
+        std::lock_guard<std::mutex> lock(strokesMutex);
+        releaseBoardTiles(boards[currentBoardIndex]);
+        journalBoardOp(journal, JOURNAL_DELETE_BOARD, currentBoardIndex);
+        deleteBoard(boards, currentBoardIndex, strokes, strokeIndex, sessionFile);
+        resetCompaction();
+    }
+    pointSize = boards[currentBoardIndex].pointSize;
+    memcpy(currentColor, boards[currentBoardIndex].currentColor, sizeof(float) * 3);
+    tool = boards[currentBoardIndex].tool;
+    totalContentHeight = (boards.size() * (THUMBNAIL_HEIGHT + 30)) + 35;
+    requestRedraw();
+}
+
+void drawText(int x, int y, const char *text)
+{
+    glRasterPos2i(x, y);
+    while (*text)
+    {
+        glutBitmapCharacter(GLUT_BITMAP_HELVETICA_12, *text++);
+    }
+}
+
+// Define predefined colors
+const float predefinedColors[][3] = {
+    {1.0f, 0.0f, 0.0f}, // Red
+    {0.0f, 1.0f, 0.0f}, // Green
+    {0.0f, 0.0f, 1.0f}, // Blue
+    {1.0f, 1.0f, 0.0f}, // Yellow
+    {1.0f, 0.0f, 1.0f}, // Magenta
+    {0.0f, 1.0f, 1.0f}  // Cyan
+};
+
+const int NUM_PREDEFINED_COLORS = sizeof(predefinedColors) / sizeof(predefinedColors[0]);
+
+// Function to handle color button clicks
+void setColorFromPalette(int index)
+{
+    if (index >= 0 && index < NUM_PREDEFINED_COLORS)
+    {
+        memcpy(currentColor, predefinedColors[index], sizeof(float) * 3);
+        requestRedraw();
+    }
+}
+
+// Add color buttons to the buttons array
+Button colorButtons[NUM_PREDEFINED_COLORS];
+
+void initColorButtons()
+{
+    for (int i = 0; i < NUM_PREDEFINED_COLORS; i++)
+    {
+        colorButtons[i] = {10, 320 + i * 30, 100, 25, "", []() {}};
+        colorButtons[i].callbackFunction = [i]()
+        { setColorFromPalette(i); };
+    }
+}
+
+Button buttons[] =
+    {
+        {10, 10, 100, 25, "<<", toggleSidebar},
+        {10, 40, 100, 25, "PENCIL (P)", setPencilTool},
+        {10, 80, 100, 25, "ERASER (E)", setEraserTool},
+        {10, 120, 100, 25, "CIRCLE (C)", setCircleTool},
+        {10, 160, 100, 25, "SQUARE (S)", setSquareTool},
+        {10, 200, 100, 25, "UNDO (U)", undoLastStroke},
+        {10, 240, 100, 25, "CLEAR", clearScreen},
+        {30, 280, 30, 25, "+", increasePointSize},
+        {70, 280, 30, 25, "-", decreasePointSize},
+        {windowWidth - RIGHT_SIDEBAR_WIDTH + 10, 10, 100, 25, "<", toggleRightSidebar}};
+int numButtons = 10;
+
+Button bottomButtons[] =
+    {
+        {0, 0, BOTTOM_BUTTON_SIZE, BOTTOM_BUTTON_SIZE, "", setPencilTool},
+        {0, 0, BOTTOM_BUTTON_SIZE, BOTTOM_BUTTON_SIZE, "", setEraserTool},
+        {0, 0, BOTTOM_BUTTON_SIZE, BOTTOM_BUTTON_SIZE, "", clearScreen},
+        {0, 0, BOTTOM_BUTTON_SIZE, BOTTOM_BUTTON_SIZE, "", deleteCurrentBoard}};
+const int NUM_BOTTOM_BUTTONS = 4;
+
+void drawRotatedClearButtonIcon(Button *b)
+{
+    glPushMatrix();
+    glTranslatef(b->x + 20, b->y + 20, 0);
+    glRotatef(45.0f, 0, 0, 1);
+    glTranslatef(-(b->x + 20), -(b->y + 20), 0);
+
+    glBegin(GL_TRIANGLES);
+    glVertex2i(b->x + 10, b->y + 30);
+    glVertex2i(b->x + 30, b->y + 30);
+    glVertex2i(b->x + 20, b->y + 10);
+    glEnd();
+
+    glBegin(GL_LINES);
+    glVertex2i(b->x + 16, b->y + 10);
+    glVertex2i(b->x + 24, b->y + 10);
+    glEnd();
+
+    glColor3f(1.0, 1.0, 1.0);
+    glBegin(GL_LINES);
+    glVertex2i(b->x + 14, b->y + 20);
+    glVertex2i(b->x + 18, b->y + 20);
+    glVertex2i(b->x + 22, b->y + 20);
+    glVertex2i(b->x + 26, b->y + 20);
+    glEnd();
+
+    glPopMatrix();
+}
+
+void drawIcon(Button *b, int iconType)
+{
+    glColor3f(0.0, 0.0, 0.0);
+    glLineWidth(2.0);
+
+    switch (iconType)
+    {
+    case 0:
+        glBegin(GL_QUADS);
+        glVertex2i(b->x + 16, b->y + 12);
+        glVertex2i(b->x + 24, b->y + 12);
+        glVertex2i(b->x + 24, b->y + 28);
+        glVertex2i(b->x + 16, b->y + 28);
+        glEnd();
+
+        glBegin(GL_TRIANGLES);
         glVertex2i(b->x + 16, b->y + 12);
         glVertex2i(b->x + 20, b->y + 4);
         glVertex2i(b->x + 24, b->y + 12);
@@ -488,52 +1295,72 @@ void updateBottomButtonPositions()
 
 Button smallToggleButton = {5, 10, 30, 25, ">", toggleSidebar};
 
-void createNewBoard()
+// Hands the strokes and settings of the current board back to it before
+// another board is shown. The caller holds strokesMutex until the next
+// board is in strokes, so the network thread never adds a stroke, or
+// journals one, while strokes and currentBoardIndex disagree.
+void storeCurrentBoard()
 {
-    if (boards.size() >= 5)
-    {
-        return;
-    }
+    Board &board = boards[currentBoardIndex];
+    storeBoard(board, strokes, strokeIndex, ++boardSwitches);
+    board.pointSize = pointSize;
+    memcpy(board.currentColor, currentColor, sizeof(float) * 3);
+    board.tool = tool;
+    releaseBoardTiles(board);
+}
 
+void createNewBoard()
+{
+    std::unique_lock<std::mutex> lock(strokesMutex);
     if (!boards.empty())
     {
-        boards[currentBoardIndex].strokes = strokes;
-        boards[currentBoardIndex].pointSize = pointSize;
-        memcpy(boards[currentBoardIndex].currentColor, currentColor, sizeof(float) * 3);
-        boards[currentBoardIndex].tool = tool;
+        storeCurrentBoard();
     }
 
     Board newBoard;
-    newBoard.name = "Board " + toString(boards.size() + 1) + "/5";
+    newBoard.name = "Board " + toString(boards.size() + 1);
     newBoard.pointSize = 2;
     newBoard.tool = 1;
     newBoard.strokes.clear();
+    newBoard.pagedIndex = -1;
+    newBoard.lastUsed = boardSwitches;
+    newBoard.clearStamp = 0;
+    newBoard.clearAuthor = 0;
     memcpy(newBoard.currentColor, currentColor, sizeof(float) * 3);
 
     boards.push_back(newBoard);
+    journalCreateBoard(journal, newBoard.name);
+    History history;
+    historyInit(history, historyLimitBytes);
+    histories.push_back(history);
     currentBoardIndex = boards.size() - 1;
-    strokes.clear();
-    glutPostRedisplay();
+    resetCompaction();
+    lock.unlock();
+    evictBoards(boards, currentBoardIndex, strokes, boardMemoryBudget);
+    requestRedraw();
 }
 
 void switchToBoard(int index)
 {
-    if (index >= 0 && index < static_cast<int>(boards.size())) // Cast to int
+    if (index >= 0 && index < static_cast<int>(boards.size()) && index != currentBoardIndex) // Cast to int
     {
-        if (!boards.empty())
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
         {
-            boards[currentBoardIndex].strokes = strokes;
-            boards[currentBoardIndex].pointSize = pointSize;
-            memcpy(boards[currentBoardIndex].currentColor, currentColor, sizeof(float) * 3);
-            boards[currentBoardIndex].tool = tool;
+            std::lock_guard<std::mutex> lock(strokesMutex);
+            storeCurrentBoard();
+            currentBoardIndex = index;
+            journalBoardOp(journal, JOURNAL_SELECT_BOARD, index);
+            showBoard(boards, index, strokes, strokeIndex, sessionFile);
+            resetCompaction();
         }
-
-        currentBoardIndex = index;
-        strokes = boards[index].strokes;
         pointSize = boards[index].pointSize;
         memcpy(currentColor, boards[index].currentColor, sizeof(float) * 3);
         tool = boards[index].tool;
-        glutPostRedisplay();
+        evictBoards(boards, currentBoardIndex, strokes, boardMemoryBudget);
+        std::cout << "Board " << index + 1 << ": switched in " << elapsedMsSince(start) << " ms, "
+                  << residentBoardBytes(boards, strokes) / 1024 << " KB of " << boardMemoryBudget / 1024
+                  << " KB resident\n";
+        requestRedraw();
     }
 }
 
@@ -566,7 +1393,7 @@ void drawBoardThumbnail(int index, int x, int y)
     glEnd();
 
     glColor3f(1.0, 1.0, 1.0);
-    std::string boardName = "Board " + toString(index + 1) + "/5";
+    std::string boardName = "Board " + toString(index + 1);
     drawText(x + 5, y + THUMBNAIL_HEIGHT + 15, boardName.c_str());
 }
 // Add the handleColorGridClick function
@@ -588,7 +1415,7 @@ void handleColorGridClick(int x, int y) {
                 y >= squareY && y <= squareY + COLOR_SQUARE_SIZE) {
                 // Set the current color to the color of the clicked square
                 memcpy(currentColor, predefinedColors[index], sizeof(float) * 3);
-                glutPostRedisplay(); // Redraw the screen to reflect the new color
+                requestRedraw(); // Redraw the screen to reflect the new color
                 return;
             }
         }
@@ -611,65 +1438,55 @@ void handleBoardClick(int x, int y)
         yOffset += THUMBNAIL_HEIGHT + 30;
     }
 
-    if (boards.size() < 5)
+    if (y >= yOffset && y <= yOffset + 25 &&
+        x >= windowWidth - RIGHT_SIDEBAR_WIDTH + 10 + rightSidebarPosition &&
+        x <= windowWidth - RIGHT_SIDEBAR_WIDTH + 90 + rightSidebarPosition)
     {
-        if (y >= yOffset && y <= yOffset + 25 &&
-            x >= windowWidth - RIGHT_SIDEBAR_WIDTH + 10 + rightSidebarPosition &&
-            x <= windowWidth - RIGHT_SIDEBAR_WIDTH + 90 + rightSidebarPosition)
-        {
-            createNewBoard();
-            return;
-        }
+        createNewBoard();
     }
 }
 
 void toggleSidebar()
 {
     isSidebarVisible = !isSidebarVisible;
-    glutIdleFunc(animateSidebar);
+    startSidebarAnimation();
 }
 
-void animateSidebar()
+void toggleRightSidebar()
 {
-    float targetPosition = isSidebarVisible ? 0.0f : -120.0f;
-    float epsilon = 0.1f;
+    isRightSidebarVisible = !isRightSidebarVisible;
+    startSidebarAnimation();
+}
 
-    if (std::abs(sidebarPosition - targetPosition) > epsilon)
-    {
-        sidebarPosition += (targetPosition - sidebarPosition) * 0.02f;
-        glutPostRedisplay();
-    }
-    else
+// Time constants (ms) for the exponential slide of each sidebar
+const float SIDEBAR_TIME_CONSTANT_MS = 60.0f;
+const float RIGHT_SIDEBAR_TIME_CONSTANT_MS = 40.0f;
+
+bool approachPosition(float &position, float target, float elapsedMs, float timeConstantMs)
+{
+    float epsilon = 0.5f;
+
+    position += (target - position) * (1.0f - std::exp(-elapsedMs / timeConstantMs));
+    if (std::abs(position - target) > epsilon)
     {
-        sidebarPosition = targetPosition;
-        glutIdleFunc(NULL);
+        return true;
     }
+    position = target;
+    return false;
 }
 
-void toggleRightSidebar()
+// Advances both sidebars by the elapsed frame time; returns true while
+// either one is still moving.
+bool animateSidebars(float elapsedMs)
 {
-    isRightSidebarVisible = !isRightSidebarVisible;
-    glutIdleFunc(animateRightSidebar);
+    bool leftMoving = approachPosition(sidebarPosition, isSidebarVisible ? 0.0f : -120.0f,
+                                       elapsedMs, SIDEBAR_TIME_CONSTANT_MS);
+    bool rightMoving = approachPosition(rightSidebarPosition, isRightSidebarVisible ? 0.0f : RIGHT_SIDEBAR_WIDTH,
+                                        elapsedMs, RIGHT_SIDEBAR_TIME_CONSTANT_MS);
+    return leftMoving || rightMoving;
 }
 
-void animateRightSidebar()
-{
-    float targetPosition = isRightSidebarVisible ? 0.0f : RIGHT_SIDEBAR_WIDTH;
-    float epsilon = 0.1f;
-
-    if (std::abs(rightSidebarPosition - targetPosition) > epsilon)
-    {
-        rightSidebarPosition += (targetPosition - rightSidebarPosition) * 0.2f;
-        glutPostRedisplay();
-    }
-    else
-    {
-        rightSidebarPosition = targetPosition;
-        glutIdleFunc(NULL);
-    }
-}
-
-void drawBoldText(int x, int y, const char *text, int boldness)
+void drawBoldText(int x, int y, const char *text, int boldness)
 {
     for (int dx = -boldness; dx <= boldness; ++dx)
     {
@@ -728,30 +1545,233 @@ void drawColorPicker()
     glEnd();
 }
 
+// Draws a stroke and counts it in the frame stats
+void drawCountedStroke(const Stroke &stroke)
+{
+    frameStats.drawBatches += drawStroke(stroke);
+    frameStats.segmentsDrawn += stroke.lines.size();
+}
+
+// Uploads pixels into a new texture on first use, then draws the tile.
+// Expects GL_TEXTURE_2D and blending enabled.
+void drawTileTexture(unsigned int &texture, int x, int y, const uint32_t *pixels)
+{
+    if (!texture)
+    {
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, BASE_TILE_SIZE, BASE_TILE_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    }
+    else
+    {
+        glBindTexture(GL_TEXTURE_2D, texture);
+    }
+    glBegin(GL_QUADS);
+    glTexCoord2f(0, 0);
+    glVertex2i(x, y);
+    glTexCoord2f(1, 0);
+    glVertex2i(x + BASE_TILE_SIZE, y);
+    glTexCoord2f(1, 1);
+    glVertex2i(x + BASE_TILE_SIZE, y + BASE_TILE_SIZE);
+    glTexCoord2f(0, 1);
+    glVertex2i(x, y + BASE_TILE_SIZE);
+    glEnd();
+    frameStats.drawBatches++;
+}
+
+// Strokes flattened for the segment budget, then those flattened by
+// compaction, drawn first so every vector stroke lands on top
+void drawCompactionTiles()
+{
+    std::vector<RasterTile> &boardTiles = boards[currentBoardIndex].tiles;
+    if (compaction.tiles.empty() && boardTiles.empty())
+    {
+        return;
+    }
+
+    glEnable(GL_TEXTURE_2D);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glColor3f(1.0, 1.0, 1.0);
+    std::vector<uint32_t> pixels;
+    for (size_t t = 0; t < boardTiles.size(); t++)
+    {
+        RasterTile &tile = boardTiles[t];
+        if (!tile.texture)
+        {
+            pixels.resize(BASE_TILE_SIZE * BASE_TILE_SIZE);
+            if (!decodeTile(tile.encoded, &pixels[0]))
+            {
+                continue;
+            }
+        }
+        drawTileTexture(tile.texture, tile.x, tile.y, pixels.empty() ? NULL : &pixels[0]);
+    }
+    for (size_t t = 0; t < compaction.tiles.size(); t++)
+    {
+        BaseTile &tile = compaction.tiles[t];
+        drawTileTexture(tile.texture, tile.x, tile.y, tile.pixels.empty() ? NULL : &tile.pixels[0]);
+        std::vector<uint32_t>().swap(tile.pixels); // Only the texture is drawn from now on
+    }
+    glDisable(GL_BLEND);
+    glDisable(GL_TEXTURE_2D);
+}
+
 void drawStrokes()
 {
     std::lock_guard<std::mutex> lock(strokesMutex); // Lock the strokes vector
+    drawnArrivals.swap(remoteArrivals);
+    remoteArrivals.clear();
+    drawCompactionTiles();
     for (size_t i = 0; i < strokes.size(); i++)
     {
-        const Stroke &stroke = strokes[i];
-        for (size_t j = 0; j < stroke.lines.size(); j++)
+        bool flattened = i < compaction.strokeCount && compaction.flattened[i];
+        if (!strokes[i].removed && !flattened)
+        {
+            drawCountedStroke(strokes[i]);
+        }
+    }
+}
+
+void drawPredictedTail()
+{
+    float px[PREDICTOR_MAX_POINTS], py[PREDICTOR_MAX_POINTS];
+    int count = predictorPredict(strokePredictor, nowMs(), px, py);
+    if (count == 0)
+    {
+        return;
+    }
+    // Another frame takes the tail away once the pointer has stopped
+    requestRedraw();
+
+    if (currentStroke.isEraser)
+    {
+        glColor3f(1.0, 1.0, 1.0);
+    }
+    else
+    {
+        glColor3fv(currentStroke.color);
+    }
+    glLineWidth(currentStroke.size);
+    glBegin(GL_LINE_STRIP);
+    glVertex2i(prevX, prevY);
+    for (int i = 0; i < count; i++)
+    {
+        glVertex2f(px[i], py[i]);
+    }
+    glEnd();
+}
+
+// Draws whatever is being dragged out right now: the freehand stroke in
+// progress or the circle/square outline under the pointer.
+void drawActiveStroke()
+{
+    if (prevX == -1 || prevY == -1)
+    {
+        return;
+    }
+
+    if (tool == 3 && circleCenterX != -1 && circleCenterY != -1)
+    {
+        int radius = sqrt(pow(previewX - circleCenterX, 2) + pow(previewY - circleCenterY, 2));
+        glColor3fv(currentColor);
+        glLineWidth(pointSize);
+        glBegin(GL_LINE_LOOP);
+        for (int i = 0; i < 200; i++)
+        {
+            float theta = 2.0f * M_PI * i / 200;
+            float px = circleCenterX + radius * cos(theta);
+            float py = circleCenterY + radius * sin(theta);
+            glVertex2f(px, py);
+        }
+        glEnd();
+    }
+    else if (tool == 4 && squareStartX != -1 && squareStartY != -1)
+    {
+        glColor3fv(currentColor);
+        glLineWidth(pointSize);
+        glBegin(GL_LINE_LOOP);
+        glVertex2i(squareStartX, squareStartY);
+        glVertex2i(previewX, squareStartY);
+        glVertex2i(previewX, previewY);
+        glVertex2i(squareStartX, previewY);
+        glEnd();
+    }
+    else if (tool != 3 && tool != 4)
+    {
+        drawCountedStroke(currentStroke);
+        drawPredictedTail();
+    }
+}
+
+// Other peers' pointers: a ring in their brush color about the size of
+// their brush, or a square for the eraser, edged in grey so a white one
+// shows. Keeps frames coming while any of them is still gliding.
+void drawRemoteCursors()
+{
+    double now = nowMs();
+    bool gliding = false;
+    std::lock_guard<std::mutex> lock(presenceMutex);
+    for (std::map<uint32_t, RemoteCursor>::const_iterator it = remoteCursors.begin(); it != remoteCursors.end(); ++it)
+    {
+        const RemoteCursor &cursor = it->second;
+        float x, y;
+        if (!cursorPosition(cursor, now, x, y))
+        {
+            continue;
+        }
+        gliding = gliding || cursorGliding(cursor, now);
+        float radius = std::max(4.0f, cursor.state.size / 2.0f + 2.0f);
+        glLineWidth(2.0f);
+        for (int pass = 0; pass < 2; pass++)
         {
-            const Line &line = stroke.lines[j];
-            if (line.isEraser)
+            float r = radius + pass * 2.0f;
+            if (pass == 0)
+            {
+                glColor3ub(cursor.state.color[0], cursor.state.color[1], cursor.state.color[2]);
+            }
+            else
             {
-                glColor3f(1.0, 1.0, 1.0);
+                glColor3f(0.5, 0.5, 0.5);
+                glLineWidth(1.0f);
+            }
+            glBegin(GL_LINE_LOOP);
+            if (cursor.state.tool == 2)
+            {
+                glVertex2f(x - r, y - r);
+                glVertex2f(x + r, y - r);
+                glVertex2f(x + r, y + r);
+                glVertex2f(x - r, y + r);
             }
             else
             {
-                glColor3fv(line.color);
+                for (int i = 0; i < 16; i++)
+                {
+                    float theta = 2.0f * M_PI * i / 16;
+                    glVertex2f(x + r * cos(theta), y + r * sin(theta));
+                }
             }
-            glLineWidth(line.size);
-            glBegin(GL_LINES);
-            glVertex2i(line.x1, line.y1);
-            glVertex2i(line.x2, line.y2);
             glEnd();
         }
     }
+    if (gliding)
+    {
+        requestRedraw();
+    }
+}
+
+// Moves the motion samples gathered since the last frame into the stroke
+// being drawn. Every sample is kept; only the drawing is deferred.
+void flushPendingSamples()
+{
+    for (size_t i = 0; i < pendingSamples.size(); i++)
+    {
+        currentStroke.lines.push_back(pendingSamples[i].line);
+        flushedSampleTimes.push_back(pendingSamples[i].timeMs);
+    }
+    pendingSamples.clear();
 }
 
 void handleButtonClick(int x, int y)
@@ -899,37 +1919,280 @@ void handleColorPickerClick(int x, int y)
                  currentColor[0],
                  currentColor[1],
                  currentColor[2]);
-        glutPostRedisplay();
+        requestRedraw();
+    }
+}
+
+// Renders the current board with the software rasterizer and saves it
+// next to the executable as board_<n>.png. Tiles render on all cores and
+// rows stream straight into the file.
+void exportCurrentBoard()
+{
+    std::vector<Stroke> snapshot;
+    std::vector<RasterTile> tiles;
+    {
+        std::lock_guard<std::mutex> lock(strokesMutex);
+        snapshot = strokes;
+        tiles = boards[currentBoardIndex].tiles;
+    }
+
+    std::string path = "board_" + toString(currentBoardIndex + 1) + ".png";
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    TiledExportStats stats;
+    if (exportStrokesTiledPNG(snapshot, windowWidth, windowHeight, path.c_str(), 256, threads, &stats, &tiles))
+    {
+        std::cout << "Exported " << path << " in " << stats.totalMs << " ms\n";
+    }
+    else
+    {
+        std::cerr << "Export to " << path << " failed.\n";
+    }
+}
+
+void loadCurrentBoard()
+{
+    showBoard(boards, currentBoardIndex, strokes, strokeIndex, sessionFile);
+    pointSize = boards[currentBoardIndex].pointSize;
+    memcpy(currentColor, boards[currentBoardIndex].currentColor, sizeof(float) * 3);
+    tool = boards[currentBoardIndex].tool;
+}
+
+// Opens a session file and lists its boards without reading any strokes;
+// only the board that was current when it was saved is paged in.
+bool restoreSession(const char *path)
+{
+    if (!openSession(path, sessionFile) || sessionFile.boardCount == 0)
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < sessionFile.boardCount; i++)
+    {
+        Board board;
+        readBoardInfo(sessionFile, i, board);
+        board.pagedIndex = i;
+        boards.push_back(board);
+    }
+
+    currentBoardIndex = sessionFile.currentBoard;
+    loadCurrentBoard();
+    std::cout << "Restored " << boards.size() << " boards from " << path << "\n";
+    return true;
+}
+
+// Strokes restored from disk count as seen, so one that a peer sends
+// again is not added a second time, and new strokes are stamped above
+// them. Boards still in the mapped file are read a stroke at a time. Ids
+// go in per author in seq order, as they were drawn.
+void markRestoredStrokes()
+{
+    std::vector<std::pair<uint32_t, uint32_t> > ids;
+    uint64_t newestStamp = 0;
+    for (size_t i = 0; i < boards.size(); i++)
+    {
+        const Board &board = boards[i];
+        std::vector<Stroke> unpacked;
+        if (board.pagedIndex >= 0)
+        {
+            loadStrokeIds(sessionFile, board.pagedIndex, ids, newestStamp);
+            continue;
+        }
+        if (!board.packed.empty())
+        {
+            unpackStrokes(board.packed, unpacked);
+        }
+        const std::vector<Stroke> &list = static_cast<int>(i) == currentBoardIndex ? strokes
+                                          : board.packed.empty()                     ? boardStrokes(board)
+                                                                                     : unpacked;
+        for (size_t s = 0; s < list.size(); s++)
+        {
+            ids.push_back(std::make_pair(list[s].author, list[s].seq));
+            newestStamp = std::max(newestStamp, list[s].stamp);
+        }
+    }
+    std::sort(ids.begin(), ids.end());
+
+    std::lock_guard<std::mutex> lock(strokesMutex);
+    strokeClock = std::max(strokeClock, newestStamp);
+    for (size_t i = 0; i < ids.size(); i++)
+    {
+        markStrokeSeen(strokesSeen, ids[i].first, ids[i].second);
+    }
+}
+
+void initHistories()
+{
+    while (histories.size() < boards.size())
+    {
+        History history;
+        historyInit(history, historyLimitBytes);
+        histories.push_back(history);
+    }
+}
+
+// Rebuilds the boards from the last checkpoint and the journal after it,
+// then starts appending to a fresh segment.
+void openJournal()
+{
+    uint32_t checkpointGeneration = 0, nextGeneration = 1;
+    RecoveryStats recovery;
+    bool recovered = recoverBoards(sessionFile, boards, currentBoardIndex, checkpointGeneration, nextGeneration, recovery);
+    if (!journalOpen(journal, std::max(nextGeneration, 1u), checkpointGeneration))
+    {
+        std::cerr << "Opening the journal failed; changes will not be recoverable.\n";
+    }
+
+    if (recovered)
+    {
+        loadCurrentBoard();
+        std::cout << "Recovered " << boards.size() << " boards in " << recovery.ms << " ms ("
+                  << recovery.segments << " segments, " << recovery.records << " records"
+                  << (recovery.tornTail ? ", torn tail dropped" : "") << ")\n";
+    }
+    else if (restoreSession(SESSION_PATH))
+    {
+        // The journal only holds changes, so it needs a checkpoint to start from
+        startCheckpoint();
+    }
+    else
+    {
+        createNewBoard();
+    }
+
+    initHistories();
+    markRestoredStrokes();
+    evictBoards(boards, currentBoardIndex, strokes, boardMemoryBudget);
+}
+
+void saveCurrentSession(const char *path)
+{
+    boards[currentBoardIndex].pointSize = pointSize;
+    memcpy(boards[currentBoardIndex].currentColor, currentColor, sizeof(float) * 3);
+    boards[currentBoardIndex].tool = tool;
+
+    // The file is about to be replaced, so nothing may still point into it
+    for (size_t i = 0; i < boards.size(); i++)
+    {
+        unmapBoard(boards[i], static_cast<int>(i) == currentBoardIndex, sessionFile);
+    }
+    closeSession(sessionFile);
+
+    bool saved;
+    {
+        // Lent to the board for the save so the strokes are not copied
+        std::lock_guard<std::mutex> lock(strokesMutex);
+        boards[currentBoardIndex].strokes.swap(strokes);
+        saved = saveSession(path, boards, currentBoardIndex);
+        boards[currentBoardIndex].strokes.swap(strokes);
+    }
+    if (saved)
+    {
+        std::cout << "Saved " << boards.size() << " boards to " << path << "\n";
+    }
+    else
+    {
+        std::cerr << "Saving " << path << " failed.\n";
+    }
+}
+
+// Saves the boards as they are next to the trace, then records from here
+void startRecording(const char *path)
+{
+    saveCurrentSession((std::string(path) + ".ibd").c_str());
+    TraceHeader header = {TRACE_MAGIC, TRACE_VERSION, localAuthor, windowWidth, windowHeight};
+    if (!traceOpen(traceWriter, path, header))
+    {
+        std::cerr << "Opening " << path << " failed; input will not be recorded.\n";
+        traceClose(traceWriter);
+        return;
+    }
+    traceStartMs = nowMs();
+    recordingTrace = true;
+}
+
+// Starts from the boards saved with the trace, as the author who drew it.
+// The journal stays closed so a replay never touches recovery files.
+bool openReplay()
+{
+    TraceHeader header;
+    if (!traceLoad(replayPath, header, replayEvents))
+    {
+        std::cerr << "Reading " << replayPath << " failed.\n";
+        return false;
+    }
+    localAuthor = header.localAuthor;
+    windowWidth = header.windowWidth;
+    windowHeight = header.windowHeight;
+    if (!restoreSession((std::string(replayPath) + ".ibd").c_str()))
+    {
+        createNewBoard();
+    }
+    initHistories();
+    markRestoredStrokes();
+    evictBoards(boards, currentBoardIndex, strokes, boardMemoryBudget);
+    return true;
+}
+
+void writeStrokeTrace()
+{
+    int spans = writeChromeTrace(STROKE_TRACE_PATH, strokeSpans, localAuthor);
+    if (spans < 0)
+    {
+        std::cerr << "Writing " << STROKE_TRACE_PATH << " failed\n";
+        return;
     }
+    std::cout << "Wrote " << spans << " stroke spans to " << STROKE_TRACE_PATH << "\n";
 }
 
 void keyboard(unsigned char key, int x, int y)
 {
+    recordEvent(TRACE_KEYBOARD, key, x, y);
     switch (tolower(key))
     {
     case 'p':
         setPencilTool();
-        glutPostRedisplay();
         break;
     case 'd':
         deleteCurrentBoard();
-        glutPostRedisplay();
         break;
     case 'e':
         setEraserTool();
-        glutPostRedisplay();
         break;
     case 'c':
         setCircleTool();
-        glutPostRedisplay();
         break;
     case 's':
         setSquareTool();
-        glutPostRedisplay();
         break;
     case 'u':
         undoLastStroke();
         break;
+    case 'r':
+        redoLastStroke();
+        break;
+    case 'f':
+        logFrameStats = !logFrameStats;
+        break;
+    case 'h':
+        showPerfHud = !showPerfHud;
+        requestRedraw();
+        break;
+    case 't':
+        writeStrokeTrace();
+        break;
+    case 'x':
+        exportCurrentBoard();
+        break;
+    case 'o':
+        updateCompaction(true);
+        break;
+    case 'w':
+        saveCurrentSession(SESSION_PATH);
+        break;
+    case 'k':
+        strokePredictor.config.enabled = !strokePredictor.config.enabled;
+        requestRedraw();
+        break;
     case '[':
         decreasePointSize();
         break;
@@ -941,6 +2204,7 @@ void keyboard(unsigned char key, int x, int y)
 
 void mouseWheel(int wheel, int direction, int x, int y)
 {
+    recordEvent(TRACE_MOUSE_WHEEL, wheel, direction, x, y);
     if (x >= windowWidth - RIGHT_SIDEBAR_WIDTH)
     {
         if (direction > 0)
@@ -956,7 +2220,7 @@ void mouseWheel(int wheel, int direction, int x, int y)
             if (scrollOffset < maxScroll)
                 scrollOffset = maxScroll;
         }
-        glutPostRedisplay();
+        requestRedraw();
     }
 }
 
@@ -979,6 +2243,7 @@ void getDrawingArea(int &drawX, int &drawWidth)
 
 void mouseButton(int button, int state, int x, int y)
 {
+    recordEvent(TRACE_MOUSE_BUTTON, button, state, x, y);
     if (button == GLUT_LEFT_BUTTON && state == GLUT_DOWN)
     {
         handleButtonClick(x, y);
@@ -994,7 +2259,7 @@ void mouseButton(int button, int state, int x, int y)
                     scrollOffset += SCROLL_SPEED;
                     if (scrollOffset > 0)
                         scrollOffset = 0;
-                    glutPostRedisplay();
+                    requestRedraw();
                     return;
                 }
                 else if (button == 4)
@@ -1003,7 +2268,7 @@ void mouseButton(int button, int state, int x, int y)
                     scrollOffset -= SCROLL_SPEED;
                     if (scrollOffset < maxScroll)
                         scrollOffset = maxScroll;
-                    glutPostRedisplay();
+                    requestRedraw();
                     return;
                 }
                 handleBoardClick(x, y);
@@ -1025,8 +2290,11 @@ void mouseButton(int button, int state, int x, int y)
         getDrawingArea(drawX, drawWidth);
         if (x >= drawX && x <= (drawX + drawWidth))
         {
+            strokeStartMs = nowMs();
             prevX = x;
             prevY = y;
+            previewX = x;
+            previewY = y;
 
             switch (tool)
             {
@@ -1040,6 +2308,9 @@ void mouseButton(int button, int state, int x, int y)
                 break;
             default:
                 currentStroke = Stroke();
+                pendingSamples.clear();
+                predictorReset(strokePredictor);
+                predictorAddSample(strokePredictor, x, y, nowMs());
                 currentStroke.isEraser = (tool == 2);
                 memcpy(currentStroke.color, currentColor, sizeof(float) * 3);
                 currentStroke.size = pointSize;
@@ -1055,121 +2326,74 @@ void mouseButton(int button, int state, int x, int y)
             if (tool == 3 && circleCenterX != -1 && circleCenterY != -1)
             {
                 int radius = sqrt(pow(x - circleCenterX, 2) + pow(y - circleCenterY, 2));
-                Stroke circleStroke;
-                circleStroke.isEraser = false;
-                memcpy(circleStroke.color, currentColor, sizeof(float) * 3);
-                circleStroke.size = pointSize;
-
-                int segments = 200;
-                for (int i = 0; i < segments; i++)
-                {
-                    Line line;
-                    float theta1 = 2.0f * M_PI * float(i) / float(segments);
-                    float theta2 = 2.0f * M_PI * float(i + 1) / float(segments);
-
-                    line.x1 = circleCenterX + radius * cos(theta1);
-                    line.y1 = circleCenterY + radius * sin(theta1);
-                    line.x2 = circleCenterX + radius * cos(theta2);
-                    line.y2 = circleCenterY + radius * sin(theta2);
-
-                    line.size = pointSize;
-                    memcpy(line.color, currentColor, sizeof(float) * 3);
-                    line.isEraser = false;
-
-                    circleStroke.lines.push_back(line);
-                }
-                strokes.push_back(circleStroke);
+                Stroke circleStroke = makeCircleStroke(circleCenterX, circleCenterY, radius, currentColor, pointSize);
+                commitLocalStroke(circleStroke);
                 circleCenterX = -1;
                 circleCenterY = -1;
-
-                // Send the stroke to the other user
-                sendStroke(circleStroke);
             }
             else if (tool == 4 && squareStartX != -1 && squareStartY != -1)
             {
-                Stroke squareStroke;
-                squareStroke.isEraser = false;
-                memcpy(squareStroke.color, currentColor, sizeof(float) * 3);
-                squareStroke.size = pointSize;
-
-                Line lines[4];
-                lines[0] = {squareStartX, squareStartY, x, squareStartY};
-                lines[1] = {x, squareStartY, x, y};
-                lines[2] = {x, y, squareStartX, y};
-                lines[3] = {squareStartX, y, squareStartX, squareStartY};
-
-                for (int i = 0; i < 4; i++)
-                {
-                    lines[i].size = pointSize;
-                    memcpy(lines[i].color, currentColor, sizeof(float) * 3);
-                    lines[i].isEraser = false;
-                    squareStroke.lines.push_back(lines[i]);
-                }
-
-                strokes.push_back(squareStroke);
+                Stroke squareStroke = makeSquareStroke(squareStartX, squareStartY, x, y, currentColor, pointSize);
+                commitLocalStroke(squareStroke);
                 squareStartX = -1;
                 squareStartY = -1;
-
-                // Send the stroke to the other user
-                sendStroke(squareStroke);
             }
             else if (tool != 3 && tool != 4)
             {
-                strokes.push_back(currentStroke);
-
-                // Send the stroke to the other user
-                sendStroke(currentStroke);
+                flushPendingSamples();
+                commitLocalStroke(currentStroke);
             }
 
             prevX = -1;
             prevY = -1;
-            glutPostRedisplay();
+            requestRedraw();
         }
     }
 }
-void mouseMotion(int x, int y)
+// Where the local pointer is, for the network thread to send; the tool
+// is 0 while the pointer is off the board
+void samplePointer(int x, int y)
 {
     int drawX, drawWidth;
     getDrawingArea(drawX, drawWidth);
+    std::lock_guard<std::mutex> lock(presenceMutex);
+    localCursor.x = x;
+    localCursor.y = y;
+    localCursor.tool = x >= drawX && x <= drawX + drawWidth ? tool : 0;
+    localCursor.size = static_cast<int>(pointSize);
+    for (int i = 0; i < 3; i++)
+    {
+        localCursor.color[i] = static_cast<uint8_t>(std::min(1.0f, std::max(0.0f, currentColor[i])) * 255 + 0.5f);
+    }
+}
 
-    if (prevX != -1 && prevY != -1 && x >= drawX && x <= (drawX + drawWidth))
+void passiveMotion(int x, int y)
+{
+    samplePointer(x, y);
+}
+
+void pointerEntry(int state)
+{
+    if (state == GLUT_LEFT)
     {
+        std::lock_guard<std::mutex> lock(presenceMutex);
+        localCursor.tool = 0;
+    }
+}
 
-        if (tool == 3 && circleCenterX != -1 && circleCenterY != -1)
-        {
-            glClear(GL_COLOR_BUFFER_BIT);
-            display();
+void mouseMotion(int x, int y)
+{
+    recordEvent(TRACE_MOUSE_MOTION, x, y);
+    samplePointer(x, y);
+    int drawX, drawWidth;
+    getDrawingArea(drawX, drawWidth);
 
-            int radius = sqrt(pow(x - circleCenterX, 2) + pow(y - circleCenterY, 2));
-            glColor3fv(currentColor);
-            glLineWidth(pointSize);
-            glBegin(GL_LINE_LOOP);
-            for (int i = 0; i < 200; i++)
-            {
-                float theta = 2.0f * M_PI * i / 200;
-                float px = circleCenterX + radius * cos(theta);
-                float py = circleCenterY + radius * sin(theta);
-                glVertex2f(px, py);
-            }
-            glEnd();
-            glFlush();
-        }
-        else if (tool == 4 && squareStartX != -1 && squareStartY != -1)
-        {
-            glClear(GL_COLOR_BUFFER_BIT);
-            display();
+    if (prevX != -1 && prevY != -1 && x >= drawX && x <= (drawX + drawWidth))
+    {
+        previewX = x;
+        previewY = y;
 
-            glColor3fv(currentColor);
-            glLineWidth(pointSize);
-            glBegin(GL_LINE_LOOP);
-            glVertex2i(squareStartX, squareStartY);
-            glVertex2i(x, squareStartY);
-            glVertex2i(x, y);
-            glVertex2i(squareStartX, y);
-            glEnd();
-            glFlush();
-        }
-        else if (tool != 3 && tool != 4)
+        if (tool != 3 && tool != 4)
         {
             Line line;
             line.x1 = prevX;
@@ -1179,30 +2403,22 @@ void mouseMotion(int x, int y)
             line.isEraser = (tool == 2);
             memcpy(line.color, currentColor, sizeof(float) * 3);
             line.size = pointSize;
-            currentStroke.lines.push_back(line);
 
-            if (line.isEraser)
-            {
-                glColor3f(1.0, 1.0, 1.0);
-            }
-            else
-            {
-                glColor3fv(line.color);
-            }
-
-            glLineWidth(line.size);
-            glBegin(GL_LINES);
-            glVertex2i(line.x1, line.y1);
-            glVertex2i(line.x2, line.y2);
-            glEnd();
-            glFlush();
+            MotionSample sample;
+            sample.line = line;
+            sample.timeMs = nowMs();
+            pendingSamples.push_back(sample);
+            predictorAddSample(strokePredictor, x, y, sample.timeMs);
+            frameStats.motionSamples++;
 
             prevX = x;
             prevY = y;
         }
+        requestRedraw();
     }
 }
 void reshape(int w, int h) {
+    recordEvent(TRACE_RESHAPE, w, h);
     const int MIN_HEIGHT = 650; // Minimum height for the window
 
     // If the height is less than the minimum, reset the window size
@@ -1225,11 +2441,131 @@ void reshape(int w, int h) {
     glLoadIdentity();
     gluOrtho2D(0.0, windowWidth, windowHeight, 0.0);
 
-    glutPostRedisplay();
+    requestRedraw();
+}
+
+// Called right after the swap, so every latency ends when the frame is
+// on its way to the screen
+void recordFrameLatencies(std::chrono::steady_clock::time_point frameStart)
+{
+    double swapMs = nowMs();
+    rollingAdd(frameTimes, elapsedMsSince(frameStart));
+    for (size_t i = 0; i < flushedSampleTimes.size(); i++)
+    {
+        rollingAdd(inputLatency, swapMs - flushedSampleTimes[i]);
+    }
+    flushedSampleTimes.clear();
+    double frameStartMs = swapMs - elapsedMsSince(frameStart);
+    for (size_t i = 0; i < drawnArrivals.size(); i++)
+    {
+        const RemoteArrival &arrival = drawnArrivals[i];
+        rollingAdd(remoteLatency, swapMs - arrival.timeMs);
+        spanRecord(strokeSpans, localAuthor, arrival.author, arrival.seq, SPAN_REDRAW_WAIT, arrival.timeMs, frameStartMs);
+        spanRecord(strokeSpans, localAuthor, arrival.author, arrival.seq, SPAN_DRAW, frameStartMs, swapMs);
+    }
+    drawnArrivals.clear();
+
+    if (swapMs - perfWindowStartMs >= PERF_WINDOW_MS)
+    {
+        rollingAdvance(frameTimes);
+        rollingAdvance(inputLatency);
+        rollingAdvance(remoteLatency);
+        trafficPerSecond = trafficRates(traffic, trafficAtWindow, swapMs - perfWindowStartMs);
+        perfWindowStartMs = swapMs;
+    }
+}
+
+// One overlay row: label, p50/p95/p99 and a bar per histogram bucket
+void drawLatencyRow(int x, int y, const char *label, const RollingHistogram &histogram)
+{
+    uint32_t counts[LATENCY_BUCKETS];
+    float p99 = rollingPercentile(histogram, 99, counts);
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(1) << label << "  p50 " << rollingPercentile(histogram, 50)
+       << "  p95 " << rollingPercentile(histogram, 95) << "  p99 " << p99 << " ms";
+    glColor3f(1.0, 1.0, 1.0);
+    drawText(x, y, ss.str().c_str());
+
+    uint32_t highest = *std::max_element(counts, counts + LATENCY_BUCKETS);
+    if (highest == 0)
+    {
+        return;
+    }
+    glColor3f(0.4, 0.8, 1.0);
+    glBegin(GL_QUADS);
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        int height = counts[i] ? std::max(1, static_cast<int>(14 * counts[i] / highest)) : 0;
+        int left = x + 300 + i * 2;
+        glVertex2i(left, y);
+        glVertex2i(left + 2, y);
+        glVertex2i(left + 2, y - height);
+        glVertex2i(left, y - height);
+    }
+    glEnd();
+}
+
+void drawPerfHud()
+{
+    size_t strokeCount, segmentCount = 0, tileCount;
+    size_t pendingArrivals;
+    {
+        std::lock_guard<std::mutex> lock(strokesMutex);
+        strokeCount = strokes.size();
+        for (size_t i = 0; i < strokes.size(); i++)
+        {
+            segmentCount += strokes[i].lines.size();
+        }
+        tileCount = boards[currentBoardIndex].tiles.size();
+        pendingArrivals = remoteArrivals.size();
+    }
+
+    int drawX, drawWidth;
+    getDrawingArea(drawX, drawWidth);
+    int x = drawX + 10, y = 10;
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glColor4f(0.0, 0.0, 0.0, 0.7);
+    glBegin(GL_QUADS);
+    glVertex2i(x, y);
+    glVertex2i(x + 440, y);
+    glVertex2i(x + 440, y + 150);
+    glVertex2i(x, y + 150);
+    glEnd();
+    glDisable(GL_BLEND);
+
+    x += 8;
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(2) << "frame " << lastFrameStats.strokesMs + lastFrameStats.chromeMs + lastFrameStats.flushMs
+       << " ms: strokes " << lastFrameStats.strokesMs << ", chrome " << lastFrameStats.chromeMs << ", flush "
+       << lastFrameStats.flushMs;
+    glColor3f(1.0, 1.0, 1.0);
+    drawText(x, y + 18, ss.str().c_str());
+
+    ss.str("");
+    ss << "board " << strokeCount << " strokes, " << segmentCount << " segments, " << tileCount << " tiles; drew "
+       << lastFrameStats.segmentsDrawn << " in " << lastFrameStats.drawBatches << " batches";
+    drawText(x, y + 34, ss.str().c_str());
+
+    ss.str("");
+    ss << std::setprecision(1) << "in " << trafficPerSecond.messagesIn << " msg/s " << trafficPerSecond.bytesIn / 1024
+       << " KB/s, out " << trafficPerSecond.messagesOut << " msg/s " << trafficPerSecond.bytesOut / 1024 << " KB/s";
+    drawText(x, y + 50, ss.str().c_str());
+
+    ss.str("");
+    ss << "queues: receive " << receiveQueueBytes << " B, send " << sendQueueBytes << " B, journal " << journalPendingBytes(journal)
+       << " B, remote ops to draw " << pendingArrivals;
+    drawText(x, y + 66, ss.str().c_str());
+
+    drawLatencyRow(x, y + 94, "frame        ", frameTimes);
+    drawLatencyRow(x, y + 116, "input->draw ", inputLatency);
+    drawLatencyRow(x, y + 138, "remote->draw", remoteLatency);
 }
 
 void display()
 {
+    std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
     glClear(GL_COLOR_BUFFER_BIT);
 
     glColor3f(1.0, 1.0, 1.0);
@@ -1240,7 +2576,12 @@ void display()
     glVertex2i(0, windowHeight);
     glEnd();
 
+    flushPendingSamples();
     drawStrokes();
+    drawActiveStroke();
+    drawRemoteCursors();
+    frameStats.strokesMs = elapsedMsSince(frameStart);
+    std::chrono::steady_clock::time_point chromeStart = std::chrono::steady_clock::now();
 
     glColor3f(0.09, 0.08, 0.23);
     glBegin(GL_QUADS);
@@ -1290,295 +2631,1220 @@ void display()
 
     for (size_t i = 0; i < boards.size(); i++)
     {
-        drawBoardThumbnail(i, windowWidth - RIGHT_SIDEBAR_WIDTH + 10 + rightSidebarPosition, yOffset);
-        yOffset += THUMBNAIL_HEIGHT + 30;
-        totalContentHeight += THUMBNAIL_HEIGHT + 30;
+        // Only thumbnails scrolled into view are drawn
+        if (yOffset + THUMBNAIL_HEIGHT + 30 >= 0 && yOffset <= windowHeight)
+        {
+            drawBoardThumbnail(i, windowWidth - RIGHT_SIDEBAR_WIDTH + 10 + rightSidebarPosition, yOffset);
+        }
+        yOffset += THUMBNAIL_HEIGHT + 30;
+        totalContentHeight += THUMBNAIL_HEIGHT + 30;
+    }
+
+    glColor3f(1.0, 0.84, 0.77);
+    glBegin(GL_QUADS);
+    glVertex2i(windowWidth - RIGHT_SIDEBAR_WIDTH + 10 + rightSidebarPosition, yOffset);
+    glVertex2i(windowWidth - RIGHT_SIDEBAR_WIDTH + 90 + rightSidebarPosition, yOffset);
+    glVertex2i(windowWidth - RIGHT_SIDEBAR_WIDTH + 90 + rightSidebarPosition, yOffset + 25);
+    glVertex2i(windowWidth - RIGHT_SIDEBAR_WIDTH + 10 + rightSidebarPosition, yOffset + 25);
+    glEnd();
+
+    glColor3f(0.0, 0.0, 0.0);
+    drawText(windowWidth - RIGHT_SIDEBAR_WIDTH + 20 + rightSidebarPosition,
+             yOffset + 15, "+ New ");
+    totalContentHeight += 35;
+
+    glDisable(GL_SCISSOR_TEST);
+
+    if (!isRightSidebarVisible)
+    {
+        Button toggleRightButton = {windowWidth - 30, 10, 30, 25, "<<", toggleRightSidebar};
+        drawButton(&toggleRightButton);
+    }
+    else
+    {
+        Button toggleRightButton =
+            {
+                windowWidth - RIGHT_SIDEBAR_WIDTH + rightSidebarPosition + 10,
+                10, 100, 25, ">>", toggleRightSidebar};
+        drawButton(&toggleRightButton);
+    }
+
+    for (int i = 0; i < NUM_BOTTOM_BUTTONS; i++)
+    {
+        drawButton(&bottomButtons[i]);
+    }
+
+    drawBottomToolbar();
+    frameStats.chromeMs = elapsedMsSince(chromeStart);
+    if (showPerfHud)
+    {
+        drawPerfHud();
+    }
+
+    std::chrono::steady_clock::time_point flushStart = std::chrono::steady_clock::now();
+    glutSwapBuffers();
+    lastFrameTime = std::chrono::steady_clock::now();
+    frameStats.flushMs = elapsedMsSince(flushStart);
+    recordFrameLatencies(frameStart);
+
+    lastFrameStats = frameStats;
+    frameStats.motionSamples = 0;
+    frameStats.segmentsDrawn = 0;
+    frameStats.drawBatches = 0;
+    if (logFrameStats)
+    {
+        std::cout << "frame: " << lastFrameStats.motionSamples << " samples, "
+                  << lastFrameStats.segmentsDrawn << " segments in "
+                  << lastFrameStats.drawBatches << " batches, "
+                  << lastFrameStats.strokesMs << " ms\n";
+    }
+}
+
+void init()
+{
+    glClearColor(1.0, 1.0, 1.0, 1.0);
+    glColor3f(0.0, 0.0, 0.0);
+    glPointSize(2.0);
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    gluOrtho2D(0.0, windowWidth, windowHeight, 0.0);
+
+    strokePredictor.config = defaultPredictorConfig();
+    std::random_device seed;
+    while (localAuthor == 0)
+    {
+        localAuthor = seed() ^ static_cast<uint32_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+    }
+    predictorReset(strokePredictor);
+
+    if (replayPath)
+    {
+        if (!openReplay())
+        {
+            exit(1);
+        }
+    }
+    else
+    {
+        openJournal();
+        if (recordPath)
+        {
+            startRecording(recordPath);
+        }
+    }
+    isRightSidebarVisible = false;
+    rightSidebarPosition = RIGHT_SIDEBAR_WIDTH;
+
+    initColorButtons(); // Initialize color buttons
+}
+
+void cleanup()
+{
+    if (compactionThread.joinable())
+    {
+        compactionThread.join();
+    }
+    if (flattenThread.joinable())
+    {
+        flattenThread.join();
+    }
+    journalClose(journal);
+    traceClose(traceWriter);
+    {
+        std::lock_guard<std::mutex> lock(peersMutex);
+        for (size_t i = 0; i < peers.size(); i++)
+        {
+            if (peers[i].connected)
+            {
+                closePeer(peers[i]);
+            }
+        }
+        peers.clear();
+    }
+    if (hostSocket != NET_INVALID)
+    {
+        netClose(hostSocket);
+    }
+    if (metricsSocket != NET_INVALID)
+    {
+        netClose(metricsSocket);
+    }
+    if (localSocket != NET_INVALID)
+    {
+        netClose(localSocket);
+        shmHostStop();
+    }
+    netCleanup();
+}
+
+void startHost()
+{
+    // Clients are accepted by the network thread as they come
+    hostSocket = netListen("27015", false);
+    if (hostSocket == NET_INVALID)
+    {
+        std::cerr << "Could not listen on port 27015: " << netLastError() << "\n";
+        return;
+    }
+    netWatch(hostSocket);
+
+    isHost = true;
+    std::cout << "Hosting on port 27015.\n";
+    if (sharedMemory)
+    {
+        localSocket = shmHostStart("27015");
+        if (localSocket == NET_INVALID)
+        {
+            std::cerr << "Local clients cannot use shared memory: " << netLastError() << "\n";
+        }
+        else
+        {
+            netWatch(localSocket);
+            std::cout << "Local clients can join through shared memory.\n";
+        }
+    }
+    startMetrics();
+}
+
+// Serves the metrics on the loopback interface only, so nothing outside
+// this machine can read them
+void startMetrics()
+{
+    metricsSocket = netListen(METRICS_PORT, true);
+    if (metricsSocket == NET_INVALID)
+    {
+        std::cerr << "Metrics are not served: " << netLastError() << "\n";
+        return;
+    }
+    netWatch(metricsSocket);
+    std::cout << "Metrics on http://127.0.0.1:" << METRICS_PORT << "/metrics\n";
+}
+
+void connectToHost(const char *hostname)
+{
+    if (sharedMemory)
+    {
+        Transport transport;
+        if (!shmConnect("27015", transport))
+        {
+            std::cerr << "Unable to connect to a host on this machine!\n";
+            return;
+        }
+        addPeer(transport);
+        isClient = true;
+        std::cout << "Connected to host through shared memory.\n";
+        return;
+    }
+    NetSocket clientSocket = netConnect(hostname, "27015");
+    if (clientSocket == NET_INVALID)
+    {
+        std::cerr << "Unable to connect to server!\n";
+        return;
+    }
+
+    addPeer(socketTransport(clientSocket));
+    isClient = true;
+    std::cout << "Connected to host.\n";
+}
+
+void addPeer(const Transport &transport)
+{
+    Peer peer = Peer();
+    peer.transport = transport;
+    peer.connected = true;
+    peer.lanes.sending = -1;
+    peer.sendCredit = CREDIT_WINDOW_BYTES;
+    peer.creditReturned = std::make_shared<std::atomic<int64_t>>(0);
+    clockSyncReset(peer.clock);
+    std::lock_guard<std::mutex> lock(peersMutex);
+    peer.id = nextPeerId++;
+    peers.push_back(peer);
+    if (isHost)
+    {
+        // Tells the client to send on credit; see send_lanes.h
+        SharedBytes hello = std::make_shared<const std::string>(encodeCredit(0));
+        queueForPeer(peers.back(), hello, std::vector<SharedBytes>(), LANE_LIVE, SharedCredit(), nowMs());
+        flushSends();
+    }
+}
+
+// The caller holds peersMutex
+Peer *findPeer(uint32_t id)
+{
+    for (size_t i = 0; i < peers.size(); i++)
+    {
+        if (peers[i].id == id)
+        {
+            return &peers[i];
+        }
+    }
+    return NULL;
+}
+
+void closePeer(Peer &peer)
+{
+    peer.transport.close();
+    peer.connected = false;
+}
+
+// Sends as much as the socket takes, from the highest lane that has
+// anything; a client only starts a stroke or bulk message while it has
+// credit. The caller holds peersMutex.
+void flushPeer(Peer &peer)
+{
+    SendLanes &lanes = peer.lanes;
+    int lane;
+    while (peer.connected &&
+           (lane = lanesNext(lanes, !isClient || !peer.creditFromHost || peer.sendCredit > 0)) >= 0)
+    {
+        QueuedPiece &piece = lanes.queues[lane].front();
+        if (lanes.sending < 0)
+        {
+            lanes.sending = lane;
+            if (lane != LANE_LIVE)
+            {
+                peer.sendCredit -= piece.messageBytes;
+            }
+        }
+        int iResult = peer.transport.send(piece.bytes, lanes.offset);
+        if (iResult <= 0)
+        {
+            if (iResult < 0)
+            {
+                closePeer(peer);
+            }
+            return;
+        }
+        peer.bytesOut += iResult;
+        traffic.bytesOut += iResult;
+        peer.queuedBytes -= iResult;
+        if (piece.cursorOf != 0)
+        {
+            peer.presenceBytesOut += iResult;
+        }
+        lanes.offset += iResult;
+        if (lanes.offset == piece.bytes->size())
+        {
+            if (piece.last)
+            {
+                rollingAdd(laneWait[lane], nowMs() - piece.queuedMs);
+            }
+            lanes.bytes[lane] -= piece.bytes->size();
+            lanes.queues[lane].pop_front();
+            lanes.sending = -1;
+            lanes.offset = 0;
+        }
+    }
+}
+
+// Queues a message, or the pieces chunkMessage cut it into. A peer that
+// stops reading loses messages once its queue is full rather than holding
+// up everyone else, and a peer more than a credit window behind no longer
+// holds the sender's credit. The caller holds peersMutex.
+void queueForPeer(Peer &peer, const SharedBytes &message, const std::vector<SharedBytes> &pieces, Lane lane,
+                  const SharedCredit &credit, double queuedMs)
+{
+    if (!peer.connected)
+    {
+        return;
+    }
+    size_t bytes = pieces.empty() ? message->size() : 0;
+    for (size_t i = 0; i < pieces.size(); i++)
+    {
+        bytes += pieces[i]->size();
+    }
+    if (peer.queuedBytes + bytes > PEER_QUEUE_LIMIT)
+    {
+        peer.drops++;
+        return;
+    }
+    QueuedPiece piece = {message, peer.queuedBytes <= CREDIT_WINDOW_BYTES ? credit : SharedCredit(), queuedMs,
+                         message->size(), pieces.empty(), 0};
+    std::deque<QueuedPiece> &queue = peer.lanes.queues[lane];
+    if (pieces.empty())
+    {
+        queue.push_back(piece);
+    }
+    for (size_t i = 0; i < pieces.size(); i++)
+    {
+        piece.bytes = pieces[i];
+        piece.last = i + 1 == pieces.size();
+        queue.push_back(piece);
+        piece.messageBytes = 0;
+    }
+    peer.lanes.bytes[lane] += bytes;
+    peer.queuedBytes += bytes;
+    peer.messagesOut++;
+    traffic.messagesOut++;
+    flushPeer(peer);
+}
+
+// Shared memory records first, since publishing one can ring doorbells
+// that go out with the socket sends
+void flushSends()
+{
+    shmFlush();
+    netFlush();
+}
+
+// Sends to every peer but the one a relayed message came from (0 for
+// none). The message is encoded once: every peer's queue holds a
+// reference to the same buffer, which is freed when the last send of it
+// finishes, local clients read it from one record in shared memory, and
+// io_uring gets all the sends in one submission. A relayed message holds
+// its sender's credit until every copy has been taken.
+void sendToPeers(const SharedBytes &bytes, uint32_t except, const SharedCredit &credit = SharedCredit())
+{
+    Lane lane = messageLane(*bytes);
+    std::vector<SharedBytes> pieces;
+    chunkMessage(bytes, lane, pieces);
+    double now = nowMs();
+    std::lock_guard<std::mutex> lock(peersMutex);
+    for (size_t i = 0; i < peers.size(); i++)
+    {
+        if (peers[i].id != except)
+        {
+            queueForPeer(peers[i], bytes, pieces, lane, credit, now);
+        }
+    }
+    flushSends();
+}
+
+void sendToPeer(uint32_t id, std::string data)
+{
+    SharedBytes bytes = std::make_shared<const std::string>(std::move(data));
+    Lane lane = messageLane(*bytes);
+    std::vector<SharedBytes> pieces;
+    chunkMessage(bytes, lane, pieces);
+    std::lock_guard<std::mutex> lock(peersMutex);
+    Peer *peer = findPeer(id);
+    if (peer)
+    {
+        queueForPeer(*peer, bytes, pieces, lane, SharedCredit(), nowMs());
+    }
+    flushSends();
+}
+
+// Queues a cursor update in place of one from the same author that has
+// not started going out yet, which it makes stale; past the peer's
+// presence budget it is dropped, as the next update will do instead. The
+// caller holds peersMutex.
+void queuePresence(Peer &peer, const SharedBytes &message, uint32_t author, double now)
+{
+    if (!peer.connected)
+    {
+        return;
+    }
+    std::deque<QueuedPiece> &queue = peer.lanes.queues[LANE_LIVE];
+    for (size_t i = peer.lanes.sending == LANE_LIVE ? 1 : 0; i < queue.size(); i++)
+    {
+        if (queue[i].cursorOf == author)
+        {
+            peer.lanes.bytes[LANE_LIVE] = peer.lanes.bytes[LANE_LIVE] - queue[i].bytes->size() + message->size();
+            peer.queuedBytes = peer.queuedBytes - queue[i].bytes->size() + message->size();
+            queue[i].bytes = message;
+            queue[i].messageBytes = message->size();
+            peer.presenceDrops++;
+            return;
+        }
+    }
+    if (peer.queuedBytes + message->size() > PEER_QUEUE_LIMIT ||
+        !budgetTake(peer.presenceBudget, message->size(), PRESENCE_BYTES_PER_S, now))
+    {
+        peer.presenceDrops++;
+        return;
+    }
+    QueuedPiece piece = {message, SharedCredit(), now, message->size(), true, author};
+    queue.push_back(piece);
+    peer.lanes.bytes[LANE_LIVE] += message->size();
+    peer.queuedBytes += message->size();
+    peer.messagesOut++;
+    traffic.messagesOut++;
+    flushPeer(peer);
+}
+
+// Sends to every peer but except, like sendToPeers
+void sendPresenceToPeers(const SharedBytes &message, uint32_t author, uint32_t except)
+{
+    double now = nowMs();
+    std::lock_guard<std::mutex> lock(peersMutex);
+    for (size_t i = 0; i < peers.size(); i++)
+    {
+        if (peers[i].id != except)
+        {
+            queuePresence(peers[i], message, author, now);
+        }
+    }
+    flushSends();
+}
+
+// Sends the local cursor when presenceDue says so; network thread only
+void sendPresence(double now)
+{
+    CursorState cursor;
+    {
+        std::lock_guard<std::mutex> lock(presenceMutex);
+        cursor = localCursor;
+    }
+    cursor.author = localAuthor;
+    if (presenceDue(presenceSender, cursor, now))
+    {
+        sendPresenceToPeers(std::make_shared<const std::string>(encodePresence(cursor)), localAuthor, 0);
     }
+}
 
-    if (boards.size() < 5)
+// Forgets cursors that went quiet, and redraws without them
+void expireCursors(double now)
+{
+    bool expired = false;
     {
-        glColor3f(1.0, 0.84, 0.77);
-        glBegin(GL_QUADS);
-        glVertex2i(windowWidth - RIGHT_SIDEBAR_WIDTH + 10 + rightSidebarPosition, yOffset);
-        glVertex2i(windowWidth - RIGHT_SIDEBAR_WIDTH + 90 + rightSidebarPosition, yOffset);
-        glVertex2i(windowWidth - RIGHT_SIDEBAR_WIDTH + 90 + rightSidebarPosition, yOffset + 25);
-        glVertex2i(windowWidth - RIGHT_SIDEBAR_WIDTH + 10 + rightSidebarPosition, yOffset + 25);
-        glEnd();
-
-        glColor3f(0.0, 0.0, 0.0);
-        drawText(windowWidth - RIGHT_SIDEBAR_WIDTH + 20 + rightSidebarPosition,
-                 yOffset + 15, "+ New ");
-        totalContentHeight += 35;
+        std::lock_guard<std::mutex> lock(presenceMutex);
+        for (std::map<uint32_t, RemoteCursor>::iterator it = remoteCursors.begin(); it != remoteCursors.end();)
+        {
+            if (now - it->second.updateMs > PRESENCE_TIMEOUT_MS)
+            {
+                remoteCursors.erase(it++);
+                expired = true;
+            }
+            else
+            {
+                ++it;
+            }
+        }
     }
-
-    glDisable(GL_SCISSOR_TEST);
-
-    if (!isRightSidebarVisible)
+    if (expired)
     {
-        Button toggleRightButton = {windowWidth - 30, 10, 30, 25, "<<", toggleRightSidebar};
-        drawButton(&toggleRightButton);
+        requestRedraw();
     }
-    else
+}
+
+void sendData(std::string data)
+{
+    sendToPeers(std::make_shared<const std::string>(std::move(data)), 0);
+}
+
+// Reads what the socket has into the peer's buffer, up to 1 MB per poll so
+// one busy peer cannot starve the rest; the caller holds peersMutex
+void receiveData(Peer &peer)
+{
+    char recvbuf[16384];
+    for (int reads = 0; reads < 64 && peer.connected; reads++)
     {
-        Button toggleRightButton =
+        int iResult = peer.transport.receive(recvbuf, sizeof(recvbuf));
+        if (iResult <= 0)
+        {
+            if (iResult < 0)
             {
-                windowWidth - RIGHT_SIDEBAR_WIDTH + rightSidebarPosition + 10,
-                10, 100, 25, ">>", toggleRightSidebar};
-        drawButton(&toggleRightButton);
+                closePeer(peer);
+            }
+            return;
+        }
+        peer.bytesIn += iResult;
+        traffic.bytesIn += iResult;
+        peer.receiveBuffer.append(recvbuf, iResult);
     }
+}
 
-    for (int i = 0; i < NUM_BOTTOM_BUTTONS; i++)
+// Sends the stroke, then when each stage of getting it out began, so the
+// peer can trace it end to end
+void sendStroke(const Stroke &stroke, double commitMs)
+{
+    double encodeMs = nowMs();
+    std::string message = encodeStroke(stroke);
+    double sendMs = nowMs();
+    sendData(std::move(message));
+    double sentMs = nowMs();
+
+    spanRecord(strokeSpans, localAuthor, stroke.author, stroke.seq, SPAN_CAPTURE, strokeStartMs, commitMs);
+    spanRecord(strokeSpans, localAuthor, stroke.author, stroke.seq, SPAN_COMMIT, commitMs, encodeMs);
+    spanRecord(strokeSpans, localAuthor, stroke.author, stroke.seq, SPAN_SERIALIZE, encodeMs, sendMs);
+    spanRecord(strokeSpans, localAuthor, stroke.author, stroke.seq, SPAN_SEND, sendMs, sentMs);
+    if (isHost || isClient)
     {
-        drawButton(&bottomButtons[i]);
+        StrokeTiming timing = {stroke.author, stroke.seq,
+                               {msToUs(strokeStartMs), msToUs(commitMs), msToUs(encodeMs), msToUs(sendMs), msToUs(sentMs)}};
+        sendData(encodeStrokeTiming(timing));
     }
-
-    drawBottomToolbar();
-    glFlush();
 }
 
-void init()
+void sendStrokeOp(char op, uint32_t author, uint32_t seq)
 {
-    glClearColor(1.0, 1.0, 1.0, 1.0);
-    glColor3f(0.0, 0.0, 0.0);
-    glPointSize(2.0);
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    gluOrtho2D(0.0, windowWidth, windowHeight, 0.0);
-
-    createNewBoard();
-    isRightSidebarVisible = false;
-    rightSidebarPosition = RIGHT_SIDEBAR_WIDTH;
+    sendData(encodeStrokeOp(op, author, seq));
+}
 
-    initColorButtons(); // Initialize color buttons
+void sendClear(uint32_t author, uint32_t seq, uint64_t stamp)
+{
+    sendData(encodeClear(author, seq, stamp));
 }
 
-void cleanup()
+// The caller holds strokesMutex
+void noteRemoteArrival(const Stroke &stroke)
 {
-    if (clientSocket != INVALID_SOCKET)
-    {
-        closesocket(clientSocket);
-    }
-    if (hostSocket != INVALID_SOCKET)
+    if (remoteArrivals.size() < MAX_PENDING_ARRIVALS)
     {
-        closesocket(hostSocket);
+        RemoteArrival arrival = {nowMs(), stroke.author, stroke.seq};
+        remoteArrivals.push_back(arrival);
     }
-    WSACleanup();
 }
 
-void startHost()
+// Clock probes and the sender's stage times of a stroke, from the peer
+// with id from. Sender spans are moved onto our clock; recv is late by up
+// to a poll interval on both sides, which the shortest-round-trip probe
+// mostly avoids. Neither is relayed, as offsets only hold between the two
+// ends of one connection.
+void receiveTimingMessage(const std::string &message, uint32_t from)
 {
-    struct addrinfo *result = NULL, hints;
-    ZeroMemory(&hints, sizeof(hints));
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_protocol = IPPROTO_TCP;
-    hints.ai_flags = AI_PASSIVE;
-
-    if (getaddrinfo(NULL, "27015", &hints, &result) != 0)
+    char type;
+    int64_t time, remoteTime;
+    if (decodeClockProbe(message, type, time, remoteTime))
     {
-        std::cerr << "getaddrinfo failed.\n";
-        WSACleanup();
+        if (type == 'P')
+        {
+            sendToPeer(from, encodeClockProbe('Q', time, msToUs(lastReceiveMs)));
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(peersMutex);
+            Peer *peer = findPeer(from);
+            if (peer)
+            {
+                clockSyncSample(peer->clock, time / 1000.0, remoteTime / 1000.0, lastReceiveMs);
+            }
+        }
         return;
     }
 
-    hostSocket = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
-    if (hostSocket == INVALID_SOCKET)
+    StrokeTiming timing;
+    if (!decodeStrokeTiming(message, timing))
     {
-        std::cerr << "Error at socket(): " << WSAGetLastError() << "\n";
-        freeaddrinfo(result);
-        WSACleanup();
+        parseErrors++;
         return;
     }
+    double offsetMs, rttMs;
+    uint64_t lastStrokeKey;
+    double lastStrokeReceiveMs;
+    {
+        std::lock_guard<std::mutex> lock(peersMutex);
+        Peer *peer = findPeer(from);
+        if (!peer || !clockSyncEstimate(peer->clock, offsetMs, rttMs))
+        {
+            return;
+        }
+        lastStrokeKey = peer->lastStrokeKey;
+        lastStrokeReceiveMs = peer->lastStrokeReceiveMs;
+    }
+    double ms[5];
+    for (int i = 0; i < 5; i++)
+    {
+        ms[i] = timing.us[i] / 1000.0 - offsetMs;
+    }
+    spanRecord(strokeSpans, timing.author, timing.author, timing.seq, SPAN_CAPTURE, ms[0], ms[1]);
+    spanRecord(strokeSpans, timing.author, timing.author, timing.seq, SPAN_COMMIT, ms[1], ms[2]);
+    spanRecord(strokeSpans, timing.author, timing.author, timing.seq, SPAN_SERIALIZE, ms[2], ms[3]);
+    spanRecord(strokeSpans, timing.author, timing.author, timing.seq, SPAN_SEND, ms[3], ms[4]);
+    if (strokeKey(timing.author, timing.seq) == lastStrokeKey)
+    {
+        double arrivedMs = std::min(ms[4] + rttMs * 0.5, lastStrokeReceiveMs);
+        spanRecord(strokeSpans, timing.author, timing.author, timing.seq, SPAN_NETWORK, ms[4], arrivedMs);
+        spanRecord(strokeSpans, localAuthor, timing.author, timing.seq, SPAN_POLL_WAIT, arrivedMs, lastStrokeReceiveMs);
+    }
+}
 
-    if (bind(hostSocket, result->ai_addr, (int)result->ai_addrlen) == SOCKET_ERROR)
+// Credit the host handed back, or C 0 saying it will; whatever was
+// waiting for it goes out now
+void receiveCredit(const std::string &message, uint32_t from)
+{
+    int64_t bytes;
+    if (!decodeCredit(message, bytes))
     {
-        std::cerr << "bind failed with error: " << WSAGetLastError() << "\n";
-        freeaddrinfo(result);
-        closesocket(hostSocket);
-        WSACleanup();
+        parseErrors++;
         return;
     }
+    std::lock_guard<std::mutex> lock(peersMutex);
+    Peer *peer = findPeer(from);
+    if (peer)
+    {
+        peer->creditFromHost = true;
+        peer->sendCredit += bytes;
+        flushPeer(*peer);
+    }
+    flushSends();
+}
 
-    freeaddrinfo(result);
-
-    if (listen(hostSocket, SOMAXCONN) == SOCKET_ERROR)
+// Moves another peer's cursor; our own comes back when replaying
+void receivePresence(const std::string &message)
+{
+    CursorState cursor;
+    if (!decodePresence(message, cursor) || cursor.author == 0)
     {
-        std::cerr << "Listen failed with error: " << WSAGetLastError() << "\n";
-        closesocket(hostSocket);
-        WSACleanup();
+        parseErrors++;
         return;
     }
-
-    clientSocket = accept(hostSocket, NULL, NULL);
-    if (clientSocket == INVALID_SOCKET)
+    if (cursor.author == localAuthor)
     {
-        std::cerr << "accept failed: " << WSAGetLastError() << "\n";
-        closesocket(hostSocket);
-        WSACleanup();
         return;
     }
-
-    // Set the socket to non-blocking mode
-    u_long mode = 1; // 1 to enable non-blocking socket
-    ioctlsocket(clientSocket, FIONBIO, &mode);
-
-    isHost = true;
-    std::cout << "Client connected.\n";
+    {
+        std::lock_guard<std::mutex> lock(presenceMutex);
+        bool known = remoteCursors.count(cursor.author) > 0;
+        cursorUpdate(remoteCursors[cursor.author], cursor, known, nowMs());
+    }
+    requestRedraw();
 }
 
-void connectToHost(const char *hostname)
+// Applies a message from the peer with id from, or 0 when replaying; it
+// may still end with its newline. Returns false for a stroke or clear that
+// was already applied, or a message that could not be parsed, which the
+// host then does not relay. Undo and redo set a state, so they are safe
+// to apply again as they are.
+bool receiveMessage(const std::string &message, uint32_t from)
 {
-    struct addrinfo *result = NULL, *ptr = NULL, hints;
-    ZeroMemory(&hints, sizeof(hints));
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_protocol = IPPROTO_TCP;
+    recordMessage(message);
+    traffic.messagesIn++;
+    if (!message.empty() && (message[0] == 'T' || message[0] == 'P' || message[0] == 'Q'))
+    {
+        receiveTimingMessage(message, from);
+        return true;
+    }
+    if (!message.empty() && message[0] == 'C')
+    {
+        receiveCredit(message, from);
+        return true;
+    }
+    if (!message.empty() && message[0] == 'M')
+    {
+        receivePresence(message);
+        return true;
+    }
 
-    if (getaddrinfo(hostname, "27015", &hints, &result) != 0)
+    double parseMs = nowMs();
+    char type;
+    Stroke stroke;
+    if (!decodeMessage(message, type, stroke))
     {
-        std::cerr << "getaddrinfo failed.\n";
-        WSACleanup();
-        return;
+        parseErrors++;
+        return false;
     }
+    double applyMs = nowMs();
 
-    for (ptr = result; ptr != NULL; ptr = ptr->ai_next)
+    if (type == 'U' || type == 'R')
     {
-        clientSocket = socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol);
-        if (clientSocket == INVALID_SOCKET)
+        std::lock_guard<std::mutex> lock(strokesMutex);
+        if (setStrokeRemoved(stroke.author, stroke.seq, type == 'U'))
         {
-            std::cerr << "Error at socket(): " << WSAGetLastError() << "\n";
-            WSACleanup();
-            return;
+            noteRemoteArrival(stroke);
+            requestRedraw();
         }
+        return true;
+    }
 
-        if (connect(clientSocket, ptr->ai_addr, (int)ptr->ai_addrlen) == SOCKET_ERROR)
+    if (type == 'K')
+    {
+        std::lock_guard<std::mutex> lock(strokesMutex);
+        if (!markStrokeSeen(strokesSeen, stroke.author, stroke.seq))
         {
-            closesocket(clientSocket);
-            clientSocket = INVALID_SOCKET;
-            continue;
+            duplicateStrokes++;
+            return false;
         }
-        break;
+        strokeClock = std::max(strokeClock, stroke.stamp);
+        applyClear(stroke.author, stroke.stamp);
+        requestRedraw();
+        return true;
     }
 
-    freeaddrinfo(result);
+    {
+        std::lock_guard<std::mutex> lock(strokesMutex); // Lock the strokes vector
+        if (!markStrokeSeen(strokesSeen, stroke.author, stroke.seq))
+        {
+            duplicateStrokes++;
+            return false;
+        }
+        // Drawn before a clear that got here first; peers that got the
+        // stroke first cleared it away too
+        if (clearedAway(stroke))
+        {
+            strokeClock = std::max(strokeClock, stroke.stamp);
+            return true;
+        }
+        stackRemoteStroke(stroke);
+        journalAddStroke(journal, currentBoardIndex, stroke);
+        noteRemoteArrival(stroke);
+        requestRedraw();
+    }
 
-    if (clientSocket == INVALID_SOCKET)
+    spanRecord(strokeSpans, localAuthor, stroke.author, stroke.seq, SPAN_PARSE, parseMs, applyMs);
+    spanRecord(strokeSpans, localAuthor, stroke.author, stroke.seq, SPAN_APPLY, applyMs, nowMs());
+    std::lock_guard<std::mutex> lock(peersMutex);
+    Peer *peer = findPeer(from);
+    if (peer)
     {
-        std::cerr << "Unable to connect to server!\n";
-        WSACleanup();
-        return;
+        peer->lastStrokeKey = strokeKey(stroke.author, stroke.seq);
+        peer->lastStrokeReceiveMs = lastReceiveMs;
     }
+    return true;
+}
 
-    // Set the socket to non-blocking mode
-    u_long mode = 1; // 1 to enable non-blocking socket
-    ioctlsocket(clientSocket, FIONBIO, &mode);
+struct IncomingMessage
+{
+    uint32_t peer;
+    double receivedMs;
+    SharedBytes line; // With its newline, so the host can relay it as is
+    SharedCredit credit; // The sender's, for what it sent on credit
+};
 
-    isClient = true;
-    std::cout << "Connected to host.\n";
+// Hands back, once enough has built up, the credit of what each client
+// sent that the host is finished with
+void grantCredit()
+{
+    std::lock_guard<std::mutex> lock(peersMutex);
+    for (size_t i = 0; i < peers.size(); i++)
+    {
+        int64_t returned = *peers[i].creditReturned;
+        if (returned >= CREDIT_GRANT_BYTES)
+        {
+            *peers[i].creditReturned -= returned;
+            SharedBytes grant = std::make_shared<const std::string>(encodeCredit(returned));
+            queueForPeer(peers[i], grant, std::vector<SharedBytes>(), LANE_LIVE, SharedCredit(), nowMs());
+        }
+    }
+    flushSends();
 }
 
-void sendData(const std::string &data)
+// A recv can end in the middle of a message, so bytes stay in the peer's
+// buffer until the newline that ends it arrives, and the pieces of a long
+// message are joined first. Messages are handled after peersMutex is
+// released, since handling them sends. The host passes strokes, undos,
+// redos and clears on to every other peer.
+void receiveStrokes()
 {
-    if (isHost || isClient)
+    std::vector<IncomingMessage> messages;
+    size_t receiveBytes = 0, sendBytes = 0;
+    {
+        std::lock_guard<std::mutex> lock(peersMutex);
+        for (size_t i = 0; i < peers.size(); i++)
+        {
+            Peer &peer = peers[i];
+            receiveData(peer);
+            double receivedMs = nowMs();
+            size_t start = 0, end;
+            while ((end = peer.receiveBuffer.find('\n', start)) != std::string::npos)
+            {
+                bool malformed;
+                SharedBytes line =
+                    joinChunk(peer.chunks, peer.receiveBuffer, start, end + 1 - start, PEER_QUEUE_LIMIT, malformed);
+                start = end + 1;
+                if (malformed)
+                {
+                    parseErrors++;
+                }
+                if (!line)
+                {
+                    continue;
+                }
+                if ((*line)[0] == 'M')
+                {
+                    peer.presenceBytesIn += line->size();
+                    if (isHost && !budgetTake(peer.presenceInBudget, line->size(), PRESENCE_IN_BYTES_PER_S, receivedMs))
+                    {
+                        peer.presenceDrops++;
+                        continue;
+                    }
+                }
+                IncomingMessage message = {peer.id, receivedMs, line, SharedCredit()};
+                if (isHost && messageLane(*line) != LANE_LIVE)
+                {
+                    message.credit = holdCredit(peer.creditReturned, line->size());
+                }
+                messages.push_back(message);
+                peer.messagesIn++;
+            }
+            peer.receiveBuffer.erase(0, start);
+
+            // Whatever earlier sends left queued
+            flushPeer(peer);
+            receiveBytes += peer.receiveBuffer.size();
+            sendBytes += peer.queuedBytes;
+        }
+        flushSends();
+
+        for (size_t i = peers.size(); i-- > 0;)
+        {
+            if (!peers[i].connected)
+            {
+                std::cout << "Peer " << peers[i].id << " disconnected.\n";
+                peers.erase(peers.begin() + i);
+            }
+        }
+    }
+    receiveQueueBytes = receiveBytes;
+    sendQueueBytes = sendBytes;
+
+    for (size_t i = 0; i < messages.size(); i++)
     {
-        int iResult = send(clientSocket, data.c_str(), data.length(), 0);
-        if (iResult == SOCKET_ERROR)
+        const std::string &text = *messages[i].line;
+        lastReceiveMs = messages[i].receivedMs;
+        bool applied = receiveMessage(text, messages[i].peer);
+        if (applied && isHost && (text[0] == 'S' || text[0] == 'U' || text[0] == 'R' || text[0] == 'K'))
+        {
+            sendToPeers(messages[i].line, messages[i].peer, messages[i].credit);
+        }
+        CursorState cursor;
+        if (isHost && text[0] == 'M' && decodePresence(text, cursor) && cursor.author != 0)
         {
-            std::cerr << "send failed: " << WSAGetLastError() << "\n";
-            closesocket(clientSocket);
-            WSACleanup();
+            sendPresenceToPeers(messages[i].line, cursor.author, messages[i].peer);
         }
     }
+    if (isHost)
+    {
+        messages.clear(); // Lets go of the credit of what was not relayed
+        grantCredit();
+    }
 }
 
-std::string receiveData()
+void acceptPeers()
 {
-    char recvbuf[512];
-    int iResult = recv(clientSocket, recvbuf, 512, 0);
-    if (iResult > 0)
+    if (hostSocket == NET_INVALID)
     {
-        recvbuf[iResult] = '\0';
-        return std::string(recvbuf);
+        return;
     }
-    else if (iResult == 0)
+    NetSocket socket;
+    while ((socket = netAccept(hostSocket)) != NET_INVALID)
     {
-        std::cout << "Connection closed\n";
-        closesocket(clientSocket);
-        clientSocket = INVALID_SOCKET;
+        addPeer(socketTransport(socket));
+        std::cout << "Client connected.\n";
     }
-    else
+    while (localSocket != NET_INVALID && (socket = netAccept(localSocket)) != NET_INVALID)
     {
-        if (WSAGetLastError() != WSAEWOULDBLOCK)
+        Transport transport;
+        if (shmAccept(socket, transport))
         {
-            std::cerr << "recv failed: " << WSAGetLastError() << "\n";
-            closesocket(clientSocket);
-            clientSocket = INVALID_SOCKET;
+            addPeer(transport);
+            std::cout << "Local client connected.\n";
         }
     }
-    return "";
 }
 
-void sendStroke(const Stroke &stroke)
+// Messages per second over the last window, for the metrics endpoint;
+// network thread only
+TrafficRates networkRates = {0, 0, 0, 0};
+uint64_t networkRatesBase[4] = {0, 0, 0, 0};
+double networkRatesMs = 0;
+
+std::string buildMetrics()
 {
-    std::stringstream ss;
-    ss << stroke.isEraser << " " << stroke.size << " " << stroke.color[0] << " " << stroke.color[1] << " " << stroke.color[2] << " ";
-    for (size_t i = 0; i < stroke.lines.size(); i++)
-    {
-        const Line &line = stroke.lines[i];
-        ss << line.x1 << " " << line.y1 << " " << line.x2 << " " << line.y2 << " ";
+    std::stringstream out;
+    metricFamily(out, "instantboard_messages_total", "counter", "Messages received, and queued for sending summed over peers");
+    metricSample(out, "instantboard_messages_total", metricLabel("direction", "in"), traffic.messagesIn);
+    metricSample(out, "instantboard_messages_total", metricLabel("direction", "out"), traffic.messagesOut);
+    metricFamily(out, "instantboard_messages_per_second", "gauge", "Message rate over the last 5 s");
+    metricSample(out, "instantboard_messages_per_second", metricLabel("direction", "in"), networkRates.messagesIn);
+    metricSample(out, "instantboard_messages_per_second", metricLabel("direction", "out"), networkRates.messagesOut);
+    metricFamily(out, "instantboard_bytes_total", "counter", "Bytes read from and written to sockets");
+    metricSample(out, "instantboard_bytes_total", metricLabel("direction", "in"), traffic.bytesIn);
+    metricSample(out, "instantboard_bytes_total", metricLabel("direction", "out"), traffic.bytesOut);
+    metricFamily(out, "instantboard_socket_syscalls_total", "counter", "Socket system calls, each io_uring_enter counted once");
+    metricSample(out, "instantboard_socket_syscalls_total", metricLabel("backend", netBackend()), netSyscalls());
+    metricFamily(out, "instantboard_parse_errors_total", "counter", "Messages that could not be parsed");
+    metricSample(out, "instantboard_parse_errors_total", "", parseErrors);
+    metricFamily(out, "instantboard_duplicate_strokes_total", "counter", "Strokes received again and dropped");
+    metricSample(out, "instantboard_duplicate_strokes_total", "", duplicateStrokes);
+    metricFamily(out, "instantboard_journal_pending_bytes", "gauge", "Journal records not written yet");
+    metricSample(out, "instantboard_journal_pending_bytes", "", journalPendingBytes(journal));
+
+    {
+        std::lock_guard<std::mutex> lock(peersMutex);
+        metricFamily(out, "instantboard_peers_connected", "gauge", "Open peer connections");
+        metricSample(out, "instantboard_peers_connected", "", peers.size());
+        metricFamily(out, "instantboard_peer_messages_total", "counter", "Messages per peer");
+        for (size_t i = 0; i < peers.size(); i++)
+        {
+            std::string peer = metricLabel("peer", toString(peers[i].id));
+            metricSample(out, "instantboard_peer_messages_total", peer + "," + metricLabel("direction", "in"), peers[i].messagesIn);
+            metricSample(out, "instantboard_peer_messages_total", peer + "," + metricLabel("direction", "out"), peers[i].messagesOut);
+        }
+        metricFamily(out, "instantboard_peer_bytes_total", "counter", "Bytes per peer");
+        for (size_t i = 0; i < peers.size(); i++)
+        {
+            std::string peer = metricLabel("peer", toString(peers[i].id));
+            metricSample(out, "instantboard_peer_bytes_total", peer + "," + metricLabel("direction", "in"), peers[i].bytesIn);
+            metricSample(out, "instantboard_peer_bytes_total", peer + "," + metricLabel("direction", "out"), peers[i].bytesOut);
+        }
+        metricFamily(out, "instantboard_peer_queue_bytes", "gauge", "Bytes waiting to be sent to a peer");
+        for (size_t i = 0; i < peers.size(); i++)
+        {
+            metricSample(out, "instantboard_peer_queue_bytes", metricLabel("peer", toString(peers[i].id)), peers[i].queuedBytes);
+        }
+        metricFamily(out, "instantboard_peer_lane_queue_bytes", "gauge", "Bytes waiting to be sent to a peer, per lane");
+        for (size_t i = 0; i < peers.size(); i++)
+        {
+            std::string peer = metricLabel("peer", toString(peers[i].id));
+            for (int lane = 0; lane < LANE_COUNT; lane++)
+            {
+                metricSample(out, "instantboard_peer_lane_queue_bytes", peer + "," + metricLabel("lane", LANE_NAMES[lane]),
+                             peers[i].lanes.bytes[lane]);
+            }
+        }
+        metricFamily(out, "instantboard_lane_wait_ms", "gauge",
+                     "Time from queueing a message to its last byte going out, over the last 5 to 10 s");
+        for (int lane = 0; lane < LANE_COUNT; lane++)
+        {
+            std::string labels = metricLabel("lane", LANE_NAMES[lane]);
+            metricSample(out, "instantboard_lane_wait_ms", labels + "," + metricLabel("quantile", "0.5"),
+                         rollingPercentile(laneWait[lane], 50));
+            metricSample(out, "instantboard_lane_wait_ms", labels + "," + metricLabel("quantile", "0.99"),
+                         rollingPercentile(laneWait[lane], 99));
+        }
+        metricFamily(out, "instantboard_peer_drops_total", "counter", "Messages dropped because a peer's queue was full");
+        for (size_t i = 0; i < peers.size(); i++)
+        {
+            metricSample(out, "instantboard_peer_drops_total", metricLabel("peer", toString(peers[i].id)), peers[i].drops);
+        }
+        metricFamily(out, "instantboard_peer_presence_bytes_total", "counter", "Cursor update bytes per peer");
+        for (size_t i = 0; i < peers.size(); i++)
+        {
+            std::string peer = metricLabel("peer", toString(peers[i].id));
+            metricSample(out, "instantboard_peer_presence_bytes_total", peer + "," + metricLabel("direction", "in"),
+                         peers[i].presenceBytesIn);
+            metricSample(out, "instantboard_peer_presence_bytes_total", peer + "," + metricLabel("direction", "out"),
+                         peers[i].presenceBytesOut);
+        }
+        metricFamily(out, "instantboard_peer_presence_drops_total", "counter",
+                     "Cursor updates to a peer replaced by a newer one or over its budget");
+        for (size_t i = 0; i < peers.size(); i++)
+        {
+            metricSample(out, "instantboard_peer_presence_drops_total", metricLabel("peer", toString(peers[i].id)),
+                         peers[i].presenceDrops);
+        }
     }
-    ss << "\n"; // Add a delimiter to mark the end of the stroke
-    sendData(ss.str());
+
+    std::lock_guard<std::mutex> lock(metricsMutex);
+    out << boardMetricsText;
+    return out.str();
 }
 
-void receiveStrokes()
+// A metrics request still arriving, or its response still going out
+struct Scrape
+{
+    NetSocket socket;
+    std::string request;
+    std::string response; // Empty until the request is in
+    size_t sent;
+    double acceptedMs;
+};
+
+const size_t SCRAPE_REQUEST_LIMIT = 8192;
+const double SCRAPE_TIMEOUT_MS = 2000;
+std::vector<Scrape> scrapes; // Network thread only
+
+// Moves every scrape along as far as its socket allows without waiting,
+// so a slow or stalled scraper never holds up the peers. The request is
+// only read to its end, not looked at: every path gets the metrics.
+void serveMetrics()
 {
-    std::string data = receiveData();
-    if (!data.empty())
+    if (metricsSocket == NET_INVALID)
+    {
+        return;
+    }
+    double now = nowMs();
+    NetSocket socket;
+    while ((socket = netAccept(metricsSocket)) != NET_INVALID)
+    {
+        netWatch(socket);
+        Scrape scrape = {socket, std::string(), std::string(), 0, now};
+        scrapes.push_back(scrape);
+    }
+
+    for (size_t i = scrapes.size(); i-- > 0;)
     {
-        std::stringstream ss(data);
-        Stroke stroke;
-        ss >> stroke.isEraser >> stroke.size >> stroke.color[0] >> stroke.color[1] >> stroke.color[2];
-        while (ss)
+        Scrape &scrape = scrapes[i];
+        bool failed = false;
+        if (scrape.response.empty())
         {
-            Line line;
-            ss >> line.x1 >> line.y1 >> line.x2 >> line.y2;
-            if (ss)
+            char buffer[1024];
+            int received;
+            while (scrape.request.size() < SCRAPE_REQUEST_LIMIT &&
+                   (received = netReceive(scrape.socket, buffer, sizeof(buffer))) != 0)
+            {
+                if (received < 0)
+                {
+                    failed = true;
+                    break;
+                }
+                scrape.request.append(buffer, received);
+            }
+            if (!failed && (scrape.request.find("\r\n\r\n") != std::string::npos ||
+                            scrape.request.find("\n\n") != std::string::npos ||
+                            scrape.request.size() >= SCRAPE_REQUEST_LIMIT))
             {
-                line.isEraser = stroke.isEraser;
-                line.size = stroke.size;
-                memcpy(line.color, stroke.color, sizeof(float) * 3);
-                stroke.lines.push_back(line);
+                scrape.response = metricsHttpResponse(buildMetrics());
             }
         }
-        std::lock_guard<std::mutex> lock(strokesMutex); // Lock the strokes vector
-        strokes.push_back(stroke);
-        glutPostRedisplay();
+        while (!failed && !scrape.response.empty() && scrape.sent < scrape.response.size())
+        {
+            int sent = netSend(scrape.socket, scrape.response.data() + scrape.sent,
+                               static_cast<int>(scrape.response.size() - scrape.sent));
+            if (sent <= 0)
+            {
+                failed = sent < 0;
+                break;
+            }
+            scrape.sent += sent;
+        }
+        bool answered = !scrape.response.empty() && scrape.sent == scrape.response.size();
+        if (failed || answered || now - scrape.acceptedMs > SCRAPE_TIMEOUT_MS)
+        {
+            netClose(scrape.socket);
+            scrapes.erase(scrapes.begin() + i);
+        }
+    }
+}
+
+double percentile(const std::vector<float> &sorted, int percent)
+{
+    return sorted.empty() ? 0 : sorted[std::min(sorted.size() - 1, sorted.size() * percent / 100)];
+}
+
+// Feeds the trace through the same handlers GLUT and the network thread
+// call. Background passes are waited for at every frame, so every replay
+// of a trace ends with the same boards.
+int runReplay()
+{
+    std::vector<float> frameMs;
+    size_t networkOps = 0;
+    uint64_t allocationsBefore = allocationCount;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t e = 0; e < replayEvents.size(); e++)
+    {
+        const TraceEvent &event = replayEvents[e];
+        const int32_t *args = event.args;
+        if (replayRealtime)
+        {
+            std::this_thread::sleep_until(start + std::chrono::microseconds(static_cast<int64_t>(event.timeMs * 1000.0)));
+        }
+        switch (event.type)
+        {
+        case TRACE_MOUSE_BUTTON:
+            mouseButton(args[0], args[1], args[2], args[3]);
+            break;
+        case TRACE_MOUSE_MOTION:
+            mouseMotion(args[0], args[1]);
+            break;
+        case TRACE_KEYBOARD:
+            keyboard(static_cast<unsigned char>(args[0]), args[1], args[2]);
+            break;
+        case TRACE_MOUSE_WHEEL:
+            mouseWheel(args[0], args[1], args[2], args[3]);
+            break;
+        case TRACE_RESHAPE:
+            reshape(args[0], args[1]);
+            break;
+        case TRACE_NETWORK:
+            receiveMessage(event.text, 0);
+            networkOps++;
+            break;
+        case TRACE_FRAME:
+        {
+            std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+            bool redraw = advanceFrame(args[0] / 1000.0f);
+            finishBackgroundPasses();
+            if (redraw)
+            {
+                display();
+                glFinish();
+                frameMs.push_back(elapsedMsSince(frameStart));
+            }
+            break;
+        }
+        }
+    }
+    double totalMs = elapsedMsSince(start);
+    uint64_t allocations = allocationCount - allocationsBefore;
+
+    std::sort(frameMs.begin(), frameMs.end());
+    std::cout << "Replayed " << replayEvents.size() << " events (" << networkOps << " network ops) in "
+              << totalMs << " ms\n";
+    std::cout << frameMs.size() << " frames: p50 " << percentile(frameMs, 50) << " ms, p90 "
+              << percentile(frameMs, 90) << " ms, p99 " << percentile(frameMs, 99) << " ms, max "
+              << (frameMs.empty() ? 0 : frameMs.back()) << " ms\n";
+    std::cout << allocations << " allocations (" << (frameMs.empty() ? 0 : allocations / frameMs.size())
+              << " per frame)\n";
+
+    for (size_t i = 0; i < boards.size(); i++)
+    {
+        ensureBoardResident(boards[i], sessionFile);
+        const std::vector<Stroke> &list = static_cast<int>(i) == currentBoardIndex ? strokes : boards[i].strokes;
+        std::cout << "Board " << i + 1 << ": " << list.size() << " strokes, " << boards[i].tiles.size()
+                  << " tiles, checksum " << std::hex << std::setw(16) << std::setfill('0')
+                  << boardChecksum(list, boards[i].tiles) << std::dec << std::setfill(' ') << "\n";
     }
+    return 0;
 }
 
 void networkThread()
 {
+    double lastProbeMs = 0;
     while (true)
     {
+        acceptPeers();
         receiveStrokes();
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        double now = nowMs();
+        if ((isHost || isClient) && now - lastProbeMs >= CLOCK_PROBE_INTERVAL_MS)
+        {
+            sendData(encodeClockProbe('P', msToUs(now)));
+            lastProbeMs = now;
+        }
+        if (isHost || isClient)
+        {
+            sendPresence(now);
+        }
+        expireCursors(now);
+        if (now - networkRatesMs >= PERF_WINDOW_MS)
+        {
+            networkRates = trafficRates(traffic, networkRatesBase, now - networkRatesMs);
+            networkRatesMs = now;
+            std::lock_guard<std::mutex> lock(peersMutex);
+            for (int lane = 0; lane < LANE_COUNT; lane++)
+            {
+                rollingAdvance(laneWait[lane]);
+            }
+        }
+        serveMetrics();
+        // Wakes as soon as a peer or scrape has something, so incoming
+        // strokes are not held up to the next tick
+        netWait(static_cast<int>(std::ceil(presenceWaitMs(presenceSender, now, 100))));
     }
 }
 
 int main(int argc, char **argv)
 {
+    mainThreadId = std::this_thread::get_id();
+    spanRingInit(strokeSpans, SPAN_RING_SIZE);
     glutInit(&argc, argv);
-    glutInitDisplayMode(GLUT_SINGLE | GLUT_RGB);
+    glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB);
     glutInitWindowSize(windowWidth, windowHeight);
     glutCreateWindow("InstantBoard");
 
-    WSADATA wsaData;
-    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+    bool ioUring = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-io-uring") == 0)
+        {
+            ioUring = true;
+        }
+        if (strcmp(argv[i], "-shm") == 0)
+        {
+            sharedMemory = true;
+        }
+    }
+    if (!netStartup(ioUring))
     {
-        std::cerr << "WSAStartup failed.\n";
+        std::cerr << "Network startup failed.\n";
         return 1;
     }
+    if (ioUring && strcmp(netBackend(), "io_uring") != 0)
+    {
+        std::cerr << "io_uring is not available; using " << netBackend() << ".\n";
+    }
 
     if (argc > 1 && strcmp(argv[1], "-host") == 0)
     {
@@ -1593,15 +3859,50 @@ int main(int argc, char **argv)
     glutReshapeFunc(reshape);
     glutMouseFunc(mouseButton);
     glutMotionFunc(mouseMotion);
+    glutPassiveMotionFunc(passiveMotion);
+    glutEntryFunc(pointerEntry);
     glutKeyboardFunc(keyboard);
 
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (strcmp(argv[i], "-history-kb") == 0)
+        {
+            historyLimitBytes = atoi(argv[i + 1]) * 1024;
+        }
+        if (strcmp(argv[i], "-segment-budget") == 0)
+        {
+            segmentBudget = atoi(argv[i + 1]);
+        }
+        if (strcmp(argv[i], "-board-memory-mb") == 0)
+        {
+            boardMemoryBudget = static_cast<size_t>(atoi(argv[i + 1])) * 1024 * 1024;
+        }
+        if (strcmp(argv[i], "-record") == 0)
+        {
+            recordPath = argv[i + 1];
+        }
+        if (strcmp(argv[i], "-replay") == 0 || strcmp(argv[i], "-replay-realtime") == 0)
+        {
+            replayPath = argv[i + 1];
+            replayRealtime = strcmp(argv[i], "-replay-realtime") == 0;
+        }
+    }
+
+    // Boards are recovered before anything can arrive from the network
+    init();
+
+    // GLUT ends the process with exit() when the window closes, and
+    // joinable threads must not outlive main
+    atexit(cleanup);
+    if (replayPath)
+    {
+        return runReplay();
+    }
+
     // Start the network thread
     std::thread t(networkThread);
     t.detach(); // Detach the thread to run independently
 
-    init();
     glutMainLoop();
-
-    cleanup();
     return 0;
 }
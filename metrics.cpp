@@ -0,0 +1,60 @@
+#include "metrics.h"
+#include <cmath>
+
+void metricFamily(std::ostream &out, const char *name, const char *type, const char *help)
+{
+    out << "# HELP " << name << " " << help << "\n";
+    out << "# TYPE " << name << " " << type << "\n";
+}
+
+void metricSample(std::ostream &out, const char *name, const std::string &labels, double value)
+{
+    out << name;
+    if (!labels.empty())
+    {
+        out << "{" << labels << "}";
+    }
+    // Counters would otherwise lose digits to the default precision
+    if (value == std::floor(value) && std::fabs(value) < 1e15)
+    {
+        out << " " << static_cast<long long>(value) << "\n";
+    }
+    else
+    {
+        out << " " << value << "\n";
+    }
+}
+
+std::string metricLabel(const char *key, const std::string &value)
+{
+    std::string label = key;
+    label += "=\"";
+    for (size_t i = 0; i < value.size(); i++)
+    {
+        if (value[i] == '\\' || value[i] == '"')
+        {
+            label += '\\';
+            label += value[i];
+        }
+        else if (value[i] == '\n')
+        {
+            label += "\\n";
+        }
+        else
+        {
+            label += value[i];
+        }
+    }
+    return label + "\"";
+}
+
+std::string metricsHttpResponse(const std::string &body)
+{
+    std::stringstream ss;
+    ss << "HTTP/1.0 200 OK\r\n"
+       << "Content-Type: text/plain; version=0.0.4\r\n"
+       << "Content-Length: " << body.size() << "\r\n"
+       << "Connection: close\r\n\r\n"
+       << body;
+    return ss.str();
+}
@@ -0,0 +1,21 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <sstream>
+#include <string>
+
+// Session telemetry in the Prometheus text exposition format (version
+// 0.0.4), served by the host over plain HTTP on a loopback-only port so
+// it can be scraped during a session.
+
+const char *const METRICS_PORT = "9464";
+
+// # HELP and # TYPE lines; type is "counter" or "gauge"
+void metricFamily(std::ostream &out, const char *name, const char *type, const char *help);
+// labels is empty or a list like peer="1",direction="in"
+void metricSample(std::ostream &out, const char *name, const std::string &labels, double value);
+std::string metricLabel(const char *key, const std::string &value); // Escapes the value
+
+std::string metricsHttpResponse(const std::string &body);
+
+#endif
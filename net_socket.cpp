@@ -0,0 +1,464 @@
+#include "net_socket.h"
+#include "net_uring.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <vector>
+#ifdef _WIN32
+#define _WIN32_WINNT 0x0601 // Windows 7 or later
+#define FD_SETSIZE 1024     // Sockets netWait can select on
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+static std::vector<NetSocket> watched;
+#else
+static int epollFd = -1;
+// Per descriptor: not watched, watched and read to EAGAIN since epoll last
+// signalled it, or signalled input not yet read to EAGAIN
+enum WatchState
+{
+    UNWATCHED,
+    WATCHED_IDLE,
+    WATCHED_READY
+};
+static std::vector<uint8_t> watchStates;
+static size_t readyCount = 0;
+#endif
+static std::mutex watchMutex;
+static bool uringActive = false;
+static std::atomic<uint64_t> syscalls(0);
+static std::atomic<bool> stayAwake(false);
+
+const char *netBackend()
+{
+#ifdef _WIN32
+    return "winsock";
+#else
+    return uringActive ? "io_uring" : "epoll";
+#endif
+}
+
+uint64_t netSyscalls()
+{
+    return syscalls + uringEnters();
+}
+
+int netLastError()
+{
+#ifdef _WIN32
+    return WSAGetLastError();
+#else
+    return errno;
+#endif
+}
+
+static void setLastError(int error)
+{
+#ifdef _WIN32
+    WSASetLastError(error);
+#else
+    errno = error;
+#endif
+}
+
+static bool wouldBlock()
+{
+#ifdef _WIN32
+    int error = WSAGetLastError();
+    return error == WSAEWOULDBLOCK || error == WSAETIMEDOUT;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+static void closeRaw(NetSocket socket)
+{
+#ifdef _WIN32
+    closesocket(static_cast<SOCKET>(socket));
+#else
+    close(static_cast<int>(socket));
+#endif
+}
+
+static void setNonBlocking(NetSocket socket, bool nonBlocking)
+{
+#ifdef _WIN32
+    u_long mode = nonBlocking ? 1 : 0;
+    ioctlsocket(static_cast<SOCKET>(socket), FIONBIO, &mode);
+#else
+    int flags = fcntl(static_cast<int>(socket), F_GETFL);
+    fcntl(static_cast<int>(socket), F_SETFL, nonBlocking ? flags | O_NONBLOCK : flags & ~O_NONBLOCK);
+#endif
+}
+
+#ifndef _WIN32
+// The caller holds watchMutex
+static void setWatchState(NetSocket socket, WatchState state)
+{
+    size_t fd = static_cast<size_t>(socket);
+    if (fd >= watchStates.size())
+    {
+        watchStates.resize(fd + 1, UNWATCHED);
+    }
+    readyCount += (state == WATCHED_READY) - (watchStates[fd] == WATCHED_READY);
+    watchStates[fd] = static_cast<uint8_t>(state);
+}
+
+static void setReady(NetSocket socket, bool ready)
+{
+    std::lock_guard<std::mutex> lock(watchMutex);
+    size_t fd = static_cast<size_t>(socket);
+    if (fd < watchStates.size() && watchStates[fd] != UNWATCHED)
+    {
+        setWatchState(socket, ready ? WATCHED_READY : WATCHED_IDLE);
+    }
+}
+
+// A watched socket epoll has not signalled since it last read to EAGAIN
+// has nothing to read, so the call can be skipped
+static bool knownIdle(NetSocket socket)
+{
+    std::lock_guard<std::mutex> lock(watchMutex);
+    size_t fd = static_cast<size_t>(socket);
+    return fd < watchStates.size() && watchStates[fd] == WATCHED_IDLE;
+}
+#endif
+
+bool netStartup(bool ioUring)
+{
+#ifdef _WIN32
+    (void)ioUring;
+    WSADATA wsaData;
+    return WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+#else
+    uringActive = ioUring && uringStart();
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    return epollFd >= 0;
+#endif
+}
+
+void netCleanup()
+{
+#ifdef _WIN32
+    WSACleanup();
+#else
+    if (uringActive)
+    {
+        uringStop();
+        uringActive = false;
+    }
+    if (epollFd >= 0)
+    {
+        close(epollFd);
+        epollFd = -1;
+    }
+#endif
+}
+
+NetSocket netListen(const char *port, bool loopbackOnly)
+{
+    struct addrinfo *result = NULL, hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    hints.ai_flags = loopbackOnly ? 0 : AI_PASSIVE;
+
+    if (getaddrinfo(loopbackOnly ? "127.0.0.1" : NULL, port, &hints, &result) != 0)
+    {
+        return NET_INVALID;
+    }
+    NetSocket listener = static_cast<NetSocket>(socket(result->ai_family, result->ai_socktype, result->ai_protocol));
+    if (listener == NET_INVALID)
+    {
+        freeaddrinfo(result);
+        return NET_INVALID;
+    }
+#ifndef _WIN32
+    // A restarted host can take the port back while old connections linger
+    int on = 1;
+    setsockopt(static_cast<int>(listener), SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+#endif
+    if (bind(listener, result->ai_addr, (int)result->ai_addrlen) != 0 || listen(listener, SOMAXCONN) != 0)
+    {
+        int error = netLastError();
+        freeaddrinfo(result);
+        closeRaw(listener);
+        setLastError(error);
+        return NET_INVALID;
+    }
+    freeaddrinfo(result);
+    setNonBlocking(listener, true);
+    return listener;
+}
+
+NetSocket netConnect(const char *host, const char *port)
+{
+    struct addrinfo *result = NULL, *ptr = NULL, hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    if (getaddrinfo(host, port, &hints, &result) != 0)
+    {
+        return NET_INVALID;
+    }
+    NetSocket connection = NET_INVALID;
+    for (ptr = result; ptr != NULL && connection == NET_INVALID; ptr = ptr->ai_next)
+    {
+        connection = static_cast<NetSocket>(socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol));
+        if (connection != NET_INVALID && connect(connection, ptr->ai_addr, (int)ptr->ai_addrlen) != 0)
+        {
+            closeRaw(connection);
+            connection = NET_INVALID;
+        }
+    }
+    freeaddrinfo(result);
+    if (connection != NET_INVALID)
+    {
+        setNonBlocking(connection, true);
+    }
+    return connection;
+}
+
+NetSocket netAccept(NetSocket listener)
+{
+    if (uringActive && uringOwns(listener))
+    {
+        return uringAccept(listener);
+    }
+#ifndef _WIN32
+    if (knownIdle(listener))
+    {
+        return NET_INVALID;
+    }
+#endif
+    syscalls++;
+#ifdef _WIN32
+    SOCKET accepted = accept(static_cast<SOCKET>(listener), NULL, NULL);
+    if (accepted == INVALID_SOCKET)
+    {
+        return NET_INVALID;
+    }
+    setNonBlocking(accepted, true);
+    return static_cast<NetSocket>(accepted);
+#else
+    int accepted = accept4(static_cast<int>(listener), NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (accepted < 0 && wouldBlock())
+    {
+        setReady(listener, false);
+    }
+    return accepted < 0 ? NET_INVALID : accepted;
+#endif
+}
+
+void netClose(NetSocket socket)
+{
+    if (uringActive && uringClose(socket))
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(watchMutex);
+#ifdef _WIN32
+    watched.erase(std::remove(watched.begin(), watched.end(), socket), watched.end());
+#else
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, static_cast<int>(socket), NULL);
+    setWatchState(socket, UNWATCHED);
+#endif
+    closeRaw(socket);
+}
+
+int netSend(NetSocket socket, const char *data, int length)
+{
+    syscalls++;
+#ifdef _WIN32
+    int sent = send(static_cast<SOCKET>(socket), data, length, 0);
+#else
+    int sent = static_cast<int>(send(static_cast<int>(socket), data, length, MSG_NOSIGNAL));
+#endif
+    if (sent < 0)
+    {
+        return wouldBlock() ? 0 : -1;
+    }
+    return sent;
+}
+
+// An orderly close from the other end leaves the last error at 0
+int netReceive(NetSocket socket, char *buffer, int length)
+{
+    if (uringActive && uringOwns(socket))
+    {
+        return uringReceive(socket, buffer, length);
+    }
+#ifndef _WIN32
+    if (knownIdle(socket))
+    {
+        return 0;
+    }
+#endif
+    syscalls++;
+#ifdef _WIN32
+    int received = recv(static_cast<SOCKET>(socket), buffer, length, 0);
+#else
+    int received = static_cast<int>(recv(static_cast<int>(socket), buffer, length, 0));
+#endif
+    if (received == 0)
+    {
+        setLastError(0);
+        return -1;
+    }
+    if (received < 0)
+    {
+        if (!wouldBlock())
+        {
+            return -1;
+        }
+#ifndef _WIN32
+        setReady(socket, false);
+#endif
+        return 0;
+    }
+    return received;
+}
+
+void netWatch(NetSocket socket)
+{
+    if (uringActive && uringWatch(socket))
+    {
+        return;
+    }
+#ifdef _WIN32
+    std::lock_guard<std::mutex> lock(watchMutex);
+    watched.push_back(socket);
+#else
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.fd = static_cast<int>(socket);
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, static_cast<int>(socket), &event);
+    // Input that came before it was watched raises no edge
+    std::lock_guard<std::mutex> lock(watchMutex);
+    setWatchState(socket, WATCHED_READY);
+#endif
+}
+
+void netWait(int timeoutMs)
+{
+    if (stayAwake.exchange(false))
+    {
+        timeoutMs = 0;
+    }
+    if (uringActive)
+    {
+        uringWait(timeoutMs);
+        return;
+    }
+    syscalls++;
+#ifdef _WIN32
+    fd_set readable;
+    FD_ZERO(&readable);
+    {
+        std::lock_guard<std::mutex> lock(watchMutex);
+        for (size_t i = 0; i < watched.size() && i < FD_SETSIZE; i++)
+        {
+            FD_SET(static_cast<SOCKET>(watched[i]), &readable);
+        }
+    }
+    if (readable.fd_count == 0)
+    {
+        Sleep(timeoutMs);
+        return;
+    }
+    struct timeval timeout;
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_usec = (timeoutMs % 1000) * 1000;
+    select(0, &readable, NULL, NULL, &timeout);
+#else
+    {
+        std::lock_guard<std::mutex> lock(watchMutex);
+        if (readyCount > 0)
+        {
+            timeoutMs = 0;
+        }
+    }
+    struct epoll_event events[64];
+    int count = epoll_wait(epollFd, events, 64, timeoutMs);
+    for (int i = 0; i < count; i++)
+    {
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+        {
+            setReady(events[i].data.fd, true);
+        }
+    }
+#endif
+}
+
+void netStayAwake()
+{
+    stayAwake = true;
+}
+
+void netFlush()
+{
+    if (uringActive)
+    {
+        uringFlush();
+    }
+}
+
+Transport socketTransport(NetSocket socket)
+{
+    int on = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&on), sizeof(on));
+    netWatch(socket);
+
+    Transport transport;
+    transport.send = [socket](const SharedBytes &data, size_t offset)
+    {
+        int sent = uringActive && uringOwns(socket)
+                       ? uringSend(socket, data, offset)
+                       : netSend(socket, data->data() + offset, static_cast<int>(data->size() - offset));
+        if (sent < 0)
+        {
+            std::cerr << "send failed: " << netLastError() << "\n";
+        }
+        return sent;
+    };
+    transport.receive = [socket](char *buffer, int length)
+    {
+        int received = netReceive(socket, buffer, length);
+        if (received < 0)
+        {
+            if (netLastError() == 0)
+            {
+                std::cout << "Connection closed\n";
+            }
+            else
+            {
+                std::cerr << "recv failed: " << netLastError() << "\n";
+            }
+        }
+        return received;
+    };
+    transport.close = [socket]()
+    {
+        netClose(socket);
+    };
+    return transport;
+}
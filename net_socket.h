@@ -0,0 +1,59 @@
+#ifndef NET_SOCKET_H
+#define NET_SOCKET_H
+
+#include "transport.h"
+#include <cstdint>
+
+// Non-blocking TCP sockets for peer connections and the metrics port.
+//
+// There are three implementations. On Windows it is Winsock, and netWait
+// is a select over the watched sockets. On Linux the watched sockets sit
+// in an epoll set, edge-triggered, or go through io_uring when that is
+// asked for and the kernel has it (see net_uring.h). A socket that
+// signalled input stays in a ready list until a read or accept on it
+// would block, and netWait does not sleep while that list is non-empty,
+// so a reader that stops early to be fair to other peers is not left
+// waiting for an edge that will not come. A socket that has not
+// signalled since its last read would block returns 0 from netReceive
+// without a system call, so idle peers cost nothing per pass. Peer
+// sockets get TCP_NODELAY, since every message is a small write that
+// should leave at once.
+
+typedef intptr_t NetSocket; // SOCKET on Windows, a file descriptor elsewhere
+const NetSocket NET_INVALID = -1;
+
+// ioUring is only a preference; netBackend says what is in use
+bool netStartup(bool ioUring);
+void netCleanup();
+const char *netBackend(); // "winsock", "epoll" or "io_uring"
+int netLastError();       // WSAGetLastError or errno
+// Socket calls made so far, counting each io_uring_enter as one
+uint64_t netSyscalls();
+
+// Listens on every interface, or on 127.0.0.1 only
+NetSocket netListen(const char *port, bool loopbackOnly);
+// Blocks until connected; the socket is non-blocking after that
+NetSocket netConnect(const char *host, const char *port);
+// NET_INVALID when no connection is waiting
+NetSocket netAccept(NetSocket listener);
+void netClose(NetSocket socket); // Also stops watching it
+
+// Bytes moved, 0 if the call would block, -1 once the connection is gone
+int netSend(NetSocket socket, const char *data, int length);
+int netReceive(NetSocket socket, char *buffer, int length);
+
+// Sockets netWait wakes up for
+void netWatch(NetSocket socket);
+// Up to timeoutMs until a watched socket can be read or written
+void netWait(int timeoutMs);
+// The next netWait returns at once; for input that was left unread
+// somewhere netWait does not watch
+void netStayAwake();
+// Hands queued sends to the kernel; io_uring holds them until then, so
+// callers flush once after a broadcast rather than once per peer
+void netFlush();
+
+// A watched peer connection; closing it closes the socket
+Transport socketTransport(NetSocket socket);
+
+#endif
@@ -0,0 +1,679 @@
+#include "net_uring.h"
+
+#ifdef __linux__
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+const unsigned URING_ENTRIES = 1024;
+const unsigned URING_COMPLETIONS = 16384;
+const unsigned RECEIVE_BUFFERS = 512;
+const unsigned RECEIVE_BUFFER_SIZE = 16384;
+const uint16_t BUFFER_GROUP = 0;
+// Bytes one socket can have waiting here before uringSend takes no more,
+// like a socket's send buffer
+const size_t SEND_WINDOW_BYTES = 256 * 1024;
+
+enum UringOp
+{
+    OP_RECEIVE = 1, // Or accept, for a listener
+    OP_SEND,
+    OP_CANCEL,
+    OP_BUFFERS
+};
+
+struct PendingSend
+{
+    SharedBytes data;
+    size_t offset;
+};
+
+struct UringSocket
+{
+    int fd;
+    bool listener;
+    bool receiving; // The multishot receive or accept is armed
+    bool sending;   // The front of output is in flight
+    bool ended;     // Input ended or the connection failed
+    bool closing;   // Closed by us; forgotten once nothing is in flight
+    int error;      // What ended it; 0 for an orderly close
+    std::string input;
+    size_t inputOffset; // Read up to here
+    std::deque<PendingSend> output;
+    size_t outputBytes;
+    std::deque<int> accepted;
+};
+
+static int ringFd = -1;
+static void *ringMemory = MAP_FAILED;
+static size_t ringSize;
+static io_uring_sqe *sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+static size_t sqesSize;
+static unsigned *sqHead, *sqTail, *sqArray, sqMask, sqEntries;
+static unsigned *cqHead, *cqTail, cqMask;
+static io_uring_cqe *cqes;
+static unsigned unsubmitted;
+
+static char *bufferMemory;
+
+// Sockets are known by an id rather than their descriptor, which the
+// kernel hands out again as soon as it is closed
+static std::unordered_map<uint64_t, UringSocket> sockets;
+static std::unordered_map<int, uint64_t> socketIds;
+static uint64_t nextSocketId = 1;
+static std::atomic<uint64_t> enters(0);
+static std::mutex uringMutex;
+
+static int enter(unsigned submit, unsigned wait, unsigned flags, void *arg, size_t argSize)
+{
+    enters++;
+    return static_cast<int>(syscall(__NR_io_uring_enter, ringFd, submit, wait, flags, arg, argSize));
+}
+
+static void submitPending()
+{
+    while (unsubmitted > 0)
+    {
+        int submitted = enter(unsubmitted, 0, 0, NULL, 0);
+        if (submitted <= 0)
+        {
+            return; // Busy or interrupted; the next flush or wait tries again
+        }
+        unsubmitted -= submitted;
+    }
+}
+
+// The entry counts as queued at once; that is safe because the kernel
+// only reads entries during io_uring_enter, which is always called with
+// uringMutex held after they are filled in
+static io_uring_sqe *nextSqe()
+{
+    unsigned tail = *sqTail;
+    if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries)
+    {
+        submitPending();
+        if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries)
+        {
+            return NULL;
+        }
+    }
+    io_uring_sqe *sqe = &sqes[tail & sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray[tail & sqMask] = tail & sqMask;
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    unsubmitted++;
+    return sqe;
+}
+
+static uint64_t userData(uint64_t id, UringOp op)
+{
+    return id << 8 | op;
+}
+
+// Hands count buffers from bid on back to the kernel. The buffers go
+// back with an operation rather than through a mapped buffer ring, which
+// not every kernel that has multishot receive accepts.
+static bool provideBuffers(uint16_t bid, unsigned count)
+{
+    io_uring_sqe *sqe = nextSqe();
+    if (!sqe)
+    {
+        return false;
+    }
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = static_cast<int>(count);
+    sqe->addr = reinterpret_cast<uint64_t>(bufferMemory + static_cast<size_t>(bid) * RECEIVE_BUFFER_SIZE);
+    sqe->len = RECEIVE_BUFFER_SIZE;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->off = bid;
+    sqe->user_data = userData(0, OP_BUFFERS);
+    return true;
+}
+
+static void armReceive(uint64_t id, UringSocket &socket)
+{
+    io_uring_sqe *sqe = nextSqe();
+    if (!sqe)
+    {
+        return;
+    }
+    sqe->fd = socket.fd;
+    if (socket.listener)
+    {
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    }
+    else
+    {
+        sqe->opcode = IORING_OP_RECV;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = BUFFER_GROUP;
+    }
+    sqe->user_data = userData(id, OP_RECEIVE);
+    socket.receiving = true;
+}
+
+static void startSend(uint64_t id, UringSocket &socket)
+{
+    if (socket.sending || socket.output.empty() || socket.ended || socket.closing)
+    {
+        return;
+    }
+    io_uring_sqe *sqe = nextSqe();
+    if (!sqe)
+    {
+        return;
+    }
+    const PendingSend &send = socket.output.front();
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = socket.fd;
+    sqe->addr = reinterpret_cast<uint64_t>(send.data->data() + send.offset);
+    sqe->len = static_cast<uint32_t>(send.data->size() - send.offset);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = userData(id, OP_SEND);
+    socket.sending = true;
+}
+
+static void complete(const io_uring_cqe &cqe)
+{
+    uint64_t id = cqe.user_data >> 8;
+    int op = static_cast<int>(cqe.user_data & 0xff);
+    bool more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+    if (op == OP_CANCEL || op == OP_BUFFERS)
+    {
+        return;
+    }
+    std::unordered_map<uint64_t, UringSocket>::iterator found = sockets.find(id);
+    if (op == OP_RECEIVE && (cqe.flags & IORING_CQE_F_BUFFER))
+    {
+        uint16_t bid = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        if (found != sockets.end() && cqe.res > 0)
+        {
+            found->second.input.append(bufferMemory + static_cast<size_t>(bid) * RECEIVE_BUFFER_SIZE, cqe.res);
+        }
+        provideBuffers(bid, 1);
+    }
+    if (found == sockets.end())
+    {
+        return;
+    }
+    UringSocket &socket = found->second;
+
+    if (op == OP_RECEIVE && socket.listener)
+    {
+        if (cqe.res >= 0 && socket.closing)
+        {
+            close(cqe.res);
+        }
+        else if (cqe.res >= 0)
+        {
+            socket.accepted.push_back(cqe.res);
+        }
+        socket.receiving = more;
+    }
+    else if (op == OP_RECEIVE)
+    {
+        // Out of buffers only stops the multishot; it is armed again on
+        // the next wait, once the buffers have been handed back
+        if (cqe.res == 0 || (cqe.res < 0 && cqe.res != -ENOBUFS))
+        {
+            socket.ended = true;
+            socket.error = cqe.res < 0 ? -cqe.res : 0;
+        }
+        socket.receiving = more;
+    }
+    else if (op == OP_SEND)
+    {
+        socket.sending = false;
+        if (cqe.res < 0)
+        {
+            socket.ended = true;
+            socket.error = -cqe.res;
+            socket.output.clear();
+            socket.outputBytes = 0;
+        }
+        else
+        {
+            PendingSend &send = socket.output.front();
+            send.offset += cqe.res;
+            socket.outputBytes -= cqe.res;
+            if (send.offset == send.data->size())
+            {
+                socket.output.pop_front();
+            }
+            startSend(id, socket);
+        }
+    }
+
+    if (socket.closing && !socket.receiving && !socket.sending)
+    {
+        sockets.erase(found);
+    }
+}
+
+static void reap()
+{
+    unsigned head = *cqHead;
+    unsigned tail;
+    while (head != (tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)))
+    {
+        for (; head != tail; head++)
+        {
+            complete(cqes[head & cqMask]);
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    }
+}
+
+// Multishot receive arrived in 6.0, after everything else used here, so
+// it is tried on a socket pair, along with the buffers provided at start,
+// rather than assumed
+static bool multishotWorks()
+{
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair) != 0)
+    {
+        return false;
+    }
+    UringSocket probe = UringSocket();
+    probe.fd = pair[0];
+    armReceive(0, probe);
+    bool provided = false;
+    bool received = false;
+    if (write(pair[1], "x", 1) == 1 && enter(unsubmitted, 2, IORING_ENTER_GETEVENTS, NULL, 0) >= 0)
+    {
+        unsubmitted = 0;
+        unsigned head = *cqHead;
+        for (; head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE); head++)
+        {
+            const io_uring_cqe &cqe = cqes[head & cqMask];
+            if (cqe.user_data == userData(0, OP_BUFFERS))
+            {
+                provided = cqe.res >= 0;
+            }
+            else if (cqe.user_data == userData(0, OP_RECEIVE))
+            {
+                received = cqe.res == 1 && (cqe.flags & IORING_CQE_F_MORE);
+            }
+            if (cqe.flags & IORING_CQE_F_BUFFER)
+            {
+                provideBuffers(static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT), 1);
+            }
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    }
+    // The receive ends when the pair closes, and its last completion is
+    // dropped by complete() as belonging to no socket
+    close(pair[0]);
+    close(pair[1]);
+    return provided && received;
+}
+
+static void releaseRing()
+{
+    free(bufferMemory);
+    bufferMemory = NULL;
+    if (sqes != MAP_FAILED)
+    {
+        munmap(sqes, sqesSize);
+        sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+    }
+    if (ringMemory != MAP_FAILED)
+    {
+        munmap(ringMemory, ringSize);
+        ringMemory = MAP_FAILED;
+    }
+    if (ringFd >= 0)
+    {
+        close(ringFd);
+        ringFd = -1;
+    }
+}
+
+bool uringStart()
+{
+    std::lock_guard<std::mutex> lock(uringMutex);
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = URING_COMPLETIONS;
+    ringFd = static_cast<int>(syscall(__NR_io_uring_setup, URING_ENTRIES, &params));
+    if (ringFd < 0)
+    {
+        return false;
+    }
+    unsigned needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((params.features & needed) != needed)
+    {
+        releaseRing();
+        return false;
+    }
+
+    ringSize = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    ringMemory = mmap(NULL, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = static_cast<io_uring_sqe *>(
+        mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES));
+    bufferMemory = static_cast<char *>(malloc(static_cast<size_t>(RECEIVE_BUFFERS) * RECEIVE_BUFFER_SIZE));
+    if (ringMemory == MAP_FAILED || sqes == MAP_FAILED || !bufferMemory)
+    {
+        releaseRing();
+        return false;
+    }
+
+    char *ring = static_cast<char *>(ringMemory);
+    sqHead = reinterpret_cast<unsigned *>(ring + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned *>(ring + params.sq_off.tail);
+    sqArray = reinterpret_cast<unsigned *>(ring + params.sq_off.array);
+    sqMask = *reinterpret_cast<unsigned *>(ring + params.sq_off.ring_mask);
+    sqEntries = *reinterpret_cast<unsigned *>(ring + params.sq_off.ring_entries);
+    cqHead = reinterpret_cast<unsigned *>(ring + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned *>(ring + params.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned *>(ring + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe *>(ring + params.cq_off.cqes);
+    unsubmitted = 0;
+
+    if (!provideBuffers(0, RECEIVE_BUFFERS) || !multishotWorks())
+    {
+        releaseRing();
+        return false;
+    }
+    return true;
+}
+
+void uringStop()
+{
+    std::vector<int> openIds;
+    {
+        std::lock_guard<std::mutex> lock(uringMutex);
+        for (std::unordered_map<int, uint64_t>::const_iterator it = socketIds.begin(); it != socketIds.end(); ++it)
+        {
+            openIds.push_back(it->first);
+        }
+    }
+    for (size_t i = 0; i < openIds.size(); i++)
+    {
+        uringClose(openIds[i]);
+    }
+    // Sends still in flight point into buffers the sockets hold
+    for (int tries = 0; tries < 100; tries++)
+    {
+        {
+            std::lock_guard<std::mutex> lock(uringMutex);
+            if (sockets.empty())
+            {
+                break;
+            }
+        }
+        uringWait(10);
+    }
+
+    std::lock_guard<std::mutex> lock(uringMutex);
+    sockets.clear();
+    socketIds.clear();
+    releaseRing();
+}
+
+bool uringWatch(NetSocket socket)
+{
+    int fd = static_cast<int>(socket);
+    int listening = 0;
+    socklen_t size = sizeof(listening);
+    getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &size);
+    // The ring waits for the socket itself; a non-blocking one would have
+    // its sends fail with EAGAIN instead
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+    std::lock_guard<std::mutex> lock(uringMutex);
+    uint64_t id = nextSocketId++;
+    UringSocket &state = sockets[id];
+    state = UringSocket();
+    state.fd = fd;
+    state.listener = listening != 0;
+    socketIds[fd] = id;
+    armReceive(id, state);
+    return true;
+}
+
+bool uringOwns(NetSocket socket)
+{
+    std::lock_guard<std::mutex> lock(uringMutex);
+    return socketIds.count(static_cast<int>(socket)) > 0;
+}
+
+bool uringClose(NetSocket socket)
+{
+    int fd = static_cast<int>(socket);
+    std::lock_guard<std::mutex> lock(uringMutex);
+    std::unordered_map<int, uint64_t>::iterator found = socketIds.find(fd);
+    if (found == socketIds.end())
+    {
+        return false;
+    }
+    uint64_t id = found->second;
+    socketIds.erase(found);
+    UringSocket &state = sockets[id];
+    state.closing = true;
+    if (state.receiving)
+    {
+        io_uring_sqe *sqe = nextSqe();
+        if (sqe)
+        {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = userData(id, OP_RECEIVE);
+            sqe->user_data = userData(id, OP_CANCEL);
+        }
+    }
+    for (size_t i = 0; i < state.accepted.size(); i++)
+    {
+        close(state.accepted[i]);
+    }
+    state.accepted.clear();
+    // Fails a send in flight; the kernel keeps its own reference to the
+    // socket until the last operation on it completes
+    shutdown(fd, SHUT_RDWR);
+    close(fd);
+    submitPending();
+    if (!state.receiving && !state.sending)
+    {
+        sockets.erase(id);
+    }
+    return true;
+}
+
+int uringSend(NetSocket socket, const SharedBytes &data, size_t offset)
+{
+    std::lock_guard<std::mutex> lock(uringMutex);
+    std::unordered_map<int, uint64_t>::iterator found = socketIds.find(static_cast<int>(socket));
+    if (found == socketIds.end())
+    {
+        errno = EBADF;
+        return -1;
+    }
+    UringSocket &state = sockets[found->second];
+    if (state.ended)
+    {
+        errno = state.error ? state.error : EPIPE;
+        return -1;
+    }
+    if (state.outputBytes >= SEND_WINDOW_BYTES)
+    {
+        return 0;
+    }
+    PendingSend send = {data, offset};
+    state.output.push_back(send);
+    state.outputBytes += data->size() - offset;
+    startSend(found->second, state);
+    return static_cast<int>(data->size() - offset);
+}
+
+int uringReceive(NetSocket socket, char *buffer, int length)
+{
+    std::lock_guard<std::mutex> lock(uringMutex);
+    std::unordered_map<int, uint64_t>::iterator found = socketIds.find(static_cast<int>(socket));
+    if (found == socketIds.end())
+    {
+        errno = EBADF;
+        return -1;
+    }
+    UringSocket &state = sockets[found->second];
+    size_t available = state.input.size() - state.inputOffset;
+    if (available == 0)
+    {
+        if (state.ended)
+        {
+            errno = state.error;
+            return -1;
+        }
+        return 0;
+    }
+    size_t count = std::min(available, static_cast<size_t>(length));
+    memcpy(buffer, state.input.data() + state.inputOffset, count);
+    state.inputOffset += count;
+    if (state.inputOffset == state.input.size())
+    {
+        state.input.clear();
+        state.inputOffset = 0;
+    }
+    return static_cast<int>(count);
+}
+
+NetSocket uringAccept(NetSocket listener)
+{
+    std::lock_guard<std::mutex> lock(uringMutex);
+    std::unordered_map<int, uint64_t>::iterator found = socketIds.find(static_cast<int>(listener));
+    if (found == socketIds.end() || sockets[found->second].accepted.empty())
+    {
+        errno = EAGAIN;
+        return NET_INVALID;
+    }
+    UringSocket &state = sockets[found->second];
+    int accepted = state.accepted.front();
+    state.accepted.pop_front();
+    return accepted;
+}
+
+void uringFlush()
+{
+    std::lock_guard<std::mutex> lock(uringMutex);
+    submitPending();
+}
+
+void uringWait(int timeoutMs)
+{
+    {
+        std::lock_guard<std::mutex> lock(uringMutex);
+        for (std::unordered_map<uint64_t, UringSocket>::iterator it = sockets.begin(); it != sockets.end(); ++it)
+        {
+            UringSocket &state = it->second;
+            if (!state.receiving && !state.ended && !state.closing)
+            {
+                armReceive(it->first, state);
+            }
+            startSend(it->first, state);
+            // Not slept on while something is waiting to be read
+            if (!state.closing && (state.inputOffset < state.input.size() || !state.accepted.empty() || state.ended))
+            {
+                timeoutMs = 0;
+            }
+        }
+        submitPending();
+        if (*cqHead != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+        {
+            timeoutMs = 0;
+        }
+    }
+
+    // Without the lock, so other threads can queue and submit sends
+    if (timeoutMs > 0)
+    {
+        __kernel_timespec timeout;
+        timeout.tv_sec = timeoutMs / 1000;
+        timeout.tv_nsec = static_cast<long long>(timeoutMs % 1000) * 1000000;
+        io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = reinterpret_cast<uint64_t>(&timeout);
+        enter(0, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    }
+
+    std::lock_guard<std::mutex> lock(uringMutex);
+    reap();
+    submitPending();
+}
+
+uint64_t uringEnters()
+{
+    return enters;
+}
+
+#else
+
+bool uringStart()
+{
+    return false;
+}
+
+void uringStop()
+{
+}
+
+bool uringWatch(NetSocket)
+{
+    return false;
+}
+
+bool uringOwns(NetSocket)
+{
+    return false;
+}
+
+bool uringClose(NetSocket)
+{
+    return false;
+}
+
+int uringSend(NetSocket, const SharedBytes &, size_t)
+{
+    return -1;
+}
+
+int uringReceive(NetSocket, char *, int)
+{
+    return -1;
+}
+
+NetSocket uringAccept(NetSocket)
+{
+    return NET_INVALID;
+}
+
+void uringFlush()
+{
+}
+
+void uringWait(int)
+{
+}
+
+uint64_t uringEnters()
+{
+    return 0;
+}
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef NET_URING_H
+#define NET_URING_H
+
+#include "net_socket.h"
+
+// io_uring backend behind net_socket.cpp, Linux 6.0 or later.
+//
+// Each connection has one multishot receive armed, reading into a ring of
+// provided buffers, so data arrives with no syscall per socket; it is
+// copied out of the buffer into the connection's input and the buffer
+// goes straight back to the ring. Listeners have a multishot accept.
+// Sends hold a reference to the caller's SharedBytes until they complete,
+// so a message relayed to every peer stays one copy, and each socket has
+// at most one send in flight to keep its bytes in order. Sends are only
+// submitted by uringFlush or uringWait, so a broadcast to any number of
+// peers costs one io_uring_enter.
+
+bool uringStart(); // False when the kernel lacks something it needs
+void uringStop();
+
+// False if the socket is not one of ours, in which case the plain
+// socket calls apply
+bool uringWatch(NetSocket socket);
+bool uringOwns(NetSocket socket);
+bool uringClose(NetSocket socket);
+
+int uringSend(NetSocket socket, const SharedBytes &data, size_t offset);
+int uringReceive(NetSocket socket, char *buffer, int length);
+NetSocket uringAccept(NetSocket listener);
+
+void uringFlush();
+void uringWait(int timeoutMs);
+uint64_t uringEnters();
+
+#endif
@@ -0,0 +1,93 @@
+#include "perf_stats.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+const float FIRST_BUCKET_MS = 1.0f / 16.0f;
+const int BUCKETS_PER_DOUBLING = 4;
+
+void histogramClear(LatencyHistogram &histogram)
+{
+    memset(&histogram, 0, sizeof(histogram));
+}
+
+void histogramAdd(LatencyHistogram &histogram, float ms)
+{
+    int bucket = 0;
+    if (ms > FIRST_BUCKET_MS)
+    {
+        bucket = static_cast<int>(std::ceil(std::log2(ms / FIRST_BUCKET_MS) * BUCKETS_PER_DOUBLING));
+        bucket = std::min(bucket, LATENCY_BUCKETS - 1);
+    }
+    histogram.counts[bucket]++;
+    histogram.total++;
+    histogram.maxMs = std::max(histogram.maxMs, ms);
+}
+
+float bucketUpperMs(int bucket)
+{
+    return FIRST_BUCKET_MS * std::exp2(static_cast<float>(bucket) / BUCKETS_PER_DOUBLING);
+}
+
+void rollingAdd(RollingHistogram &rolling, float ms)
+{
+    histogramAdd(rolling.current, ms);
+}
+
+void rollingAdvance(RollingHistogram &rolling)
+{
+    rolling.previous = rolling.current;
+    histogramClear(rolling.current);
+}
+
+float rollingPercentile(const RollingHistogram &rolling, int percent, uint32_t *counts)
+{
+    uint32_t combined[LATENCY_BUCKETS];
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        combined[i] = rolling.current.counts[i] + rolling.previous.counts[i];
+    }
+    if (counts)
+    {
+        memcpy(counts, combined, sizeof(combined));
+    }
+
+    uint64_t total = static_cast<uint64_t>(rolling.current.total) + rolling.previous.total;
+    if (total == 0)
+    {
+        return 0;
+    }
+    // Rank of the sample at the percentile, counting from 1
+    uint64_t rank = std::max<uint64_t>(1, (total * percent + 99) / 100);
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        seen += combined[i];
+        if (seen >= rank)
+        {
+            return std::min(bucketUpperMs(i), std::max(rolling.current.maxMs, rolling.previous.maxMs));
+        }
+    }
+    return bucketUpperMs(LATENCY_BUCKETS - 1);
+}
+
+void trafficClear(TrafficCounters &traffic)
+{
+    traffic.messagesIn = 0;
+    traffic.bytesIn = 0;
+    traffic.messagesOut = 0;
+    traffic.bytesOut = 0;
+}
+
+TrafficRates trafficRates(const TrafficCounters &traffic, uint64_t last[4], double elapsedMs)
+{
+    uint64_t now[4] = {traffic.messagesIn, traffic.bytesIn, traffic.messagesOut, traffic.bytesOut};
+    float rates[4];
+    for (int i = 0; i < 4; i++)
+    {
+        rates[i] = elapsedMs > 0 ? static_cast<float>((now[i] - last[i]) * 1000.0 / elapsedMs) : 0;
+        last[i] = now[i];
+    }
+    TrafficRates result = {rates[0], rates[1], rates[2], rates[3]};
+    return result;
+}
@@ -0,0 +1,59 @@
+#ifndef PERF_STATS_H
+#define PERF_STATS_H
+
+#include <atomic>
+#include <cstdint>
+
+// Counters and latency histograms behind the performance overlay.
+//
+// Collection is always on and costs a clock read and a bucket increment
+// per sample; percentiles and rates are only worked out when the overlay
+// is drawn. Histograms have four log-spaced buckets per doubling from
+// 1/16 ms up to about 3.5 s, so percentiles are good to about 20%, and
+// cover the last one to two PERF_WINDOW_MS windows.
+
+const int LATENCY_BUCKETS = 64;
+const double PERF_WINDOW_MS = 5000.0;
+
+struct LatencyHistogram
+{
+    uint32_t counts[LATENCY_BUCKETS];
+    uint32_t total;
+    float maxMs;
+};
+
+struct RollingHistogram
+{
+    LatencyHistogram current;
+    LatencyHistogram previous;
+};
+
+// Message traffic in both directions; updated from the network thread
+struct TrafficCounters
+{
+    std::atomic<uint64_t> messagesIn;
+    std::atomic<uint64_t> bytesIn;
+    std::atomic<uint64_t> messagesOut;
+    std::atomic<uint64_t> bytesOut;
+};
+
+struct TrafficRates
+{
+    float messagesIn, bytesIn, messagesOut, bytesOut; // Per second
+};
+
+void histogramClear(LatencyHistogram &histogram);
+void histogramAdd(LatencyHistogram &histogram, float ms);
+float bucketUpperMs(int bucket);
+
+void rollingAdd(RollingHistogram &rolling, float ms);
+void rollingAdvance(RollingHistogram &rolling); // Starts a new window
+// Upper bound of the bucket holding the percentile over both windows; 0
+// when empty. counts, if given, receives the combined bucket counts.
+float rollingPercentile(const RollingHistogram &rolling, int percent, uint32_t *counts = 0);
+
+void trafficClear(TrafficCounters &traffic);
+// Rates since the previous call, which must be elapsedMs ago
+TrafficRates trafficRates(const TrafficCounters &traffic, uint64_t last[4], double elapsedMs);
+
+#endif
@@ -0,0 +1,243 @@
+#include "png_writer.h"
+
+static uint32_t crcTable[256];
+static bool crcTableReady = false;
+
+static void initCrcTable()
+{
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++)
+        {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        crcTable[n] = c;
+    }
+    crcTableReady = true;
+}
+
+static uint32_t updateCrc(uint32_t crc, const unsigned char *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        crc = crcTable[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+static void putBigEndian(unsigned char *out, uint32_t value)
+{
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+static void writeChunk(FILE *file, const char *type, const unsigned char *data, size_t length)
+{
+    unsigned char header[8];
+    putBigEndian(header, length);
+    header[4] = type[0];
+    header[5] = type[1];
+    header[6] = type[2];
+    header[7] = type[3];
+    fwrite(header, 1, 8, file);
+    if (length > 0)
+    {
+        fwrite(data, 1, length, file);
+    }
+
+    uint32_t crc = updateCrc(0xffffffffu, header + 4, 4);
+    crc = updateCrc(crc, data, length) ^ 0xffffffffu;
+    unsigned char trailer[4];
+    putBigEndian(trailer, crc);
+    fwrite(trailer, 1, 4, file);
+}
+
+static void writeBits(PngWriter &writer, uint32_t value, int count)
+{
+    writer.bitBuffer |= value << writer.bitCount;
+    writer.bitCount += count;
+    while (writer.bitCount >= 8)
+    {
+        writer.pending.push_back(writer.bitBuffer & 0xff);
+        writer.bitBuffer >>= 8;
+        writer.bitCount -= 8;
+    }
+}
+
+// Huffman codes are defined most significant bit first
+static void writeCode(PngWriter &writer, uint32_t code, int length)
+{
+    uint32_t reversed = 0;
+    for (int i = 0; i < length; i++)
+    {
+        reversed = (reversed << 1) | ((code >> i) & 1);
+    }
+    writeBits(writer, reversed, length);
+}
+
+static void writeSymbol(PngWriter &writer, int symbol)
+{
+    if (symbol <= 143)
+    {
+        writeCode(writer, 0x30 + symbol, 8);
+    }
+    else if (symbol <= 255)
+    {
+        writeCode(writer, 0x190 + symbol - 144, 9);
+    }
+    else if (symbol <= 279)
+    {
+        writeCode(writer, symbol - 256, 7);
+    }
+    else
+    {
+        writeCode(writer, 0xC0 + symbol - 280, 8);
+    }
+}
+
+static const int LENGTH_BASE[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const int LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                     3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+
+// Back-reference of the given length to the previous pixel (distance 4)
+static void writePixelRun(PngWriter &writer, int length)
+{
+    int index = 28;
+    if (length < 258)
+    {
+        index = 0;
+        while (index < 27 && LENGTH_BASE[index + 1] <= length)
+        {
+            index++;
+        }
+    }
+    writeSymbol(writer, 257 + index);
+    writeBits(writer, length - LENGTH_BASE[index], LENGTH_EXTRA[index]);
+    writeCode(writer, 3, 5);
+}
+
+static void flushPending(PngWriter &writer)
+{
+    if (!writer.pending.empty())
+    {
+        writeChunk(writer.file, "IDAT", &writer.pending[0], writer.pending.size());
+        writer.pending.clear();
+    }
+}
+
+bool pngBegin(PngWriter &writer, const char *path, int width, int height)
+{
+    if (!crcTableReady)
+    {
+        initCrcTable();
+    }
+
+    writer.file = fopen(path, "wb");
+    if (!writer.file)
+    {
+        return false;
+    }
+    writer.width = width;
+    writer.height = height;
+    writer.rowsWritten = 0;
+    writer.adler = 1;
+    writer.bitBuffer = 0;
+    writer.bitCount = 0;
+    writer.pending.clear();
+    writer.row.resize(1 + width * 4);
+
+    static const unsigned char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    fwrite(signature, 1, 8, writer.file);
+
+    unsigned char header[13];
+    putBigEndian(header, width);
+    putBigEndian(header + 4, height);
+    header[8] = 8;  // Bit depth
+    header[9] = 6;  // RGBA
+    header[10] = 0; // Deflate
+    header[11] = 0; // Adaptive filtering
+    header[12] = 0; // No interlace
+    writeChunk(writer.file, "IHDR", header, sizeof(header));
+
+    // zlib header, then a single final fixed-Huffman block
+    writer.pending.push_back(0x78);
+    writer.pending.push_back(0x01);
+    writeBits(writer, 1, 1);
+    writeBits(writer, 1, 2);
+    return true;
+}
+
+void pngWriteRow(PngWriter &writer, const uint32_t *pixels)
+{
+    unsigned char *row = &writer.row[0];
+    int length = 1 + writer.width * 4;
+    row[0] = 0; // Filter: none
+    for (int x = 0; x < writer.width; x++)
+    {
+        uint32_t p = pixels[x];
+        row[1 + x * 4] = p & 0xff;
+        row[2 + x * 4] = (p >> 8) & 0xff;
+        row[3 + x * 4] = (p >> 16) & 0xff;
+        row[4 + x * 4] = p >> 24;
+    }
+
+    uint32_t a = writer.adler & 0xffff, b = writer.adler >> 16;
+    for (int i = 0; i < length; i++)
+    {
+        a = (a + row[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    writer.adler = (b << 16) | a;
+
+    int i = 0;
+    while (i < length)
+    {
+        int run = 0;
+        if (i >= 4)
+        {
+            while (run < 258 && i + run < length && row[i + run] == row[i + run - 4])
+            {
+                run++;
+            }
+        }
+        if (run >= 3)
+        {
+            writePixelRun(writer, run);
+            i += run;
+        }
+        else
+        {
+            writeSymbol(writer, row[i]);
+            i++;
+        }
+    }
+
+    writer.rowsWritten++;
+    if (writer.pending.size() >= 65536)
+    {
+        flushPending(writer);
+    }
+}
+
+bool pngFinish(PngWriter &writer)
+{
+    writeSymbol(writer, 256);
+    if (writer.bitCount > 0)
+    {
+        writeBits(writer, 0, 8 - writer.bitCount);
+    }
+    unsigned char adler[4];
+    putBigEndian(adler, writer.adler);
+    writer.pending.insert(writer.pending.end(), adler, adler + 4);
+    flushPending(writer);
+    writeChunk(writer.file, "IEND", NULL, 0);
+
+    bool ok = writer.rowsWritten == writer.height && !ferror(writer.file);
+    fclose(writer.file);
+    writer.file = NULL;
+    return ok;
+}
@@ -0,0 +1,31 @@
+#ifndef PNG_WRITER_H
+#define PNG_WRITER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// Streaming RGBA8 PNG encoder. Rows are compressed as they are written
+// (fixed-Huffman deflate with pixel-run matches, which suits mostly-white
+// boards), so an image never has to be held in memory as a whole.
+struct PngWriter
+{
+    FILE *file;
+    int width;
+    int height;
+    int rowsWritten;
+    uint32_t adler;
+    uint32_t bitBuffer;
+    int bitCount;
+    std::vector<unsigned char> pending; // Compressed bytes not yet emitted as an IDAT chunk
+    std::vector<unsigned char> row;
+};
+
+bool pngBegin(PngWriter &writer, const char *path, int width, int height);
+
+// pixels holds width values packed as in Image (R in the low byte).
+void pngWriteRow(PngWriter &writer, const uint32_t *pixels);
+
+bool pngFinish(PngWriter &writer);
+
+#endif
@@ -0,0 +1,95 @@
+#include "presence.h"
+#include <algorithm>
+#include <cstring>
+
+static bool sameCursor(const CursorState &a, const CursorState &b)
+{
+    return a.x / PRESENCE_GRID == b.x / PRESENCE_GRID && a.y / PRESENCE_GRID == b.y / PRESENCE_GRID &&
+           a.tool == b.tool && a.size == b.size && memcmp(a.color, b.color, sizeof(a.color)) == 0;
+}
+
+bool presenceDue(PresenceSender &sender, const CursorState &cursor, double nowMs)
+{
+    bool changed = !sender.sent || !sameCursor(cursor, sender.last);
+    if (!changed && cursor.tool == 0)
+    {
+        return false; // Nothing to keep alive while off the board
+    }
+    if (nowMs - sender.lastSentMs < (changed ? PRESENCE_INTERVAL_MS : PRESENCE_IDLE_MS))
+    {
+        return false;
+    }
+    if (changed)
+    {
+        sender.lastChangeMs = nowMs;
+    }
+    sender.last = cursor;
+    sender.lastSentMs = nowMs;
+    sender.sent = true;
+    return true;
+}
+
+double presenceWaitMs(const PresenceSender &sender, double nowMs, double idleWaitMs)
+{
+    if (nowMs - sender.lastChangeMs > PRESENCE_IDLE_MS)
+    {
+        return idleWaitMs;
+    }
+    double untilNextMs = sender.lastSentMs + PRESENCE_INTERVAL_MS - nowMs;
+    if (untilNextMs <= 0)
+    {
+        untilNextMs = PRESENCE_INTERVAL_MS; // Keep sampling at the send rate
+    }
+    return std::min(idleWaitMs, untilNextMs);
+}
+
+bool budgetTake(ByteBudget &budget, size_t bytes, double bytesPerS, double nowMs)
+{
+    double burst = bytesPerS / 4;
+    budget.bytes = std::min(burst, budget.bytes + (nowMs - budget.updatedMs) * bytesPerS / 1000.0);
+    budget.updatedMs = nowMs;
+    if (budget.bytes < bytes)
+    {
+        return false;
+    }
+    budget.bytes -= bytes;
+    return true;
+}
+
+void cursorUpdate(RemoteCursor &cursor, const CursorState &state, bool known, double nowMs)
+{
+    float x, y;
+    if (known && cursorPosition(cursor, nowMs, x, y))
+    {
+        cursor.fromX = x;
+        cursor.fromY = y;
+        cursor.glideMs = std::min(std::max(nowMs - cursor.updateMs, PRESENCE_INTERVAL_MS / 2), 4 * PRESENCE_INTERVAL_MS);
+    }
+    else
+    {
+        // Appears where it is rather than sliding in from a stale spot
+        cursor.fromX = static_cast<float>(state.x);
+        cursor.fromY = static_cast<float>(state.y);
+        cursor.glideMs = 0;
+    }
+    cursor.state = state;
+    cursor.updateMs = nowMs;
+}
+
+bool cursorPosition(const RemoteCursor &cursor, double nowMs, float &x, float &y)
+{
+    double elapsedMs = nowMs - cursor.updateMs;
+    if (cursor.state.tool == 0 || elapsedMs > PRESENCE_TIMEOUT_MS)
+    {
+        return false;
+    }
+    float t = cursor.glideMs > 0 ? static_cast<float>(std::min(1.0, elapsedMs / cursor.glideMs)) : 1.0f;
+    x = cursor.fromX + (cursor.state.x - cursor.fromX) * t;
+    y = cursor.fromY + (cursor.state.y - cursor.fromY) * t;
+    return true;
+}
+
+bool cursorGliding(const RemoteCursor &cursor, double nowMs)
+{
+    return cursor.state.tool != 0 && nowMs - cursor.updateMs < cursor.glideMs;
+}
@@ -0,0 +1,66 @@
+#ifndef PRESENCE_H
+#define PRESENCE_H
+
+#include "stroke_wire.h"
+
+// Where the other peers are pointing, sent as M messages on the live lane
+// (see send_lanes.h), apart from the strokes.
+//
+// The UI keeps the local pointer, quantized to PRESENCE_GRID cells, with
+// the tool and color in use; the network thread sends it at most every
+// PRESENCE_INTERVAL_MS while it changes, and every PRESENCE_IDLE_MS when
+// it does not, so a still pointer costs a message every couple of seconds
+// and a moving one at most 30 a second. An update replaces any older one
+// of the same author still queued to a peer instead of queueing behind
+// it, and each peer is sent at most PRESENCE_BYTES_PER_S of them; the
+// rest are dropped, as the next update makes them stale anyway. The host
+// also relays at most PRESENCE_IN_BYTES_PER_S from each peer, so one
+// sending too fast cannot crowd out the others.
+//
+// Remote cursors glide from where they are drawn to each new position
+// over the time since the previous update, so they move smoothly about
+// one update behind, and disappear after PRESENCE_TIMEOUT_MS of silence.
+
+const double PRESENCE_INTERVAL_MS = 1000.0 / 30.0;
+const double PRESENCE_IDLE_MS = 2000.0;
+const double PRESENCE_TIMEOUT_MS = 5000.0;
+const double PRESENCE_BYTES_PER_S = 8 * 1024; // About eight busy cursors
+const double PRESENCE_IN_BYTES_PER_S = PRESENCE_BYTES_PER_S / 4; // Taken from each peer
+
+// When the local cursor was last sent
+struct PresenceSender
+{
+    CursorState last;
+    double lastSentMs;
+    double lastChangeMs;
+    bool sent;
+};
+
+// True if cursor should go out now; it is then taken as sent
+bool presenceDue(PresenceSender &sender, const CursorState &cursor, double nowMs);
+// How soon to look again: sooner while the cursor is moving
+double presenceWaitMs(const PresenceSender &sender, double nowMs, double idleWaitMs);
+
+// Token bucket for a byte rate, with a quarter of a second of burst
+struct ByteBudget
+{
+    double bytes;
+    double updatedMs;
+};
+
+bool budgetTake(ByteBudget &budget, size_t bytes, double bytesPerS, double nowMs);
+
+struct RemoteCursor
+{
+    CursorState state;
+    float fromX, fromY; // Where it was drawn when the update came
+    double updateMs;
+    double glideMs; // How long it takes to get to state
+};
+
+void cursorUpdate(RemoteCursor &cursor, const CursorState &state, bool known, double nowMs);
+// Where to draw it; false while it is off the board or timed out
+bool cursorPosition(const RemoteCursor &cursor, double nowMs, float &x, float &y);
+bool cursorGliding(const RemoteCursor &cursor, double nowMs);
+
+#endif
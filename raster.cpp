@@ -0,0 +1,337 @@
+#include "raster.h"
+#include "png_writer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+uint32_t packColor(const float color[3])
+{
+    uint32_t r = static_cast<uint32_t>(std::min(std::max(color[0], 0.0f), 1.0f) * 255.0f + 0.5f);
+    uint32_t g = static_cast<uint32_t>(std::min(std::max(color[1], 0.0f), 1.0f) * 255.0f + 0.5f);
+    uint32_t b = static_cast<uint32_t>(std::min(std::max(color[2], 0.0f), 1.0f) * 255.0f + 0.5f);
+    return r | (g << 8) | (b << 16) | 0xff000000u;
+}
+
+// Solid fill of a run of pixels, four at a time where SSE2 is available
+static void fillSpan(uint32_t *dst, int count, uint32_t color)
+{
+#ifdef __SSE2__
+    __m128i value = _mm_set1_epi32(static_cast<int>(color));
+    for (; count >= 16; count -= 16, dst += 16)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), value);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4), value);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 8), value);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 12), value);
+    }
+    for (; count >= 4; count -= 4, dst += 4)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), value);
+    }
+#endif
+    while (count-- > 0)
+    {
+        *dst++ = color;
+    }
+}
+
+void imageInit(Image &image, int width, int height, uint32_t background)
+{
+    image.width = width;
+    image.height = height;
+    image.originX = 0;
+    image.originY = 0;
+    image.pixels.resize(static_cast<size_t>(width) * height);
+    if (!image.pixels.empty())
+    {
+        fillSpan(&image.pixels[0], static_cast<int>(image.pixels.size()), background);
+    }
+}
+
+static inline uint32_t blendPixel(uint32_t dst, uint32_t src, float coverage)
+{
+    int a = static_cast<int>(coverage * 256.0f);
+    uint32_t result = 0xff000000u;
+    for (int shift = 0; shift < 24; shift += 8)
+    {
+        int d = (dst >> shift) & 0xff;
+        int s = (src >> shift) & 0xff;
+        result |= static_cast<uint32_t>(d + (((s - d) * a) >> 8)) << shift;
+    }
+    return result;
+}
+
+struct Capsule
+{
+    float ax, ay, bx, by;
+    float ux, uy, length;
+    float radius;
+};
+
+// x-interval where lo <= k * x + c <= hi
+static bool linearInterval(float k, float c, float lo, float hi, float &x0, float &x1)
+{
+    if (std::fabs(k) < 1e-6f)
+    {
+        if (c < lo || c > hi)
+        {
+            return false;
+        }
+        x0 = -1e9f;
+        x1 = 1e9f;
+        return true;
+    }
+    x0 = (lo - c) / k;
+    x1 = (hi - c) / k;
+    if (x0 > x1)
+    {
+        std::swap(x0, x1);
+    }
+    return true;
+}
+
+static void includeInterval(bool &any, float &x0, float &x1, float a0, float a1)
+{
+    if (!any)
+    {
+        x0 = a0;
+        x1 = a1;
+        any = true;
+    }
+    else
+    {
+        x0 = std::min(x0, a0);
+        x1 = std::max(x1, a1);
+    }
+}
+
+// The capsule is convex, so its intersection with a scanline is the hull
+// of the intersections of the two end discs and the body rectangle.
+static bool capsuleSpan(const Capsule &c, float radius, float y, float &x0, float &x1)
+{
+    bool any = false;
+    float ends[2][2] = {{c.ax, c.ay}, {c.bx, c.by}};
+    for (int i = 0; i < 2; i++)
+    {
+        float dy = y - ends[i][1];
+        if (std::fabs(dy) <= radius)
+        {
+            float half = std::sqrt(radius * radius - dy * dy);
+            includeInterval(any, x0, x1, ends[i][0] - half, ends[i][0] + half);
+        }
+    }
+
+    if (c.length > 1e-6f)
+    {
+        float t0, t1, p0, p1;
+        if (linearInterval(c.ux, -c.ax * c.ux + (y - c.ay) * c.uy, 0.0f, c.length, t0, t1) &&
+            linearInterval(-c.uy, c.ax * c.uy + (y - c.ay) * c.ux, -radius, radius, p0, p1))
+        {
+            float b0 = std::max(t0, p0), b1 = std::min(t1, p1);
+            if (b0 <= b1)
+            {
+                includeInterval(any, x0, x1, b0, b1);
+            }
+        }
+    }
+    return any;
+}
+
+static float distanceToSegment(const Capsule &c, float x, float y)
+{
+    float t = (x - c.ax) * c.ux + (y - c.ay) * c.uy;
+    t = std::max(0.0f, std::min(c.length, t));
+    float dx = x - (c.ax + c.ux * t);
+    float dy = y - (c.ay + c.uy * t);
+    return std::sqrt(dx * dx + dy * dy);
+}
+
+// Geometry stays in board coordinates so every tile of a tiled export
+// computes bit-identical coverage; only the pixel index uses the origin.
+static Capsule lineCapsule(const Line &line)
+{
+    Capsule c;
+    c.ax = line.x1 + 0.5f;
+    c.ay = line.y1 + 0.5f;
+    c.bx = line.x2 + 0.5f;
+    c.by = line.y2 + 0.5f;
+    float dx = c.bx - c.ax, dy = c.by - c.ay;
+    c.length = std::sqrt(dx * dx + dy * dy);
+    c.ux = c.length > 1e-6f ? dx / c.length : 1.0f;
+    c.uy = c.length > 1e-6f ? dy / c.length : 0.0f;
+    c.radius = std::max(line.size, 1) * 0.5f;
+    return c;
+}
+
+void lineRowRange(const Line &line, float radius, int &rowStart, int &rowEnd)
+{
+    Capsule c = lineCapsule(line);
+    rowStart = static_cast<int>(std::floor(std::min(c.ay, c.by) - radius));
+    rowEnd = static_cast<int>(std::ceil(std::max(c.ay, c.by) + radius));
+}
+
+bool lineRowSpan(const Line &line, float radius, int py, int &x0, int &x1)
+{
+    Capsule c = lineCapsule(line);
+    float sx0, sx1;
+    if (!capsuleSpan(c, radius, py + 0.5f, sx0, sx1))
+    {
+        return false;
+    }
+    x0 = static_cast<int>(std::ceil(sx0 - 0.5f));
+    x1 = static_cast<int>(std::floor(sx1 - 0.5f));
+    return x0 <= x1;
+}
+
+void rasterizeLine(Image &image, const Line &line)
+{
+    uint32_t color = line.isEraser ? BACKGROUND_COLOR : packColor(line.color);
+    Capsule c = lineCapsule(line);
+
+    float outer = c.radius + 0.5f;
+    float inner = c.radius - 0.5f;
+    int left = image.originX, right = image.originX + image.width - 1;
+    int rowStart = std::max(image.originY, static_cast<int>(std::floor(std::min(c.ay, c.by) - outer)));
+    int rowEnd = std::min(image.originY + image.height - 1, static_cast<int>(std::ceil(std::max(c.ay, c.by) + outer)));
+
+    for (int py = rowStart; py <= rowEnd; py++)
+    {
+        float y = py + 0.5f;
+        float ox0, ox1;
+        if (!capsuleSpan(c, outer, y, ox0, ox1))
+        {
+            continue;
+        }
+        int outerStart = std::max(left, static_cast<int>(std::ceil(ox0 - 0.5f)));
+        int outerEnd = std::min(right, static_cast<int>(std::floor(ox1 - 0.5f)));
+        if (outerStart > outerEnd)
+        {
+            continue;
+        }
+
+        // Pixels whose centers are inside the inner capsule are fully covered
+        int innerStart = outerEnd + 1, innerEnd = outerEnd;
+        float ix0, ix1;
+        if (inner > 0.0f && capsuleSpan(c, inner, y, ix0, ix1))
+        {
+            innerStart = std::max(outerStart, static_cast<int>(std::ceil(ix0 - 0.5f)));
+            innerEnd = std::min(outerEnd, static_cast<int>(std::floor(ix1 - 0.5f)));
+            if (innerStart > innerEnd)
+            {
+                innerStart = outerEnd + 1;
+                innerEnd = outerEnd;
+            }
+        }
+
+        uint32_t *row = &image.pixels[static_cast<size_t>(py - image.originY) * image.width];
+        for (int px = outerStart; px <= outerEnd; px++)
+        {
+            if (px == innerStart)
+            {
+                fillSpan(row + (innerStart - left), innerEnd - innerStart + 1, color);
+                px = innerEnd;
+                continue;
+            }
+            float coverage = c.radius + 0.5f - distanceToSegment(c, px + 0.5f, y);
+            if (coverage >= 1.0f)
+            {
+                row[px - left] = color;
+            }
+            else if (coverage > 0.0f)
+            {
+                row[px - left] = blendPixel(row[px - left], color, coverage);
+            }
+        }
+    }
+}
+
+void rasterizeStroke(Image &image, const Stroke &stroke)
+{
+    for (size_t i = 0; i < stroke.lines.size(); i++)
+    {
+        rasterizeLine(image, stroke.lines[i]);
+    }
+}
+
+void rasterizeStrokes(Image &image, const std::vector<Stroke> &strokes)
+{
+    for (size_t i = 0; i < strokes.size(); i++)
+    {
+        if (!strokes[i].removed)
+        {
+            rasterizeStroke(image, strokes[i]);
+        }
+    }
+}
+
+bool writeImagePNG(const char *path, const Image &image)
+{
+    PngWriter writer;
+    if (!pngBegin(writer, path, image.width, image.height))
+    {
+        return false;
+    }
+    for (int y = 0; y < image.height; y++)
+    {
+        pngWriteRow(writer, &image.pixels[static_cast<size_t>(y) * image.width]);
+    }
+    return pngFinish(writer);
+}
+
+static bool pixelsClose(uint32_t pa, uint32_t pb, int tolerance)
+{
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        if (std::abs(static_cast<int>((pa >> shift) & 0xff) - static_cast<int>((pb >> shift) & 0xff)) > tolerance)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Whether some pixel of image within slack of (x, y) is close to value
+static bool closeNearby(const Image &image, int x, int y, uint32_t value, int tolerance, int slack)
+{
+    for (int ny = std::max(0, y - slack); ny <= std::min(image.height - 1, y + slack); ny++)
+    {
+        for (int nx = std::max(0, x - slack); nx <= std::min(image.width - 1, x + slack); nx++)
+        {
+            if (pixelsClose(value, image.pixels[static_cast<size_t>(ny) * image.width + nx], tolerance))
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+int compareImages(const Image &a, const Image &b, int tolerance, int slack)
+{
+    if (a.width != b.width || a.height != b.height)
+    {
+        return a.width * a.height;
+    }
+
+    int differing = 0;
+    for (int y = 0; y < a.height; y++)
+    {
+        for (int x = 0; x < a.width; x++)
+        {
+            size_t i = static_cast<size_t>(y) * a.width + x;
+            if (pixelsClose(a.pixels[i], b.pixels[i], tolerance))
+            {
+                continue;
+            }
+            if (slack == 0 || !closeNearby(b, x, y, a.pixels[i], tolerance, slack) ||
+                !closeNearby(a, x, y, b.pixels[i], tolerance, slack))
+            {
+                differing++;
+            }
+        }
+    }
+    return differing;
+}
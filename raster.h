@@ -0,0 +1,53 @@
+#ifndef RASTER_H
+#define RASTER_H
+
+#include "board.h"
+#include <cstdint>
+#include <vector>
+
+// Software renderer for board contents. It draws Stroke data into an RGBA
+// image with no GL context, for snapshots, PNG export and compaction
+// tiles. It does not reproduce drawStrokes() pixel for pixel: lines here
+// are anti-aliased capsules with round ends, where GL_LINES under
+// glLineWidth are aliased and butt-ended at each vertex, so stroke ends,
+// joints and edges differ slightly (tools/golden_check measures by how
+// much).
+
+// Pixels are packed with R in the low byte, so on little-endian hosts the
+// memory layout is R, G, B, A.
+struct Image
+{
+    int width;
+    int height;
+    int originX; // Board coordinate of pixel (0, 0)
+    int originY;
+    std::vector<uint32_t> pixels;
+};
+
+const uint32_t BACKGROUND_COLOR = 0xffffffffu;
+
+uint32_t packColor(const float color[3]);
+
+void imageInit(Image &image, int width, int height, uint32_t background = BACKGROUND_COLOR);
+
+// Anti-aliased thick line with round ends. Eraser lines paint background,
+// exactly as the GL path draws them in white.
+void rasterizeLine(Image &image, const Line &line);
+
+void rasterizeStroke(Image &image, const Stroke &stroke);
+void rasterizeStrokes(Image &image, const std::vector<Stroke> &strokes);
+
+// Rows that pixels within radius of the line's centerline can fall on, and
+// the columns [x0, x1] of one such row; used for coverage tests.
+void lineRowRange(const Line &line, float radius, int &rowStart, int &rowEnd);
+bool lineRowSpan(const Line &line, float radius, int py, int &x0, int &x1);
+
+bool writeImagePNG(const char *path, const Image &image);
+
+// Number of pixels where any channel differs by more than tolerance. With
+// slack, such a pixel still matches if each image's value has a close
+// enough pixel within slack pixels in the other, so edges placed a pixel
+// apart do not count.
+int compareImages(const Image &a, const Image &b, int tolerance, int slack = 0);
+
+#endif
@@ -0,0 +1,97 @@
+#include "send_lanes.h"
+
+const char *const LANE_NAMES[LANE_COUNT] = {"live", "strokes", "bulk"};
+
+Lane messageLane(const std::string &message)
+{
+    char type = message.empty() ? 0 : message[0];
+    if (type == 'P' || type == 'Q' || type == 'C' || type == 'M')
+    {
+        return LANE_LIVE;
+    }
+    if (type == 'S' || type == 'U' || type == 'R' || type == 'K')
+    {
+        return LANE_STROKES;
+    }
+    return LANE_BULK;
+}
+
+void chunkMessage(const SharedBytes &message, Lane lane, std::vector<SharedBytes> &pieces)
+{
+    pieces.clear();
+    if (message->size() <= CHUNK_BYTES)
+    {
+        return;
+    }
+    for (size_t start = 0; start < message->size(); start += CHUNK_BYTES)
+    {
+        bool last = start + CHUNK_BYTES >= message->size();
+        std::string piece;
+        piece.reserve(CHUNK_BYTES + 3);
+        piece += last ? '=' : '+';
+        piece += static_cast<char>('0' + lane);
+        piece.append(*message, start, CHUNK_BYTES);
+        if (!last)
+        {
+            piece += '\n'; // The last piece ends with the message's own
+        }
+        pieces.push_back(std::make_shared<const std::string>(std::move(piece)));
+    }
+}
+
+SharedCredit holdCredit(const std::shared_ptr<std::atomic<int64_t>> &returned, size_t bytes)
+{
+    return SharedCredit(returned.get(), [returned, bytes](void *)
+    {
+        *returned += static_cast<int64_t>(bytes);
+    });
+}
+
+int lanesNext(const SendLanes &lanes, bool credit)
+{
+    if (lanes.sending >= 0)
+    {
+        return lanes.sending;
+    }
+    for (int lane = 0; lane < LANE_COUNT; lane++)
+    {
+        if (!lanes.queues[lane].empty() && (lane == LANE_LIVE || credit))
+        {
+            return lane;
+        }
+    }
+    return -1;
+}
+
+SharedBytes joinChunk(ChunkJoiner &joiner, const std::string &buffer, size_t start, size_t length, size_t maxBytes,
+                      bool &malformed)
+{
+    malformed = false;
+    char type = buffer[start];
+    if (type != '+' && type != '=')
+    {
+        return std::make_shared<const std::string>(buffer, start, length);
+    }
+    int lane = length > 2 ? buffer[start + 1] - '0' : -1;
+    if (lane < 0 || lane >= LANE_COUNT)
+    {
+        malformed = true;
+        return SharedBytes();
+    }
+    std::string &partial = joiner.partial[lane];
+    if (partial.size() + length - 2 > maxBytes)
+    {
+        partial.clear();
+        malformed = true;
+        return SharedBytes();
+    }
+    if (type == '+')
+    {
+        partial.append(buffer, start + 2, length - 3); // Without the newline
+        return SharedBytes();
+    }
+    partial.append(buffer, start + 2, length - 2);
+    SharedBytes message = std::make_shared<const std::string>(std::move(partial));
+    partial.clear();
+    return message;
+}
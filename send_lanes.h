@@ -0,0 +1,97 @@
+#ifndef SEND_LANES_H
+#define SEND_LANES_H
+
+#include "transport.h"
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// Priority lanes for what is queued to one peer, and the chunking that
+// lets a small message overtake a large one on the same stream.
+//
+// Each message goes in a lane by its type: clock probes, credit and
+// cursors in LANE_LIVE, strokes, undos, redos and clears in
+// LANE_STROKES, and stroke timings and anything else in LANE_BULK. Messages keep their
+// order within a lane, and the next thing sent is the front of the
+// highest lane that has one. A message longer than CHUNK_BYTES is queued
+// as pieces, each a line of its own:
+//
+//   +<lane><up to CHUNK_BYTES of the message>    more pieces follow
+//   =<lane><the rest of the message>             the last piece
+//
+// and lanes only change between pieces, so a live message waits behind
+// at most one piece of a long one.
+//
+// Clients send the strokes and bulk lanes on credit. Each starts with
+// CREDIT_WINDOW_BYTES, spends a message's size when it starts sending it,
+// and waits while it has none left. The host hands the bytes back in C
+// messages once every copy it relayed has been taken by the peers' sockets,
+// so a client drawing faster than the others can read is held to their
+// pace instead of filling the host's queues. A peer that falls more than a
+// window behind stops holding senders back and is left to its queue limit.
+// A host says it gives credit with a C 0 as soon as a client connects;
+// until one arrives the client sends without waiting, as a host from
+// before credit never hands any back.
+
+enum Lane
+{
+    LANE_LIVE,
+    LANE_STROKES,
+    LANE_BULK,
+    LANE_COUNT
+};
+
+const size_t CHUNK_BYTES = 16 * 1024;
+const int64_t CREDIT_WINDOW_BYTES = 1024 * 1024;
+const int64_t CREDIT_GRANT_BYTES = CREDIT_WINDOW_BYTES / 4; // Smallest C message
+
+extern const char *const LANE_NAMES[LANE_COUNT]; // "live", "strokes", "bulk"
+
+Lane messageLane(const std::string &message);
+
+// The pieces of a message longer than CHUNK_BYTES; pieces is left empty
+// when it goes whole
+void chunkMessage(const SharedBytes &message, Lane lane, std::vector<SharedBytes> &pieces);
+
+// Bytes of a peer's credit, held by every queued copy of one message it
+// sent and added to returned when the last copy is released
+typedef std::shared_ptr<void> SharedCredit;
+SharedCredit holdCredit(const std::shared_ptr<std::atomic<int64_t>> &returned, size_t bytes);
+
+struct QueuedPiece
+{
+    SharedBytes bytes;
+    SharedCredit credit;
+    double queuedMs;
+    size_t messageBytes; // On a message's first piece, its size unchunked
+    bool last;           // Ends a message
+    uint32_t cursorOf;   // Author of a cursor update, which a newer one replaces
+};
+
+struct SendLanes
+{
+    std::deque<QueuedPiece> queues[LANE_COUNT];
+    size_t bytes[LANE_COUNT];
+    int sending;   // Lane whose front piece has started, -1 if none has
+    size_t offset; // Into that piece
+};
+
+// The lane to send from next, -1 if none; the strokes and bulk lanes only
+// start a message when credit allows
+int lanesNext(const SendLanes &lanes, bool credit);
+
+// Pieces of messages still arriving, per lane
+struct ChunkJoiner
+{
+    std::string partial[LANE_COUNT];
+};
+
+// Takes one received line, newline included, and returns the message it
+// completes: the line itself unless it is a piece, null while more pieces
+// are due. A malformed piece, or one that would make a message longer
+// than maxBytes, is dropped with what came before it, and sets malformed.
+SharedBytes joinChunk(ChunkJoiner &joiner, const std::string &buffer, size_t start, size_t length, size_t maxBytes,
+                      bool &malformed);
+
+#endif
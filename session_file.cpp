@@ -0,0 +1,611 @@
+#include "session_file.h"
+#include <cstdio>
+#include <cstring>
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// The on-disk layout is the in-memory layout of these records
+static_assert(sizeof(SessionHeader) == 24, "SessionHeader layout");
+static_assert(sizeof(BoardIndexEntry) == 72, "BoardIndexEntry layout");
+static_assert(sizeof(TileRecord) == 16, "TileRecord layout");
+
+static bool sameStyle(const Line &line, int size, bool isEraser, const float *color)
+{
+    return line.size == size && line.isEraser == isEraser && memcmp(line.color, color, sizeof(float) * 3) == 0;
+}
+
+void strokeStyleRuns(const Stroke &stroke, std::vector<StyleRun> &runs)
+{
+    const std::vector<Line> &lines = stroke.lines;
+    size_t i = 0;
+    while (i < lines.size())
+    {
+        if (sameStyle(lines[i], stroke.size, stroke.isEraser, stroke.color))
+        {
+            i++;
+            continue;
+        }
+        size_t first = i;
+        while (i < lines.size() && sameStyle(lines[i], lines[first].size, lines[first].isEraser, lines[first].color))
+        {
+            i++;
+        }
+        StyleRun run;
+        run.firstLine = first;
+        run.lineCount = i - first;
+        run.size = lines[first].size;
+        memcpy(run.color, lines[first].color, sizeof(float) * 3);
+        run.flags = lines[first].isEraser ? STROKE_FLAG_ERASER : 0;
+        runs.push_back(run);
+    }
+}
+
+void applyStyleRun(Stroke &stroke, const StyleRun &run)
+{
+    size_t first = run.firstLine < stroke.lines.size() ? run.firstLine : stroke.lines.size();
+    size_t count = run.lineCount < stroke.lines.size() - first ? run.lineCount : stroke.lines.size() - first;
+    for (size_t i = first; i < first + count; i++)
+    {
+        Line &line = stroke.lines[i];
+        line.size = run.size;
+        line.isEraser = (run.flags & STROKE_FLAG_ERASER) != 0;
+        memcpy(line.color, run.color, sizeof(float) * 3);
+    }
+}
+
+static void putVarint64(std::vector<uint8_t> &out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+static void putVarint(std::vector<uint8_t> &out, uint32_t value)
+{
+    putVarint64(out, value);
+}
+
+static void putSigned(std::vector<uint8_t> &out, int32_t value)
+{
+    putVarint(out, (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31));
+}
+
+static bool getVarint64(const uint8_t *&cursor, const uint8_t *end, uint64_t &value)
+{
+    value = 0;
+    for (int shift = 0; shift < 70 && cursor < end; shift += 7)
+    {
+        uint8_t byte = *cursor++;
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool getVarint(const uint8_t *&cursor, const uint8_t *end, uint32_t &value)
+{
+    uint64_t wide;
+    if (!getVarint64(cursor, end, wide))
+    {
+        return false;
+    }
+    value = static_cast<uint32_t>(wide);
+    return true;
+}
+
+static bool getSigned(const uint8_t *&cursor, const uint8_t *end, int32_t &value)
+{
+    uint32_t zigzag;
+    if (!getVarint(cursor, end, zigzag))
+    {
+        return false;
+    }
+    value = static_cast<int32_t>((zigzag >> 1) ^ (0u - (zigzag & 1)));
+    return true;
+}
+
+void packStrokes(const std::vector<Stroke> &strokes, std::vector<uint8_t> &packed)
+{
+    uint32_t segments = 0;
+    for (size_t s = 0; s < strokes.size(); s++)
+    {
+        segments += strokes[s].lines.size();
+    }
+    packed.clear();
+    std::vector<StyleRun> runs;
+    putVarint(packed, strokes.size());
+    putVarint(packed, segments);
+    for (size_t s = 0; s < strokes.size(); s++)
+    {
+        const Stroke &stroke = strokes[s];
+        putVarint(packed, stroke.author);
+        putVarint(packed, stroke.seq);
+        putVarint64(packed, stroke.stamp);
+        putVarint(packed, stroke.size);
+        putVarint(packed, (stroke.isEraser ? STROKE_FLAG_ERASER : 0) | (stroke.removed ? STROKE_FLAG_REMOVED : 0));
+        const uint8_t *color = reinterpret_cast<const uint8_t *>(stroke.color);
+        packed.insert(packed.end(), color, color + sizeof(stroke.color));
+
+        putVarint(packed, stroke.lines.size());
+        int x = 0, y = 0;
+        for (size_t i = 0; i < stroke.lines.size(); i++)
+        {
+            const Line &line = stroke.lines[i];
+            putSigned(packed, line.x1 - x);
+            putSigned(packed, line.y1 - y);
+            putSigned(packed, line.x2 - line.x1);
+            putSigned(packed, line.y2 - line.y1);
+            x = line.x2;
+            y = line.y2;
+        }
+
+        runs.clear();
+        strokeStyleRuns(stroke, runs);
+        putVarint(packed, runs.size());
+        for (size_t r = 0; r < runs.size(); r++)
+        {
+            putVarint(packed, runs[r].firstLine);
+            putVarint(packed, runs[r].lineCount);
+            putSigned(packed, runs[r].size);
+            putVarint(packed, runs[r].flags);
+            const uint8_t *runColor = reinterpret_cast<const uint8_t *>(runs[r].color);
+            packed.insert(packed.end(), runColor, runColor + sizeof(runs[r].color));
+        }
+    }
+    packed.shrink_to_fit();
+}
+
+static void packedCounts(const uint8_t *cursor, size_t size, uint32_t &strokeCount, uint64_t &segments)
+{
+    const uint8_t *end = cursor + size;
+    uint32_t count;
+    strokeCount = 0;
+    segments = 0;
+    if (getVarint(cursor, end, strokeCount) && getVarint(cursor, end, count))
+    {
+        segments = count;
+    }
+}
+
+uint32_t packedSegmentCount(const std::vector<uint8_t> &packed)
+{
+    uint32_t strokeCount;
+    uint64_t segments;
+    packedCounts(packed.empty() ? NULL : &packed[0], packed.size(), strokeCount, segments);
+    return segments;
+}
+
+// Reuses the capacity of stroke.lines
+static bool unpackStroke(const uint8_t *&cursor, const uint8_t *end, Stroke &stroke)
+{
+    uint32_t size, flags, lineCount;
+    if (!getVarint(cursor, end, stroke.author) || !getVarint(cursor, end, stroke.seq) ||
+        !getVarint64(cursor, end, stroke.stamp) || !getVarint(cursor, end, size) || !getVarint(cursor, end, flags) ||
+        static_cast<size_t>(end - cursor) < sizeof(stroke.color))
+    {
+        return false;
+    }
+    memcpy(stroke.color, cursor, sizeof(stroke.color));
+    cursor += sizeof(stroke.color);
+    stroke.size = size;
+    stroke.isEraser = (flags & STROKE_FLAG_ERASER) != 0;
+    stroke.removed = (flags & STROKE_FLAG_REMOVED) != 0;
+
+    // Every line takes at least 4 bytes, which bounds a corrupt count
+    if (!getVarint(cursor, end, lineCount) || lineCount > static_cast<size_t>(end - cursor) / 4)
+    {
+        return false;
+    }
+    stroke.lines.resize(lineCount);
+    int32_t x = 0, y = 0;
+    for (uint32_t i = 0; i < lineCount; i++)
+    {
+        Line &line = stroke.lines[i];
+        int32_t dx1, dy1, dx2, dy2;
+        if (!getSigned(cursor, end, dx1) || !getSigned(cursor, end, dy1) || !getSigned(cursor, end, dx2) ||
+            !getSigned(cursor, end, dy2))
+        {
+            return false;
+        }
+        line.x1 = x + dx1;
+        line.y1 = y + dy1;
+        line.x2 = line.x1 + dx2;
+        line.y2 = line.y1 + dy2;
+        line.size = stroke.size;
+        line.isEraser = stroke.isEraser;
+        memcpy(line.color, stroke.color, sizeof(float) * 3);
+        x = line.x2;
+        y = line.y2;
+    }
+
+    uint32_t runCount;
+    if (!getVarint(cursor, end, runCount))
+    {
+        return false;
+    }
+    for (uint32_t r = 0; r < runCount; r++)
+    {
+        StyleRun run;
+        if (!getVarint(cursor, end, run.firstLine) || !getVarint(cursor, end, run.lineCount) ||
+            !getSigned(cursor, end, run.size) || !getVarint(cursor, end, run.flags) ||
+            static_cast<size_t>(end - cursor) < sizeof(run.color))
+        {
+            return false;
+        }
+        memcpy(run.color, cursor, sizeof(run.color));
+        cursor += sizeof(run.color);
+        applyStyleRun(stroke, run);
+    }
+    return true;
+}
+
+// Keeps the strokes before any corruption
+static bool unpackBytes(const uint8_t *cursor, size_t size, std::vector<Stroke> &strokes)
+{
+    const uint8_t *end = cursor + size;
+    uint32_t strokeCount, segments;
+    strokes.clear();
+    if (!getVarint(cursor, end, strokeCount) || !getVarint(cursor, end, segments) || strokeCount > size)
+    {
+        return false;
+    }
+    strokes.resize(strokeCount);
+    for (uint32_t s = 0; s < strokeCount; s++)
+    {
+        if (!unpackStroke(cursor, end, strokes[s]))
+        {
+            strokes.resize(s);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool unpackStrokes(const std::vector<uint8_t> &packed, std::vector<Stroke> &strokes)
+{
+    return unpackBytes(packed.empty() ? NULL : &packed[0], packed.size(), strokes);
+}
+
+static bool writeBytes(FILE *file, uint64_t &offset, const void *data, size_t length)
+{
+    if (length > 0 && fwrite(data, 1, length, file) != length)
+    {
+        return false;
+    }
+    offset += length;
+    return true;
+}
+
+static bool padTo8(FILE *file, uint64_t &offset)
+{
+    static const unsigned char zeros[8] = {0};
+    return writeBytes(file, offset, zeros, (8 - offset % 8) % 8);
+}
+
+bool syncFile(FILE *file)
+{
+    if (fflush(file) != 0)
+    {
+        return false;
+    }
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+bool replaceFile(const char *tempPath, const char *path)
+{
+#ifdef _WIN32
+    return MoveFileExA(tempPath, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    if (rename(tempPath, path) != 0)
+    {
+        return false;
+    }
+    // The rename is only durable once the directory entry is
+    std::string directory = path;
+    size_t slash = directory.rfind('/');
+    directory = slash == std::string::npos ? "." : slash == 0 ? "/" : directory.substr(0, slash);
+    int fd = open(directory.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+#endif
+}
+
+bool saveSession(const char *path, const std::vector<Board> &boards, int currentBoard)
+{
+    std::string tempPath = std::string(path) + ".tmp";
+    FILE *file = fopen(tempPath.c_str(), "wb");
+    if (!file)
+    {
+        return false;
+    }
+
+    SessionHeader header;
+    header.magic = SESSION_MAGIC;
+    header.version = SESSION_VERSION;
+    header.boardCount = boards.size();
+    header.currentBoard = currentBoard;
+    header.indexOffset = 0;
+
+    uint64_t offset = 0;
+    bool ok = writeBytes(file, offset, &header, sizeof(header));
+
+    std::vector<BoardIndexEntry> index(boards.size());
+    std::vector<uint8_t> packed;
+    for (size_t b = 0; b < boards.size() && ok; b++)
+    {
+        const Board &board = boards[b];
+        BoardIndexEntry &entry = index[b];
+        memset(&entry, 0, sizeof(entry));
+        memcpy(entry.currentColor, board.currentColor, sizeof(float) * 3);
+        entry.pointSize = board.pointSize;
+        entry.tool = board.tool;
+
+        entry.nameOffset = offset;
+        entry.nameLength = board.name.size();
+        ok = writeBytes(file, offset, board.name.data(), board.name.size()) && padTo8(file, offset);
+
+        // Evicted boards are already in the form the file holds
+        if (board.packed.empty())
+        {
+            packStrokes(board.shared ? *board.shared : board.strokes, packed);
+        }
+        const std::vector<uint8_t> &strokes = board.packed.empty() ? packed : board.packed;
+        uint32_t strokeCount;
+        packedCounts(strokes.empty() ? NULL : &strokes[0], strokes.size(), strokeCount, entry.lineCount);
+        entry.strokeCount = strokeCount;
+        entry.strokesOffset = offset;
+        entry.strokesBytes = strokes.size();
+        ok = ok && writeBytes(file, offset, strokes.empty() ? NULL : &strokes[0], strokes.size()) &&
+             padTo8(file, offset);
+
+        entry.tilesOffset = offset;
+        entry.tileCount = board.tiles.size();
+        for (size_t t = 0; t < board.tiles.size() && ok; t++)
+        {
+            const RasterTile &tile = board.tiles[t];
+            TileRecord record;
+            record.x = tile.x;
+            record.y = tile.y;
+            record.encodedSize = tile.encoded.size();
+            record.reserved = 0;
+            ok = writeBytes(file, offset, &record, sizeof(record)) &&
+                 writeBytes(file, offset, tile.encoded.empty() ? NULL : &tile.encoded[0], tile.encoded.size()) &&
+                 padTo8(file, offset);
+        }
+    }
+
+    header.indexOffset = offset;
+    ok = ok && writeBytes(file, offset, index.empty() ? NULL : &index[0], index.size() * sizeof(BoardIndexEntry));
+    ok = ok && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1 && syncFile(file);
+    ok = (fclose(file) == 0) && ok;
+
+    if (!ok)
+    {
+        remove(tempPath.c_str());
+        return false;
+    }
+    return replaceFile(tempPath.c_str(), path);
+}
+
+static bool mapFile(const char *path, SessionFile &session)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping)
+    {
+        CloseHandle(file);
+        return false;
+    }
+    void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!view)
+    {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    session.fileHandle = file;
+    session.mappingHandle = mapping;
+    session.data = static_cast<const unsigned char *>(view);
+    session.size = static_cast<size_t>(size.QuadPart);
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+    void *view = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (view == MAP_FAILED)
+    {
+        close(fd);
+        return false;
+    }
+    session.fd = fd;
+    session.data = static_cast<const unsigned char *>(view);
+    session.size = st.st_size;
+#endif
+    return true;
+}
+
+void closeSession(SessionFile &session)
+{
+    if (!session.data)
+    {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(session.data);
+    CloseHandle(session.mappingHandle);
+    CloseHandle(session.fileHandle);
+#else
+    munmap(const_cast<unsigned char *>(session.data), session.size);
+    close(session.fd);
+#endif
+    session.data = NULL;
+    session.index = NULL;
+    session.boardCount = 0;
+}
+
+static BoardIndexEntry indexEntry(const SessionFile &session, int index)
+{
+    BoardIndexEntry entry;
+    memcpy(&entry, session.index + static_cast<size_t>(index) * sizeof(entry), sizeof(entry));
+    return entry;
+}
+
+static bool rangeInside(const SessionFile &session, uint64_t offset, uint64_t length)
+{
+    return offset <= session.size && length <= session.size - offset;
+}
+
+bool openSession(const char *path, SessionFile &session)
+{
+    session.data = NULL;
+    session.index = NULL;
+    session.boardCount = 0;
+    if (!mapFile(path, session))
+    {
+        return false;
+    }
+
+    SessionHeader header;
+    bool valid = session.size >= sizeof(header);
+    if (valid)
+    {
+        memcpy(&header, session.data, sizeof(header));
+        valid = header.magic == SESSION_MAGIC && header.version == SESSION_VERSION;
+    }
+
+    valid = valid && header.indexOffset % 8 == 0 &&
+            rangeInside(session, header.indexOffset, uint64_t(header.boardCount) * sizeof(BoardIndexEntry));
+    session.index = valid ? session.data + header.indexOffset : NULL;
+
+    // Every section must lie inside the file before anything is read from it
+    for (uint32_t i = 0; valid && i < header.boardCount; i++)
+    {
+        BoardIndexEntry entry = indexEntry(session, i);
+        valid = rangeInside(session, entry.nameOffset, entry.nameLength) &&
+                rangeInside(session, entry.strokesOffset, entry.strokesBytes) &&
+                entry.tilesOffset % 8 == 0 && rangeInside(session, entry.tilesOffset, 0);
+    }
+
+    if (!valid)
+    {
+        closeSession(session);
+        return false;
+    }
+    session.boardCount = header.boardCount;
+    session.currentBoard = header.currentBoard < header.boardCount ? header.currentBoard : 0;
+    return true;
+}
+
+void readBoardInfo(const SessionFile &session, int index, Board &board)
+{
+    BoardIndexEntry entry = indexEntry(session, index);
+    board.name.assign(reinterpret_cast<const char *>(session.data + entry.nameOffset), entry.nameLength);
+    board.strokes.clear();
+    board.tiles.clear();
+    board.packed.clear();
+    board.lastUsed = 0;
+    board.clearStamp = 0;
+    board.clearAuthor = 0;
+    memcpy(board.currentColor, entry.currentColor, sizeof(float) * 3);
+    board.pointSize = entry.pointSize;
+    board.tool = entry.tool;
+}
+
+void loadBoardStrokes(const SessionFile &session, int index, std::vector<Stroke> &strokes)
+{
+    BoardIndexEntry entry = indexEntry(session, index);
+    unpackBytes(session.data + entry.strokesOffset, entry.strokesBytes, strokes);
+}
+
+uint64_t boardLineCount(const SessionFile &session, int index)
+{
+    return indexEntry(session, index).lineCount;
+}
+
+void loadStrokeIds(const SessionFile &session, int index, std::vector<std::pair<uint32_t, uint32_t> > &ids,
+                   uint64_t &newestStamp)
+{
+    BoardIndexEntry entry = indexEntry(session, index);
+    const uint8_t *cursor = session.data + entry.strokesOffset;
+    const uint8_t *end = cursor + entry.strokesBytes;
+    uint32_t strokeCount, segments;
+    if (!getVarint(cursor, end, strokeCount) || !getVarint(cursor, end, segments))
+    {
+        return;
+    }
+    // One stroke at a time, so only the longest one's lines are held
+    Stroke stroke;
+    for (uint32_t s = 0; s < strokeCount && unpackStroke(cursor, end, stroke); s++)
+    {
+        ids.push_back(std::make_pair(stroke.author, stroke.seq));
+        if (stroke.stamp > newestStamp)
+        {
+            newestStamp = stroke.stamp;
+        }
+    }
+}
+
+void loadBoardTiles(const SessionFile &session, int index, std::vector<RasterTile> &tiles)
+{
+    BoardIndexEntry entry = indexEntry(session, index);
+    tiles.clear();
+    uint64_t offset = entry.tilesOffset;
+    for (uint32_t t = 0; t < entry.tileCount && rangeInside(session, offset, sizeof(TileRecord)); t++)
+    {
+        TileRecord record;
+        memcpy(&record, session.data + offset, sizeof(record));
+        offset += sizeof(record);
+        if (!rangeInside(session, offset, record.encodedSize))
+        {
+            break;
+        }
+        RasterTile tile;
+        tile.x = record.x;
+        tile.y = record.y;
+        tile.encoded.assign(session.data + offset, session.data + offset + record.encodedSize);
+        tile.texture = 0;
+        tiles.push_back(tile);
+        offset += (record.encodedSize + 7) / 8 * 8;
+    }
+}
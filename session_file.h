@@ -0,0 +1,128 @@
+#ifndef SESSION_FILE_H
+#define SESSION_FILE_H
+
+#include "board.h"
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Versioned binary file holding every board of a session.
+//
+//   SessionHeader
+//   per board: name bytes
+//              strokes in packed form                 (see packStrokes)
+//              per tile: TileRecord, encoded bytes
+//   BoardIndexEntry[boardCount]                       (at indexOffset)
+//
+// Sections start on 8-byte boundaries and values are little-endian. The
+// file is mapped: opening reads only the header and the index, and a
+// board's strokes are unpacked when it is first selected. Segments are
+// stored as varint deltas, so a freehand segment takes about 4 bytes.
+
+const uint32_t SESSION_MAGIC = 0x44524249; // "IBRD"
+const uint32_t SESSION_VERSION = 1;
+
+struct SessionHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t boardCount;
+    uint32_t currentBoard;
+    uint64_t indexOffset;
+};
+
+struct BoardIndexEntry
+{
+    uint64_t nameOffset;
+    uint64_t strokesOffset;
+    uint64_t strokesBytes;
+    uint64_t lineCount;
+    uint64_t tilesOffset;
+    uint32_t nameLength;
+    uint32_t strokeCount;
+    uint32_t tileCount;
+    float currentColor[3];
+    int32_t pointSize;
+    int32_t tool;
+};
+
+// Lines of a stroke drawn with another brush than the stroke's own, as
+// when the brush changed in the middle of a drag
+struct StyleRun
+{
+    uint32_t firstLine; // Within the stroke
+    uint32_t lineCount;
+    int32_t size;
+    float color[3];
+    uint32_t flags; // STROKE_FLAG_ERASER
+};
+
+struct TileRecord
+{
+    int32_t x;
+    int32_t y;
+    uint32_t encodedSize; // Followed by the encoded bytes, padded to 8
+    uint32_t reserved;
+};
+
+const uint32_t STROKE_FLAG_ERASER = 1;
+const uint32_t STROKE_FLAG_REMOVED = 2;
+
+struct SessionFile
+{
+    const unsigned char *data;
+    size_t size;
+    const unsigned char *index;
+    uint32_t boardCount;
+    uint32_t currentBoard;
+#ifdef _WIN32
+    void *fileHandle;
+    void *mappingHandle;
+#else
+    int fd;
+#endif
+};
+
+// Written to a temporary file that is fsynced and then renamed over path,
+// so a crash leaves either the old file or the new one, never neither
+bool saveSession(const char *path, const std::vector<Board> &boards, int currentBoard);
+
+// Flushes and fsyncs a file
+bool syncFile(FILE *file);
+// Renames tempPath over path in one step and syncs the directory, so the
+// rename survives a power loss too; tempPath should be synced already
+bool replaceFile(const char *tempPath, const char *path);
+
+// Maps the file and validates the header and index; no stroke data is read
+bool openSession(const char *path, SessionFile &session);
+void closeSession(SessionFile &session);
+
+// Board name and settings from the index, with an empty stroke list
+void readBoardInfo(const SessionFile &session, int index, Board &board);
+
+// Unpacks the strokes of one board from the mapped file
+void loadBoardStrokes(const SessionFile &session, int index, std::vector<Stroke> &strokes);
+void loadBoardTiles(const SessionFile &session, int index, std::vector<RasterTile> &tiles);
+uint64_t boardLineCount(const SessionFile &session, int index);
+// The (author, seq) of every stroke of a board, without keeping its lines;
+// newestStamp is raised to the newest of their stamps
+void loadStrokeIds(const SessionFile &session, int index, std::vector<std::pair<uint32_t, uint32_t> > &ids,
+                   uint64_t &newestStamp);
+
+// Appends the runs of lines whose style differs from their stroke's
+void strokeStyleRuns(const Stroke &stroke, std::vector<StyleRun> &runs);
+// Restyles the lines of a run, clipped to the stroke
+void applyStyleRun(Stroke &stroke, const StyleRun &run);
+
+// Compressed form of a board's strokes, kept in memory for a board that
+// is not shown and written as is to session files: varints, with each
+// line stored as deltas from the end of the previous one, which for
+// freehand strokes takes about 4 bytes instead of a Line, and each
+// stroke's style runs after its lines.
+void packStrokes(const std::vector<Stroke> &strokes, std::vector<uint8_t> &packed);
+bool unpackStrokes(const std::vector<uint8_t> &packed, std::vector<Stroke> &strokes);
+uint32_t packedSegmentCount(const std::vector<uint8_t> &packed); // Without unpacking
+
+#endif
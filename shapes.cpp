@@ -0,0 +1,62 @@
+#include "shapes.h"
+#include <cmath>
+#include <cstring>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static Stroke shapeStroke(const float color[3], int size)
+{
+    Stroke stroke = Stroke();
+    stroke.isEraser = false;
+    memcpy(stroke.color, color, sizeof(float) * 3);
+    stroke.size = size;
+    return stroke;
+}
+
+static Line shapeLine(int x1, int y1, int x2, int y2, const Stroke &stroke)
+{
+    Line line;
+    line.x1 = x1;
+    line.y1 = y1;
+    line.x2 = x2;
+    line.y2 = y2;
+    line.size = stroke.size;
+    memcpy(line.color, stroke.color, sizeof(float) * 3);
+    line.isEraser = false;
+    return line;
+}
+
+Stroke makeCircleStroke(int centerX, int centerY, int radius, const float color[3], int size)
+{
+    Stroke stroke = shapeStroke(color, size);
+    stroke.lines.reserve(CIRCLE_SEGMENTS);
+
+    // Each point ends one segment and starts the next, so it is computed once
+    int prevX = 0, prevY = 0;
+    for (int i = 0; i <= CIRCLE_SEGMENTS; i++)
+    {
+        float theta = 2.0f * M_PI * float(i) / float(CIRCLE_SEGMENTS);
+        int x = centerX + radius * cos(theta);
+        int y = centerY + radius * sin(theta);
+        if (i > 0)
+        {
+            stroke.lines.push_back(shapeLine(prevX, prevY, x, y, stroke));
+        }
+        prevX = x;
+        prevY = y;
+    }
+    return stroke;
+}
+
+Stroke makeSquareStroke(int x1, int y1, int x2, int y2, const float color[3], int size)
+{
+    Stroke stroke = shapeStroke(color, size);
+    stroke.lines.reserve(4);
+    stroke.lines.push_back(shapeLine(x1, y1, x2, y1, stroke));
+    stroke.lines.push_back(shapeLine(x2, y1, x2, y2, stroke));
+    stroke.lines.push_back(shapeLine(x2, y2, x1, y2, stroke));
+    stroke.lines.push_back(shapeLine(x1, y2, x1, y1, stroke));
+    return stroke;
+}
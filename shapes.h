@@ -0,0 +1,13 @@
+#ifndef SHAPES_H
+#define SHAPES_H
+
+#include "board.h"
+
+// Strokes for the circle and square tools; the caller assigns the id
+
+const int CIRCLE_SEGMENTS = 200;
+
+Stroke makeCircleStroke(int centerX, int centerY, int radius, const float color[3], int size);
+Stroke makeSquareStroke(int x1, int y1, int x2, int y2, const float color[3], int size);
+
+#endif
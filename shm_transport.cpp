@@ -0,0 +1,629 @@
+#include "shm_transport.h"
+
+#ifdef __linux__
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+const uint64_t SHM_MAGIC = 0x314d48534249ULL; // "IBSHM1"
+// As much as a TCP peer's queue may hold before it starts losing messages
+const size_t BROADCAST_BYTES = 8 * 1024 * 1024;
+const size_t UPSTREAM_BYTES = 1024 * 1024;
+const size_t RECORD_HEADER = 16; // Length, padding, mask
+const unsigned char SLOTS_FULL = 0xff;
+
+enum SlotState
+{
+    SLOT_FREE,
+    SLOT_OPEN,
+    SLOT_CLOSED
+};
+
+// One local client's part of the segment. Each group is written by one
+// side only and sits on its own cache line.
+struct ShmSlot
+{
+    // Host
+    alignas(64) uint32_t state;
+    uint32_t hostWaiting; // Found the upstream ring empty
+    int32_t pid;          // Of the client
+    uint64_t upstreamRead;
+    // Client
+    alignas(64) uint32_t clientWaiting; // Found nothing for it in the broadcast ring
+    uint32_t clientGone;
+    uint64_t broadcastRead;
+    uint64_t upstreamWrite;
+};
+
+struct ShmHeader
+{
+    uint64_t magic;
+    alignas(64) uint64_t broadcastWrite;
+    ShmSlot slots[SHM_MAX_CLIENTS];
+};
+
+const size_t BROADCAST_OFFSET = (sizeof(ShmHeader) + 4095) & ~static_cast<size_t>(4095);
+const size_t SEGMENT_BYTES = BROADCAST_OFFSET + BROADCAST_BYTES + SHM_MAX_CLIENTS * UPSTREAM_BYTES;
+
+static SharedBytes doorbell = std::make_shared<const std::string>("!");
+
+static std::string segmentName(const char *port)
+{
+    return std::string("/instantboard-") + port;
+}
+
+// Abstract, so a host that dies leaves no socket file behind
+static socklen_t listenAddress(const char *port, sockaddr_un &address)
+{
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::string name = std::string("instantboard-") + port;
+    memcpy(address.sun_path + 1, name.data(), name.size());
+    return static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 + name.size());
+}
+
+static char *broadcastRing(char *memory)
+{
+    return memory + BROADCAST_OFFSET;
+}
+
+static char *upstreamRing(char *memory, int slot)
+{
+    return memory + BROADCAST_OFFSET + BROADCAST_BYTES + slot * UPSTREAM_BYTES;
+}
+
+static void ringWrite(char *ring, size_t size, uint64_t position, const char *data, size_t length)
+{
+    size_t start = static_cast<size_t>(position % size);
+    size_t first = std::min(length, size - start);
+    memcpy(ring + start, data, first);
+    memcpy(ring, data + first, length - first);
+}
+
+static void ringRead(const char *ring, size_t size, uint64_t position, char *data, size_t length)
+{
+    size_t start = static_cast<size_t>(position % size);
+    size_t first = std::min(length, size - start);
+    memcpy(data, ring + start, first);
+    memcpy(data + first, ring, length - first);
+}
+
+static uint64_t recordSpan(size_t length)
+{
+    return RECORD_HEADER + ((length + 7) & ~static_cast<size_t>(7));
+}
+
+// Host side. Every transport call comes in under shmMutex, since the
+// slots and the pending record are shared by all of them.
+
+struct HostSlot
+{
+    Transport control;
+    uint64_t generation; // So a closed transport cannot touch a reused slot
+};
+
+// Sends of one broadcast, gathered into a single record
+struct PendingRecord
+{
+    SharedBytes data;
+    size_t offset;
+    uint64_t mask;
+};
+
+static std::mutex shmMutex;
+static char *hostMemory = NULL;
+static std::string hostSegment;
+static HostSlot hostSlots[SHM_MAX_CLIENTS];
+static uint64_t nextGeneration = 1;
+static PendingRecord pending;
+
+static ShmHeader *hostHeader()
+{
+    return reinterpret_cast<ShmHeader *>(hostMemory);
+}
+
+static bool slotLive(int slot, uint64_t generation)
+{
+    return hostMemory && hostSlots[slot].generation == generation &&
+           __atomic_load_n(&hostHeader()->slots[slot].state, __ATOMIC_ACQUIRE) == SLOT_OPEN;
+}
+
+static void ring(Transport &control)
+{
+    // Zero means the socket is full of doorbells already
+    control.send(doorbell, 0);
+}
+
+static void cutOff(int slot)
+{
+    std::cerr << "Local client " << slot << " fell a whole ring behind and is cut off.\n";
+    __atomic_store_n(&hostHeader()->slots[slot].state, SLOT_CLOSED, __ATOMIC_RELEASE);
+    ring(hostSlots[slot].control);
+}
+
+static void publishPending()
+{
+    if (!pending.data)
+    {
+        return;
+    }
+    ShmHeader *header = hostHeader();
+    size_t length = pending.data->size() - pending.offset;
+    uint64_t span = recordSpan(length);
+    uint64_t write = header->broadcastWrite;
+    uint64_t mask = 0;
+    for (int i = 0; i < SHM_MAX_CLIENTS; i++)
+    {
+        ShmSlot &slot = header->slots[i];
+        if (__atomic_load_n(&slot.state, __ATOMIC_ACQUIRE) != SLOT_OPEN)
+        {
+            continue;
+        }
+        if (write + span - __atomic_load_n(&slot.broadcastRead, __ATOMIC_ACQUIRE) > BROADCAST_BYTES)
+        {
+            cutOff(i);
+        }
+        else if (pending.mask & (1ULL << i))
+        {
+            mask |= 1ULL << i;
+        }
+    }
+
+    if (mask != 0)
+    {
+        char *ringBytes = broadcastRing(hostMemory);
+        uint64_t recordHeader[2] = {length, mask};
+        ringWrite(ringBytes, BROADCAST_BYTES, write, reinterpret_cast<const char *>(recordHeader), RECORD_HEADER);
+        ringWrite(ringBytes, BROADCAST_BYTES, write + RECORD_HEADER, pending.data->data() + pending.offset, length);
+        __atomic_store_n(&header->broadcastWrite, write + span, __ATOMIC_RELEASE);
+        // Pairs with the fence in clientReceive: either the client sees
+        // the record or we see that it went to sleep
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        for (int i = 0; i < SHM_MAX_CLIENTS; i++)
+        {
+            if ((mask & (1ULL << i)) && __atomic_exchange_n(&header->slots[i].clientWaiting, 0, __ATOMIC_ACQ_REL))
+            {
+                ring(hostSlots[i].control);
+            }
+        }
+    }
+    pending = PendingRecord();
+}
+
+static int hostSend(int slot, uint64_t generation, const SharedBytes &data, size_t offset)
+{
+    std::lock_guard<std::mutex> lock(shmMutex);
+    if (!slotLive(slot, generation))
+    {
+        return -1;
+    }
+    size_t length = data->size() - offset;
+    if (recordSpan(length) > BROADCAST_BYTES / 2)
+    {
+        std::cerr << "A " << length << " byte message is too big for the local ring.\n";
+        return -1;
+    }
+    if (pending.data != data || pending.offset != offset)
+    {
+        publishPending();
+        pending.data = data;
+        pending.offset = offset;
+    }
+    pending.mask |= 1ULL << slot;
+    return static_cast<int>(length);
+}
+
+static int hostReceive(int slot, uint64_t generation, char *buffer, int length)
+{
+    std::lock_guard<std::mutex> lock(shmMutex);
+    if (!slotLive(slot, generation))
+    {
+        return -1;
+    }
+    char bells[64];
+    if (hostSlots[slot].control.receive(bells, sizeof(bells)) < 0)
+    {
+        return -1;
+    }
+
+    ShmSlot &state = hostHeader()->slots[slot];
+    uint64_t read = state.upstreamRead;
+    uint64_t available = __atomic_load_n(&state.upstreamWrite, __ATOMIC_ACQUIRE) - read;
+    if (available == 0)
+    {
+        __atomic_store_n(&state.hostWaiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        available = __atomic_load_n(&state.upstreamWrite, __ATOMIC_ACQUIRE) - read;
+        if (available == 0)
+        {
+            return 0;
+        }
+        __atomic_store_n(&state.hostWaiting, 0, __ATOMIC_RELAXED);
+    }
+    size_t count = static_cast<size_t>(std::min(available, static_cast<uint64_t>(length)));
+    ringRead(upstreamRing(hostMemory, slot), UPSTREAM_BYTES, read, buffer, count);
+    __atomic_store_n(&state.upstreamRead, read + count, __ATOMIC_RELEASE);
+    if (count < available)
+    {
+        netStayAwake();
+    }
+    return static_cast<int>(count);
+}
+
+static void hostClose(int slot, uint64_t generation)
+{
+    std::lock_guard<std::mutex> lock(shmMutex);
+    if (!hostMemory || hostSlots[slot].generation != generation)
+    {
+        return;
+    }
+    __atomic_store_n(&hostHeader()->slots[slot].state, SLOT_CLOSED, __ATOMIC_RELEASE);
+    hostSlots[slot].control.close();
+    hostSlots[slot].generation = 0;
+    pending.mask &= ~(1ULL << slot);
+}
+
+NetSocket shmHostStart(const char *port)
+{
+    std::lock_guard<std::mutex> lock(shmMutex);
+    hostSegment = segmentName(port);
+    shm_unlink(hostSegment.c_str()); // Left by a host that did not exit cleanly
+    int fd = shm_open(hostSegment.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+    {
+        return NET_INVALID;
+    }
+    void *memory = MAP_FAILED;
+    if (ftruncate(fd, SEGMENT_BYTES) == 0)
+    {
+        memory = mmap(NULL, SEGMENT_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (memory == MAP_FAILED)
+    {
+        shm_unlink(hostSegment.c_str());
+        return NET_INVALID;
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    sockaddr_un address;
+    socklen_t size = listenAddress(port, address);
+    if (listener < 0 || bind(listener, reinterpret_cast<sockaddr *>(&address), size) != 0 ||
+        listen(listener, SOMAXCONN) != 0)
+    {
+        if (listener >= 0)
+        {
+            close(listener);
+        }
+        munmap(memory, SEGMENT_BYTES);
+        shm_unlink(hostSegment.c_str());
+        return NET_INVALID;
+    }
+    hostMemory = static_cast<char *>(memory);
+    hostHeader()->magic = SHM_MAGIC;
+    return listener;
+}
+
+void shmHostStop()
+{
+    std::lock_guard<std::mutex> lock(shmMutex);
+    if (!hostMemory)
+    {
+        return;
+    }
+    for (int i = 0; i < SHM_MAX_CLIENTS; i++)
+    {
+        __atomic_store_n(&hostHeader()->slots[i].state, SLOT_CLOSED, __ATOMIC_RELEASE);
+    }
+    pending = PendingRecord();
+    munmap(hostMemory, SEGMENT_BYTES);
+    hostMemory = NULL;
+    shm_unlink(hostSegment.c_str());
+}
+
+// A closed slot is free again once its client has let go of it or died
+static bool slotReusable(const ShmSlot &slot)
+{
+    uint32_t state = __atomic_load_n(&slot.state, __ATOMIC_ACQUIRE);
+    return state == SLOT_FREE ||
+           (state == SLOT_CLOSED && (__atomic_load_n(&slot.clientGone, __ATOMIC_ACQUIRE) ||
+                                     (kill(slot.pid, 0) != 0 && errno == ESRCH)));
+}
+
+bool shmAccept(NetSocket socket, Transport &transport)
+{
+    std::unique_lock<std::mutex> lock(shmMutex);
+    int fd = static_cast<int>(socket);
+    int slot = 0;
+    while (hostMemory && slot < SHM_MAX_CLIENTS && !slotReusable(hostHeader()->slots[slot]))
+    {
+        slot++;
+    }
+    if (!hostMemory || slot == SHM_MAX_CLIENTS)
+    {
+        send(fd, &SLOTS_FULL, 1, MSG_NOSIGNAL);
+        lock.unlock();
+        netClose(socket);
+        return false;
+    }
+
+    ucred credentials = ucred();
+    socklen_t size = sizeof(credentials);
+    getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &size);
+    ShmHeader *header = hostHeader();
+    ShmSlot &state = header->slots[slot];
+    state.hostWaiting = 0;
+    state.pid = credentials.pid;
+    state.upstreamRead = 0;
+    state.clientWaiting = 0;
+    state.clientGone = 0;
+    state.upstreamWrite = 0;
+    state.broadcastRead = header->broadcastWrite;
+    __atomic_store_n(&state.state, SLOT_OPEN, __ATOMIC_RELEASE);
+
+    // The slot number is the whole handshake; a fresh socket has room for it
+    unsigned char slotByte = static_cast<unsigned char>(slot);
+    if (send(fd, &slotByte, 1, MSG_NOSIGNAL) != 1)
+    {
+        __atomic_store_n(&state.state, SLOT_CLOSED, __ATOMIC_RELEASE);
+        lock.unlock();
+        netClose(socket);
+        return false;
+    }
+    uint64_t generation = nextGeneration++;
+    hostSlots[slot].generation = generation;
+    hostSlots[slot].control = socketTransport(socket);
+
+    transport.send = [slot, generation](const SharedBytes &data, size_t offset)
+    {
+        return hostSend(slot, generation, data, offset);
+    };
+    transport.receive = [slot, generation](char *buffer, int length)
+    {
+        return hostReceive(slot, generation, buffer, length);
+    };
+    transport.close = [slot, generation]()
+    {
+        hostClose(slot, generation);
+    };
+    return true;
+}
+
+void shmFlush()
+{
+    std::lock_guard<std::mutex> lock(shmMutex);
+    if (hostMemory)
+    {
+        publishPending();
+    }
+}
+
+// Client side. Only the client's own network thread uses its transport,
+// under peersMutex, so it needs no lock of its own.
+
+struct ShmClient
+{
+    char *memory;
+    int slot;
+    Transport control;
+    uint64_t broadcastRead;
+    size_t recordOffset; // Into the record at broadcastRead
+    bool gone;
+};
+
+static ShmSlot &clientSlot(ShmClient &client)
+{
+    return reinterpret_cast<ShmHeader *>(client.memory)->slots[client.slot];
+}
+
+static bool clientOpen(ShmClient &client)
+{
+    if (!client.gone && __atomic_load_n(&clientSlot(client).state, __ATOMIC_ACQUIRE) != SLOT_OPEN)
+    {
+        client.gone = true;
+        std::cout << "The host closed the local connection\n";
+    }
+    return !client.gone;
+}
+
+static int clientSend(ShmClient &client, const SharedBytes &data, size_t offset)
+{
+    if (!clientOpen(client))
+    {
+        return -1;
+    }
+    ShmSlot &slot = clientSlot(client);
+    uint64_t write = slot.upstreamWrite;
+    uint64_t space = UPSTREAM_BYTES - (write - __atomic_load_n(&slot.upstreamRead, __ATOMIC_ACQUIRE));
+    size_t count = static_cast<size_t>(std::min(space, static_cast<uint64_t>(data->size() - offset)));
+    if (count == 0)
+    {
+        return 0;
+    }
+    ringWrite(upstreamRing(client.memory, client.slot), UPSTREAM_BYTES, write, data->data() + offset, count);
+    __atomic_store_n(&slot.upstreamWrite, write + count, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&slot.hostWaiting, 0, __ATOMIC_ACQ_REL))
+    {
+        ring(client.control);
+    }
+    return static_cast<int>(count);
+}
+
+static int clientReceive(ShmClient &client, char *buffer, int length)
+{
+    char bells[64];
+    if (client.gone || client.control.receive(bells, sizeof(bells)) < 0)
+    {
+        client.gone = true;
+        return -1;
+    }
+
+    ShmHeader *header = reinterpret_cast<ShmHeader *>(client.memory);
+    ShmSlot &slot = clientSlot(client);
+    const char *ringBytes = broadcastRing(client.memory);
+    uint64_t bit = 1ULL << client.slot;
+    int copied = 0;
+    uint64_t write = __atomic_load_n(&header->broadcastWrite, __ATOMIC_ACQUIRE);
+    while (copied < length)
+    {
+        if (client.broadcastRead == write)
+        {
+            if (copied > 0)
+            {
+                break;
+            }
+            __atomic_store_n(&slot.clientWaiting, 1, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            write = __atomic_load_n(&header->broadcastWrite, __ATOMIC_ACQUIRE);
+            if (client.broadcastRead == write)
+            {
+                break;
+            }
+            __atomic_store_n(&slot.clientWaiting, 0, __ATOMIC_RELAXED);
+        }
+        uint64_t recordHeader[2];
+        ringRead(ringBytes, BROADCAST_BYTES, client.broadcastRead, reinterpret_cast<char *>(recordHeader),
+                 RECORD_HEADER);
+        size_t recordLength = static_cast<size_t>(recordHeader[0]);
+        if (recordHeader[1] & bit)
+        {
+            size_t count = std::min(recordLength - client.recordOffset, static_cast<size_t>(length - copied));
+            ringRead(ringBytes, BROADCAST_BYTES, client.broadcastRead + RECORD_HEADER + client.recordOffset,
+                     buffer + copied, count);
+            copied += static_cast<int>(count);
+            client.recordOffset += count;
+        }
+        if (!(recordHeader[1] & bit) || client.recordOffset == recordLength)
+        {
+            client.broadcastRead += recordSpan(recordLength);
+            client.recordOffset = 0;
+        }
+    }
+    __atomic_store_n(&slot.broadcastRead, client.broadcastRead, __ATOMIC_RELEASE);
+
+    // Checked after copying, since a client that was cut off may have
+    // been copying bytes the host was writing over
+    if (!clientOpen(client))
+    {
+        return -1;
+    }
+    if (copied == length)
+    {
+        netStayAwake();
+    }
+    return copied;
+}
+
+static void clientClose(ShmClient &client)
+{
+    if (client.memory)
+    {
+        __atomic_store_n(&clientSlot(client).clientGone, 1, __ATOMIC_RELEASE);
+        munmap(client.memory, SEGMENT_BYTES);
+        client.memory = NULL;
+    }
+    client.control.close();
+    client.gone = true;
+}
+
+bool shmConnect(const char *port, Transport &transport)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un address;
+    socklen_t size = listenAddress(port, address);
+    timeval timeout = {5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    unsigned char slot = SLOTS_FULL;
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&address), size) != 0 || recv(fd, &slot, 1, 0) != 1 ||
+        slot == SLOTS_FULL)
+    {
+        if (slot == SLOTS_FULL && fd >= 0)
+        {
+            std::cerr << "No host on this machine, or it has no room for another local client.\n";
+        }
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return false;
+    }
+
+    int segment = shm_open(segmentName(port).c_str(), O_RDWR, 0);
+    void *memory = MAP_FAILED;
+    if (segment >= 0)
+    {
+        memory = mmap(NULL, SEGMENT_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, segment, 0);
+        close(segment);
+    }
+    if (memory == MAP_FAILED || reinterpret_cast<ShmHeader *>(memory)->magic != SHM_MAGIC)
+    {
+        if (memory != MAP_FAILED)
+        {
+            munmap(memory, SEGMENT_BYTES);
+        }
+        close(fd);
+        return false;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    std::shared_ptr<ShmClient> client = std::make_shared<ShmClient>();
+    client->memory = static_cast<char *>(memory);
+    client->slot = slot;
+    client->control = socketTransport(fd);
+    client->broadcastRead = __atomic_load_n(&clientSlot(*client).broadcastRead, __ATOMIC_ACQUIRE);
+    client->recordOffset = 0;
+    client->gone = false;
+    transport.send = [client](const SharedBytes &data, size_t offset)
+    {
+        return clientSend(*client, data, offset);
+    };
+    transport.receive = [client](char *buffer, int length)
+    {
+        return clientReceive(*client, buffer, length);
+    };
+    transport.close = [client]()
+    {
+        clientClose(*client);
+    };
+    return true;
+}
+
+#else
+
+NetSocket shmHostStart(const char *)
+{
+    return NET_INVALID;
+}
+
+void shmHostStop()
+{
+}
+
+bool shmAccept(NetSocket socket, Transport &)
+{
+    netClose(socket);
+    return false;
+}
+
+void shmFlush()
+{
+}
+
+bool shmConnect(const char *, Transport &)
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef SHM_TRANSPORT_H
+#define SHM_TRANSPORT_H
+
+#include "net_socket.h"
+
+// Peer connections through shared memory, for clients on the host's
+// machine. Linux only.
+//
+// The host maps one segment with a broadcast ring and, for each local
+// client, a ring back to the host. A message sent to several local
+// clients is written to the broadcast ring once, with a mask of the
+// clients it is for, and each client copies it straight out of the ring;
+// the sends of one broadcast are gathered until shmFlush. A client that
+// falls a whole ring behind is cut off, as its queue would overflow on
+// TCP.
+//
+// Each client also has a Unix socket to the host. It is how a client
+// joins and how either end learns that the other has gone, and it
+// carries one-byte doorbells: whoever writes to a ring rings the reader
+// only if the reader found its ring empty and went to sleep, so the
+// doorbells wake netWait like any socket and a busy reader costs no
+// system calls at all.
+
+const int SHM_MAX_CLIENTS = 64; // One bit each in a broadcast record's mask
+
+// The listening socket for local clients, NET_INVALID on failure; the
+// segment is named after the TCP port
+NetSocket shmHostStart(const char *port);
+void shmHostStop();
+// An accepted connection from the listener; false if no slot was free
+bool shmAccept(NetSocket socket, Transport &transport);
+// Publishes what the host's transports gathered since the last flush
+void shmFlush();
+
+// Joins the host on this machine that listens on port
+bool shmConnect(const char *port, Transport &transport);
+
+#endif
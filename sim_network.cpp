@@ -0,0 +1,176 @@
+#include "sim_network.h"
+#include <algorithm>
+#include <cstring>
+
+SimLinkConfig simDefaultLink()
+{
+    SimLinkConfig config;
+    config.latencyMs = 20.0;
+    config.jitterMs = 0.0;
+    config.bytesPerMs = 1000.0;
+    config.windowBytes = 256 * 1024;
+    config.reorderPercent = 0;
+    config.lossPercent = 0;
+    config.disconnectAtMs = -1.0;
+    return config;
+}
+
+void simInit(SimNetwork &network, unsigned seed)
+{
+    network.nowMs = 0;
+    network.rng.seed(seed);
+    network.pipes.clear();
+}
+
+static bool percentChance(SimNetwork &network, int percent)
+{
+    return percent > 0 && static_cast<int>(network.rng() % 100) < percent;
+}
+
+static int pipeSend(SimNetwork &network, size_t index, const char *data, int length)
+{
+    SimPipe &pipe = network.pipes[index];
+    if (pipe.failed || pipe.closed || pipe.readerGone)
+    {
+        return -1;
+    }
+    if (pipe.inFlightBytes > 0 && pipe.inFlightBytes + length > pipe.config.windowBytes)
+    {
+        return 0;
+    }
+    pipe.bytesSent += length;
+    if (percentChance(network, pipe.config.lossPercent))
+    {
+        pipe.chunksDropped++;
+        return length;
+    }
+
+    double leaveMs = std::max(network.nowMs, pipe.sendFreeMs);
+    if (pipe.config.bytesPerMs > 0)
+    {
+        leaveMs += length / pipe.config.bytesPerMs;
+    }
+    pipe.sendFreeMs = leaveMs;
+    SimChunk chunk;
+    chunk.deliverMs = leaveMs + pipe.config.latencyMs;
+    if (pipe.config.jitterMs > 0)
+    {
+        chunk.deliverMs += std::uniform_real_distribution<double>(0, pipe.config.jitterMs)(network.rng);
+    }
+    if (!percentChance(network, pipe.config.reorderPercent))
+    {
+        chunk.deliverMs = std::max(chunk.deliverMs, pipe.lastDeliverMs);
+        pipe.lastDeliverMs = chunk.deliverMs;
+    }
+    chunk.bytes.assign(data, length);
+
+    // After everything due at the same time, so a partly read front chunk
+    // stays in front
+    std::deque<SimChunk>::iterator position = pipe.inFlight.end();
+    while (position != pipe.inFlight.begin() && (position - 1)->deliverMs > chunk.deliverMs)
+    {
+        --position;
+    }
+    pipe.inFlight.insert(position, chunk);
+    pipe.inFlightBytes += length;
+    return length;
+}
+
+static int pipeReceive(SimNetwork &network, size_t index, char *buffer, int length)
+{
+    SimPipe &pipe = network.pipes[index];
+    if (pipe.failed || pipe.readerGone)
+    {
+        return -1;
+    }
+    int copied = 0;
+    while (copied < length && !pipe.inFlight.empty() && pipe.inFlight.front().deliverMs <= network.nowMs)
+    {
+        SimChunk &chunk = pipe.inFlight.front();
+        size_t count = std::min(chunk.bytes.size() - pipe.readOffset, static_cast<size_t>(length - copied));
+        memcpy(buffer + copied, chunk.bytes.data() + pipe.readOffset, count);
+        copied += static_cast<int>(count);
+        pipe.readOffset += count;
+        if (pipe.readOffset == chunk.bytes.size())
+        {
+            pipe.inFlightBytes -= chunk.bytes.size();
+            pipe.bytesDelivered += chunk.bytes.size();
+            pipe.readOffset = 0;
+            pipe.inFlight.pop_front();
+        }
+    }
+    if (copied == 0 && pipe.closed && pipe.inFlight.empty())
+    {
+        return -1;
+    }
+    return copied;
+}
+
+static void makeEnd(SimNetwork &network, size_t out, size_t in, Transport &transport)
+{
+    SimNetwork *net = &network;
+    transport.send = [net, out](const SharedBytes &data, size_t offset)
+    {
+        return pipeSend(*net, out, data->data() + offset, static_cast<int>(data->size() - offset));
+    };
+    transport.receive = [net, in](char *buffer, int length) { return pipeReceive(*net, in, buffer, length); };
+    transport.close = [net, out, in]()
+    {
+        net->pipes[out].closed = true;
+        net->pipes[in].readerGone = true;
+    };
+}
+
+int simConnect(SimNetwork &network, const SimLinkConfig &config, Transport &a, Transport &b)
+{
+    int link = static_cast<int>(network.pipes.size() / 2);
+    SimPipe pipe = SimPipe();
+    pipe.config = config;
+    network.pipes.push_back(pipe);
+    network.pipes.push_back(pipe);
+    makeEnd(network, link * 2, link * 2 + 1, a);
+    makeEnd(network, link * 2 + 1, link * 2, b);
+    return link;
+}
+
+void simDisconnect(SimNetwork &network, int link)
+{
+    network.pipes[link * 2].failed = true;
+    network.pipes[link * 2 + 1].failed = true;
+}
+
+void simAdvance(SimNetwork &network, double nowMs)
+{
+    network.nowMs = nowMs;
+    for (size_t i = 0; i < network.pipes.size(); i++)
+    {
+        SimPipe &pipe = network.pipes[i];
+        if (pipe.config.disconnectAtMs >= 0 && nowMs >= pipe.config.disconnectAtMs)
+        {
+            pipe.failed = true;
+        }
+    }
+}
+
+bool simIdle(const SimNetwork &network)
+{
+    for (size_t i = 0; i < network.pipes.size(); i++)
+    {
+        const SimPipe &pipe = network.pipes[i];
+        if (!pipe.failed && !pipe.readerGone && !pipe.inFlight.empty())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint64_t simBytesSent(const SimNetwork &network)
+{
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < network.pipes.size(); i++)
+    {
+        bytes += network.pipes[i].bytesSent;
+    }
+    return bytes;
+}
@@ -0,0 +1,71 @@
+#ifndef SIM_NETWORK_H
+#define SIM_NETWORK_H
+
+#include "transport.h"
+#include <cstdint>
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+
+// In-process network for running several peers in one process.
+//
+// Each link is a pair of one-way pipes. Time is virtual and only moves
+// when simAdvance is called, so a run is repeatable for a given seed. A
+// send is delivered whole, after waiting for the bytes ahead of it to
+// leave at the link's bandwidth, then the latency plus up to jitterMs
+// more. Deliveries keep send order like TCP unless reorderPercent lets
+// one overtake, and lossPercent drops sends outright; with either of
+// those the pipe no longer behaves like a stream, which is the point.
+
+struct SimLinkConfig
+{
+    double latencyMs;
+    double jitterMs;
+    double bytesPerMs;     // 0 for unlimited
+    size_t windowBytes;    // Undelivered bytes before send takes no more
+    int reorderPercent;
+    int lossPercent;
+    double disconnectAtMs; // Virtual time the link fails at, or < 0
+};
+
+SimLinkConfig simDefaultLink(); // 20 ms each way, 1 MB/s, 256 KB window
+
+struct SimChunk
+{
+    double deliverMs;
+    std::string bytes;
+};
+
+struct SimPipe
+{
+    SimLinkConfig config;
+    std::deque<SimChunk> inFlight; // By delivery time
+    size_t inFlightBytes;
+    size_t readOffset;             // Into the first chunk
+    double sendFreeMs;             // When the last send finishes leaving
+    double lastDeliverMs;
+    bool closed;                   // The sender closed; reads end after inFlight
+    bool readerGone;               // The receiver closed; sends fail
+    bool failed;                   // Link down; both ends fail right away
+    uint64_t bytesSent, bytesDelivered, chunksDropped;
+};
+
+struct SimNetwork
+{
+    double nowMs;
+    std::mt19937 rng;
+    std::vector<SimPipe> pipes; // Link n is pipes 2n (a to b) and 2n + 1
+};
+
+void simInit(SimNetwork &network, unsigned seed);
+
+// Connects a and b; returns the link number
+int simConnect(SimNetwork &network, const SimLinkConfig &config, Transport &a, Transport &b);
+void simDisconnect(SimNetwork &network, int link);
+void simAdvance(SimNetwork &network, double nowMs);
+
+bool simIdle(const SimNetwork &network); // Nothing in flight anywhere
+uint64_t simBytesSent(const SimNetwork &network);
+
+#endif
@@ -0,0 +1,38 @@
+#include "stroke_draw.h"
+#include <GL/gl.h>
+#include <cstring>
+
+bool sameLineStyle(const Line &a, const Line &b)
+{
+    return a.size == b.size && a.isEraser == b.isEraser &&
+           (a.isEraser || memcmp(a.color, b.color, sizeof(float) * 3) == 0);
+}
+
+int drawStroke(const Stroke &stroke)
+{
+    int batches = 0;
+    size_t j = 0;
+    while (j < stroke.lines.size())
+    {
+        const Line &first = stroke.lines[j];
+        if (first.isEraser)
+        {
+            glColor3f(1.0, 1.0, 1.0);
+        }
+        else
+        {
+            glColor3fv(first.color);
+        }
+        glLineWidth(first.size);
+        glBegin(GL_LINES);
+        for (; j < stroke.lines.size() && sameLineStyle(stroke.lines[j], first); j++)
+        {
+            const Line &line = stroke.lines[j];
+            glVertex2i(line.x1, line.y1);
+            glVertex2i(line.x2, line.y2);
+        }
+        glEnd();
+        batches++;
+    }
+    return batches;
+}
@@ -0,0 +1,16 @@
+#ifndef STROKE_DRAW_H
+#define STROKE_DRAW_H
+
+#include "board.h"
+
+// Immediate-mode GL submission of strokes, for the window and the
+// benchmarks. A GL context must be current.
+
+bool sameLineStyle(const Line &a, const Line &b);
+
+// Submits consecutive lines that share a width and color inside a single
+// glBegin/glEnd pair, so a stroke normally costs one batch. Returns the
+// number of batches.
+int drawStroke(const Stroke &stroke);
+
+#endif
@@ -0,0 +1,146 @@
+#include "stroke_predictor.h"
+#include <cmath>
+
+PredictorConfig defaultPredictorConfig()
+{
+    PredictorConfig config;
+    config.enabled = true;
+    config.horizonMs = 24.0f;
+    config.points = 3;
+    config.windowMs = 40.0f;
+    config.maxAcceleration = 0.05f;
+    config.maxTurnRadians = 1.2f;
+    config.minSpeed = 0.05f;
+    config.maxSampleAgeMs = 2 * 1000.0f / 60.0f; // Two frames
+    return config;
+}
+
+void predictorReset(StrokePredictor &predictor)
+{
+    predictor.count = 0;
+    predictor.next = 0;
+    predictor.erratic = false;
+}
+
+void predictorAddSample(StrokePredictor &predictor, float x, float y, double timeMs)
+{
+    PointerSample &sample = predictor.history[predictor.next];
+    sample.x = x;
+    sample.y = y;
+    sample.timeMs = timeMs;
+    predictor.next = (predictor.next + 1) % PREDICTOR_HISTORY;
+    if (predictor.count < PREDICTOR_HISTORY)
+    {
+        predictor.count++;
+    }
+}
+
+// Least-squares fit of p(t) = p0 + v t + 0.5 a t^2 over samples whose time t
+// is measured back from the newest one. Falls back to a straight line when
+// the quadratic system is degenerate.
+static void fitAxis(const float *t, const float *p, int n, float &velocity, float &acceleration)
+{
+    double s0 = n, s1 = 0, s2 = 0, s3 = 0, s4 = 0;
+    double p0 = 0, p1 = 0, p2 = 0;
+    for (int i = 0; i < n; i++)
+    {
+        double ti = t[i];
+        s1 += ti;
+        s2 += ti * ti;
+        s3 += ti * ti * ti;
+        s4 += ti * ti * ti * ti;
+        p0 += p[i];
+        p1 += p[i] * ti;
+        p2 += p[i] * ti * ti;
+    }
+
+    double det = s0 * (s2 * s4 - s3 * s3) - s1 * (s1 * s4 - s2 * s3) + s2 * (s1 * s3 - s2 * s2);
+    if (n >= 3 && std::fabs(det) > 1e-6)
+    {
+        double b = (s0 * (p1 * s4 - s3 * p2) - p0 * (s1 * s4 - s2 * s3) + s2 * (s1 * p2 - p1 * s2)) / det;
+        double c = (s0 * (s2 * p2 - p1 * s3) - s1 * (s1 * p2 - p1 * s2) + p0 * (s1 * s3 - s2 * s2)) / det;
+        velocity = b;
+        acceleration = 2.0 * c;
+        return;
+    }
+
+    double lineDet = s0 * s2 - s1 * s1;
+    velocity = std::fabs(lineDet) > 1e-6 ? (s0 * p1 - s1 * p0) / lineDet : 0.0;
+    acceleration = 0.0f;
+}
+
+int predictorPredict(StrokePredictor &predictor, double nowMs, float *outX, float *outY)
+{
+    const PredictorConfig &config = predictor.config;
+    predictor.erratic = false;
+    if (!config.enabled || predictor.count < 3)
+    {
+        return 0;
+    }
+
+    // Newest first, limited to the fit window
+    float t[PREDICTOR_HISTORY], xs[PREDICTOR_HISTORY], ys[PREDICTOR_HISTORY];
+    int newest = (predictor.next + PREDICTOR_HISTORY - 1) % PREDICTOR_HISTORY;
+    const PointerSample &tip = predictor.history[newest];
+    if (nowMs - tip.timeMs > config.maxSampleAgeMs)
+    {
+        return 0;
+    }
+    int n = 0;
+    for (int i = 0; i < predictor.count; i++)
+    {
+        const PointerSample &s = predictor.history[(newest - i + PREDICTOR_HISTORY) % PREDICTOR_HISTORY];
+        float age = static_cast<float>(tip.timeMs - s.timeMs);
+        if (age > config.windowMs && n >= 3)
+        {
+            break;
+        }
+        t[n] = -age;
+        xs[n] = s.x;
+        ys[n] = s.y;
+        n++;
+    }
+    if (n < 3 || t[n - 1] > -1.0f)
+    {
+        return 0;
+    }
+
+    float vx, vy, ax, ay;
+    fitAxis(t, xs, n, vx, ax);
+    fitAxis(t, ys, n, vy, ay);
+
+    float speed = std::sqrt(vx * vx + vy * vy);
+    if (speed < config.minSpeed)
+    {
+        return 0;
+    }
+
+    // Direction change between the oldest and newest pairs in the window
+    float oldDx = xs[n - 2] - xs[n - 1], oldDy = ys[n - 2] - ys[n - 1];
+    float newDx = xs[0] - xs[1], newDy = ys[0] - ys[1];
+    float turn = std::fabs(std::atan2(oldDx * newDy - oldDy * newDx, oldDx * newDx + oldDy * newDy));
+    if (std::sqrt(ax * ax + ay * ay) > config.maxAcceleration || turn > config.maxTurnRadians)
+    {
+        predictor.erratic = true;
+        return 0;
+    }
+
+    int points = config.points < PREDICTOR_MAX_POINTS ? config.points : PREDICTOR_MAX_POINTS;
+    int written = 0;
+    for (int i = 1; i <= points; i++)
+    {
+        float dt = config.horizonMs * i / points;
+        float px = vx * dt + 0.5f * ax * dt * dt;
+        float py = vy * dt + 0.5f * ay * dt * dt;
+
+        // Deceleration must not fold the tail back behind the tip
+        if (px * vx + py * vy <= 0.0f)
+        {
+            break;
+        }
+        outX[written] = tip.x + px;
+        outY[written] = tip.y + py;
+        written++;
+    }
+    return written;
+}
@@ -0,0 +1,50 @@
+#ifndef STROKE_PREDICTOR_H
+#define STROKE_PREDICTOR_H
+
+// Short-horizon extrapolation of the pointer so the tip of a freehand
+// stroke can be drawn where the cursor is about to be, instead of where
+// the last motion event left it.
+
+const int PREDICTOR_HISTORY = 8;
+const int PREDICTOR_MAX_POINTS = 4;
+
+struct PredictorConfig
+{
+    bool enabled;
+    float horizonMs;           // How far past the newest sample to predict
+    int points;                // Points in the provisional tail (<= PREDICTOR_MAX_POINTS)
+    float windowMs;            // Age of the oldest sample used for the fit
+    float maxAcceleration;     // px/ms^2; above this the motion counts as erratic
+    float maxTurnRadians;      // Direction change across the window that counts as erratic
+    float minSpeed;            // px/ms; below this nothing is predicted
+    float maxSampleAgeMs;      // Newest sample older than this: the pointer stopped
+};
+
+struct PointerSample
+{
+    float x, y;
+    double timeMs;
+};
+
+struct StrokePredictor
+{
+    PredictorConfig config;
+    PointerSample history[PREDICTOR_HISTORY];
+    int count;
+    int next;
+    bool erratic;
+};
+
+PredictorConfig defaultPredictorConfig();
+
+void predictorReset(StrokePredictor &predictor);
+void predictorAddSample(StrokePredictor &predictor, float x, float y, double timeMs);
+
+// Fills outX/outY with up to config.points positions after the newest
+// sample and returns how many were written. Returns 0 when prediction is
+// disabled, there is not enough history, the motion is erratic, or no
+// sample has come for config.maxSampleAgeMs before nowMs, since then the
+// pointer has stopped and the real tip is where it is.
+int predictorPredict(StrokePredictor &predictor, double nowMs, float *outX, float *outY);
+
+#endif
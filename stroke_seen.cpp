@@ -0,0 +1,63 @@
+#include "stroke_seen.h"
+#include <cstring>
+
+static bool aheadBit(const AuthorSeen &author, uint32_t seq)
+{
+    uint32_t bit = seq % SEEN_WINDOW;
+    return (author.ahead[bit / 64] >> (bit % 64)) & 1;
+}
+
+static void setAheadBit(AuthorSeen &author, uint32_t seq, bool value)
+{
+    uint32_t bit = seq % SEEN_WINDOW;
+    uint64_t mask = static_cast<uint64_t>(1) << (bit % 64);
+    author.ahead[bit / 64] = value ? author.ahead[bit / 64] | mask : author.ahead[bit / 64] & ~mask;
+}
+
+bool markStrokeSeen(StrokeSeen &seen, uint32_t author, uint32_t seq)
+{
+    if (author == 0)
+    {
+        return true;
+    }
+    StrokeSeen::iterator it = seen.find(author);
+    if (it == seen.end())
+    {
+        // Nothing seen yet, so an early seq waits in the window for the
+        // ones before it like any other
+        AuthorSeen first;
+        first.highWater = 0;
+        memset(first.ahead, 0, sizeof(first.ahead));
+        it = seen.insert(std::make_pair(author, first)).first;
+    }
+    AuthorSeen &state = it->second;
+    if (seq <= state.highWater || (seq - state.highWater <= SEEN_WINDOW && aheadBit(state, seq)))
+    {
+        return false;
+    }
+    if (seq - state.highWater > SEEN_WINDOW)
+    {
+        // Give up on the gap that would leave the window; its bits are
+        // reused for the seqs the window moves on to
+        uint32_t newHighWater = seq - SEEN_WINDOW;
+        if (newHighWater - state.highWater >= SEEN_WINDOW)
+        {
+            memset(state.ahead, 0, sizeof(state.ahead));
+        }
+        else
+        {
+            for (uint32_t s = state.highWater + 1; s <= newHighWater; s++)
+            {
+                setAheadBit(state, s, false);
+            }
+        }
+        state.highWater = newHighWater;
+    }
+    setAheadBit(state, seq, true);
+    while (aheadBit(state, state.highWater + 1))
+    {
+        state.highWater++;
+        setAheadBit(state, state.highWater, false);
+    }
+    return true;
+}
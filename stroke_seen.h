@@ -0,0 +1,33 @@
+#ifndef STROKE_SEEN_H
+#define STROKE_SEEN_H
+
+#include <cstdint>
+#include <unordered_map>
+
+// Which stroke ids (author, seq) have been applied, so a stroke that
+// arrives again, after a retransmit or over a second relay path, is
+// dropped instead of piling up on the board.
+//
+// Every author numbers its strokes 1, 2, 3..., so per author it is enough
+// to keep the highest seq up to which all have been seen, and a bitmap of
+// the SEEN_WINDOW seqs after it for strokes that arrived early. Marking
+// and checking are O(1) and an author costs 40 bytes however many strokes
+// it draws. A gap left SEEN_WINDOW strokes behind is taken as seen: those
+// strokes are not coming, and late copies of them are dropped like
+// duplicates.
+
+const uint32_t SEEN_WINDOW = 256;
+
+struct AuthorSeen
+{
+    uint32_t highWater;               // Every seq up to this one has been seen
+    uint64_t ahead[SEEN_WINDOW / 64]; // Seq s above it seen: bit s % SEEN_WINDOW
+};
+
+typedef std::unordered_map<uint32_t, AuthorSeen> StrokeSeen; // By author
+
+// True the first time a stroke id is marked, false for a duplicate;
+// author 0, used for strokes saved without an id, is never tracked
+bool markStrokeSeen(StrokeSeen &seen, uint32_t author, uint32_t seq);
+
+#endif
@@ -0,0 +1,194 @@
+#include "stroke_wire.h"
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <sstream>
+
+// Appends value and a space; digits are written backwards into a scratch
+// buffer, as the coordinates of a long stroke are most of its encoding
+void appendInt(std::string &out, int value)
+{
+    char digits[12];
+    char *end = digits + sizeof(digits), *p = end;
+    *--p = ' ';
+    unsigned int magnitude = value < 0 ? 0u - static_cast<unsigned int>(value) : static_cast<unsigned int>(value);
+    do
+    {
+        *--p = static_cast<char>('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+    if (value < 0)
+    {
+        *--p = '-';
+    }
+    out.append(p, end - p);
+}
+
+// Built in one buffer sized for the stroke rather than a stringstream,
+// which costs several allocations and a locale lookup per field
+std::string encodeStroke(const Stroke &stroke)
+{
+    std::string out;
+    out.reserve(96 + stroke.lines.size() * 48);
+    char field[128];
+    // Enough digits for colors to come back bit for bit, or peers' boards
+    // would differ from the author's
+    const int digits = std::numeric_limits<float>::max_digits10;
+    int length = snprintf(field, sizeof(field), "S %u %u %llu %d %d %.*g %.*g %.*g ", stroke.author, stroke.seq,
+                          static_cast<unsigned long long>(stroke.stamp), stroke.isEraser ? 1 : 0, stroke.size, digits, stroke.color[0], digits,
+                          stroke.color[1], digits, stroke.color[2]);
+    out.append(field, length);
+    for (size_t i = 0; i < stroke.lines.size(); i++)
+    {
+        const Line &line = stroke.lines[i];
+        appendInt(out, line.x1);
+        appendInt(out, line.y1);
+        appendInt(out, line.x2);
+        appendInt(out, line.y2);
+    }
+    out += '\n'; // Add a delimiter to mark the end of the stroke
+    return out;
+}
+
+std::string encodeStrokeOp(char op, uint32_t author, uint32_t seq)
+{
+    std::stringstream ss;
+    ss << op << " " << author << " " << seq << "\n";
+    return ss.str();
+}
+
+std::string encodeClear(uint32_t author, uint32_t seq, uint64_t stamp)
+{
+    std::stringstream ss;
+    ss << "K " << author << " " << seq << " " << stamp << "\n";
+    return ss.str();
+}
+
+std::string encodeStrokeTiming(const StrokeTiming &timing)
+{
+    std::stringstream ss;
+    ss << "T " << timing.author << " " << timing.seq;
+    for (int i = 0; i < 5; i++)
+    {
+        ss << " " << timing.us[i];
+    }
+    ss << "\n";
+    return ss.str();
+}
+
+std::string encodeClockProbe(char type, int64_t time, int64_t remoteTime)
+{
+    std::stringstream ss;
+    ss << type << " " << time;
+    if (type == 'Q')
+    {
+        ss << " " << remoteTime;
+    }
+    ss << "\n";
+    return ss.str();
+}
+
+std::string encodeCredit(int64_t bytes)
+{
+    std::stringstream ss;
+    ss << "C " << bytes << "\n";
+    return ss.str();
+}
+
+std::string encodePresence(const CursorState &cursor)
+{
+    char text[96];
+    int length = snprintf(text, sizeof(text), "M %u %d %d %d %d %u %u %u\n", cursor.author, cursor.x / PRESENCE_GRID,
+                          cursor.y / PRESENCE_GRID, cursor.tool, cursor.size, cursor.color[0], cursor.color[1],
+                          cursor.color[2]);
+    return std::string(text, length);
+}
+
+bool decodeMessage(const std::string &message, char &type, Stroke &stroke)
+{
+    std::stringstream ss(message);
+    type = 0;
+    ss >> type >> stroke.author >> stroke.seq;
+    if (!ss || (type != 'S' && type != 'U' && type != 'R' && type != 'K'))
+    {
+        return false;
+    }
+    if (type == 'K')
+    {
+        ss >> stroke.stamp;
+        return !ss.fail();
+    }
+    if (type != 'S')
+    {
+        return true;
+    }
+
+    stroke.removed = false;
+    stroke.lines.clear();
+    ss >> stroke.stamp >> stroke.isEraser >> stroke.size >> stroke.color[0] >> stroke.color[1] >> stroke.color[2];
+    while (ss)
+    {
+        Line line;
+        ss >> line.x1 >> line.y1 >> line.x2 >> line.y2;
+        if (ss)
+        {
+            line.isEraser = stroke.isEraser;
+            line.size = stroke.size;
+            memcpy(line.color, stroke.color, sizeof(float) * 3);
+            stroke.lines.push_back(line);
+        }
+    }
+    return true;
+}
+
+bool decodeStrokeTiming(const std::string &message, StrokeTiming &timing)
+{
+    std::stringstream ss(message);
+    char type = 0;
+    ss >> type >> timing.author >> timing.seq;
+    for (int i = 0; i < 5; i++)
+    {
+        ss >> timing.us[i];
+    }
+    return ss && type == 'T';
+}
+
+bool decodeClockProbe(const std::string &message, char &type, int64_t &time, int64_t &remoteTime)
+{
+    std::stringstream ss(message);
+    type = 0;
+    remoteTime = 0;
+    ss >> type >> time;
+    if (type == 'Q')
+    {
+        ss >> remoteTime;
+    }
+    return ss && (type == 'P' || type == 'Q');
+}
+
+bool decodeCredit(const std::string &message, int64_t &bytes)
+{
+    std::stringstream ss(message);
+    char type = 0;
+    ss >> type >> bytes;
+    return ss && type == 'C' && bytes >= 0;
+}
+
+bool decodePresence(const std::string &message, CursorState &cursor)
+{
+    std::stringstream ss(message);
+    char type = 0;
+    unsigned int color[3];
+    ss >> type >> cursor.author >> cursor.x >> cursor.y >> cursor.tool >> cursor.size >> color[0] >> color[1] >> color[2];
+    if (!ss || type != 'M' || color[0] > 255 || color[1] > 255 || color[2] > 255)
+    {
+        return false;
+    }
+    cursor.x = cursor.x * PRESENCE_GRID + PRESENCE_GRID / 2;
+    cursor.y = cursor.y * PRESENCE_GRID + PRESENCE_GRID / 2;
+    for (int i = 0; i < 3; i++)
+    {
+        cursor.color[i] = static_cast<uint8_t>(color[i]);
+    }
+    return true;
+}
@@ -0,0 +1,74 @@
+#ifndef STROKE_WIRE_H
+#define STROKE_WIRE_H
+
+#include "board.h"
+#include <cstdint>
+#include <string>
+
+// Text messages exchanged between peers, one per line:
+//
+//   S author seq stamp isEraser size r g b x1 y1 ...    a finished stroke
+//   U author seq                                        undo of a stroke
+//   R author seq                                        redo of a stroke
+//   K author seq stamp                                  clear of the board:
+//                                                       the strokes stacked
+//                                                       below stamp go
+//   T author seq capture commit encode send sent        when each sending
+//                                                       stage of the stroke
+//                                                       began, and when the
+//                                                       send returned
+//   P time                                              clock probe
+//   Q time remoteTime                                   reply to a probe
+//   C bytes                                             send credit handed
+//                                                       back by the host
+//   M author x y tool size r g b                        where a peer's
+//                                                       pointer is; x and y
+//                                                       in PRESENCE_GRID
+//                                                       cells, color 0-255
+//
+// Times are microseconds on the sender's monotonic clock. Peers ignore
+// messages they do not know, so T, P and Q are safe to send to older ones.
+// Long messages go in pieces, and C paces a client; see send_lanes.h. M
+// is covered in presence.h.
+
+std::string encodeStroke(const Stroke &stroke); // Ends with the newline
+std::string encodeStrokeOp(char op, uint32_t author, uint32_t seq);
+// A clear takes its id and stamp from the same counters as the author's
+// strokes, so it is dropped when it arrives again just as they are
+std::string encodeClear(uint32_t author, uint32_t seq, uint64_t stamp);
+
+struct StrokeTiming
+{
+    uint32_t author, seq;
+    int64_t us[5]; // capture, commit, encode, send, sent
+};
+
+std::string encodeStrokeTiming(const StrokeTiming &timing);
+std::string encodeClockProbe(char type, int64_t time, int64_t remoteTime = 0);
+// Send credit the host hands back; see send_lanes.h. The host sends C 0
+// when a client connects, to say that it does.
+std::string encodeCredit(int64_t bytes);
+
+const int PRESENCE_GRID = 4; // Pixels per cell of a cursor position
+
+struct CursorState
+{
+    uint32_t author;
+    int x, y; // Pixels; decoded ones are the middle of their cell
+    int tool; // 1 pen, 2 eraser, 3 circle, 4 square; 0 off the board
+    int size;
+    uint8_t color[3];
+};
+
+std::string encodePresence(const CursorState &cursor);
+
+// Parses one message, with or without its newline. Only author and seq
+// are set for U and R, and those and stamp for K; false if the message
+// is malformed.
+bool decodeMessage(const std::string &message, char &type, Stroke &stroke);
+bool decodeStrokeTiming(const std::string &message, StrokeTiming &timing);
+bool decodeClockProbe(const std::string &message, char &type, int64_t &time, int64_t &remoteTime);
+bool decodeCredit(const std::string &message, int64_t &bytes);
+bool decodePresence(const std::string &message, CursorState &cursor);
+
+#endif
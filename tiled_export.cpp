@@ -0,0 +1,288 @@
+#include "tiled_export.h"
+#include "board_tiles.h"
+#include "png_writer.h"
+#include "raster.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// Long strokes are binned in runs of this many segments so a stroke that
+// crosses the whole board only lands in the tiles it actually touches.
+const int SEGMENT_RUN_LENGTH = 64;
+
+struct SegmentRun
+{
+    int stroke;
+    int first;
+    int count;
+};
+
+struct WorkerQueue
+{
+    std::mutex mutex;
+    std::deque<int> tasks;
+};
+
+// Each worker pops from the back of its own queue and steals from the
+// front of the others when it runs dry.
+struct WorkStealingPool
+{
+    std::vector<std::thread> threads;
+    std::deque<WorkerQueue> queues;
+    std::function<void(int)> job;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::atomic<int> queued;
+    bool stopping;
+    int nextQueue;
+};
+
+static bool takeTask(WorkStealingPool &pool, int self, int &task)
+{
+    int count = static_cast<int>(pool.queues.size());
+    for (int i = 0; i < count; i++)
+    {
+        WorkerQueue &queue = pool.queues[(self + i) % count];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty())
+        {
+            continue;
+        }
+        if (i == 0)
+        {
+            task = queue.tasks.back();
+            queue.tasks.pop_back();
+        }
+        else
+        {
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+        }
+        pool.queued--;
+        return true;
+    }
+    return false;
+}
+
+static void workerLoop(WorkStealingPool &pool, int self)
+{
+    while (true)
+    {
+        int task;
+        if (takeTask(pool, self, task))
+        {
+            pool.job(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(pool.mutex);
+        pool.wake.wait(lock, [&pool]()
+                       { return pool.stopping || pool.queued > 0; });
+        if (pool.stopping && pool.queued == 0)
+        {
+            return;
+        }
+    }
+}
+
+static void poolStart(WorkStealingPool &pool, int threads, const std::function<void(int)> &job)
+{
+    pool.job = job;
+    pool.queued = 0;
+    pool.stopping = false;
+    pool.nextQueue = 0;
+    pool.queues.resize(threads);
+    for (int i = 0; i < threads; i++)
+    {
+        pool.threads.push_back(std::thread(workerLoop, std::ref(pool), i));
+    }
+}
+
+static void poolSubmit(WorkStealingPool &pool, int task)
+{
+    WorkerQueue &queue = pool.queues[pool.nextQueue];
+    pool.nextQueue = (pool.nextQueue + 1) % pool.queues.size();
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(task);
+    }
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    pool.queued++;
+    pool.wake.notify_one();
+}
+
+static void poolStop(WorkStealingPool &pool)
+{
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.stopping = true;
+    }
+    pool.wake.notify_all();
+    for (size_t i = 0; i < pool.threads.size(); i++)
+    {
+        pool.threads[i].join();
+    }
+    pool.threads.clear();
+}
+
+static double msBetween(std::chrono::steady_clock::time_point a, std::chrono::steady_clock::time_point b)
+{
+    return std::chrono::duration<double, std::milli>(b - a).count();
+}
+
+void exportStrokesTiled(const std::vector<Stroke> &strokes, int width, int height,
+                        int tileSize, int threads, const RowSink &sink, TiledExportStats *stats,
+                        const std::vector<RasterTile> *baseTiles)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    threads = std::max(1, threads);
+    int tilesX = (width + tileSize - 1) / tileSize;
+    int tilesY = (height + tileSize - 1) / tileSize;
+
+    std::vector<std::vector<SegmentRun> > bins(tilesX * tilesY);
+    size_t binnedRuns = 0;
+    for (size_t s = 0; s < strokes.size(); s++)
+    {
+        if (strokes[s].removed)
+        {
+            continue;
+        }
+        const std::vector<Line> &lines = strokes[s].lines;
+        for (size_t first = 0; first < lines.size(); first += SEGMENT_RUN_LENGTH)
+        {
+            size_t last = std::min(lines.size(), first + SEGMENT_RUN_LENGTH);
+            int minX = lines[first].x1, maxX = minX, minY = lines[first].y1, maxY = minY, pad = 0;
+            for (size_t i = first; i < last; i++)
+            {
+                const Line &l = lines[i];
+                minX = std::min(minX, std::min(l.x1, l.x2));
+                maxX = std::max(maxX, std::max(l.x1, l.x2));
+                minY = std::min(minY, std::min(l.y1, l.y2));
+                maxY = std::max(maxY, std::max(l.y1, l.y2));
+                pad = std::max(pad, l.size / 2 + 2);
+            }
+
+            int tx0 = std::max(0, (minX - pad) / tileSize), tx1 = std::min(tilesX - 1, (maxX + pad) / tileSize);
+            int ty0 = std::max(0, (minY - pad) / tileSize), ty1 = std::min(tilesY - 1, (maxY + pad) / tileSize);
+            SegmentRun run = {static_cast<int>(s), static_cast<int>(first), static_cast<int>(last - first)};
+            for (int ty = ty0; ty <= ty1; ty++)
+            {
+                for (int tx = tx0; tx <= tx1; tx++)
+                {
+                    bins[ty * tilesX + tx].push_back(run);
+                    binnedRuns++;
+                }
+            }
+        }
+    }
+    std::chrono::steady_clock::time_point binned = std::chrono::steady_clock::now();
+
+    // Two band buffers: one being rendered while the other is written out
+    std::vector<uint32_t> bands[2];
+    bands[0].resize(static_cast<size_t>(tileSize) * width);
+    bands[1].resize(static_cast<size_t>(tileSize) * width);
+    std::vector<int> bandRemaining(tilesY, tilesX);
+    std::mutex bandMutex;
+    std::condition_variable bandDone;
+
+    WorkStealingPool pool;
+    poolStart(pool, threads, [&](int tileIndex)
+              {
+        int tx = tileIndex % tilesX, ty = tileIndex / tilesX;
+        Image tile;
+        imageInit(tile, std::min(tileSize, width - tx * tileSize), std::min(tileSize, height - ty * tileSize));
+        tile.originX = tx * tileSize;
+        tile.originY = ty * tileSize;
+        if (baseTiles)
+        {
+            compositeTiles(tile, *baseTiles);
+        }
+
+        const std::vector<SegmentRun> &bin = bins[tileIndex];
+        for (size_t r = 0; r < bin.size(); r++)
+        {
+            const std::vector<Line> &lines = strokes[bin[r].stroke].lines;
+            for (int i = bin[r].first; i < bin[r].first + bin[r].count; i++)
+            {
+                rasterizeLine(tile, lines[i]);
+            }
+        }
+
+        uint32_t *band = &bands[ty % 2][0];
+        for (int y = 0; y < tile.height; y++)
+        {
+            memcpy(band + static_cast<size_t>(y) * width + tile.originX,
+                   &tile.pixels[static_cast<size_t>(y) * tile.width], tile.width * sizeof(uint32_t));
+        }
+
+        std::lock_guard<std::mutex> lock(bandMutex);
+        if (--bandRemaining[ty] == 0)
+        {
+            bandDone.notify_all();
+        } });
+
+    double waitMs = 0;
+    for (int tx = 0; tx < tilesX && tilesY > 0; tx++)
+    {
+        poolSubmit(pool, tx);
+    }
+    for (int ty = 0; ty < tilesY; ty++)
+    {
+        if (ty + 1 < tilesY)
+        {
+            for (int tx = 0; tx < tilesX; tx++)
+            {
+                poolSubmit(pool, (ty + 1) * tilesX + tx);
+            }
+        }
+
+        std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+        {
+            std::unique_lock<std::mutex> lock(bandMutex);
+            bandDone.wait(lock, [&]()
+                          { return bandRemaining[ty] == 0; });
+        }
+        waitMs += msBetween(waitStart, std::chrono::steady_clock::now());
+
+        int rows = std::min(tileSize, height - ty * tileSize);
+        for (int y = 0; y < rows; y++)
+        {
+            sink(&bands[ty % 2][static_cast<size_t>(y) * width]);
+        }
+
+        // The buffer just written is reused by band ty + 2, which is only
+        // submitted on the next iteration
+    }
+    poolStop(pool);
+
+    if (stats)
+    {
+        stats->tiles = tilesX * tilesY;
+        stats->threads = threads;
+        stats->binnedRuns = binnedRuns;
+        stats->binMs = msBetween(start, binned);
+        stats->renderMs = waitMs;
+        stats->totalMs = msBetween(start, std::chrono::steady_clock::now());
+        stats->bandBytes = bands[0].size() * sizeof(uint32_t);
+    }
+}
+
+bool exportStrokesTiledPNG(const std::vector<Stroke> &strokes, int width, int height,
+                           const char *path, int tileSize, int threads, TiledExportStats *stats,
+                           const std::vector<RasterTile> *baseTiles)
+{
+    PngWriter writer;
+    if (!pngBegin(writer, path, width, height))
+    {
+        return false;
+    }
+    exportStrokesTiled(strokes, width, height, tileSize, threads, [&writer](const uint32_t *row)
+                       { pngWriteRow(writer, row); },
+                       stats, baseTiles);
+    return pngFinish(writer);
+}
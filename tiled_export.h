@@ -0,0 +1,38 @@
+#ifndef TILED_EXPORT_H
+#define TILED_EXPORT_H
+
+#include "board.h"
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Parallel export of large boards. The image is cut into square tiles;
+// runs of stroke segments are binned into every tile their bounding box
+// touches, in stroke order, so each tile can be rasterized independently
+// and still composite strokes in the original order. Tiles of one band
+// (a row of tiles) render on a work-stealing pool while the previous band
+// is handed to the row sink, so only two bands are ever in memory.
+// Raster tiles of the board, if given, go under every stroke.
+
+struct TiledExportStats
+{
+    int tiles;
+    int threads;
+    size_t binnedRuns;
+    double binMs;
+    double renderMs; // Time the writer spent waiting on tiles
+    double totalMs;
+    size_t bandBytes;
+};
+
+typedef std::function<void(const uint32_t *row)> RowSink;
+
+void exportStrokesTiled(const std::vector<Stroke> &strokes, int width, int height,
+                        int tileSize, int threads, const RowSink &sink, TiledExportStats *stats,
+                        const std::vector<RasterTile> *baseTiles = NULL);
+
+bool exportStrokesTiledPNG(const std::vector<Stroke> &strokes, int width, int height,
+                           const char *path, int tileSize, int threads, TiledExportStats *stats,
+                           const std::vector<RasterTile> *baseTiles = NULL);
+
+#endif
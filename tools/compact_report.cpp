@@ -0,0 +1,199 @@
+// Reports what eraser-overdraw compaction saves on a recorded session.
+//
+// Usage: compact_report [-session file] [-cycles n] [-width w] [-height h]
+//
+// Every board of the session file (session.ibd or a checkpoint-<n>.ibd)
+// is compacted, or without -session a synthetic board where a region is
+// scribbled over and erased n times (40 by default). For each board it
+// prints the segments drawn per frame before and after, and the software
+// render time of a w x h frame (1920 x 1080) both ways as a stand-in for
+// the GL frame time. The two frames must match.
+
+#include "../compaction.h"
+#include "../raster.h"
+#include "../session_file.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+double elapsedMs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+Stroke makeStroke(bool isEraser, int size, int &x, int &y, int segments, int step)
+{
+    Stroke stroke = Stroke();
+    stroke.isEraser = isEraser;
+    stroke.size = size;
+    for (int c = 0; c < 3; c++)
+    {
+        stroke.color[c] = isEraser ? 1.0f : (rand() % 256) / 255.0f;
+    }
+    for (int i = 0; i < segments; i++)
+    {
+        Line line;
+        line.x1 = x;
+        line.y1 = y;
+        x += rand() % (2 * step + 1) - step;
+        y += rand() % (2 * step + 1) - step;
+        line.x2 = x;
+        line.y2 = y;
+        line.size = size;
+        line.isEraser = isEraser;
+        memcpy(line.color, stroke.color, sizeof(float) * 3);
+        stroke.lines.push_back(line);
+    }
+    return stroke;
+}
+
+// Scribbles in a box, then wipes the box with a wide eraser zig-zag
+std::vector<Stroke> syntheticSession(int cycles)
+{
+    std::vector<Stroke> strokes;
+    srand(5);
+    for (int c = 0; c < cycles; c++)
+    {
+        int left = 100 + rand() % 800, top = 100 + rand() % 400;
+        for (int s = 0; s < 200; s++)
+        {
+            int x = left + 40 + rand() % 220, y = top + 40 + rand() % 220;
+            strokes.push_back(makeStroke(false, 1 + rand() % 6, x, y, 5 + rand() % 20, 6));
+        }
+
+        Stroke eraser = Stroke();
+        eraser.isEraser = true;
+        eraser.size = 40;
+        eraser.color[0] = eraser.color[1] = eraser.color[2] = 1.0f;
+        for (int row = 0; row < 12; row++)
+        {
+            Line line;
+            line.x1 = row % 2 ? left + 330 : left - 30;
+            line.x2 = row % 2 ? left - 30 : left + 330;
+            line.y1 = line.y2 = top + row * 30;
+            line.size = eraser.size;
+            line.isEraser = true;
+            memcpy(line.color, eraser.color, sizeof(float) * 3);
+            eraser.lines.push_back(line);
+        }
+        strokes.push_back(eraser);
+    }
+
+    // A little that survives on top
+    for (int s = 0; s < 50; s++)
+    {
+        int x = rand() % 1200, y = rand() % 700;
+        strokes.push_back(makeStroke(false, 2, x, y, 10, 8));
+    }
+    return strokes;
+}
+
+void renderCompacted(Image &image, const std::vector<Stroke> &strokes, const Compaction &compaction)
+{
+    for (size_t t = 0; t < compaction.tiles.size(); t++)
+    {
+        const BaseTile &tile = compaction.tiles[t];
+        for (int y = 0; y < BASE_TILE_SIZE; y++)
+        {
+            int py = tile.y + y - image.originY;
+            for (int x = 0; x < BASE_TILE_SIZE && py >= 0 && py < image.height; x++)
+            {
+                int px = tile.x + x - image.originX;
+                uint32_t pixel = tile.pixels[y * BASE_TILE_SIZE + x];
+                if (px >= 0 && px < image.width && (pixel >> 24) != 0)
+                {
+                    image.pixels[static_cast<size_t>(py) * image.width + px] = pixel;
+                }
+            }
+        }
+    }
+    for (size_t s = 0; s < strokes.size(); s++)
+    {
+        if (!strokes[s].removed && !compaction.flattened[s])
+        {
+            rasterizeStroke(image, strokes[s]);
+        }
+    }
+}
+
+bool report(const char *name, const std::vector<Stroke> &strokes, int width, int height)
+{
+    Compaction compaction;
+    if (!compactStrokes(strokes, compaction))
+    {
+        printf("%-12s too large to compact\n", name);
+        return true;
+    }
+    const CompactionStats &stats = compaction.stats;
+
+    Image full, compacted;
+    imageInit(full, width, height);
+    imageInit(compacted, width, height);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    rasterizeStrokes(full, strokes);
+    double fullMs = elapsedMs(start);
+    start = std::chrono::steady_clock::now();
+    renderCompacted(compacted, strokes, compaction);
+    double compactedMs = elapsedMs(start);
+    int differing = compareImages(full, compacted, 2);
+
+    printf("%-12s %8zu %10zu %10zu %7zu %9.1f %9.2f %9.2f %s\n", name, stats.strokes, stats.segments,
+           stats.segments - stats.flattenedSegments, compaction.tiles.size(), stats.ms, fullMs, compactedMs,
+           differing == 0 ? "match" : "MISMATCH");
+    return differing == 0;
+}
+
+int main(int argc, char **argv)
+{
+    std::string sessionPath;
+    int cycles = 40;
+    int width = 1920, height = 1080;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-session") == 0 && i + 1 < argc)
+        {
+            sessionPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "-cycles") == 0 && i + 1 < argc)
+        {
+            cycles = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-width") == 0 && i + 1 < argc)
+        {
+            width = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-height") == 0 && i + 1 < argc)
+        {
+            height = atoi(argv[++i]);
+        }
+    }
+
+    printf("%-12s %8s %10s %10s %7s %9s %9s %9s\n", "board", "strokes", "segments", "after", "tiles",
+           "pass ms", "frame ms", "after ms");
+    bool ok = true;
+    if (sessionPath.empty())
+    {
+        ok = report("synthetic", syntheticSession(cycles), width, height);
+    }
+    else
+    {
+        SessionFile session;
+        if (!openSession(sessionPath.c_str(), session))
+        {
+            fprintf(stderr, "Opening %s failed\n", sessionPath.c_str());
+            return 1;
+        }
+        for (uint32_t b = 0; b < session.boardCount; b++)
+        {
+            Board board;
+            readBoardInfo(session, b, board);
+            loadBoardStrokes(session, b, board.strokes);
+            ok = report(board.name.c_str(), board.strokes, width, height) && ok;
+        }
+        closeSession(session);
+    }
+    return ok ? 0 : 1;
+}
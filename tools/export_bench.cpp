@@ -0,0 +1,122 @@
+// Measures tiled export scaling on a synthetic board.
+//
+// Usage: export_bench [-strokes n] [-size w h] [-tile px] [-threads max] [-png path]
+//
+// Renders the board with 1, 2, 4, ... up to max threads into a null row
+// sink (or a PNG for the last run when -png is given) and reports the time
+// and speedup of each run. Every run must produce the same image, which is
+// checked with a row hash.
+
+#include "../tiled_export.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+std::vector<Stroke> syntheticBoard(int strokeCount, int width, int height)
+{
+    std::vector<Stroke> strokes(strokeCount);
+    srand(42);
+    for (int s = 0; s < strokeCount; s++)
+    {
+        Stroke &stroke = strokes[s];
+        stroke.isEraser = (rand() % 10) == 0;
+        stroke.size = 1 + rand() % 8;
+        for (int c = 0; c < 3; c++)
+        {
+            stroke.color[c] = (rand() % 256) / 255.0f;
+        }
+
+        int x = rand() % width, y = rand() % height;
+        int segments = 1 + rand() % 4;
+        for (int i = 0; i < segments; i++)
+        {
+            Line line;
+            line.x1 = x;
+            line.y1 = y;
+            x += rand() % 41 - 20;
+            y += rand() % 41 - 20;
+            line.x2 = x;
+            line.y2 = y;
+            line.size = stroke.size;
+            line.isEraser = stroke.isEraser;
+            memcpy(line.color, stroke.color, sizeof(float) * 3);
+            stroke.lines.push_back(line);
+        }
+    }
+    return strokes;
+}
+
+int main(int argc, char **argv)
+{
+    int strokeCount = 1000000;
+    int width = 8192, height = 8192;
+    int tileSize = 256;
+    int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    const char *pngPath = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-strokes") == 0 && i + 1 < argc)
+        {
+            strokeCount = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-size") == 0 && i + 2 < argc)
+        {
+            width = atoi(argv[++i]);
+            height = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-tile") == 0 && i + 1 < argc)
+        {
+            tileSize = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc)
+        {
+            maxThreads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-png") == 0 && i + 1 < argc)
+        {
+            pngPath = argv[++i];
+        }
+    }
+
+    std::vector<Stroke> strokes = syntheticBoard(strokeCount, width, height);
+    printf("%d strokes on %dx%d, %dpx tiles, %u hardware threads\n",
+           strokeCount, width, height, tileSize, std::thread::hardware_concurrency());
+    printf("threads   total ms   bin ms   waiting ms   speedup   hash\n");
+
+    double baseline = 0;
+    unsigned long long firstHash = 0;
+    for (int threads = 1; threads <= maxThreads; threads = threads * 2 > maxThreads && threads < maxThreads ? maxThreads : threads * 2)
+    {
+        unsigned long long hash = 1469598103934665603ull;
+        TiledExportStats stats;
+        exportStrokesTiled(strokes, width, height, tileSize, threads, [&](const uint32_t *row)
+                           {
+            for (int x = 0; x < width; x += 7)
+            {
+                hash = (hash ^ row[x]) * 1099511628211ull;
+            } },
+                           &stats);
+
+        if (threads == 1)
+        {
+            baseline = stats.totalMs;
+            firstHash = hash;
+        }
+        printf("%7d %10.1f %8.1f %12.1f %8.2fx   %016llx%s\n", threads, stats.totalMs, stats.binMs,
+               stats.renderMs, baseline / stats.totalMs, hash, hash == firstHash ? "" : "  MISMATCH");
+    }
+
+    if (pngPath)
+    {
+        TiledExportStats stats;
+        if (!exportStrokesTiledPNG(strokes, width, height, pngPath, tileSize, maxThreads, &stats))
+        {
+            fprintf(stderr, "Writing %s failed\n", pngPath);
+            return 1;
+        }
+        printf("PNG export with %d threads: %.1f ms, %zu bytes per band buffer\n", maxThreads, stats.totalMs, stats.bandBytes);
+    }
+    return 0;
+}
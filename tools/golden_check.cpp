@@ -0,0 +1,224 @@
+// Checks the software rasterizer against what GL draws for the same
+// strokes.
+//
+// Usage: golden_check [-tolerance n] [-slack n] [-max-differing pct]
+//                     [-out prefix]
+//
+// Each fixture board is drawn with drawStroke() into a hidden GLUT window
+// under the app's projection, read back with glReadPixels, and compared
+// with rasterizeStrokes() of the same board by compareImages().
+//
+// The two are not meant to be identical. GL_LINES with glLineWidth are
+// aliased, end flat at each vertex and measure the width of a sloped line
+// along x or y; the rasterizer anti-aliases, rounds both ends and measures
+// across the line. So a pixel only differs if some channel is off by more
+// than the tolerance (128 by default, which an edge pixel blended halfway
+// stays within) and nothing within slack pixels (1) of it in the other
+// image is close, which allows for GL placing edges a pixel apart. Stroke
+// ends and joints still differ; a fixture passes if at most max-differing
+// percent (5 by default) of the pixels either image inks differ. With -out,
+// both images of each fixture are written as <prefix>-<fixture>-gl.png
+// and -raster.png.
+
+#include "../raster.h"
+#include "../stroke_draw.h"
+#include <GL/glut.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+const int WIDTH = 640, HEIGHT = 480;
+
+Line makeLine(int x1, int y1, int x2, int y2, int size, bool isEraser, const float color[3])
+{
+    Line line;
+    line.x1 = x1;
+    line.y1 = y1;
+    line.x2 = x2;
+    line.y2 = y2;
+    line.size = size;
+    line.isEraser = isEraser;
+    memcpy(line.color, color, sizeof(float) * 3);
+    return line;
+}
+
+Stroke makeStroke(bool isEraser, int size, float r, float g, float b)
+{
+    Stroke stroke = Stroke();
+    stroke.isEraser = isEraser;
+    stroke.size = size;
+    stroke.color[0] = isEraser ? 1.0f : r;
+    stroke.color[1] = isEraser ? 1.0f : g;
+    stroke.color[2] = isEraser ? 1.0f : b;
+    return stroke;
+}
+
+// Horizontal and vertical lines of each pen size, where only the ends
+// and edges can differ
+std::vector<Stroke> straightLines()
+{
+    std::vector<Stroke> strokes;
+    for (int size = 1; size <= 12; size++)
+    {
+        Stroke stroke = makeStroke(false, size, (size * 20 % 256) / 255.0f, 0.2f, 0.6f);
+        int y = 20 + size * 30;
+        stroke.lines.push_back(makeLine(40, y, 300, y, size, false, stroke.color));
+        int x = 340 + size * 22;
+        stroke.lines.push_back(makeLine(x, 40, x, 440, size, false, stroke.color));
+        strokes.push_back(stroke);
+    }
+    return strokes;
+}
+
+// Freehand strokes as mouse motion records them: short segments in all
+// directions
+std::vector<Stroke> scribbles()
+{
+    std::vector<Stroke> strokes;
+    srand(7);
+    for (int s = 0; s < 40; s++)
+    {
+        int size = 1 + rand() % 4;
+        Stroke stroke = makeStroke(false, size, (rand() % 256) / 255.0f, (rand() % 256) / 255.0f,
+                                   (rand() % 256) / 255.0f);
+        int x = 60 + rand() % 520, y = 60 + rand() % 360;
+        for (int i = 0; i < 30; i++)
+        {
+            int nx = x + rand() % 13 - 6, ny = y + rand() % 13 - 6;
+            stroke.lines.push_back(makeLine(x, y, nx, ny, size, false, stroke.color));
+            x = nx;
+            y = ny;
+        }
+        strokes.push_back(stroke);
+    }
+    return strokes;
+}
+
+// Filled bands wiped through by a wide eraser
+std::vector<Stroke> erased()
+{
+    std::vector<Stroke> strokes;
+    for (int row = 0; row < 8; row++)
+    {
+        Stroke stroke = makeStroke(false, 10, 0.1f * row, 0.5f, 1.0f - 0.1f * row);
+        int y = 60 + row * 45;
+        stroke.lines.push_back(makeLine(40, y, 600, y, 10, false, stroke.color));
+        strokes.push_back(stroke);
+    }
+    Stroke eraser = makeStroke(true, 30, 1.0f, 1.0f, 1.0f);
+    eraser.lines.push_back(makeLine(200, 20, 200, 460, 30, true, eraser.color));
+    eraser.lines.push_back(makeLine(420, 20, 420, 460, 30, true, eraser.color));
+    strokes.push_back(eraser);
+    return strokes;
+}
+
+void drawGl(Image &image, const std::vector<Stroke> &strokes)
+{
+    glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    for (size_t s = 0; s < strokes.size(); s++)
+    {
+        drawStroke(strokes[s]);
+    }
+    glFinish();
+
+    // GL rows run bottom up
+    imageInit(image, WIDTH, HEIGHT);
+    std::vector<uint32_t> rows(image.pixels.size());
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, &rows[0]);
+    for (int y = 0; y < HEIGHT; y++)
+    {
+        memcpy(&image.pixels[static_cast<size_t>(y) * WIDTH], &rows[static_cast<size_t>(HEIGHT - 1 - y) * WIDTH],
+               sizeof(uint32_t) * WIDTH);
+    }
+    for (size_t i = 0; i < image.pixels.size(); i++)
+    {
+        image.pixels[i] |= 0xff000000u;
+    }
+}
+
+int inkedPixels(const Image &a, const Image &b)
+{
+    int inked = 0;
+    for (size_t i = 0; i < a.pixels.size(); i++)
+    {
+        if (a.pixels[i] != BACKGROUND_COLOR || b.pixels[i] != BACKGROUND_COLOR)
+        {
+            inked++;
+        }
+    }
+    return inked;
+}
+
+bool check(const char *name, const std::vector<Stroke> &strokes, int tolerance, int slack, double maxDiffering,
+           const char *outPrefix)
+{
+    Image gl, raster;
+    drawGl(gl, strokes);
+    imageInit(raster, WIDTH, HEIGHT);
+    rasterizeStrokes(raster, strokes);
+
+    int inked = inkedPixels(gl, raster);
+    int differing = compareImages(gl, raster, tolerance, slack);
+    double percent = inked > 0 ? 100.0 * differing / inked : 0.0;
+    bool ok = inked > 0 && percent <= maxDiffering;
+    printf("%-10s %8d %10d %8.2f%% %s\n", name, inked, differing, percent, ok ? "match" : "MISMATCH");
+
+    if (outPrefix)
+    {
+        std::string prefix = std::string(outPrefix) + "-" + name;
+        if (!writeImagePNG((prefix + "-gl.png").c_str(), gl) || !writeImagePNG((prefix + "-raster.png").c_str(), raster))
+        {
+            fprintf(stderr, "Writing %s images failed\n", prefix.c_str());
+        }
+    }
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    int tolerance = 128;
+    int slack = 1;
+    double maxDiffering = 5.0;
+    const char *outPrefix = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-tolerance") == 0 && i + 1 < argc)
+        {
+            tolerance = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-slack") == 0 && i + 1 < argc)
+        {
+            slack = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-max-differing") == 0 && i + 1 < argc)
+        {
+            maxDiffering = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-out") == 0 && i + 1 < argc)
+        {
+            outPrefix = argv[++i];
+        }
+    }
+
+    glutInit(&argc, argv);
+    glutInitDisplayMode(GLUT_SINGLE | GLUT_RGBA);
+    glutInitWindowSize(WIDTH, HEIGHT);
+    glutCreateWindow("golden_check");
+    glutHideWindow();
+    glViewport(0, 0, WIDTH, HEIGHT);
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    gluOrtho2D(0.0, WIDTH, HEIGHT, 0.0);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+
+    printf("%-10s %8s %10s %9s\n", "fixture", "inked", "differing", "");
+    bool ok = check("straight", straightLines(), tolerance, slack, maxDiffering, outPrefix);
+    ok = check("scribble", scribbles(), tolerance, slack, maxDiffering, outPrefix) && ok;
+    ok = check("erased", erased(), tolerance, slack, maxDiffering, outPrefix) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,644 @@
+// Synthetic load for a hosting InstantBoard.
+//
+// Usage: load_gen [-host addr] [-port n] [-clients n] [-rate strokes/s]
+//                 [-duration s] [-drain s] [-mix freehand,circle,square]
+//                 [-segments min-max] [-radius min-max] [-brush min-max]
+//                 [-undo percent] [-seed n]
+//
+// Opens -clients connections to the host (127.0.0.1:27015 by default) and
+// has each one draw like a user: strokes at -rate per second with
+// exponentially distributed gaps, picked by the -mix weights from
+// freehand strokes of -segments segments, circles of -radius pixels and
+// squares, with brush sizes from -brush, and -undo percent of them undos
+// of its own earlier strokes. Every message is checked as it arrives at
+// the other clients, which must get it exactly once and byte for byte as
+// sent. After -drain seconds for the tail to arrive it prints throughput,
+// fan-out latency (send to arrival at each other client, and to arrival
+// at the last of them), and missing, duplicated, corrupted and echoed
+// messages, and the number of clients whose board no longer matches. The
+// exit code is 1 if any board diverged.
+//
+// Clients keep to the send credit the host hands out (see send_lanes.h):
+// one that has run out holds its next stroke until credit comes back, and
+// the wait counts towards that stroke's latency. A host that has not sent
+// C 0 to say it gives credit is sent to without it.
+//
+// All clients run on one thread with poll, so sends and arrivals share a
+// clock. Linux only; raise the open file limit (ulimit -n) for more than
+// about 1000 clients. Build with
+//   g++ -std=c++11 -O2 tools/load_gen.cpp stroke_wire.cpp shapes.cpp send_lanes.cpp -o load_gen
+
+#include "../send_lanes.h"
+#include "../shapes.h"
+#include "../stroke_wire.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <random>
+#include <sys/socket.h>
+#include <unistd.h>
+
+const int BOARD_WIDTH = 1000, BOARD_HEIGHT = 700;
+const double HANDSHAKE_TIMEOUT_MS = 5000.0;
+
+struct Range
+{
+    int low, high;
+};
+
+struct Client
+{
+    int socket;
+    uint32_t author;
+    uint32_t seq;
+    std::string receiveBuffer;
+    ChunkJoiner chunks;
+    std::string sendQueue;
+    int64_t credit;
+    bool creditFromHost; // The host said it gives credit, with a C 0
+    double nextSendMs;
+    bool ready; // The host answered our probe, so it has accepted us
+    std::vector<uint32_t> liveStrokes; // Own strokes that can still be undone
+    uint64_t messagesIn, bytesIn;
+};
+
+// Stroke or undo sent by one of the clients
+struct SentMessage
+{
+    int client;
+    double sentMs;
+    uint32_t hash;
+    std::vector<uint8_t> received; // Times each client got it
+    double lastArrivalMs;
+};
+
+typedef std::pair<char, uint64_t> MessageKey;
+
+std::vector<Client> clients;
+std::map<MessageKey, SentMessage> sent;
+std::vector<float> fanoutMs;
+std::mt19937 rng;
+
+uint64_t messagesOut = 0, bytesOut = 0;
+uint64_t duplicated = 0, corrupted = 0, echoed = 0, foreign = 0, parseErrors = 0;
+int disconnects = 0;
+
+double nowMs()
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int uniform(const Range &range)
+{
+    return std::uniform_int_distribution<int>(range.low, std::max(range.low, range.high))(rng);
+}
+
+bool parseRange(const char *text, Range &range)
+{
+    if (sscanf(text, "%d-%d", &range.low, &range.high) == 2)
+    {
+        return range.low <= range.high;
+    }
+    if (sscanf(text, "%d", &range.low) == 1)
+    {
+        range.high = range.low;
+        return true;
+    }
+    return false;
+}
+
+uint32_t hashText(const char *text, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ static_cast<uint8_t>(text[i])) * 16777619u;
+    }
+    return hash;
+}
+
+MessageKey messageKey(char type, uint32_t author, uint32_t seq)
+{
+    return MessageKey(type, (static_cast<uint64_t>(author) << 32) | seq);
+}
+
+// A random walk that turns gradually, about as far per segment as mouse
+// motion events are apart
+Stroke freehandStroke(int segments, const float color[3], int size)
+{
+    Stroke stroke = Stroke();
+    stroke.size = size;
+    memcpy(stroke.color, color, sizeof(float) * 3);
+    double x = uniform(Range{0, BOARD_WIDTH - 1}), y = uniform(Range{0, BOARD_HEIGHT - 1});
+    double angle = std::uniform_real_distribution<double>(0, 6.2832)(rng);
+    std::normal_distribution<double> turn(0.0, 0.3);
+    for (int i = 0; i < segments; i++)
+    {
+        angle += turn(rng);
+        double step = uniform(Range{2, 8});
+        Line line;
+        line.x1 = static_cast<int>(x);
+        line.y1 = static_cast<int>(y);
+        x = std::min(std::max(x + cos(angle) * step, 0.0), BOARD_WIDTH - 1.0);
+        y = std::min(std::max(y + sin(angle) * step, 0.0), BOARD_HEIGHT - 1.0);
+        line.x2 = static_cast<int>(x);
+        line.y2 = static_cast<int>(y);
+        memcpy(line.color, color, sizeof(float) * 3);
+        line.size = size;
+        line.isEraser = false;
+        stroke.lines.push_back(line);
+    }
+    return stroke;
+}
+
+Stroke randomStroke(const int mix[3], const Range &segments, const Range &radius, const Range &brush)
+{
+    float color[3];
+    for (int c = 0; c < 3; c++)
+    {
+        color[c] = uniform(Range{0, 255}) / 255.0f;
+    }
+    int size = uniform(brush);
+    int pick = uniform(Range{0, mix[0] + mix[1] + mix[2] - 1});
+    if (pick < mix[0])
+    {
+        return freehandStroke(uniform(segments), color, size);
+    }
+    int x = uniform(Range{0, BOARD_WIDTH - 1}), y = uniform(Range{0, BOARD_HEIGHT - 1});
+    int r = uniform(radius);
+    if (pick < mix[0] + mix[1])
+    {
+        return makeCircleStroke(x, y, r, color, size);
+    }
+    return makeSquareStroke(x - r, y - r, x + r, y + r, color, size);
+}
+
+void queueMessage(int index, char type, uint32_t seq, const std::string &text, double now)
+{
+    Client &client = clients[index];
+    SentMessage &message = sent[messageKey(type, client.author, seq)];
+    message.client = index;
+    message.sentMs = now;
+    message.hash = hashText(text.data(), text.size() - 1);
+    message.received.assign(clients.size(), 0);
+    message.lastArrivalMs = 0;
+    client.sendQueue += text;
+    client.credit -= text.size();
+    messagesOut++;
+    bytesOut += text.size();
+}
+
+void drawSomething(int index, const int mix[3], const Range &segments, const Range &radius, const Range &brush,
+                   int undoPercent, double now)
+{
+    Client &client = clients[index];
+    if (!client.liveStrokes.empty() && uniform(Range{0, 99}) < undoPercent)
+    {
+        uint32_t seq = client.liveStrokes.back();
+        client.liveStrokes.pop_back();
+        queueMessage(index, 'U', seq, encodeStrokeOp('U', client.author, seq), now);
+        return;
+    }
+    Stroke stroke = randomStroke(mix, segments, radius, brush);
+    stroke.author = client.author;
+    stroke.seq = ++client.seq;
+    stroke.stamp = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::system_clock::now().time_since_epoch()).count();
+    client.liveStrokes.push_back(stroke.seq);
+    queueMessage(index, 'S', stroke.seq, encodeStroke(stroke), now);
+}
+
+// A host from before credit never says it gives any, and is sent to
+// without waiting for it
+bool hasCredit(const Client &client)
+{
+    return !client.creditFromHost || client.credit > 0;
+}
+
+void closeClient(Client &client)
+{
+    if (client.socket >= 0)
+    {
+        close(client.socket);
+        client.socket = -1;
+        disconnects++;
+    }
+}
+
+void flushClient(Client &client)
+{
+    while (client.socket >= 0 && !client.sendQueue.empty())
+    {
+        ssize_t sentBytes = send(client.socket, client.sendQueue.data(), client.sendQueue.size(), MSG_NOSIGNAL);
+        if (sentBytes < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                closeClient(client);
+            }
+            return;
+        }
+        client.sendQueue.erase(0, sentBytes);
+    }
+}
+
+void receiveLine(int index, const char *text, size_t length, double now)
+{
+    Client &client = clients[index];
+    client.messagesIn++;
+    client.bytesIn += length + 1;
+    std::string message(text, length);
+    char type = message.empty() ? 0 : message[0];
+    if (type == 'P' || type == 'Q')
+    {
+        int64_t time, remoteTime;
+        if (!decodeClockProbe(message, type, time, remoteTime))
+        {
+            parseErrors++;
+        }
+        else if (type == 'P')
+        {
+            client.sendQueue += encodeClockProbe('Q', time, static_cast<int64_t>(now * 1000.0));
+        }
+        else
+        {
+            client.ready = true;
+        }
+        return;
+    }
+    if (type == 'C')
+    {
+        int64_t bytes;
+        if (decodeCredit(message, bytes))
+        {
+            client.creditFromHost = true;
+            client.credit += bytes;
+        }
+        else
+        {
+            parseErrors++;
+        }
+        return;
+    }
+    if (type != 'S' && type != 'U' && type != 'R')
+    {
+        return; // Stroke timings and anything newer
+    }
+
+    Stroke stroke;
+    if (!decodeMessage(message, type, stroke))
+    {
+        parseErrors++;
+        return;
+    }
+    std::map<MessageKey, SentMessage>::iterator found = sent.find(messageKey(type, stroke.author, stroke.seq));
+    if (found == sent.end())
+    {
+        foreign++; // Drawn at the host, or sent before we connected
+        return;
+    }
+    SentMessage &sentMessage = found->second;
+    if (sentMessage.client == index)
+    {
+        echoed++;
+        return;
+    }
+    if (sentMessage.received[index]++ > 0)
+    {
+        duplicated++;
+        return;
+    }
+    if (hashText(text, length) != sentMessage.hash)
+    {
+        corrupted++;
+    }
+    fanoutMs.push_back(static_cast<float>(now - sentMessage.sentMs));
+    sentMessage.lastArrivalMs = now;
+}
+
+void receiveClient(int index)
+{
+    Client &client = clients[index];
+    char buffer[16384];
+    ssize_t received;
+    while (client.socket >= 0 && (received = recv(client.socket, buffer, sizeof(buffer), 0)) != 0)
+    {
+        if (received < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                closeClient(client);
+            }
+            break;
+        }
+        client.receiveBuffer.append(buffer, received);
+    }
+    if (received == 0)
+    {
+        closeClient(client);
+    }
+
+    double now = nowMs();
+    size_t start = 0, end;
+    while ((end = client.receiveBuffer.find('\n', start)) != std::string::npos)
+    {
+        bool malformed;
+        SharedBytes line = joinChunk(client.chunks, client.receiveBuffer, start, end + 1 - start, 64 << 20, malformed);
+        start = end + 1;
+        parseErrors += malformed;
+        if (line)
+        {
+            receiveLine(index, line->data(), line->size() - 1, now);
+        }
+    }
+    client.receiveBuffer.erase(0, start);
+}
+
+int connectClient(const char *host, const char *port)
+{
+    addrinfo hints = addrinfo(), *result = NULL;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    if (getaddrinfo(host, port, &hints, &result) != 0)
+    {
+        return -1;
+    }
+    int fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    if (fd >= 0 && connect(fd, result->ai_addr, result->ai_addrlen) != 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+    if (fd >= 0)
+    {
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+    return fd;
+}
+
+// Runs every client until untilMs or until done() holds
+template <typename Done>
+void pump(double untilMs, Done done, bool drawing, double rate, const int mix[3], const Range &segments,
+          const Range &radius, const Range &brush, int undoPercent)
+{
+    std::exponential_distribution<double> gap(rate > 0 ? rate / 1000.0 : 1.0);
+    std::vector<pollfd> fds(clients.size());
+    double now;
+    while ((now = nowMs()) < untilMs && !done())
+    {
+        double wakeMs = std::min(untilMs, now + 10.0);
+        for (size_t i = 0; i < clients.size(); i++)
+        {
+            Client &client = clients[i];
+            if (drawing && rate > 0 && client.socket >= 0)
+            {
+                while (client.nextSendMs <= now && hasCredit(client))
+                {
+                    drawSomething(static_cast<int>(i), mix, segments, radius, brush, undoPercent, client.nextSendMs);
+                    client.nextSendMs += gap(rng);
+                }
+                if (hasCredit(client))
+                {
+                    wakeMs = std::min(wakeMs, client.nextSendMs);
+                }
+            }
+            flushClient(client);
+            fds[i].fd = client.socket;
+            fds[i].events = POLLIN | (client.sendQueue.empty() ? 0 : POLLOUT);
+            fds[i].revents = 0;
+        }
+        poll(fds.data(), fds.size(), std::max(0, static_cast<int>(wakeMs - nowMs())));
+        for (size_t i = 0; i < clients.size(); i++)
+        {
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                receiveClient(static_cast<int>(i));
+            }
+        }
+    }
+}
+
+float percentile(const std::vector<float> &sorted, double pct)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+    size_t index = static_cast<size_t>(pct / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+void printLatency(const char *name, std::vector<float> &samples)
+{
+    std::sort(samples.begin(), samples.end());
+    printf("%-22s p50 %.2f  p90 %.2f  p99 %.2f  p99.9 %.2f  max %.2f ms (%zu samples)\n", name,
+           percentile(samples, 50), percentile(samples, 90), percentile(samples, 99), percentile(samples, 99.9),
+           samples.empty() ? 0.0f : samples.back(), samples.size());
+}
+
+int main(int argc, char **argv)
+{
+    const char *host = "127.0.0.1";
+    const char *port = "27015";
+    int clientCount = 8;
+    double rate = 2.0;
+    double durationS = 10.0, drainS = 2.0;
+    int mix[3] = {70, 15, 15};
+    Range segments = {20, 220}, radius = {10, 200}, brush = {1, 10};
+    int undoPercent = 5;
+    unsigned seed = 1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool ok = true;
+        if (strcmp(argv[i], "-host") == 0 && i + 1 < argc)
+        {
+            host = argv[++i];
+        }
+        else if (strcmp(argv[i], "-port") == 0 && i + 1 < argc)
+        {
+            port = argv[++i];
+        }
+        else if (strcmp(argv[i], "-clients") == 0 && i + 1 < argc)
+        {
+            clientCount = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-rate") == 0 && i + 1 < argc)
+        {
+            rate = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-duration") == 0 && i + 1 < argc)
+        {
+            durationS = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-drain") == 0 && i + 1 < argc)
+        {
+            drainS = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-mix") == 0 && i + 1 < argc)
+        {
+            ok = sscanf(argv[++i], "%d,%d,%d", &mix[0], &mix[1], &mix[2]) == 3 && mix[0] >= 0 && mix[1] >= 0 &&
+                 mix[2] >= 0 && mix[0] + mix[1] + mix[2] > 0;
+        }
+        else if (strcmp(argv[i], "-segments") == 0 && i + 1 < argc)
+        {
+            ok = parseRange(argv[++i], segments) && segments.low > 0;
+        }
+        else if (strcmp(argv[i], "-radius") == 0 && i + 1 < argc)
+        {
+            ok = parseRange(argv[++i], radius);
+        }
+        else if (strcmp(argv[i], "-brush") == 0 && i + 1 < argc)
+        {
+            ok = parseRange(argv[++i], brush) && brush.low > 0;
+        }
+        else if (strcmp(argv[i], "-undo") == 0 && i + 1 < argc)
+        {
+            undoPercent = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc)
+        {
+            seed = strtoul(argv[++i], NULL, 10);
+        }
+        else
+        {
+            ok = false;
+        }
+        if (!ok)
+        {
+            fprintf(stderr, "Bad argument: %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if (clientCount < 1)
+    {
+        fprintf(stderr, "Need at least one client\n");
+        return 2;
+    }
+    rng.seed(seed);
+
+    for (int i = 0; i < clientCount; i++)
+    {
+        Client client = Client();
+        client.socket = connectClient(host, port);
+        client.credit = CREDIT_WINDOW_BYTES;
+        if (client.socket < 0)
+        {
+            fprintf(stderr, "Could not connect client %d to %s:%s\n", i, host, port);
+            return 2;
+        }
+        do
+        {
+            client.author = static_cast<uint32_t>(rng());
+        } while (client.author == 0);
+        client.sendQueue = encodeClockProbe('P', static_cast<int64_t>(nowMs() * 1000.0));
+        clients.push_back(client);
+    }
+
+    // A probe is answered once the host has accepted the connection; a
+    // client it has not accepted yet would miss the others' strokes
+    pump(nowMs() + HANDSHAKE_TIMEOUT_MS,
+         []()
+         {
+             for (size_t i = 0; i < clients.size(); i++)
+             {
+                 if (!clients[i].ready)
+                 {
+                     return false;
+                 }
+             }
+             return true;
+         },
+         false, rate, mix, segments, radius, brush, undoPercent);
+    for (size_t i = 0; i < clients.size(); i++)
+    {
+        if (!clients[i].ready)
+        {
+            fprintf(stderr, "Host did not answer client %zu within %.0f ms\n", i, HANDSHAKE_TIMEOUT_MS);
+            return 2;
+        }
+    }
+
+    double startMs = nowMs();
+    std::exponential_distribution<double> firstGap(rate > 0 ? rate / 1000.0 : 1.0);
+    for (size_t i = 0; i < clients.size(); i++)
+    {
+        clients[i].nextSendMs = startMs + firstGap(rng);
+    }
+    pump(startMs + durationS * 1000.0, []() { return false; }, true, rate, mix, segments, radius, brush, undoPercent);
+    double sendEndMs = nowMs();
+
+    uint64_t expected = static_cast<uint64_t>(sent.size()) * (clients.size() - 1);
+    pump(sendEndMs + drainS * 1000.0, [expected]() { return fanoutMs.size() + duplicated >= expected; }, false, rate,
+         mix, segments, radius, brush, undoPercent);
+
+    // A client's board diverged if it misses any stroke or undo another
+    // client sent; with the host relaying in order nothing else can differ
+    uint64_t missing = 0;
+    std::vector<bool> diverged(clients.size(), false);
+    std::vector<float> lastArrivalMs;
+    for (std::map<MessageKey, SentMessage>::const_iterator it = sent.begin(); it != sent.end(); ++it)
+    {
+        const SentMessage &message = it->second;
+        bool complete = true;
+        for (size_t c = 0; c < clients.size(); c++)
+        {
+            if (static_cast<int>(c) != message.client && message.received[c] == 0)
+            {
+                missing++;
+                diverged[c] = true;
+                complete = false;
+            }
+        }
+        if (complete && clients.size() > 1)
+        {
+            lastArrivalMs.push_back(static_cast<float>(message.lastArrivalMs - message.sentMs));
+        }
+    }
+    int divergedCount = static_cast<int>(std::count(diverged.begin(), diverged.end(), true));
+
+    uint64_t messagesIn = 0, bytesIn = 0;
+    for (size_t i = 0; i < clients.size(); i++)
+    {
+        messagesIn += clients[i].messagesIn;
+        bytesIn += clients[i].bytesIn;
+    }
+    double seconds = (sendEndMs - startMs) / 1000.0;
+    printf("%d clients, %.1f s at %.2f strokes/s each\n", clientCount, seconds, rate);
+    printf("sent      %llu messages, %.2f MB (%.1f messages/s, %.2f MB/s)\n",
+           static_cast<unsigned long long>(messagesOut), bytesOut / 1e6, messagesOut / seconds, bytesOut / 1e6 / seconds);
+    printf("received  %llu messages, %.2f MB (%.1f messages/s, %.2f MB/s)\n",
+           static_cast<unsigned long long>(messagesIn), bytesIn / 1e6, messagesIn / seconds, bytesIn / 1e6 / seconds);
+    printLatency("fan-out latency", fanoutMs);
+    printLatency("last-peer latency", lastArrivalMs);
+    printf("missing %llu of %llu, duplicated %llu, corrupted %llu, echoed %llu, foreign %llu, parse errors %llu\n",
+           static_cast<unsigned long long>(missing), static_cast<unsigned long long>(expected),
+           static_cast<unsigned long long>(duplicated), static_cast<unsigned long long>(corrupted),
+           static_cast<unsigned long long>(echoed), static_cast<unsigned long long>(foreign),
+           static_cast<unsigned long long>(parseErrors));
+    printf("diverged boards %d of %d, disconnects %d\n", divergedCount, clientCount, disconnects);
+
+    for (size_t i = 0; i < clients.size(); i++)
+    {
+        if (clients[i].socket >= 0)
+        {
+            close(clients[i].socket);
+        }
+    }
+    return divergedCount > 0 || corrupted > 0 || duplicated > 0 ? 1 : 0;
+}
@@ -0,0 +1,318 @@
+// Replays pointer traces through the stroke predictor and reports how far
+// the drawn stroke tip is from the real pointer, with and without
+// prediction. It also counts stale tails: frames that still draw a tail
+// ahead of the pointer after it has stood still for STOPPED_MS, and exits
+// with 1 if there are any.
+//
+// Usage: predict_replay [-latency ms] [-horizon ms] [-rate hz] [trace ...]
+//
+// A trace is a text file of "timeMs x y" lines; a blank line starts a new
+// stroke. Without trace files a set of synthetic strokes is replayed.
+
+#include "../stroke_predictor.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+struct Trace
+{
+    std::string name;
+    std::vector<std::vector<PointerSample> > strokes;
+};
+
+struct ReplayResult
+{
+    double baselineError;
+    double predictedError;
+    double baselineP95;
+    double predictedP95;
+    double meanSpeed;
+    int frames;
+    int predictedFrames;
+    int staleTails;
+};
+
+const double STOPPED_MS = 100.0;
+
+bool loadTrace(const char *path, Trace &trace)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        std::cerr << "Cannot open trace " << path << "\n";
+        return false;
+    }
+
+    trace.name = path;
+    trace.strokes.push_back(std::vector<PointerSample>());
+    std::string line;
+    while (std::getline(in, line))
+    {
+        std::stringstream ss(line);
+        PointerSample sample;
+        if (ss >> sample.timeMs >> sample.x >> sample.y)
+        {
+            trace.strokes.back().push_back(sample);
+        }
+        else if (!trace.strokes.back().empty())
+        {
+            trace.strokes.push_back(std::vector<PointerSample>());
+        }
+    }
+    return true;
+}
+
+// Synthetic strokes sampled at the given rate: steady line, circle, wave,
+// a jittery scribble that should switch prediction off, and a line where
+// the pointer stops halfway and is held still, sending nothing, until the
+// button is released.
+std::vector<Trace> syntheticTraces(float rateHz)
+{
+    std::vector<Trace> traces;
+    double step = 1000.0 / rateHz;
+    const char *names[] = {"line", "circle", "wave", "scribble", "stop"};
+    srand(7);
+
+    for (int kind = 0; kind < 5; kind++)
+    {
+        Trace trace;
+        trace.name = names[kind];
+        for (int stroke = 0; stroke < 5; stroke++)
+        {
+            std::vector<PointerSample> samples;
+            for (double t = 0; t < 800; t += step)
+            {
+                if (kind == 4 && t > 400 && t + step < 800)
+                {
+                    continue; // Held still; the last sample is the release
+                }
+                PointerSample s;
+                s.timeMs = t;
+                double u = t / 800.0;
+                switch (kind)
+                {
+                case 0:
+                    s.x = 100 + 600 * u;
+                    s.y = 100 + 200 * u;
+                    break;
+                case 1:
+                    s.x = 400 + 150 * cos(2 * M_PI * u);
+                    s.y = 300 + 150 * sin(2 * M_PI * u);
+                    break;
+                case 2:
+                    s.x = 100 + 600 * u;
+                    s.y = 300 + 60 * sin(6 * M_PI * u);
+                    break;
+                case 4:
+                    s.x = 100 + 600 * std::min(u, 0.5);
+                    s.y = 100 + 200 * std::min(u, 0.5);
+                    break;
+                default:
+                    s.x = 300 + 400 * u + (rand() % 31 - 15);
+                    s.y = 300 + (rand() % 61 - 30);
+                    break;
+                }
+                samples.push_back(s);
+            }
+            trace.strokes.push_back(samples);
+        }
+        traces.push_back(trace);
+    }
+    return traces;
+}
+
+// Pointer position at time t, interpolated between samples
+void positionAt(const std::vector<PointerSample> &samples, double t, float &x, float &y)
+{
+    size_t i = 1;
+    while (i < samples.size() && samples[i].timeMs < t)
+    {
+        i++;
+    }
+    if (i >= samples.size())
+    {
+        x = samples.back().x;
+        y = samples.back().y;
+        return;
+    }
+    const PointerSample &a = samples[i - 1];
+    const PointerSample &b = samples[i];
+    double span = b.timeMs - a.timeMs;
+    float f = span > 0 ? static_cast<float>((t - a.timeMs) / span) : 1.0f;
+    f = std::max(0.0f, std::min(1.0f, f));
+    x = a.x + (b.x - a.x) * f;
+    y = a.y + (b.y - a.y) * f;
+}
+
+double percentile(std::vector<double> values, double p)
+{
+    if (values.empty())
+    {
+        return 0.0;
+    }
+    std::sort(values.begin(), values.end());
+    return values[static_cast<size_t>(p * (values.size() - 1))];
+}
+
+// Each frame shows the samples that arrived latencyMs before it. The error
+// is the distance from the drawn tip to where the pointer really is.
+ReplayResult replay(const Trace &trace, const PredictorConfig &config, float latencyMs)
+{
+    const double FRAME_MS = 1000.0 / 60.0;
+    std::vector<double> baseline, predicted;
+    double speedSum = 0;
+    ReplayResult result = {0, 0, 0, 0, 0, 0, 0, 0};
+
+    for (size_t s = 0; s < trace.strokes.size(); s++)
+    {
+        const std::vector<PointerSample> &samples = trace.strokes[s];
+        if (samples.size() < 2)
+        {
+            continue;
+        }
+
+        StrokePredictor predictor;
+        predictor.config = config;
+        predictorReset(predictor);
+        size_t fed = 0;
+
+        for (double frame = samples.front().timeMs + FRAME_MS; frame <= samples.back().timeMs; frame += FRAME_MS)
+        {
+            while (fed < samples.size() && samples[fed].timeMs <= frame - latencyMs)
+            {
+                predictorAddSample(predictor, samples[fed].x, samples[fed].y, samples[fed].timeMs);
+                fed++;
+            }
+            if (fed == 0)
+            {
+                continue;
+            }
+
+            float realX, realY;
+            positionAt(samples, frame, realX, realY);
+            const PointerSample &tip = samples[fed - 1];
+            double baseError = std::hypot(realX - tip.x, realY - tip.y);
+
+            // Samples are timed when they reach the app, latencyMs late
+            float px[PREDICTOR_MAX_POINTS], py[PREDICTOR_MAX_POINTS];
+            int n = predictorPredict(predictor, frame - latencyMs, px, py);
+            double predError = baseError;
+            if (n > 0)
+            {
+                predError = std::hypot(realX - px[n - 1], realY - py[n - 1]);
+                result.predictedFrames++;
+            }
+
+            float stillX, stillY;
+            positionAt(samples, frame - STOPPED_MS, stillX, stillY);
+            if (n > 0 && stillX == realX && stillY == realY && predError > 0.5)
+            {
+                result.staleTails++;
+            }
+
+            float beforeX, beforeY;
+            positionAt(samples, frame - FRAME_MS, beforeX, beforeY);
+            speedSum += std::hypot(realX - beforeX, realY - beforeY) / FRAME_MS;
+
+            baseline.push_back(baseError);
+            predicted.push_back(predError);
+            result.frames++;
+        }
+    }
+
+    if (result.frames == 0)
+    {
+        return result;
+    }
+    for (size_t i = 0; i < baseline.size(); i++)
+    {
+        result.baselineError += baseline[i];
+        result.predictedError += predicted[i];
+    }
+    result.baselineError /= result.frames;
+    result.predictedError /= result.frames;
+    result.baselineP95 = percentile(baseline, 0.95);
+    result.predictedP95 = percentile(predicted, 0.95);
+    result.meanSpeed = speedSum / result.frames;
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    float latencyMs = 24.0f;
+    float rateHz = 500.0f;
+    PredictorConfig config = defaultPredictorConfig();
+    bool horizonSet = false;
+    std::vector<Trace> traces;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-latency") == 0 && i + 1 < argc)
+        {
+            latencyMs = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-horizon") == 0 && i + 1 < argc)
+        {
+            config.horizonMs = atof(argv[++i]);
+            horizonSet = true;
+        }
+        else if (strcmp(argv[i], "-rate") == 0 && i + 1 < argc)
+        {
+            rateHz = atof(argv[++i]);
+        }
+        else
+        {
+            Trace trace;
+            if (!loadTrace(argv[i], trace))
+            {
+                return 1;
+            }
+            traces.push_back(trace);
+        }
+    }
+    if (!horizonSet)
+    {
+        config.horizonMs = latencyMs;
+    }
+    if (traces.empty())
+    {
+        traces = syntheticTraces(rateHz);
+    }
+
+    printf("latency %.1f ms, horizon %.1f ms\n", latencyMs, config.horizonMs);
+    printf("trace        frames  predicted  tip error px (mean/p95)      lag ms (mean)                stale\n");
+    printf("                                 baseline     predicted     baseline -> predicted\n");
+    int staleTails = 0;
+    for (size_t i = 0; i < traces.size(); i++)
+    {
+        ReplayResult r = replay(traces[i], config, latencyMs);
+        if (r.frames == 0)
+        {
+            continue;
+        }
+        staleTails += r.staleTails;
+        double baseLag = r.meanSpeed > 0 ? r.baselineError / r.meanSpeed : 0;
+        double predLag = r.meanSpeed > 0 ? r.predictedError / r.meanSpeed : 0;
+        printf("%-12s %6d  %8.1f%%  %5.1f/%-6.1f %6.1f/%-6.1f %6.1f -> %-6.1f (%+4.0f%%)  %5d\n",
+               traces[i].name.c_str(), r.frames, 100.0 * r.predictedFrames / r.frames,
+               r.baselineError, r.baselineP95, r.predictedError, r.predictedP95,
+               baseLag, predLag, baseLag > 0 ? 100.0 * (predLag - baseLag) / baseLag : 0.0, r.staleTails);
+    }
+    if (staleTails > 0)
+    {
+        printf("%d frames drew a tail after the pointer stopped\n", staleTails);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,540 @@
+// Relay cost of each socket backend and of shared memory.
+//
+// Usage: relay_bench [-peers n,n,...] [-rate strokes/s] [-duration s]
+//                    [-segments n] [-port n] [-copy-per-peer]
+//
+// For each peer count it runs a relay on this machine three times: over
+// loopback TCP with epoll, over loopback TCP with io_uring, and over
+// shared memory (see shm_transport.h). The relay works like the host in
+// main.cpp: each message read from a peer is queued once, as one
+// SharedBytes, for every other peer, and the sends go out with one flush
+// after each pass over the peers; -copy-per-peer gives every peer a copy
+// of its own instead, the way messages were once encoded per recipient.
+// Strokes are relayed without being decoded or drawn, so only the
+// transport is measured. The peers run in a
+// child process, each sending a stroke of -segments segments -rate times
+// a second and reading everything sent to it; a stroke's seq is the time
+// it was sent, so they also measure how long strokes took to arrive.
+//
+// Prints a CSV line per run: the transport, backend and buffers, peers,
+// strokes relayed and messages delivered per second, socket calls (see
+// netSyscalls), heap allocations and relay thread CPU microseconds per
+// relayed stroke, peer process CPU microseconds per delivered message,
+// and p50 and p99 latency in microseconds. Linux only. Build with
+//   g++ -std=c++11 -O2 tools/relay_bench.cpp net_socket.cpp net_uring.cpp shm_transport.cpp stroke_wire.cpp -o relay_bench -lpthread
+
+#include "../net_socket.h"
+#include "../shm_transport.h"
+#include "../stroke_wire.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <new>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+const size_t PEER_QUEUE_LIMIT = 8 * 1024 * 1024;
+const int READ_BUDGET = 64 * 1024; // Per peer per pass
+const double CONNECT_TIMEOUT_MS = 5000.0;
+const double DRAIN_TIMEOUT_MS = 5000.0;
+const uint32_t SEQ_BASE = 1000000000; // Keeps the seq ten digits long
+
+// Every operator new in the process; the peers run in a forked child, so
+// these are the relay's own. Not inlined, or GCC takes the free below
+// for a mismatched delete.
+std::atomic<uint64_t> allocations(0);
+
+__attribute__((noinline)) void *operator new(size_t size)
+{
+    allocations++;
+    void *memory = malloc(size ? size : 1);
+    if (!memory)
+    {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+__attribute__((noinline)) void operator delete(void *memory) noexcept
+{
+    free(memory);
+}
+
+struct RelayPeer
+{
+    Transport transport;
+    bool connected;
+    std::string receiveBuffer;
+    std::deque<SharedBytes> sendQueue;
+    size_t sendOffset;
+    size_t queuedBytes;
+};
+
+struct BenchClient
+{
+    Transport transport;
+    bool open;
+    SharedBytes sending; // The stroke going out, if any
+    size_t sendOffset;
+    double nextSendMs;
+    std::string partialLine;
+};
+
+struct BenchResult
+{
+    double relayedPerS, deliveredPerS, syscallsPerStroke, allocationsPerStroke, relayCpuUs, peerCpuUs;
+    float latencyUs[2]; // p50, p99
+    uint64_t drops;
+};
+
+double nowMs()
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint32_t stampNow()
+{
+    return SEQ_BASE + static_cast<uint32_t>(static_cast<uint64_t>(nowMs() * 1000.0) % SEQ_BASE);
+}
+
+double cpuUs(const rusage &usage)
+{
+    return usage.ru_utime.tv_sec * 1e6 + usage.ru_utime.tv_usec + usage.ru_stime.tv_sec * 1e6 +
+           usage.ru_stime.tv_usec;
+}
+
+double threadCpuUs()
+{
+    rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    return cpuUs(usage);
+}
+
+std::string benchStroke(uint32_t author, int segments)
+{
+    Stroke stroke = Stroke();
+    stroke.author = author;
+    stroke.seq = SEQ_BASE;
+    stroke.size = 3;
+    stroke.color[0] = 0.25f;
+    stroke.color[1] = 0.5f;
+    stroke.color[2] = 0.75f;
+    for (int i = 0; i < segments; i++)
+    {
+        Line line = Line();
+        line.x1 = 100 + i * 5;
+        line.y1 = 200 + (i % 7) * 3;
+        line.x2 = line.x1 + 5;
+        line.y2 = 200 + ((i + 1) % 7) * 3;
+        memcpy(line.color, stroke.color, sizeof(stroke.color));
+        line.size = stroke.size;
+        stroke.lines.push_back(line);
+    }
+    return encodeStroke(stroke);
+}
+
+// Latency of each complete stroke in data
+void readLines(BenchClient &client, const char *data, int length, std::vector<float> &latencyUs)
+{
+    client.partialLine.append(data, length);
+    size_t start = 0, newline;
+    while ((newline = client.partialLine.find('\n', start)) != std::string::npos)
+    {
+        unsigned author, seq;
+        if (sscanf(client.partialLine.c_str() + start, "S %u %u", &author, &seq) == 2 && seq >= SEQ_BASE)
+        {
+            latencyUs.push_back(static_cast<float>((stampNow() + SEQ_BASE - seq) % SEQ_BASE));
+        }
+        start = newline + 1;
+    }
+    client.partialLine.erase(0, start);
+}
+
+// The peers, in the child process. They run until the relay closes every
+// connection, then write their latency percentiles to resultFd.
+void runClients(bool sharedMemory, int count, const char *port, double rate, int segments, int resultFd)
+{
+    netStartup(false);
+    std::vector<BenchClient> clients;
+    std::vector<std::string> strokes;
+    double startMs = nowMs();
+    for (int i = 0; i < count; i++)
+    {
+        BenchClient client = BenchClient();
+        bool connected;
+        if (sharedMemory)
+        {
+            connected = shmConnect(port, client.transport);
+        }
+        else
+        {
+            NetSocket socket = netConnect("127.0.0.1", port);
+            connected = socket != NET_INVALID;
+            if (connected)
+            {
+                client.transport = socketTransport(socket);
+            }
+        }
+        if (!connected)
+        {
+            fprintf(stderr, "Could not connect client %d\n", i);
+            _exit(2);
+        }
+        client.open = true;
+        // Spread over the first interval so the peers do not send in step
+        client.nextSendMs = startMs + 1000.0 / rate * i / count;
+        clients.push_back(client);
+        strokes.push_back(benchStroke(i + 1, segments));
+    }
+
+    size_t seqAt = strokes[0].find(' ', 2) + 1; // After "S author "
+    std::vector<char> buffer(READ_BUDGET);
+    std::vector<float> latencyUs;
+    size_t open = clients.size();
+    while (open > 0)
+    {
+        double now = nowMs();
+        double wakeMs = now + 10.0;
+        for (size_t i = 0; i < clients.size(); i++)
+        {
+            BenchClient &client = clients[i];
+            if (!client.open)
+            {
+                continue;
+            }
+            if (!client.sending && client.nextSendMs <= now)
+            {
+                std::string stroke = strokes[i];
+                char stamp[16];
+                snprintf(stamp, sizeof(stamp), "%u", stampNow());
+                stroke.replace(seqAt, 10, stamp);
+                client.sending = std::make_shared<const std::string>(stroke);
+                client.sendOffset = 0;
+                client.nextSendMs = std::max(client.nextSendMs + 1000.0 / rate, now);
+            }
+            if (client.sending)
+            {
+                int sent = client.transport.send(client.sending, client.sendOffset);
+                client.sendOffset += std::max(sent, 0);
+                if (client.sendOffset == client.sending->size())
+                {
+                    client.sending.reset();
+                }
+            }
+            wakeMs = std::min(wakeMs, client.nextSendMs);
+
+            int received;
+            while ((received = client.transport.receive(buffer.data(), READ_BUDGET)) > 0)
+            {
+                readLines(client, buffer.data(), received, latencyUs);
+            }
+            if (received < 0)
+            {
+                client.transport.close();
+                client.open = false;
+                open--;
+            }
+        }
+        netFlush();
+        netWait(std::max(0, static_cast<int>(wakeMs - nowMs())));
+    }
+
+    std::sort(latencyUs.begin(), latencyUs.end());
+    float result[2] = {0, 0};
+    if (!latencyUs.empty())
+    {
+        result[0] = latencyUs[latencyUs.size() / 2];
+        result[1] = latencyUs[std::min(latencyUs.size() - 1, latencyUs.size() * 99 / 100)];
+    }
+    ssize_t written = write(resultFd, result, sizeof(result));
+    _exit(written == sizeof(result) ? 0 : 2);
+}
+
+void flushRelayPeer(RelayPeer &peer)
+{
+    while (!peer.sendQueue.empty() && peer.connected)
+    {
+        int sent = peer.transport.send(peer.sendQueue.front(), peer.sendOffset);
+        if (sent <= 0)
+        {
+            if (sent < 0)
+            {
+                peer.connected = false;
+            }
+            return;
+        }
+        peer.queuedBytes -= sent;
+        peer.sendOffset += sent;
+        if (peer.sendOffset == peer.sendQueue.front()->size())
+        {
+            peer.sendQueue.pop_front();
+            peer.sendOffset = 0;
+        }
+    }
+}
+
+// False if the backend could not be started
+bool runRelay(bool sharedMemory, bool ioUring, bool copyPerPeer, int peerCount, const char *port, double rate,
+              int segments, double durationS, BenchResult &result)
+{
+    // Listening before the fork lets the peers connect at once; the child
+    // starts a network of its own, so no io_uring is shared with it
+    NetSocket listener = sharedMemory ? shmHostStart(port) : netListen(port, true);
+    int results[2];
+    if (listener == NET_INVALID || pipe(results) != 0)
+    {
+        fprintf(stderr, "Could not listen on port %s\n", port);
+        exit(2);
+    }
+    pid_t child = fork();
+    if (child == 0)
+    {
+        close(static_cast<int>(listener));
+        close(results[0]);
+        runClients(sharedMemory, peerCount, port, rate, segments, results[1]);
+    }
+    close(results[1]);
+    bool started = netStartup(ioUring) && (!ioUring || strcmp(netBackend(), "io_uring") == 0);
+    if (started)
+    {
+        netWatch(listener);
+    }
+
+    std::vector<RelayPeer> peers;
+    std::vector<char> buffer(READ_BUDGET);
+    double connectDeadline = nowMs() + CONNECT_TIMEOUT_MS;
+    double startMs = 0, endMs = 0, startCpuUs = 0;
+    uint64_t startSyscalls = 0, startAllocations = 0;
+    uint64_t relayed = 0, delivered = 0;
+    result = BenchResult();
+    while (started)
+    {
+        NetSocket accepted;
+        while ((accepted = netAccept(listener)) != NET_INVALID)
+        {
+            RelayPeer peer = RelayPeer();
+            if (sharedMemory)
+            {
+                peer.connected = shmAccept(accepted, peer.transport);
+            }
+            else
+            {
+                peer.transport = socketTransport(accepted);
+                peer.connected = true;
+            }
+            peers.push_back(peer);
+        }
+        double now = nowMs();
+        if (startMs == 0 && static_cast<int>(peers.size()) == peerCount)
+        {
+            startMs = now;
+            endMs = now + durationS * 1000.0;
+            startCpuUs = threadCpuUs();
+            startSyscalls = netSyscalls();
+            startAllocations = allocations;
+        }
+        else if (startMs == 0 && now > connectDeadline)
+        {
+            fprintf(stderr, "Only %zu of %d peers connected\n", peers.size(), peerCount);
+            exit(2);
+        }
+        if (startMs > 0 && now >= endMs)
+        {
+            break;
+        }
+
+        for (size_t i = 0; i < peers.size(); i++)
+        {
+            if (!peers[i].connected)
+            {
+                continue;
+            }
+            int received = peers[i].transport.receive(buffer.data(), READ_BUDGET);
+            if (received <= 0)
+            {
+                peers[i].connected = received == 0;
+                continue;
+            }
+            peers[i].receiveBuffer.append(buffer.data(), received);
+            size_t start = 0, newline;
+            while ((newline = peers[i].receiveBuffer.find('\n', start)) != std::string::npos)
+            {
+                SharedBytes data =
+                    std::make_shared<const std::string>(peers[i].receiveBuffer.substr(start, newline + 1 - start));
+                start = newline + 1;
+                for (size_t j = 0; j < peers.size(); j++)
+                {
+                    if (j == i || !peers[j].connected)
+                    {
+                        continue;
+                    }
+                    if (peers[j].queuedBytes + data->size() > PEER_QUEUE_LIMIT)
+                    {
+                        result.drops++;
+                        continue;
+                    }
+                    peers[j].sendQueue.push_back(copyPerPeer ? std::make_shared<const std::string>(*data) : data);
+                    peers[j].queuedBytes += data->size();
+                    delivered += startMs > 0;
+                    flushRelayPeer(peers[j]);
+                }
+                relayed += startMs > 0;
+            }
+            peers[i].receiveBuffer.erase(0, start);
+        }
+        for (size_t i = 0; i < peers.size(); i++)
+        {
+            flushRelayPeer(peers[i]);
+        }
+        shmFlush();
+        netFlush();
+        netWait(10);
+    }
+
+    if (started)
+    {
+        double elapsedS = (nowMs() - startMs) / 1000.0;
+        double perStroke = relayed > 0 ? 1.0 / relayed : 0;
+        result.relayedPerS = relayed / elapsedS;
+        result.deliveredPerS = delivered / elapsedS;
+        result.syscallsPerStroke = (netSyscalls() - startSyscalls) * perStroke;
+        result.allocationsPerStroke = (allocations - startAllocations) * perStroke;
+        result.relayCpuUs = (threadCpuUs() - startCpuUs) * perStroke;
+    }
+    else
+    {
+        kill(child, SIGKILL);
+    }
+
+    // Closing every connection is what tells the peers to stop
+    for (size_t i = 0; i < peers.size(); i++)
+    {
+        peers[i].transport.close();
+    }
+    netFlush();
+    double drainEndMs = nowMs() + DRAIN_TIMEOUT_MS;
+    int status;
+    rusage usage;
+    while (wait4(child, &status, WNOHANG, &usage) == 0)
+    {
+        if (nowMs() > drainEndMs)
+        {
+            kill(child, SIGKILL);
+        }
+        usleep(10000);
+    }
+    if (read(results[0], result.latencyUs, sizeof(result.latencyUs)) != sizeof(result.latencyUs))
+    {
+        result.latencyUs[0] = result.latencyUs[1] = 0;
+    }
+    close(results[0]);
+    result.peerCpuUs = delivered > 0 ? cpuUs(usage) / delivered : 0;
+
+    netClose(listener);
+    if (sharedMemory)
+    {
+        shmHostStop();
+    }
+    netCleanup();
+    return started;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<int> peerCounts;
+    double rate = 5.0;
+    double durationS = 5.0;
+    int segments = 60;
+    const char *port = "27115";
+    bool copyPerPeer = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool ok = true;
+        if (strcmp(argv[i], "-peers") == 0 && i + 1 < argc)
+        {
+            for (char *item = strtok(argv[++i], ","); item; item = strtok(NULL, ","))
+            {
+                peerCounts.push_back(atoi(item));
+                ok = ok && peerCounts.back() >= 2;
+            }
+        }
+        else if (strcmp(argv[i], "-rate") == 0 && i + 1 < argc)
+        {
+            rate = atof(argv[++i]);
+            ok = rate > 0;
+        }
+        else if (strcmp(argv[i], "-duration") == 0 && i + 1 < argc)
+        {
+            durationS = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-segments") == 0 && i + 1 < argc)
+        {
+            segments = atoi(argv[++i]);
+            ok = segments > 0;
+        }
+        else if (strcmp(argv[i], "-port") == 0 && i + 1 < argc)
+        {
+            port = argv[++i];
+        }
+        else if (strcmp(argv[i], "-copy-per-peer") == 0)
+        {
+            copyPerPeer = true;
+        }
+        else
+        {
+            ok = false;
+        }
+        if (!ok)
+        {
+            fprintf(stderr, "Bad argument: %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if (peerCounts.empty())
+    {
+        peerCounts.push_back(10);
+        peerCounts.push_back(50);
+    }
+
+    const struct
+    {
+        const char *transport;
+        bool sharedMemory, ioUring;
+    } runs[] = {{"tcp", false, false}, {"tcp", false, true}, {"shm", true, false}};
+    printf("transport,backend,buffers,peers,relayed_per_s,delivered_per_s,syscalls_per_stroke,allocs_per_stroke,"
+           "relay_cpu_us_per_stroke,peer_cpu_us_per_delivery,latency_p50_us,latency_p99_us,drops\n");
+    fflush(stdout); // Or each forked child prints it again
+    for (size_t i = 0; i < peerCounts.size(); i++)
+    {
+        for (size_t r = 0; r < sizeof(runs) / sizeof(runs[0]); r++)
+        {
+            const char *backend = runs[r].ioUring ? "io_uring" : "epoll";
+            BenchResult result;
+            if (runs[r].sharedMemory && peerCounts[i] > SHM_MAX_CLIENTS)
+            {
+                fprintf(stderr, "shm takes at most %d peers; skipped\n", SHM_MAX_CLIENTS);
+                continue;
+            }
+            if (!runRelay(runs[r].sharedMemory, runs[r].ioUring, copyPerPeer, peerCounts[i], port, rate, segments,
+                          durationS, result))
+            {
+                fprintf(stderr, "%s over %s is not available; skipped\n", runs[r].transport, backend);
+                continue;
+            }
+            printf("%s,%s,%s,%d,%.0f,%.0f,%.2f,%.2f,%.2f,%.2f,%.0f,%.0f,%llu\n", runs[r].transport, backend,
+                   copyPerPeer ? "per_peer" : "shared", peerCounts[i], result.relayedPerS, result.deliveredPerS,
+                   result.syscallsPerStroke, result.allocationsPerStroke, result.relayCpuUs, result.peerCpuUs,
+                   result.latencyUs[0], result.latencyUs[1], static_cast<unsigned long long>(result.drops));
+            fflush(stdout);
+        }
+    }
+    return 0;
+}
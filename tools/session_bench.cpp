@@ -0,0 +1,221 @@
+// Compares the binary session file against a naive text save/load.
+//
+// Usage: session_bench [-segments n] [-boards n] [-path file]
+//
+// Builds boards holding n segments in total (1M by default) and times:
+// saving, opening (map + index only), paging in the first board, and
+// paging in every board, next to writing and parsing the same boards as
+// whitespace-separated text.
+
+#include "../session_file.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+double elapsedMs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+std::vector<Board> syntheticBoards(int boardCount, int segments)
+{
+    std::vector<Board> boards(boardCount);
+    srand(11);
+    for (int b = 0; b < boardCount; b++)
+    {
+        Board &board = boards[b];
+        board.name = "Board " + std::to_string(b + 1);
+        board.pointSize = 2;
+        board.tool = 1;
+        board.currentColor[0] = board.currentColor[1] = board.currentColor[2] = 0.0f;
+
+        for (int n = 0; n < segments / boardCount;)
+        {
+            Stroke stroke = Stroke();
+            stroke.size = 1 + rand() % 10;
+            stroke.isEraser = rand() % 8 == 0;
+            for (int c = 0; c < 3; c++)
+            {
+                stroke.color[c] = (rand() % 256) / 255.0f;
+            }
+            int x = rand() % 1000, y = rand() % 700;
+            int length = 20 + rand() % 200;
+            for (int i = 0; i < length; i++, n++)
+            {
+                Line line;
+                line.x1 = x;
+                line.y1 = y;
+                x += rand() % 9 - 4;
+                y += rand() % 9 - 4;
+                line.x2 = x;
+                line.y2 = y;
+                line.size = stroke.size;
+                line.isEraser = stroke.isEraser;
+                memcpy(line.color, stroke.color, sizeof(float) * 3);
+                stroke.lines.push_back(line);
+            }
+            board.strokes.push_back(stroke);
+        }
+    }
+    return boards;
+}
+
+bool saveText(const char *path, const std::vector<Board> &boards)
+{
+    std::ofstream out(path);
+    out << boards.size() << "\n";
+    for (size_t b = 0; b < boards.size(); b++)
+    {
+        const Board &board = boards[b];
+        out << board.name << "\n" << board.pointSize << " " << board.tool << " " << board.strokes.size() << "\n";
+        for (size_t s = 0; s < board.strokes.size(); s++)
+        {
+            const Stroke &stroke = board.strokes[s];
+            out << stroke.isEraser << " " << stroke.size << " " << stroke.color[0] << " " << stroke.color[1] << " "
+                << stroke.color[2] << " " << stroke.lines.size();
+            for (size_t i = 0; i < stroke.lines.size(); i++)
+            {
+                const Line &line = stroke.lines[i];
+                out << " " << line.x1 << " " << line.y1 << " " << line.x2 << " " << line.y2;
+            }
+            out << "\n";
+        }
+    }
+    return static_cast<bool>(out);
+}
+
+bool loadText(const char *path, std::vector<Board> &boards)
+{
+    std::ifstream in(path);
+    size_t boardCount;
+    if (!(in >> boardCount))
+    {
+        return false;
+    }
+    boards.resize(boardCount);
+    for (size_t b = 0; b < boardCount; b++)
+    {
+        Board &board = boards[b];
+        size_t strokeCount;
+        in >> std::ws;
+        std::getline(in, board.name);
+        in >> board.pointSize >> board.tool >> strokeCount;
+        board.strokes.resize(strokeCount);
+        for (size_t s = 0; s < strokeCount; s++)
+        {
+            Stroke &stroke = board.strokes[s];
+            size_t lineCount;
+            in >> stroke.isEraser >> stroke.size >> stroke.color[0] >> stroke.color[1] >> stroke.color[2] >> lineCount;
+            stroke.lines.resize(lineCount);
+            for (size_t i = 0; i < lineCount; i++)
+            {
+                Line &line = stroke.lines[i];
+                in >> line.x1 >> line.y1 >> line.x2 >> line.y2;
+                line.size = stroke.size;
+                line.isEraser = stroke.isEraser;
+                memcpy(line.color, stroke.color, sizeof(float) * 3);
+            }
+        }
+    }
+    return static_cast<bool>(in);
+}
+
+size_t fileSize(const char *path)
+{
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    return in ? static_cast<size_t>(in.tellg()) : 0;
+}
+
+int main(int argc, char **argv)
+{
+    int segments = 1000000;
+    int boardCount = 5;
+    std::string path = "session_bench.ibd";
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-segments") == 0 && i + 1 < argc)
+        {
+            segments = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-boards") == 0 && i + 1 < argc)
+        {
+            boardCount = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-path") == 0 && i + 1 < argc)
+        {
+            path = argv[++i];
+        }
+    }
+    std::string textPath = path + ".txt";
+
+    std::vector<Board> boards = syntheticBoards(boardCount, segments);
+    printf("%d boards, %d segments\n\n", boardCount, segments);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (!saveSession(path.c_str(), boards, 0))
+    {
+        fprintf(stderr, "Saving %s failed\n", path.c_str());
+        return 1;
+    }
+    double binarySave = elapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    SessionFile session;
+    if (!openSession(path.c_str(), session))
+    {
+        fprintf(stderr, "Opening %s failed\n", path.c_str());
+        return 1;
+    }
+    double binaryOpen = elapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    std::vector<Stroke> first;
+    loadBoardStrokes(session, 0, first);
+    double binaryFirst = elapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    std::vector<Board> loaded(session.boardCount);
+    for (uint32_t b = 0; b < session.boardCount; b++)
+    {
+        readBoardInfo(session, b, loaded[b]);
+        loadBoardStrokes(session, b, loaded[b].strokes);
+    }
+    double binaryAll = elapsedMs(start);
+    closeSession(session);
+
+    start = std::chrono::steady_clock::now();
+    saveText(textPath.c_str(), boards);
+    double textSave = elapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    std::vector<Board> textBoards;
+    loadText(textPath.c_str(), textBoards);
+    double textLoad = elapsedMs(start);
+
+    bool same = loaded.size() == boards.size();
+    for (size_t b = 0; same && b < boards.size(); b++)
+    {
+        same = loaded[b].strokes.size() == boards[b].strokes.size();
+        for (size_t s = 0; same && s < boards[b].strokes.size(); s++)
+        {
+            const std::vector<Line> &a = loaded[b].strokes[s].lines, &e = boards[b].strokes[s].lines;
+            same = a.size() == e.size() && (a.empty() || memcmp(&a[0], &e[0], a.size() * sizeof(Line)) == 0);
+        }
+    }
+
+    printf("                      binary        text\n");
+    printf("file size        %10zu  %10zu bytes\n", fileSize(path.c_str()), fileSize(textPath.c_str()));
+    printf("save             %10.2f  %10.2f ms\n", binarySave, textSave);
+    printf("open             %10.3f  %10.2f ms (text parses everything)\n", binaryOpen, textLoad);
+    printf("page in board 1  %10.2f  %10s\n", binaryFirst, "-");
+    printf("page in all      %10.2f  %10.2f ms\n", binaryAll, textLoad);
+    printf("round trip       %10s\n", same ? "identical" : "MISMATCH");
+
+    remove(path.c_str());
+    remove(textPath.c_str());
+    return same ? 0 : 1;
+}
@@ -0,0 +1,394 @@
+// Microbenchmarks for the per-stroke and per-board paths of the app.
+//
+// Usage: stroke_bench [-out file.csv] [-baseline file.csv] [-threshold x]
+//                     [-min-ms n] [-max-segments n] [-no-gl]
+//
+// Times stroke messages (encode and parse) for strokes of 10 to 1000
+// segments, committing a stroke, circle generation, and switching to,
+// packing, deleting and drawing boards of 1k to 1M segments. Results are
+// printed as CSV (name,segments,iterations,ns_per_op) and written to -out.
+// With -baseline, any result slower than the baseline by more than the
+// threshold factor (1.25 by default) is reported and the exit code is 1.
+//
+// Drawing needs a GL context, so it opens a hidden GLUT window; pass
+// -no-gl where there is no display.
+
+#include "../board_store.h"
+#include "../history.h"
+#include "../session_file.h"
+#include "../shapes.h"
+#include "../stroke_draw.h"
+#include "../stroke_wire.h"
+#include <GL/glut.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+struct Result
+{
+    std::string name;
+    size_t segments;
+    uint64_t iterations;
+    double nsPerOp;
+};
+
+double minMs = 200.0;
+std::vector<Result> results;
+
+Stroke syntheticStroke(int length)
+{
+    Stroke stroke = Stroke();
+    stroke.author = 1 + rand() % 4;
+    stroke.seq = rand();
+    stroke.size = 1 + rand() % 10;
+    stroke.isEraser = rand() % 8 == 0;
+    for (int c = 0; c < 3; c++)
+    {
+        stroke.color[c] = (rand() % 256) / 255.0f;
+    }
+    int x = rand() % 1000, y = rand() % 700;
+    for (int i = 0; i < length; i++)
+    {
+        Line line;
+        line.x1 = x;
+        line.y1 = y;
+        x += rand() % 9 - 4;
+        y += rand() % 9 - 4;
+        line.x2 = x;
+        line.y2 = y;
+        line.size = stroke.size;
+        line.isEraser = stroke.isEraser;
+        memcpy(line.color, stroke.color, sizeof(float) * 3);
+        stroke.lines.push_back(line);
+    }
+    return stroke;
+}
+
+// Strokes of 20 to 220 segments, like hand drawing, with unique ids
+std::vector<Stroke> syntheticBoard(size_t segments)
+{
+    std::vector<Stroke> strokes;
+    srand(static_cast<unsigned>(segments));
+    for (size_t n = 0; n < segments;)
+    {
+        Stroke stroke = syntheticStroke(static_cast<int>(std::min<size_t>(20 + rand() % 200, segments - n)));
+        stroke.seq = strokes.size() + 1;
+        n += stroke.lines.size();
+        strokes.push_back(stroke);
+    }
+    return strokes;
+}
+
+void addResult(const std::string &name, size_t segments, uint64_t iterations, double totalNs)
+{
+    Result result;
+    result.name = name;
+    result.segments = segments;
+    result.iterations = iterations;
+    result.nsPerOp = totalNs / iterations;
+    results.push_back(result);
+    printf("%s,%zu,%llu,%.1f\n", name.c_str(), segments, static_cast<unsigned long long>(iterations), result.nsPerOp);
+    fflush(stdout);
+}
+
+// Runs op until minMs has passed, doubling the batch each round so the
+// clock is read rarely for fast ops
+template <typename Op>
+void measure(const std::string &name, size_t segments, Op op)
+{
+    typedef std::chrono::steady_clock Clock;
+    uint64_t iterations = 0, batch = 1;
+    double totalNs = 0;
+    while (totalNs < minMs * 1e6)
+    {
+        Clock::time_point start = Clock::now();
+        for (uint64_t i = 0; i < batch; i++)
+        {
+            op();
+        }
+        totalNs += std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        iterations += batch;
+        batch *= 2;
+    }
+    addResult(name, segments, iterations, totalNs);
+}
+
+// For ops that use up their input: reset runs untimed before each op
+template <typename Op, typename Reset>
+void measureEach(const std::string &name, size_t segments, Op op, Reset reset)
+{
+    typedef std::chrono::steady_clock Clock;
+    uint64_t iterations = 0;
+    double totalNs = 0;
+    while (totalNs < minMs * 1e6)
+    {
+        reset();
+        Clock::time_point start = Clock::now();
+        op();
+        totalNs += std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        iterations++;
+    }
+    addResult(name, segments, iterations, totalNs);
+}
+
+void benchMessages()
+{
+    const int lengths[] = {10, 100, 1000};
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++)
+    {
+        srand(lengths[l]);
+        Stroke stroke = syntheticStroke(lengths[l]);
+        std::string message = encodeStroke(stroke);
+        std::string line = message.substr(0, message.size() - 1);
+
+        measure("encode_stroke", lengths[l], [&]()
+        {
+            message = encodeStroke(stroke);
+        });
+        measure("decode_stroke", lengths[l], [&]()
+        {
+            char type;
+            Stroke received;
+            decodeMessage(line, type, received);
+        });
+    }
+}
+
+// What commitLocalStroke does on the UI thread besides queueing the
+// journal record, which the writer thread encodes and syncs
+void benchCommit()
+{
+    srand(3);
+    Stroke stroke = syntheticStroke(100);
+    std::vector<Stroke> strokes;
+    StrokeIndex index;
+    History history;
+    historyInit(history, HISTORY_LIMIT_BYTES);
+    uint32_t seq = 1;
+
+    measureEach("commit_stroke", stroke.lines.size(), [&]()
+    {
+        stroke.seq = seq++;
+        strokes.push_back(stroke);
+        indexLastStroke(index, strokes);
+        historyRecord(history, stroke.seq);
+        std::string message = encodeStroke(stroke);
+    }, [&]()
+    {
+        if (strokes.size() == 1000)
+        {
+            strokes.clear();
+            index.clear();
+        }
+    });
+    historyClear(history);
+}
+
+void benchCircle()
+{
+    float color[3] = {0.2f, 0.4f, 0.6f};
+    int radius = 10;
+    measure("make_circle", CIRCLE_SEGMENTS, [&]()
+    {
+        Stroke circle = makeCircleStroke(500, 350, radius, color, 3);
+        radius = radius % 300 + 1;
+    });
+}
+
+// The board paths switchToBoard, evictBoards and deleteCurrentBoard take
+// through board_store.h; a switch keeps each board's id index, while
+// showing a packed board or the one before a deleted board builds it
+void benchBoards(size_t segments)
+{
+    std::vector<Stroke> board = syntheticBoard(segments);
+    SessionFile session = SessionFile();
+    std::vector<Board> boards(2);
+    boards[0].pagedIndex = boards[1].pagedIndex = -1;
+    boards[1].strokes = board;
+    std::vector<Stroke> strokes = board;
+    int current = 0;
+    uint64_t switches = 0;
+    StrokeIndex index;
+
+    // Back and forth between two boards of the same size
+    measure("switch_board", segments, [&]()
+    {
+        storeBoard(boards[current], strokes, index, ++switches);
+        current = 1 - current;
+        showBoard(boards, current, strokes, index, session);
+    });
+
+    measureEach("pack_board", segments, [&]()
+    {
+        evictBoards(boards, current, strokes, 0);
+    }, [&]()
+    {
+        ensureBoardResident(boards[1 - current], session);
+    });
+    measureEach("switch_packed_board", segments, [&]()
+    {
+        storeBoard(boards[current], strokes, index, ++switches);
+        current = 1 - current;
+        showBoard(boards, current, strokes, index, session);
+    }, [&]()
+    {
+        evictBoards(boards, current, strokes, 0);
+    });
+
+    // Deleting the last of three boards shows the one before it
+    measureEach("delete_board", segments, [&]()
+    {
+        deleteBoard(boards, current, strokes, index, session);
+    }, [&]()
+    {
+        boards.assign(3, Board());
+        boards[0].pagedIndex = boards[1].pagedIndex = boards[2].pagedIndex = -1;
+        boards[1].strokes = board;
+        strokes = board;
+        current = 2;
+    });
+}
+
+void benchDraw(size_t segments)
+{
+    std::vector<Stroke> strokes = syntheticBoard(segments);
+    measure("draw_board", segments, [&]()
+    {
+        for (size_t i = 0; i < strokes.size(); i++)
+        {
+            drawStroke(strokes[i]);
+        }
+        glFinish();
+    });
+}
+
+bool writeResults(const char *path)
+{
+    std::ofstream out(path);
+    out << "name,segments,iterations,ns_per_op\n";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        out << results[i].name << "," << results[i].segments << "," << results[i].iterations << "," << results[i].nsPerOp << "\n";
+    }
+    return static_cast<bool>(out);
+}
+
+// Returns the number of results slower than the baseline by more than
+// threshold; results missing from the baseline are not compared
+int compareBaseline(const char *path, double threshold)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        fprintf(stderr, "Cannot read baseline %s\n", path);
+        return -1;
+    }
+    std::map<std::string, double> baseline;
+    std::string line;
+    std::getline(in, line);
+    while (std::getline(in, line))
+    {
+        std::stringstream ss(line);
+        std::string name, segments, iterations, nsPerOp;
+        if (std::getline(ss, name, ',') && std::getline(ss, segments, ',') &&
+            std::getline(ss, iterations, ',') && std::getline(ss, nsPerOp))
+        {
+            baseline[name + "," + segments] = atof(nsPerOp.c_str());
+        }
+    }
+
+    int regressions = 0;
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        std::map<std::string, double>::iterator found = baseline.find(results[i].name + "," + std::to_string(results[i].segments));
+        if (found != baseline.end() && found->second > 0 && results[i].nsPerOp > found->second * threshold)
+        {
+            fprintf(stderr, "Regression: %s at %zu segments, %.1f ns/op against %.1f (%.2fx)\n", results[i].name.c_str(),
+                    results[i].segments, results[i].nsPerOp, found->second, results[i].nsPerOp / found->second);
+            regressions++;
+        }
+    }
+    return regressions;
+}
+
+int main(int argc, char **argv)
+{
+    const char *outPath = NULL;
+    const char *baselinePath = NULL;
+    double threshold = 1.25;
+    size_t maxSegments = 1000000;
+    bool useGl = true;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-out") == 0 && i + 1 < argc)
+        {
+            outPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "-baseline") == 0 && i + 1 < argc)
+        {
+            baselinePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "-threshold") == 0 && i + 1 < argc)
+        {
+            threshold = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-min-ms") == 0 && i + 1 < argc)
+        {
+            minMs = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-max-segments") == 0 && i + 1 < argc)
+        {
+            maxSegments = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-no-gl") == 0)
+        {
+            useGl = false;
+        }
+    }
+
+    if (useGl)
+    {
+        glutInit(&argc, argv);
+        glutInitDisplayMode(GLUT_SINGLE | GLUT_RGB);
+        glutInitWindowSize(1000, 700);
+        glutCreateWindow("stroke_bench");
+        glutHideWindow();
+        glMatrixMode(GL_PROJECTION);
+        glLoadIdentity();
+        glOrtho(0, 1000, 700, 0, -1, 1);
+    }
+
+    printf("name,segments,iterations,ns_per_op\n");
+    benchMessages();
+    benchCommit();
+    benchCircle();
+    for (size_t segments = 1000; segments <= maxSegments; segments *= 10)
+    {
+        benchBoards(segments);
+        if (useGl)
+        {
+            benchDraw(segments);
+        }
+    }
+
+    if (outPath && !writeResults(outPath))
+    {
+        fprintf(stderr, "Writing %s failed\n", outPath);
+        return 1;
+    }
+    if (baselinePath)
+    {
+        int regressions = compareBaseline(baselinePath, threshold);
+        if (regressions != 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,708 @@
+// Headless multi-peer session over the simulated network.
+//
+// Usage: sync_sim [-peers n] [-rate strokes/s] [-duration s] [-settle s]
+//                 [-latency ms] [-jitter ms] [-bandwidth KB/s] [-window KB]
+//                 [-reorder percent] [-loss percent] [-undo percent]
+//                 [-clear percent] [-duplicate percent] [-long percent]
+//                 [-holdback n] [-nocredit] [-disconnect peer:s] [-seed n]
+//
+// Peer 0 hosts and peers 1 to n-1 connect to it, each over its own
+// simulated link (see sim_network.h) with the given latency, jitter,
+// bandwidth, send window, reordering and loss; -disconnect cuts a peer's
+// link at a point in the run and can be given more than once. Every peer
+// draws freehand strokes, circles and squares at -rate per second for
+// -duration seconds, undoes or redoes its own strokes -undo percent of the
+// time, and clears the board -clear percent of the time (never by
+// default); -duplicate sends that percent of them twice, as a retransmit
+// would; -long makes that percent of freehand strokes thousands of
+// segments long, so they go out in pieces; -holdback makes every peer send
+// its first n strokes last to first once it has drawn them all, so each
+// author's ids reach the others out of order. Messages are framed, queued,
+// applied and relayed as in main.cpp, so strokes that arrive again are
+// dropped and not relayed. Time is virtual, so runs are quick and repeat
+// for a seed.
+//
+// Each connection queues in send lanes and chunks long messages as
+// send_lanes.h describes, and clients send strokes on the host's credit,
+// so a slow link holds its sender back; the run reports how long clients
+// waited for credit. -nocredit runs a host from before credit, which
+// neither says it gives credit nor hands any back.
+//
+// Once drawing stops the run goes on until nothing is in flight, or for
+// -settle seconds at most. It then prints how long after the last stroke
+// the boards settled, the bytes sent, and each peer's checksum of its
+// strokes as stacked, which must match everywhere: strokes are stamped
+// and stacked as stackPosition in history.h describes, with virtual time
+// as the wall clock. The exit code is 1 if any peer's strokes differ.
+
+#include "../history.h"
+#include "../input_trace.h"
+#include "../send_lanes.h"
+#include "../shapes.h"
+#include "../sim_network.h"
+#include "../stroke_seen.h"
+#include "../stroke_wire.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+const size_t PEER_QUEUE_LIMIT = 8 * 1024 * 1024;
+const double TICK_MS = 1.0;
+const int BOARD_WIDTH = 1000, BOARD_HEIGHT = 700;
+
+struct Connection
+{
+    Transport transport;
+    bool connected;
+    bool onCredit; // A client's connection to a host that gives credit
+    std::string receiveBuffer;
+    ChunkJoiner chunks;
+    SendLanes lanes;
+    size_t queuedBytes; // Over all lanes
+    int64_t sendCredit; // What a client may still send the host
+    // Bytes of a client's messages the host has finished with and owes back
+    std::shared_ptr<std::atomic<int64_t> > creditReturned;
+    uint64_t drops;
+    double creditWaitMs; // Time a client had strokes queued and no credit
+};
+
+struct SimPeer
+{
+    uint32_t author;
+    uint32_t nextSeq;
+    uint64_t clock; // Newest stamp drawn or received
+    Stroke cleared; // Newest clear applied, by (stamp, author)
+    std::vector<Stroke> strokes;
+    StrokeIndex index;
+    StrokeSeen seen;
+    History history;
+    std::vector<Connection> connections; // The host has one per client
+    double nextDrawMs;
+    std::vector<std::string> heldBack; // First strokes, sent once all are drawn
+    uint64_t messagesOut, messagesIn, parseErrors, duplicates, clears;
+};
+
+std::vector<SimPeer> peers;
+std::mt19937 rng;
+double lastDrawMs = 0;
+bool hostGivesCredit = true;
+uint32_t holdBack = 0;
+
+int uniform(int low, int high)
+{
+    return std::uniform_int_distribution<int>(low, high)(rng);
+}
+
+Stroke randomStroke(int longPercent)
+{
+    float color[3];
+    for (int c = 0; c < 3; c++)
+    {
+        color[c] = uniform(0, 255) / 255.0f;
+    }
+    int size = uniform(1, 10);
+    int x = uniform(0, BOARD_WIDTH - 1), y = uniform(0, BOARD_HEIGHT - 1);
+    int pick = uniform(0, 9);
+    if (pick == 0)
+    {
+        return makeCircleStroke(x, y, uniform(10, 200), color, size);
+    }
+    if (pick == 1)
+    {
+        int r = uniform(10, 200);
+        return makeSquareStroke(x - r, y - r, x + r, y + r, color, size);
+    }
+
+    Stroke stroke = Stroke();
+    stroke.size = size;
+    memcpy(stroke.color, color, sizeof(color));
+    double angle = uniform(0, 359) * M_PI / 180.0;
+    for (int i = uniform(0, 99) < longPercent ? uniform(2000, 4000) : uniform(20, 220); i > 0; i--)
+    {
+        angle += uniform(-20, 20) * M_PI / 180.0;
+        Line line;
+        line.x1 = x;
+        line.y1 = y;
+        x = std::min(std::max(x + static_cast<int>(cos(angle) * 5), 0), BOARD_WIDTH - 1);
+        y = std::min(std::max(y + static_cast<int>(sin(angle) * 5), 0), BOARD_HEIGHT - 1);
+        line.x2 = x;
+        line.y2 = y;
+        memcpy(line.color, color, sizeof(color));
+        line.size = size;
+        line.isEraser = false;
+        stroke.lines.push_back(line);
+    }
+    return stroke;
+}
+
+// As flushPeer in main.cpp: the highest lane first, and a client only
+// starts a stroke or bulk message while it has credit
+void flushConnection(Connection &connection)
+{
+    SendLanes &lanes = connection.lanes;
+    int lane;
+    while (connection.connected &&
+           (lane = lanesNext(lanes, !connection.onCredit || connection.sendCredit > 0)) >= 0)
+    {
+        QueuedPiece &piece = lanes.queues[lane].front();
+        if (lanes.sending < 0)
+        {
+            lanes.sending = lane;
+            if (lane != LANE_LIVE)
+            {
+                connection.sendCredit -= piece.messageBytes;
+            }
+        }
+        int sent = connection.transport.send(piece.bytes, lanes.offset);
+        if (sent <= 0)
+        {
+            if (sent < 0)
+            {
+                connection.transport.close();
+                connection.connected = false;
+            }
+            return;
+        }
+        connection.queuedBytes -= sent;
+        lanes.offset += sent;
+        if (lanes.offset == piece.bytes->size())
+        {
+            lanes.bytes[lane] -= piece.bytes->size();
+            lanes.queues[lane].pop_front();
+            lanes.sending = -1;
+            lanes.offset = 0;
+        }
+    }
+}
+
+// As queueForPeer in main.cpp: dropped once the queue is full, and the
+// sender's credit is only held while the connection is within a window
+void queueForConnection(SimPeer &peer, Connection &connection, const SharedBytes &message,
+                        const std::vector<SharedBytes> &pieces, Lane lane, const SharedCredit &credit)
+{
+    if (!connection.connected)
+    {
+        return;
+    }
+    size_t bytes = pieces.empty() ? message->size() : 0;
+    for (size_t i = 0; i < pieces.size(); i++)
+    {
+        bytes += pieces[i]->size();
+    }
+    if (connection.queuedBytes + bytes > PEER_QUEUE_LIMIT)
+    {
+        connection.drops++;
+        return;
+    }
+    QueuedPiece piece = {message, connection.queuedBytes <= CREDIT_WINDOW_BYTES ? credit : SharedCredit(), 0,
+                         message->size(), pieces.empty(), 0};
+    std::deque<QueuedPiece> &queue = connection.lanes.queues[lane];
+    if (pieces.empty())
+    {
+        queue.push_back(piece);
+    }
+    for (size_t i = 0; i < pieces.size(); i++)
+    {
+        piece.bytes = pieces[i];
+        piece.last = i + 1 == pieces.size();
+        queue.push_back(piece);
+        piece.messageBytes = 0;
+    }
+    connection.lanes.bytes[lane] += bytes;
+    connection.queuedBytes += bytes;
+    peer.messagesOut++;
+    flushConnection(connection);
+}
+
+// To every connection but except (-1 for none); a relayed message holds
+// its sender's credit until every copy has been sent
+void sendToConnections(SimPeer &peer, const SharedBytes &data, int except, const SharedCredit &credit)
+{
+    Lane lane = messageLane(*data);
+    std::vector<SharedBytes> pieces;
+    chunkMessage(data, lane, pieces);
+    for (size_t i = 0; i < peer.connections.size(); i++)
+    {
+        if (static_cast<int>(i) != except)
+        {
+            queueForConnection(peer, peer.connections[i], data, pieces, lane, credit);
+        }
+    }
+}
+
+// Hands clients back the credit of what the host is finished with
+void grantCredit(SimPeer &host)
+{
+    for (size_t i = 0; i < host.connections.size(); i++)
+    {
+        Connection &connection = host.connections[i];
+        int64_t returned = *connection.creditReturned;
+        if (returned >= CREDIT_GRANT_BYTES)
+        {
+            *connection.creditReturned -= returned;
+            queueForConnection(host, connection, std::make_shared<const std::string>(encodeCredit(returned)),
+                               std::vector<SharedBytes>(), LANE_LIVE, SharedCredit());
+        }
+    }
+}
+
+// A client with strokes queued that it has no credit to start
+bool waitingForCredit(const Connection &connection)
+{
+    const SendLanes &lanes = connection.lanes;
+    return connection.connected && connection.onCredit && connection.sendCredit <= 0 && lanes.sending < 0 &&
+           (!lanes.queues[LANE_STROKES].empty() || !lanes.queues[LANE_BULK].empty());
+}
+
+bool setRemoved(SimPeer &peer, uint32_t author, uint32_t seq, bool removed)
+{
+    Stroke *stroke = findStroke(peer.strokes, peer.index, author, seq);
+    if (!stroke || stroke->removed == removed)
+    {
+        return false;
+    }
+    stroke->removed = removed;
+    return true;
+}
+
+// As applyClear in main.cpp: the strokes stacked below the clear go, and
+// ones that arrive later stacked below the newest clear are dropped
+void applyClear(SimPeer &peer, const Stroke &clear)
+{
+    clearBelow(peer.strokes, peer.index, clear);
+    if (stackedBelow(peer.cleared, clear))
+    {
+        peer.cleared = clear;
+    }
+}
+
+// Sends what a peer drew, twice duplicatePercent of the time
+void sendDrawn(SimPeer &peer, const std::string &text, int duplicatePercent)
+{
+    SharedBytes data = std::make_shared<const std::string>(text);
+    sendToConnections(peer, data, -1, SharedCredit());
+    if (uniform(0, 99) < duplicatePercent)
+    {
+        sendToConnections(peer, data, -1, SharedCredit());
+    }
+}
+
+void draw(SimPeer &peer, int undoPercent, int clearPercent, int duplicatePercent, int longPercent, double nowMs)
+{
+    uint32_t seq;
+    lastDrawMs = nowMs;
+    if (peer.nextSeq > holdBack && uniform(0, 99) < clearPercent)
+    {
+        Stroke clear = Stroke();
+        clear.author = peer.author;
+        clear.seq = peer.nextSeq++;
+        clear.stamp = peer.clock = std::max(peer.clock + 1, static_cast<uint64_t>(nowMs));
+        markStrokeSeen(peer.seen, clear.author, clear.seq);
+        applyClear(peer, clear);
+        historyClear(peer.history);
+        peer.clears++;
+        sendDrawn(peer, encodeClear(clear.author, clear.seq, clear.stamp), duplicatePercent);
+        return;
+    }
+    if (peer.nextSeq > holdBack && uniform(0, 99) < undoPercent)
+    {
+        // Undo twice as often as redo, so both stacks see use
+        bool undo = uniform(0, 2) > 0;
+        while (undo ? historyUndo(peer.history, seq) : historyRedo(peer.history, seq))
+        {
+            if (setRemoved(peer, peer.author, seq, undo))
+            {
+                sendDrawn(peer, encodeStrokeOp(undo ? 'U' : 'R', peer.author, seq), duplicatePercent);
+                return;
+            }
+        }
+    }
+
+    Stroke stroke = randomStroke(longPercent);
+    stroke.author = peer.author;
+    stroke.seq = peer.nextSeq++;
+    stroke.stamp = peer.clock = std::max(peer.clock + 1, static_cast<uint64_t>(nowMs));
+    stroke.removed = false;
+    markStrokeSeen(peer.seen, stroke.author, stroke.seq);
+    peer.strokes.push_back(stroke);
+    indexLastStroke(peer.index, peer.strokes);
+    historyRecord(peer.history, stroke.seq);
+    if (stroke.seq > holdBack)
+    {
+        sendDrawn(peer, encodeStroke(stroke), duplicatePercent);
+        return;
+    }
+    peer.heldBack.push_back(encodeStroke(stroke));
+    if (stroke.seq == holdBack)
+    {
+        for (size_t i = peer.heldBack.size(); i > 0; i--)
+        {
+            sendDrawn(peer, peer.heldBack[i - 1], duplicatePercent);
+        }
+        peer.heldBack.clear();
+    }
+}
+
+// Takes a message with its newline, so the host can relay it as is
+void receiveMessage(SimPeer &peer, const SharedBytes &line, int from, bool isHost, const SharedCredit &credit)
+{
+    peer.messagesIn++;
+    const std::string &message = *line;
+    char type;
+    Stroke stroke;
+    if (message[0] == 'C')
+    {
+        int64_t bytes;
+        if (!decodeCredit(message, bytes))
+        {
+            peer.parseErrors++;
+            return;
+        }
+        peer.connections[from].onCredit = true;
+        peer.connections[from].sendCredit += bytes;
+        flushConnection(peer.connections[from]);
+        return;
+    }
+    if (message[0] != 'S' && message[0] != 'U' && message[0] != 'R' && message[0] != 'K')
+    {
+        return;
+    }
+    if (!decodeMessage(message, type, stroke))
+    {
+        peer.parseErrors++;
+        return;
+    }
+    if (type == 'S' || type == 'K')
+    {
+        if (!markStrokeSeen(peer.seen, stroke.author, stroke.seq))
+        {
+            peer.duplicates++;
+            return;
+        }
+        peer.clock = std::max(peer.clock, stroke.stamp);
+        if (type == 'K')
+        {
+            applyClear(peer, stroke);
+        }
+        else if (!stackedBelow(stroke, peer.cleared))
+        {
+            insertStroke(peer.strokes, peer.index, stroke);
+        }
+    }
+    else
+    {
+        setRemoved(peer, stroke.author, stroke.seq, type == 'U');
+    }
+    if (isHost)
+    {
+        sendToConnections(peer, line, from, credit);
+    }
+}
+
+void receiveAll(SimPeer &peer, bool isHost)
+{
+    char buffer[16384];
+    for (size_t i = 0; i < peer.connections.size(); i++)
+    {
+        Connection &connection = peer.connections[i];
+        int received;
+        while (connection.connected && (received = connection.transport.receive(buffer, sizeof(buffer))) != 0)
+        {
+            if (received < 0)
+            {
+                connection.transport.close();
+                connection.connected = false;
+                break;
+            }
+            connection.receiveBuffer.append(buffer, received);
+        }
+
+        size_t start = 0, end;
+        while ((end = connection.receiveBuffer.find('\n', start)) != std::string::npos)
+        {
+            bool malformed;
+            SharedBytes line = joinChunk(connection.chunks, connection.receiveBuffer, start, end + 1 - start,
+                                         PEER_QUEUE_LIMIT, malformed);
+            start = end + 1;
+            if (malformed)
+            {
+                peer.parseErrors++;
+            }
+            if (!line)
+            {
+                continue;
+            }
+            SharedCredit credit;
+            if (isHost && hostGivesCredit && messageLane(*line) != LANE_LIVE)
+            {
+                credit = holdCredit(connection.creditReturned, line->size());
+            }
+            receiveMessage(peer, line, static_cast<int>(i), isHost, credit);
+        }
+        connection.receiveBuffer.erase(0, start);
+        flushConnection(connection);
+    }
+}
+
+bool queuesEmpty()
+{
+    for (size_t p = 0; p < peers.size(); p++)
+    {
+        for (size_t i = 0; i < peers[p].connections.size(); i++)
+        {
+            const Connection &connection = peers[p].connections[i];
+            if (connection.connected && (connection.queuedBytes > 0 || !connection.receiveBuffer.empty()))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    int peerCount = 4;
+    double rate = 2.0, durationS = 10.0, settleS = 30.0;
+    SimLinkConfig link = simDefaultLink();
+    int undoPercent = 10;
+    int clearPercent = 0;
+    int duplicatePercent = 0;
+    int longPercent = 0;
+    unsigned seed = 1;
+    std::vector<std::pair<int, double> > disconnects;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool ok = true;
+        if (strcmp(argv[i], "-peers") == 0 && i + 1 < argc)
+        {
+            peerCount = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-rate") == 0 && i + 1 < argc)
+        {
+            rate = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-duration") == 0 && i + 1 < argc)
+        {
+            durationS = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-settle") == 0 && i + 1 < argc)
+        {
+            settleS = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-latency") == 0 && i + 1 < argc)
+        {
+            link.latencyMs = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-jitter") == 0 && i + 1 < argc)
+        {
+            link.jitterMs = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-bandwidth") == 0 && i + 1 < argc)
+        {
+            link.bytesPerMs = atof(argv[++i]) * 1024.0 / 1000.0;
+        }
+        else if (strcmp(argv[i], "-window") == 0 && i + 1 < argc)
+        {
+            link.windowBytes = strtoul(argv[++i], NULL, 10) * 1024;
+        }
+        else if (strcmp(argv[i], "-reorder") == 0 && i + 1 < argc)
+        {
+            link.reorderPercent = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-loss") == 0 && i + 1 < argc)
+        {
+            link.lossPercent = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-undo") == 0 && i + 1 < argc)
+        {
+            undoPercent = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-clear") == 0 && i + 1 < argc)
+        {
+            clearPercent = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-duplicate") == 0 && i + 1 < argc)
+        {
+            duplicatePercent = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-long") == 0 && i + 1 < argc)
+        {
+            longPercent = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-holdback") == 0 && i + 1 < argc)
+        {
+            holdBack = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-nocredit") == 0)
+        {
+            hostGivesCredit = false;
+        }
+        else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc)
+        {
+            seed = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-disconnect") == 0 && i + 1 < argc)
+        {
+            int peer;
+            double atS;
+            ok = sscanf(argv[++i], "%d:%lf", &peer, &atS) == 2 && peer > 0;
+            disconnects.push_back(std::make_pair(peer, atS * 1000.0));
+        }
+        else
+        {
+            ok = false;
+        }
+        if (!ok)
+        {
+            fprintf(stderr, "Bad argument: %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if (peerCount < 2)
+    {
+        fprintf(stderr, "Need at least two peers\n");
+        return 2;
+    }
+
+    rng.seed(seed);
+    SimNetwork network;
+    simInit(network, seed);
+    std::exponential_distribution<double> gap(rate > 0 ? rate / 1000.0 : 1.0);
+    peers.resize(peerCount);
+    for (int p = 0; p < peerCount; p++)
+    {
+        peers[p].author = static_cast<uint32_t>(p + 1);
+        peers[p].nextSeq = 1;
+        historyInit(peers[p].history, HISTORY_LIMIT_BYTES);
+        peers[p].nextDrawMs = gap(rng);
+    }
+    for (int p = 1; p < peerCount; p++)
+    {
+        SimLinkConfig config = link;
+        for (size_t d = 0; d < disconnects.size(); d++)
+        {
+            if (disconnects[d].first == p)
+            {
+                config.disconnectAtMs = disconnects[d].second;
+            }
+        }
+        Connection host = Connection(), client = Connection();
+        host.connected = client.connected = true;
+        host.lanes.sending = client.lanes.sending = -1;
+        client.sendCredit = CREDIT_WINDOW_BYTES;
+        host.creditReturned = std::make_shared<std::atomic<int64_t> >(0);
+        simConnect(network, config, host.transport, client.transport);
+        peers[0].connections.push_back(host);
+        peers[p].connections.push_back(client);
+        if (hostGivesCredit)
+        {
+            queueForConnection(peers[0], peers[0].connections.back(),
+                               std::make_shared<const std::string>(encodeCredit(0)), std::vector<SharedBytes>(),
+                               LANE_LIVE, SharedCredit());
+        }
+    }
+
+    double drawEndMs = durationS * 1000.0;
+    double endMs = drawEndMs + settleS * 1000.0;
+    double nowMs = 0;
+    bool settled = false;
+    while (nowMs < endMs)
+    {
+        simAdvance(network, nowMs);
+        for (int p = 0; p < peerCount; p++)
+        {
+            SimPeer &peer = peers[p];
+            while (rate > 0 && peer.nextDrawMs <= nowMs && peer.nextDrawMs < drawEndMs)
+            {
+                draw(peer, undoPercent, clearPercent, duplicatePercent, longPercent, peer.nextDrawMs);
+                peer.nextDrawMs += gap(rng);
+            }
+            receiveAll(peer, p == 0);
+            if (p == 0)
+            {
+                grantCredit(peer);
+            }
+            for (size_t i = 0; i < peer.connections.size(); i++)
+            {
+                if (waitingForCredit(peer.connections[i]))
+                {
+                    peer.connections[i].creditWaitMs += TICK_MS;
+                }
+            }
+        }
+        if (nowMs >= drawEndMs && simIdle(network) && queuesEmpty())
+        {
+            settled = true;
+            break;
+        }
+        nowMs += TICK_MS;
+    }
+
+    uint64_t messages = 0, drops = 0, parseErrors = 0, duplicates = 0, strokes = 0, clears = 0;
+    double creditWaitMs = 0;
+    for (int p = 0; p < peerCount; p++)
+    {
+        messages += peers[p].messagesOut;
+        parseErrors += peers[p].parseErrors;
+        duplicates += peers[p].duplicates;
+        for (size_t i = 0; i < peers[p].connections.size(); i++)
+        {
+            drops += peers[p].connections[i].drops;
+            creditWaitMs += peers[p].connections[i].creditWaitMs;
+        }
+        strokes += peers[p].nextSeq - 1 - peers[p].clears;
+        clears += peers[p].clears;
+    }
+    uint64_t bytes = simBytesSent(network);
+    uint64_t lost = 0;
+    for (size_t i = 0; i < network.pipes.size(); i++)
+    {
+        lost += network.pipes[i].chunksDropped;
+    }
+
+    printf("%d peers, %.1f s drawing, %.1f ms latency, %.1f ms jitter, %.0f KB/s, %d%% reorder, %d%% loss\n", peerCount,
+           durationS, link.latencyMs, link.jitterMs, link.bytesPerMs * 1000.0 / 1024.0, link.reorderPercent,
+           link.lossPercent);
+    if (settled)
+    {
+        printf("settled %.0f ms after the last stroke or undo\n", nowMs - lastDrawMs);
+    }
+    else
+    {
+        printf("still busy %.0f s after drawing stopped\n", settleS);
+    }
+    printf("%llu strokes drawn, %llu clears, %llu messages, %.2f MB sent (%.1f KB/s per link), %llu sends lost, "
+           "%llu queue drops, %llu parse errors, %llu duplicate strokes dropped\n",
+           static_cast<unsigned long long>(strokes), static_cast<unsigned long long>(clears),
+           static_cast<unsigned long long>(messages), bytes / 1e6,
+           bytes / 1024.0 / (nowMs / 1000.0) / (network.pipes.size() / 2), static_cast<unsigned long long>(lost),
+           static_cast<unsigned long long>(drops), static_cast<unsigned long long>(parseErrors),
+           static_cast<unsigned long long>(duplicates));
+    printf("clients waited %.0f ms in all for credit\n", creditWaitMs);
+
+    uint64_t reference = boardChecksum(peers[0].strokes, std::vector<RasterTile>());
+    int diverged = 0;
+    for (int p = 0; p < peerCount; p++)
+    {
+        uint64_t sum = boardChecksum(peers[p].strokes, std::vector<RasterTile>());
+        bool connected = p == 0 || peers[p].connections[0].connected;
+        printf("peer %d%s: %zu strokes, checksum %016llx%s%s\n", p, p == 0 ? " (host)" : "", peers[p].strokes.size(),
+               static_cast<unsigned long long>(sum), sum != reference ? "  DIVERGED" : "",
+               connected ? "" : "  disconnected");
+        diverged += sum != reference;
+        historyClear(peers[p].history);
+    }
+    printf("%d of %d peers diverged from the host\n", diverged, peerCount);
+    return diverged > 0 ? 1 : 0;
+}
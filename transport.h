@@ -0,0 +1,27 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <functional>
+#include <memory>
+#include <string>
+
+// Encoded messages; one copy is shared by every peer a message goes to,
+// and it never changes once queued
+typedef std::shared_ptr<const std::string> SharedBytes;
+
+// One peer connection's byte stream, under the message framing in main.cpp.
+// The app wraps a non-blocking socket in one; sim_network.h makes
+// in-process ones so whole sessions can run headless.
+struct Transport
+{
+    // Bytes of data past offset that were taken, 0 when none fit right
+    // now, -1 once the connection is gone. The transport may hold on to
+    // data until it has gone out.
+    std::function<int(const SharedBytes &data, size_t offset)> send;
+    // Bytes read into buffer, 0 when nothing has arrived, -1 once the
+    // connection is gone
+    std::function<int(char *buffer, int length)> receive;
+    std::function<void()> close;
+};
+
+#endif